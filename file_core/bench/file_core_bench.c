@@ -0,0 +1,680 @@
+/*
+ * file_core_bench.c
+ *
+ *  Benchmarks the public routines of file_core and reports throughput,
+ *  latency percentiles and system call counts as JSON.
+ *
+ *  Each case is run twice.  The timed pass measures every call with
+ *  CLOCK_MONOTONIC.  The counting pass runs a few calls in a child process
+ *  under ptrace(), counting the system calls made by the child and by any
+ *  threads it starts, so the tracing overhead never reaches the timings.
+ */
+
+#include "stdafx.h"
+#include "file_core.h"
+
+#include <getopt.h>
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <linux/ptrace.h>
+
+#define BENCH_DEFAULT_MIN_SIZE        1024ULL
+#define BENCH_DEFAULT_MAX_SIZE        (64ULL << 20)
+#define BENCH_DEFAULT_MAX_PATHS       10000
+#define BENCH_DEFAULT_ITERATIONS      64
+#define BENCH_BYTES_PER_CASE          (256ULL << 20)
+#define BENCH_MIN_ITERATIONS          3
+#define BENCH_COUNTED_ITERATIONS      8
+#define BENCH_MAX_CREATED_FILES       65536
+#define BENCH_MAX_CREATED_DIRS        1024
+#define BENCH_LOG_LINE_FORMAT         "%08d %s: request served in %d us\n"
+#define BENCH_LOG_LINE_REQUEST        "GET /index.html"
+
+///////////////////////////////////////////////////////////////////////////////
+// BENCH_OPERATION - Performs the nIndex'th operation of a case.
+
+typedef void (*BENCH_OPERATION)(void* pContext, int nIndex);
+
+///////////////////////////////////////////////////////////////////////////////
+// BENCH_SETUP - Prepares a case before each of its passes.
+
+typedef void (*BENCH_SETUP)(void* pContext, int nPass);
+
+///////////////////////////////////////////////////////////////////////////////
+// BENCHCASE structure
+
+typedef struct _tagBENCHCASE {
+  const char* pszName;
+  const char* pszVariant;     /* Describes the input, or NULL */
+  uint64_t nSize;             /* Bytes moved by each operation */
+  int nIterations;            /* Operations in the timed pass */
+  BENCH_SETUP lpfnSetup;
+  BENCH_OPERATION lpfnOperation;
+  void* pContext;
+} BENCHCASE, *LPBENCHCASE;
+
+///////////////////////////////////////////////////////////////////////////////
+// SIZE_CONTEXT structure - Shared by the cases that move whole files.
+
+typedef struct _tagSIZE_CONTEXT {
+  char szPath[MAX_PATH + 1];
+  char* pData;
+  uint64_t nSize;
+} SIZE_CONTEXT, *LPSIZE_CONTEXT;
+
+///////////////////////////////////////////////////////////////////////////////
+// PATH_CONTEXT structure - Shared by the cases that work on many paths.
+
+typedef struct _tagPATH_CONTEXT {
+  char** ppszPaths;
+  int nCount;
+  const char* pszRoot;
+  int nPass;
+} PATH_CONTEXT, *LPPATH_CONTEXT;
+
+static BOOL g_bCountSyscalls = TRUE;
+static BOOL g_bFirstResult = TRUE;
+static FILE* g_fpOutput = NULL;
+
+///////////////////////////////////////////////////////////////////////////////
+// Internal functions
+
+///////////////////////////////////////////////////////////////////////////////
+// GetNanoseconds function
+
+static uint64_t GetNanoseconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// CompareUint64 function
+
+static int CompareUint64(const void* pLeft, const void* pRight) {
+  uint64_t nLeft = *(const uint64_t*) pLeft;
+  uint64_t nRight = *(const uint64_t*) pRight;
+  return nLeft < nRight ? -1 : nLeft > nRight;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// GetPercentile function - Nearest-rank percentile of sorted samples.
+
+static uint64_t GetPercentile(const uint64_t* pSamples, int nCount,
+    int nPercent) {
+  int nRank = (nCount * nPercent + 99) / 100;
+  if (nRank < 1) {
+    nRank = 1;
+  }
+  return pSamples[nRank - 1];
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// CountSyscalls function - Runs nIterations operations of a case in a
+// traced child, and returns the number of system calls they made, or -1 if
+// the child could not be traced.  Only the calls between two getppid()
+// markers are counted, so setup and process teardown are left out.
+
+static long CountSyscalls(LPBENCHCASE lpCase, int nIterations) {
+  pid_t nChild = fork();
+  if (nChild < 0) {
+    return -1;
+  }
+
+  if (nChild == 0) {
+    if (OK != ptrace(PTRACE_TRACEME, 0, NULL, NULL)) {
+      _exit(1);
+    }
+    raise(SIGSTOP);
+
+    if (lpCase->lpfnSetup != NULL) {
+      lpCase->lpfnSetup(lpCase->pContext, 1);
+    }
+
+    syscall(SYS_getppid);
+    for (int i = 0; i < nIterations; i++) {
+      lpCase->lpfnOperation(lpCase->pContext, i);
+    }
+    syscall(SYS_getppid);
+
+    _exit(0);
+  }
+
+  int nStatus = 0;
+  if (waitpid(nChild, &nStatus, 0) != nChild || !WIFSTOPPED(nStatus)) {
+    return -1;
+  }
+
+  if (OK != ptrace(PTRACE_SETOPTIONS, nChild, NULL,
+      PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE | PTRACE_O_EXITKILL)) {
+    kill(nChild, SIGKILL);
+    waitpid(nChild, NULL, 0);
+    return -1;
+  }
+  ptrace(PTRACE_SYSCALL, nChild, NULL, NULL);
+
+  long nCount = 0;
+  int nMarkers = 0;
+  BOOL bChildExited = FALSE;
+
+  while (!bChildExited) {
+    pid_t nThread = waitpid(-1, &nStatus, __WALL);
+    if (nThread < 0) {
+      break;
+    }
+
+    if (WIFEXITED(nStatus) || WIFSIGNALED(nStatus)) {
+      bChildExited = nThread == nChild;
+      continue;
+    }
+
+    int nSignal = 0;
+    if (WSTOPSIG(nStatus) == (SIGTRAP | 0x80)) {
+      struct ptrace_syscall_info info;
+      memset(&info, 0, sizeof(info));
+      ptrace(PTRACE_GET_SYSCALL_INFO, nThread, sizeof(info), &info);
+
+      if (info.op == PTRACE_SYSCALL_INFO_ENTRY) {
+        if (info.entry.nr == SYS_getppid && nThread == nChild) {
+          nMarkers++;
+        } else if (nMarkers == 1) {
+          nCount++;
+        }
+      }
+    } else if (WSTOPSIG(nStatus) != SIGTRAP
+        && WSTOPSIG(nStatus) != SIGSTOP) {
+      nSignal = WSTOPSIG(nStatus);
+    }
+
+    ptrace(PTRACE_SYSCALL, nThread, NULL, (void*) (intptr_t) nSignal);
+  }
+
+  if (!bChildExited || nMarkers < 2) {
+    return -1;
+  }
+
+  return nCount;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// RunCase function - Runs both passes of a case and prints its result.
+
+static void RunCase(LPBENCHCASE lpCase) {
+  uint64_t* pSamples = (uint64_t*) malloc(
+      lpCase->nIterations * sizeof(uint64_t));
+  if (pSamples == NULL) {
+    return;
+  }
+
+  if (lpCase->lpfnSetup != NULL) {
+    lpCase->lpfnSetup(lpCase->pContext, 0);
+  }
+
+  uint64_t nTotal = 0;
+  for (int i = 0; i < lpCase->nIterations; i++) {
+    uint64_t nStart = GetNanoseconds();
+    lpCase->lpfnOperation(lpCase->pContext, i);
+    pSamples[i] = GetNanoseconds() - nStart;
+    nTotal += pSamples[i];
+  }
+
+  qsort(pSamples, lpCase->nIterations, sizeof(uint64_t), CompareUint64);
+
+  int nCounted = lpCase->nIterations < BENCH_COUNTED_ITERATIONS
+      ? lpCase->nIterations : BENCH_COUNTED_ITERATIONS;
+  long nSyscalls = g_bCountSyscalls ? CountSyscalls(lpCase, nCounted) : -1;
+
+  double dSeconds = nTotal > 0 ? (double) nTotal / 1e9 : 1e-9;
+
+  fprintf(g_fpOutput, "%s\n    {\"name\": \"%s\", ",
+      g_bFirstResult ? "" : ",", lpCase->pszName);
+  if (lpCase->pszVariant != NULL) {
+    fprintf(g_fpOutput, "\"variant\": \"%s\", ", lpCase->pszVariant);
+  }
+  fprintf(g_fpOutput, "\"size\": %" PRIu64 ", \"iterations\": %d, "
+      "\"ops_per_second\": %.1f, \"bytes_per_second\": %.1f, "
+      "\"p50_ns\": %" PRIu64 ", \"p99_ns\": %" PRIu64 ", ",
+      lpCase->nSize, lpCase->nIterations,
+      lpCase->nIterations / dSeconds,
+      (double) lpCase->nSize * lpCase->nIterations / dSeconds,
+      GetPercentile(pSamples, lpCase->nIterations, 50),
+      GetPercentile(pSamples, lpCase->nIterations, 99));
+  if (nSyscalls >= 0) {
+    fprintf(g_fpOutput, "\"syscalls_per_op\": %.2f}",
+        (double) nSyscalls / nCounted);
+  } else {
+    fprintf(g_fpOutput, "\"syscalls_per_op\": null}");
+  }
+  fflush(g_fpOutput);
+
+  g_bFirstResult = FALSE;
+  free(pSamples);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// GetIterationsForSize function - Keeps each case to a bounded number of
+// bytes, while still taking enough samples for the percentiles to mean
+// something.
+
+static int GetIterationsForSize(uint64_t nSize, int nMaxIterations) {
+  uint64_t nIterations = BENCH_BYTES_PER_CASE / nSize;
+  if (nIterations > (uint64_t) nMaxIterations) {
+    nIterations = nMaxIterations;
+  }
+  if (nIterations < BENCH_MIN_ITERATIONS) {
+    nIterations = BENCH_MIN_ITERATIONS;
+  }
+  return (int) nIterations;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Whole-file operations
+
+static void ReadAllTextOperation(void* pContext, int nIndex) {
+  LPSIZE_CONTEXT lpContext = (LPSIZE_CONTEXT) pContext;
+  char* pszText = NULL;
+  int nFileSize = 0;
+  ReadAllText(lpContext->szPath, &pszText, &nFileSize);
+  free(pszText);
+}
+
+static void ReadAllBytesOperation(void* pContext, int nIndex) {
+  LPSIZE_CONTEXT lpContext = (LPSIZE_CONTEXT) pContext;
+  char* pData = NULL;
+  size_t nLength = 0;
+  ReadAllBytes(lpContext->szPath, &pData, &nLength);
+  free(pData);
+}
+
+static void WriteAllTextOperation(void* pContext, int nIndex) {
+  LPSIZE_CONTEXT lpContext = (LPSIZE_CONTEXT) pContext;
+  int nBytesWritten = 0;
+  WriteAllText(lpContext->szPath, lpContext->pData, TRUE, &nBytesWritten);
+}
+
+static void WriteAllBytesOperation(void* pContext, int nIndex) {
+  LPSIZE_CONTEXT lpContext = (LPSIZE_CONTEXT) pContext;
+  WriteAllBytes(lpContext->szPath, lpContext->pData, lpContext->nSize,
+      WRITE_FLAG_NONE);
+}
+
+static void WriteFormattedOperation(void* pContext, int nIndex) {
+  LPSIZE_CONTEXT lpContext = (LPSIZE_CONTEXT) pContext;
+  int nBytesWritten = 0;
+  WriteFormattedTextToFile(FALSE, &nBytesWritten, lpContext->szPath,
+      BENCH_LOG_LINE_FORMAT, nIndex, BENCH_LOG_LINE_REQUEST, nIndex % 1000);
+}
+
+static uint64_t GetFormattedLineSize(int nIterations) {
+  /* The lines differ in length, so report the mean over the pass. */
+  uint64_t nTotal = 0;
+  for (int i = 0; i < nIterations; i++) {
+    nTotal += (uint64_t) snprintf(NULL, 0, BENCH_LOG_LINE_FORMAT, i,
+        BENCH_LOG_LINE_REQUEST, i % 1000);
+  }
+  return nIterations > 0 ? (nTotal + nIterations / 2) / nIterations : 0;
+}
+
+static void TruncateFileSetup(void* pContext, int nPass) {
+  LPSIZE_CONTEXT lpContext = (LPSIZE_CONTEXT) pContext;
+  WriteAllBytes(lpContext->szPath, "", 0, WRITE_FLAG_NONE);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Path operations
+
+static void FileExistsOperation(void* pContext, int nIndex) {
+  LPPATH_CONTEXT lpContext = (LPPATH_CONTEXT) pContext;
+  FileExists(lpContext->ppszPaths[nIndex]);
+}
+
+static void DirectoryExistsOperation(void* pContext, int nIndex) {
+  LPPATH_CONTEXT lpContext = (LPPATH_CONTEXT) pContext;
+  DirectoryExists(lpContext->ppszPaths[nIndex]);
+}
+
+static void ShellExpandOperation(void* pContext, int nIndex) {
+  LPPATH_CONTEXT lpContext = (LPPATH_CONTEXT) pContext;
+  char szExpanded[MAX_PATH + 1];
+  ShellExpand(lpContext->ppszPaths[nIndex], szExpanded, MAX_PATH + 1);
+}
+
+static void CreateDirOperation(void* pContext, int nIndex) {
+  LPPATH_CONTEXT lpContext = (LPPATH_CONTEXT) pContext;
+  char szPath[MAX_PATH + 1];
+  snprintf(szPath, sizeof(szPath), "%s/mkdir.%d/%d/a/b", lpContext->pszRoot,
+      lpContext->nPass, nIndex);
+  CreateDirIfNotExists(szPath);
+}
+
+static void CreateDirSetup(void* pContext, int nPass) {
+  /* Each pass creates a fresh tree. */
+  ((LPPATH_CONTEXT) pContext)->nPass = nPass;
+}
+
+static void ExistingDirSetup(void* pContext, int nPass) {
+  /* Every pass revisits the tree made by the first pass of the
+   * CreateDirIfNotExists "new" case. */
+  ((LPPATH_CONTEXT) pContext)->nPass = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// RunSizeBenchmarks function
+
+static void RunSizeBenchmarks(const char* pszRoot, uint64_t nMinSize,
+    uint64_t nMaxSize, int nMaxIterations) {
+  char* pData = (char*) malloc(nMaxSize + 1);
+  if (pData == NULL) {
+    fprintf(stderr, "file_core_bench: cannot allocate %" PRIu64 " bytes\n",
+        nMaxSize);
+    return;
+  }
+
+  /* Text made of 63-character lines. */
+  for (uint64_t i = 0; i < nMaxSize; i++) {
+    pData[i] = (i & 63) == 63 ? '\n' : 'a' + (char) (i % 26);
+  }
+
+  SIZE_CONTEXT context;
+  snprintf(context.szPath, sizeof(context.szPath), "%s/data.bin", pszRoot);
+  context.pData = pData;
+
+  for (uint64_t nSize = nMinSize; nSize <= nMaxSize; nSize *= 4) {
+    int nIterations = GetIterationsForSize(nSize, nMaxIterations);
+    BOOL bText = nSize <= INT_MAX;
+
+    char chSaved = pData[nSize];
+    pData[nSize] = '\0';
+    context.nSize = nSize;
+
+    BENCHCASE cases[] = {
+      { "WriteAllBytes", NULL, nSize, nIterations, NULL,
+          WriteAllBytesOperation, &context },
+      { "ReadAllBytes", NULL, nSize, nIterations, NULL,
+          ReadAllBytesOperation, &context },
+      { "WriteAllText", NULL, nSize, nIterations, NULL,
+          WriteAllTextOperation, &context },
+      { "ReadAllText", NULL, nSize, nIterations, NULL,
+          ReadAllTextOperation, &context },
+    };
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+      /* The text routines are limited to 2 GB. */
+      if (!bText && strstr(cases[i].pszName, "Text") != NULL) {
+        continue;
+      }
+      RunCase(&cases[i]);
+    }
+
+    pData[nSize] = chSaved;
+    unlink(context.szPath);
+
+    if (nSize > UINT64_MAX / 4) {
+      break;
+    }
+  }
+
+  snprintf(context.szPath, sizeof(context.szPath), "%s/log.txt", pszRoot);
+  BENCHCASE formatted = { "WriteFormattedTextToFile", "append log line",
+      GetFormattedLineSize(nMaxIterations * 16), nMaxIterations * 16,
+      TruncateFileSetup, WriteFormattedOperation, &context };
+  RunCase(&formatted);
+  unlink(context.szPath);
+
+  free(pData);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// FreePaths function
+
+static void FreePaths(char** ppszPaths, int nCount) {
+  for (int i = 0; i < nCount; i++) {
+    free(ppszPaths[i]);
+  }
+  free(ppszPaths);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// FormatPath function
+
+static char* FormatPath(const char* pszFormat, ...) {
+  char szPath[MAX_PATH + 1];
+  va_list args;
+  va_start(args, pszFormat);
+  vsnprintf(szPath, sizeof(szPath), pszFormat, args);
+  va_end(args);
+  return strdup(szPath);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// RunPathBenchmarks function - Half the queried paths exist.  At most
+// BENCH_MAX_CREATED_FILES files are made; past that the existing paths
+// repeat, so a million-path run does not spend its time creating files.
+
+static void RunPathBenchmarks(const char* pszRoot, int nMaxPaths) {
+  char szFiles[MAX_PATH / 2];
+  snprintf(szFiles, sizeof(szFiles), "%s/files", pszRoot);
+  CreateDirectory(szFiles);
+
+  int nCreated = nMaxPaths / 2 < BENCH_MAX_CREATED_FILES ? nMaxPaths / 2
+      : BENCH_MAX_CREATED_FILES;
+  if (nCreated < 1) {
+    nCreated = 1;
+  }
+  for (int i = 0; i < nCreated; i++) {
+    char szPath[MAX_PATH + 1];
+    snprintf(szPath, sizeof(szPath), "%s/f%d", szFiles, i);
+    WriteAllBytes(szPath, "", 0, WRITE_FLAG_NONE);
+  }
+
+  int nDirs = nCreated < BENCH_MAX_CREATED_DIRS ? nCreated
+      : BENCH_MAX_CREATED_DIRS;
+  for (int i = 0; i < nDirs; i++) {
+    char szPath[MAX_PATH + 1];
+    snprintf(szPath, sizeof(szPath), "%s/d%d", szFiles, i);
+    CreateDirectory(szPath);
+  }
+
+  char** ppszPaths = (char**) calloc(nMaxPaths, sizeof(char*));
+  if (ppszPaths == NULL) {
+    return;
+  }
+
+  PATH_CONTEXT context = { ppszPaths, nMaxPaths, pszRoot, 0 };
+
+  for (int i = 0; i < nMaxPaths; i++) {
+    ppszPaths[i] = i % 2 == 0
+        ? FormatPath("%s/f%d", szFiles, (i / 2) % nCreated)
+        : FormatPath("%s/missing/f%d", szFiles, i);
+  }
+  BENCHCASE fileExists = { "FileExists", "half exist", 0, nMaxPaths, NULL,
+      FileExistsOperation, &context };
+  RunCase(&fileExists);
+  FreePaths(ppszPaths, nMaxPaths);
+
+  ppszPaths = (char**) calloc(nMaxPaths, sizeof(char*));
+  context.ppszPaths = ppszPaths;
+  for (int i = 0; i < nMaxPaths && ppszPaths != NULL; i++) {
+    switch (i % 3) {
+      case 0:
+        ppszPaths[i] = FormatPath("%s/d%d", szFiles, (i / 3) % nDirs);
+        break;
+      case 1:
+        ppszPaths[i] = FormatPath("%s/f%d", szFiles, (i / 3) % nCreated);
+        break;
+      default:
+        ppszPaths[i] = FormatPath("%s/missing/d%d", szFiles, i);
+        break;
+    }
+  }
+  if (ppszPaths != NULL) {
+    BENCHCASE directoryExists = { "DirectoryExists",
+        "dirs, files and missing", 0, nMaxPaths, NULL,
+        DirectoryExistsOperation, &context };
+    RunCase(&directoryExists);
+    FreePaths(ppszPaths, nMaxPaths);
+  }
+
+  int nDirectories = nMaxPaths < BENCH_MAX_CREATED_FILES ? nMaxPaths
+      : BENCH_MAX_CREATED_FILES;
+  BENCHCASE createNew = { "CreateDirIfNotExists", "new, 4 levels", 0,
+      nDirectories, CreateDirSetup, CreateDirOperation, &context };
+  RunCase(&createNew);
+  BENCHCASE createExisting = { "CreateDirIfNotExists", "existing", 0,
+      nDirectories, ExistingDirSetup, CreateDirOperation, &context };
+  RunCase(&createExisting);
+
+  static const char* ppszTemplates[] = {
+    "/var/tmp/project/src/file_%d.c",
+    "~/project/src/file_%d.c",
+    "$HOME/project/src/file_%d.c",
+  };
+  static const char* ppszVariants[] = { "plain", "tilde", "variable" };
+
+  for (int nTemplate = 0; nTemplate < 3; nTemplate++) {
+    ppszPaths = (char**) calloc(nMaxPaths, sizeof(char*));
+    if (ppszPaths == NULL) {
+      break;
+    }
+    context.ppszPaths = ppszPaths;
+    for (int i = 0; i < nMaxPaths; i++) {
+      ppszPaths[i] = FormatPath(ppszTemplates[nTemplate], i);
+    }
+    BENCHCASE shellExpand = { "ShellExpand", ppszVariants[nTemplate], 0,
+        nMaxPaths, NULL, ShellExpandOperation, &context };
+    RunCase(&shellExpand);
+    FreePaths(ppszPaths, nMaxPaths);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// RemoveTree function
+
+static void RemoveTree(const char* pszRoot) {
+  pid_t nChild = fork();
+  if (nChild == 0) {
+    execlp("rm", "rm", "-rf", pszRoot, (char*) NULL);
+    _exit(127);
+  }
+  if (nChild > 0) {
+    waitpid(nChild, NULL, 0);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ParseSize function - Accepts a number with an optional K, M or G suffix.
+
+static uint64_t ParseSize(const char* pszValue) {
+  char* pszEnd = NULL;
+  uint64_t nValue = strtoull(pszValue, &pszEnd, 10);
+  switch (*pszEnd) {
+    case 'k': case 'K': return nValue << 10;
+    case 'm': case 'M': return nValue << 20;
+    case 'g': case 'G': return nValue << 30;
+    default: return nValue;
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// PrintUsage function
+
+static void PrintUsage(const char* pszProgram) {
+  fprintf(stderr,
+      "Usage: %s [options]\n"
+      "  --dir DIR          Scratch directory (default: a new one in /tmp)\n"
+      "  --min-size SIZE    Smallest file size (default: 1K)\n"
+      "  --max-size SIZE    Largest file size, e.g. 4G (default: 64M)\n"
+      "  --max-paths N      Paths per path benchmark, up to 1000000 "
+      "(default: %d)\n"
+      "  --iterations N     Most samples per file-size case (default: %d)\n"
+      "  --no-syscalls      Skip the ptrace() system call counting pass\n"
+      "  --output FILE      Write the JSON here instead of to stdout\n",
+      pszProgram, BENCH_DEFAULT_MAX_PATHS, BENCH_DEFAULT_ITERATIONS);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// main function
+
+int main(int argc, char* argv[]) {
+  static struct option options[] = {
+    { "dir", required_argument, NULL, 'd' },
+    { "min-size", required_argument, NULL, 's' },
+    { "max-size", required_argument, NULL, 'S' },
+    { "max-paths", required_argument, NULL, 'p' },
+    { "iterations", required_argument, NULL, 'i' },
+    { "no-syscalls", no_argument, NULL, 'n' },
+    { "output", required_argument, NULL, 'o' },
+    { "help", no_argument, NULL, 'h' },
+    { NULL, 0, NULL, 0 }
+  };
+
+  const char* pszDirectory = NULL;
+  const char* pszOutput = NULL;
+  uint64_t nMinSize = BENCH_DEFAULT_MIN_SIZE;
+  uint64_t nMaxSize = BENCH_DEFAULT_MAX_SIZE;
+  int nMaxPaths = BENCH_DEFAULT_MAX_PATHS;
+  int nIterations = BENCH_DEFAULT_ITERATIONS;
+
+  int nOption = 0;
+  while ((nOption = getopt_long(argc, argv, "h", options, NULL)) != -1) {
+    switch (nOption) {
+      case 'd': pszDirectory = optarg; break;
+      case 's': nMinSize = ParseSize(optarg); break;
+      case 'S': nMaxSize = ParseSize(optarg); break;
+      case 'p': nMaxPaths = atoi(optarg); break;
+      case 'i': nIterations = atoi(optarg); break;
+      case 'n': g_bCountSyscalls = FALSE; break;
+      case 'o': pszOutput = optarg; break;
+      default:
+        PrintUsage(argv[0]);
+        return nOption == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+
+  if (nMinSize == 0 || nMaxSize < nMinSize || nMaxPaths <= 0
+      || nIterations <= 0) {
+    PrintUsage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  char szRoot[MAX_PATH + 1];
+  if (pszDirectory != NULL) {
+    snprintf(szRoot, sizeof(szRoot), "%s/file_core_bench.%d", pszDirectory,
+        (int) getpid());
+    if (OK != CreateDirectory(szRoot)) {
+      perror("file_core_bench");
+      return EXIT_FAILURE;
+    }
+  } else {
+    strcpy(szRoot, "/tmp/file_core_bench.XXXXXX");
+    if (mkdtemp(szRoot) == NULL) {
+      perror("file_core_bench");
+      return EXIT_FAILURE;
+    }
+  }
+
+  g_fpOutput = pszOutput != NULL ? fopen(pszOutput, "w") : stdout;
+  if (g_fpOutput == NULL) {
+    perror("file_core_bench");
+    RemoveTree(szRoot);
+    return EXIT_FAILURE;
+  }
+
+  fprintf(g_fpOutput, "{\n  \"benchmark\": \"file_core\",\n"
+      "  \"processors\": %ld,\n  \"max_size\": %" PRIu64 ",\n"
+      "  \"max_paths\": %d,\n  \"results\": [", sysconf(_SC_NPROCESSORS_ONLN),
+      nMaxSize, nMaxPaths);
+
+  RunSizeBenchmarks(szRoot, nMinSize, nMaxSize, nIterations);
+  RunPathBenchmarks(szRoot, nMaxPaths);
+
+  fprintf(g_fpOutput, "\n  ]\n}\n");
+  if (g_fpOutput != stdout) {
+    fclose(g_fpOutput);
+  }
+
+  RemoveTree(szRoot);
+  return EXIT_SUCCESS;
+}
@@ -8,6 +8,10 @@
 #ifndef __FILE_CORE_H__
 #define __FILE_CORE_H__
 
+#ifdef __cplusplus
+extern "C" {
+#endif //__cplusplus
+
 /**
  * @brief Defines the maximum length for a path name.
  */
@@ -15,6 +19,382 @@
 #define MAX_PATH      4096
 #endif //MAX_PATH
 
+/**
+ * @brief Access-pattern hints that may be passed to MapFile.  These map onto
+ * the madvise() advice values of the same names and may be OR-ed together.
+ */
+#define MAP_FILE_HINT_NONE          0x0
+#define MAP_FILE_HINT_SEQUENTIAL    0x1
+#define MAP_FILE_HINT_RANDOM        0x2
+#define MAP_FILE_HINT_WILLNEED      0x4
+#define MAP_FILE_HINT_HUGEPAGE      0x8
+
+/**
+ * @brief Flags that may be passed to WriteAllBytes.  The default is to
+ * overwrite the file in place, with no synchronization.
+ */
+#define WRITE_FLAG_NONE             0x0
+#define WRITE_FLAG_APPEND           0x1   /* Append instead of overwriting */
+#define WRITE_FLAG_ATOMIC           0x2   /* Replace the file atomically */
+#define WRITE_FLAG_DATASYNC         0x4   /* fdatasync() the file */
+#define WRITE_FLAG_FULLSYNC         0x8   /* fsync() the file and directory */
+#define WRITE_FLAG_DIRECT           0x10  /* Bypass the page cache */
+
+/**
+ * @brief Flags that may be passed to ReadAllBytesEx.
+ */
+#define READ_FLAG_NONE              0x0
+#define READ_FLAG_DIRECT            0x1   /* Bypass the page cache */
+
+/**
+ * @brief Flags that may be passed to EnableTextCache.
+ */
+#define TEXT_CACHE_FLAG_NONE        0x0
+#define TEXT_CACHE_FLAG_WATCH       0x1   /* Invalidate through inotify */
+
+/**
+ * @brief Algorithms of ComputeFileChecksum and ComputeBufferChecksum.
+ */
+#define CHECKSUM_CRC32C             1     /* CRC-32C (Castagnoli) */
+#define CHECKSUM_HASH64             2     /* 64-bit xxHash64-based hash */
+
+/**
+ * @brief Flags that may be passed to CopyFile and MoveFile.
+ */
+#define COPY_FLAG_NONE              0x0
+#define COPY_FLAG_OVERWRITE         0x1   /* Replace an existing target */
+#define COPY_FLAG_NO_CLONE          0x2   /* Copy the data; never reflink */
+#define COPY_FLAG_PARALLEL          0x4   /* Split large files over threads */
+#define COPY_FLAG_SYNC              0x8   /* fsync() target and directory */
+
+/**
+ * @brief Flags that may be passed to BuildLineIndex.
+ */
+#define LINE_INDEX_FLAG_NONE        0x0
+#define LINE_INDEX_FLAG_PERSIST     0x1   /* Reuse or save <path>.lineindex */
+
+/**
+ * @brief Flags that may be passed to CreateScratchFile.
+ */
+#define SCRATCH_FLAG_NONE           0x0
+#define SCRATCH_FLAG_MAP            0x1   /* Map as a growable buffer */
+
+/**
+ * @brief Flags that may be passed to CreateFileCoreContextEx.
+ */
+#define CONTEXT_FLAG_NONE           0x0
+#define CONTEXT_FLAG_LITERAL_PATHS  0x1   /* Never expand paths a la Bash */
+
+/**
+ * @brief Flush policies that may be passed to OpenAppender.  Any positive
+ * value is taken as the maximum number of milliseconds that a record may sit
+ * in the appender's buffer; it is checked each time a record is appended.
+ */
+#define APPENDER_FLUSH_WHEN_FULL    0     /* Flush only when buffer fills */
+#define APPENDER_FLUSH_EVERY_RECORD -1    /* Write each record right away */
+
+/**
+ * @brief Opaque handle to a buffered append-only file writer, as produced by
+ * OpenAppender.
+ */
+typedef struct _tagAPPENDER APPENDER, *LPAPPENDER;
+
+/**
+ * @brief Opaque handle to a multi-producer group-commit writer, as produced
+ * by CreateGroupCommitWriter.
+ */
+typedef struct _tagGROUPCOMMITWRITER GROUPCOMMITWRITER, *LPGROUPCOMMITWRITER;
+
+/**
+ * @brief Flags that may be set in READMANYOPTIONS.
+ */
+#define READ_MANY_FLAG_NO_IO_URING  0x1   /* Always use the worker pool */
+
+/**
+ * @brief Tuning knobs for ReadManyFiles.  Zero in any field selects the
+ * default.
+ */
+typedef struct _tagREADMANYOPTIONS {
+  int nQueueDepth;        /* Files kept in flight on the io_uring */
+  int nThreads;           /* Workers used when io_uring is unavailable */
+  int nFlags;             /* READ_MANY_FLAG_* values */
+} READMANYOPTIONS, *LPREADMANYOPTIONS;
+
+/**
+ * @brief Outcome of reading one file with ReadManyFiles.
+ */
+typedef struct _tagREADMANYRESULT {
+  int nStatus;            /* OK or ERROR */
+  int nError;             /* errno value if nStatus is ERROR */
+  char* pData;            /* NUL-terminated contents, or NULL */
+  size_t nLength;         /* Number of bytes in pData */
+} READMANYRESULT, *LPREADMANYRESULT;
+
+/**
+ * @brief Values a DIRECTORY_WALK_CALLBACK returns to steer WalkDirectoryTree.
+ */
+#define WALK_CONTINUE               0     /* Keep going */
+#define WALK_SKIP                   1     /* Do not descend into this entry */
+#define WALK_STOP                   2     /* End the walk as soon as possible */
+
+/**
+ * @brief Describes one entry of a directory, as produced by
+ * EnumerateDirectory and WalkDirectoryTree.
+ */
+typedef struct _tagDIRECTORYENTRY {
+  const char* pszName;    /* Name of the entry within its directory */
+  const char* pszPath;    /* Path of the entry (same as pszName in listings) */
+  uint64_t nInode;        /* Inode number */
+  unsigned char nType;    /* DT_REG, DT_DIR, DT_LNK, ..., or DT_UNKNOWN */
+  int nDepth;             /* 1 for entries of the starting directory */
+} DIRECTORYENTRY, *LPDIRECTORYENTRY;
+
+/**
+ * @brief Entries of one directory, as produced by EnumerateDirectory.
+ */
+typedef struct _tagDIRECTORYLISTING {
+  LPDIRECTORYENTRY pEntries;  /* Array of nCount entries */
+  size_t nCount;              /* Number of entries */
+  char* pNames;               /* Storage for every entry's name */
+} DIRECTORYLISTING, *LPDIRECTORYLISTING;
+
+/**
+ * @brief Called by WalkDirectoryTree for each entry it finds.  Returns one
+ * of the WALK_* values.
+ */
+typedef int (*DIRECTORY_WALK_CALLBACK)(LPDIRECTORYENTRY lpEntry,
+    void* pContext);
+
+/**
+ * @brief Flags that may be set in REMOVETREEOPTIONS.
+ */
+#define REMOVE_TREE_FLAG_NONE       0x0
+#define REMOVE_TREE_FLAG_KEEP_ROOT  0x1   /* Empty the directory; keep it */
+#define REMOVE_TREE_FLAG_MISSING_OK 0x2   /* A missing directory is success */
+
+/**
+ * @brief Tuning knobs for RemoveDirectoryTree.  Zero in any field selects
+ * the default.
+ */
+typedef struct _tagREMOVETREEOPTIONS {
+  int nThreads;           /* Workers that remove subtrees */
+  int nFlags;             /* REMOVE_TREE_FLAG_* values */
+} REMOVETREEOPTIONS, *LPREMOVETREEOPTIONS;
+
+/**
+ * @brief Outcome of RemoveDirectoryTree.
+ */
+typedef struct _tagREMOVETREERESULT {
+  uint64_t nRemoved;      /* Files and directories removed */
+  uint64_t nFailed;       /* Entries that could not be read or removed */
+  int nFirstError;        /* errno value of the first failure, or 0 */
+} REMOVETREERESULT, *LPREMOVETREERESULT;
+
+/**
+ * @brief Fields that GetFileInfo and StatMany may be asked to retrieve.
+ * Asking for fewer fields lets the file system do less work.
+ */
+#define FILE_INFO_NONE              0x0   /* Existence only */
+#define FILE_INFO_TYPE              0x1   /* File type bits of nMode */
+#define FILE_INFO_SIZE              0x2   /* nSize */
+#define FILE_INFO_MTIME             0x4   /* nModifiedSeconds/Nanoseconds */
+#define FILE_INFO_INODE             0x8   /* nInode */
+#define FILE_INFO_ALL               0xF
+
+/**
+ * @brief Metadata of one file, as produced by GetFileInfo and StatMany.
+ * Fields that were not requested are unspecified.
+ */
+typedef struct _tagFILEINFO {
+  int nStatus;                    /* OK or ERROR */
+  int nError;                     /* errno value if nStatus is ERROR */
+  unsigned int nMode;             /* Use S_ISREG, S_ISDIR, ... on this */
+  uint64_t nSize;                 /* Size in bytes */
+  int64_t nModifiedSeconds;       /* Last modification time */
+  uint32_t nModifiedNanoseconds;
+  uint64_t nInode;                /* Inode number */
+} FILEINFO, *LPFILEINFO;
+
+/**
+ * @brief Describes a read-only view of a file's contents, as produced by
+ * MapFile.
+ */
+typedef struct _tagFILEVIEW {
+  const char* pData;      /* Address of the first byte of the file */
+  uint64_t nLength;       /* Number of bytes in the view */
+} FILEVIEW, *LPFILEVIEW;
+
+/**
+ * @brief Returned by ReadNextChunk and ReadNextLine once the input has been
+ * exhausted.
+ */
+#define FILE_READER_EOF             1
+
+/**
+ * @brief Opaque handle to a streaming file reader, as produced by
+ * OpenFileReader.
+ */
+typedef struct _tagFILEREADER FILEREADER, *LPFILEREADER;
+
+/**
+ * @brief Opaque handle to the line index of a text file, as produced by
+ * BuildLineIndex.
+ */
+typedef struct _tagLINEINDEX LINEINDEX, *LPLINEINDEX;
+
+/**
+ * @brief Opaque handle to a base directory for relative paths, as produced
+ * by CreateFileCoreContext and used by the *At functions.
+ */
+typedef struct _tagFILECORECONTEXT FILECORECONTEXT, *LPFILECORECONTEXT;
+
+/**
+ * @brief Opaque handle to an anonymous scratch file, as produced by
+ * CreateScratchFile.
+ */
+typedef struct _tagSCRATCHFILE SCRATCHFILE, *LPSCRATCHFILE;
+
+/**
+ * @name AddGroupCommitFile
+ * @brief Opens a file for appending through a group-commit writer.
+ * @param lpWriter Writer handle obtained from CreateGroupCommitWriter.
+ * @param pszPath Path of the file to append to.  The file is created if it
+ * does not exist.
+ * @return Index by which GroupCommitAppend refers to the file, or ERROR, in
+ * which case errno is set.  Fails with EMFILE once the writer's maximum
+ * number of files has been reached.
+ * @remarks This function is capable of expanding strings like the Bash
+ * shell.
+ */
+int AddGroupCommitFile(LPGROUPCOMMITWRITER lpWriter, const char* pszPath);
+
+/**
+ * @name Append
+ * @brief Appends a record to the file behind an appender.
+ * @param lpAppender Appender handle obtained from OpenAppender.
+ * @param pData Address of the bytes to append.  May contain NUL bytes.
+ * @param nLength Number of bytes to append.
+ * @return OK on success; ERROR otherwise, in which case errno is set.
+ * @remarks The record is copied into the appender's buffer and only reaches
+ * the file when the buffer fills, when the flush policy says so, or when
+ * FlushAppender or CloseAppender is called.  A record larger than the
+ * buffer is written straight through.  Appenders may be shared between
+ * threads; the appender's lock is held until a record is fully buffered or
+ * written, so records from one appender are never interleaved, although a
+ * short write can leave a record spread over several write() calls.
+ */
+int Append(LPAPPENDER lpAppender, const char* pData, size_t nLength);
+
+/**
+ * @name AppendAllParts
+ * @brief Appends the contents of several buffers, in order, to a file.
+ * @param pszPath Pathname of the file to append to.  It is created if it
+ * does not exist.
+ * @param pParts Array of buffers to write.  It is not modified.
+ * @param nCount Number of elements in pParts.
+ * @param nFlags WRITE_FLAG_DATASYNC or WRITE_FLAG_FULLSYNC, or
+ * WRITE_FLAG_NONE.
+ * @return OK if every byte was written (and synchronized, if requested);
+ * ERROR otherwise, in which case errno is set.
+ * @remarks As WriteAllParts with WRITE_FLAG_APPEND.
+ */
+int AppendAllParts(const char* pszPath, const struct iovec* pParts,
+    int nCount, int nFlags);
+
+/**
+ * @name AppendScratchFile
+ * @brief Appends bytes to the end of a scratch file.
+ * @param lpScratch Scratch file handle obtained from CreateScratchFile.
+ * @param pData Address of the bytes to append.  May contain NUL bytes.
+ * @param nLength Number of bytes to append.
+ * @return OK on success; ERROR otherwise, in which case errno is set.  Fails
+ * with EALREADY once the file has been linked, or with ENOSPC if the file
+ * system has no room for the file to grow.
+ * @remarks When the data outgrows the space reserved so far, the
+ * reservation is doubled.  With SCRATCH_FLAG_MAP the bytes are copied into
+ * the mapping, which may move as it grows.
+ */
+int AppendScratchFile(LPSCRATCHFILE lpScratch, const char* pData,
+    size_t nLength);
+
+/**
+ * @name AppendFormatted
+ * @brief Formats a record straight into an appender's buffer, then appends
+ * it as Append would.
+ * @param lpAppender Appender handle obtained from OpenAppender.
+ * @param pszFormat printf-style format for the record.
+ * @return OK on success; ERROR otherwise, in which case errno is set.
+ */
+int AppendFormatted(LPAPPENDER lpAppender, const char* pszFormat, ...);
+
+/**
+ * @name CloseAppender
+ * @brief Flushes and closes an appender that was opened by OpenAppender.
+ * @param lppAppender Address of the appender handle.
+ * @return OK if the remaining buffered records were written; ERROR
+ * otherwise, in which case errno is set.
+ * @remarks The handle is released and the value pointed to by lppAppender
+ * is set to NULL in either case.
+ */
+int CloseAppender(LPAPPENDER* lppAppender);
+
+/**
+ * @name BuildLineIndex
+ * @brief Indexes the lines of a text file, so that GetLine can find any of
+ * them directly.
+ * @param pszPath Path of the file to index.
+ * @param lppIndex Address of a handle that receives the index, which must
+ * be released with FreeLineIndex.
+ * @param nFlags LINE_INDEX_FLAG_* values.
+ * @return OK on success; ERROR otherwise, in which case errno is set and
+ * the handle is set to NULL.  Fails with ESTALE if the file was changed
+ * while it was being indexed.
+ * @remarks The file is mapped rather than read, and stays mapped until the
+ * index is released, so it should not be truncated meanwhile.  Newlines
+ * are found 64 bytes at a time with AVX2 or SSE2 compares where the CPU has
+ * them; files over 64 MB are cut into 64 MB ranges that are scanned by one
+ * thread per processor.  The start of every 64th line is stored whole and
+ * the rest as distances from it, bit-packed, which takes a few bytes per
+ * block of lines yet still gives constant-time lookups.  With
+ * LINE_INDEX_FLAG_PERSIST the index is kept in a file named after the
+ * source with ".lineindex" appended: it is loaded from there, without
+ * reading the source at all, if the source's size, modification time and
+ * inode match those recorded; otherwise it is rebuilt and saved, if the
+ * directory is writable.  This function is capable of expanding strings
+ * like the Bash shell.
+ */
+int BuildLineIndex(const char* pszPath, LPLINEINDEX* lppIndex, int nFlags);
+
+/**
+ * @name CachedReadAllText
+ * @brief Gets all the text in the specified file, from the text cache if
+ * the file has not changed since it was cached.
+ * @param pszPath Path of the file to read.
+ * @param ppszText Address of a pointer that receives the address of the
+ * file's NUL-terminated content.  The content is shared and must not be
+ * modified; release it with ReleaseCachedText, not free().
+ * @param pnLength Address of a variable that receives the number of bytes
+ * in the file.  May be NULL.
+ * @return OK on success; ERROR otherwise, in which case errno is set.
+ * @remarks Without EnableTextCache this simply reads the file.  With it, a
+ * hit costs one stat() and no copying: entries are found by the file's
+ * device and inode, used only if its modification time and size still
+ * match, and handed out by reference, so a reader keeps its content even
+ * if the entry is replaced or evicted meanwhile.  Files that report a size
+ * of zero, or other than what was read, as those under /proc and /sys do,
+ * are never cached.  Safe to call from any number of threads.  This
+ * function is capable of expanding strings like the Bash shell.
+ */
+int CachedReadAllText(const char* pszPath, const char** ppszText,
+    size_t* pnLength);
+
+/**
+ * @name ClearTextCache
+ * @brief Discards every file held by the text cache.  Text already handed
+ * out stays valid until it is released.
+ */
+void ClearTextCache(void);
+
 /**
  * @name CloseFile
  * @brief Closes the file specified.
@@ -26,51 +406,370 @@
  */
 void CloseFile(FILE** fppFile);
 
+/**
+ * @name CloseFileReader
+ * @brief Closes a reader that was opened by OpenFileReader.
+ * @param lppReader Address of the reader handle.
+ * @remarks Closes the underlying file and releases the reader's buffer,
+ * then sets the value pointed to by lppReader to NULL.  Any pointers
+ * previously handed out by the reader become invalid.
+ */
+void CloseFileReader(LPFILEREADER* lppReader);
+
+/**
+ * @name CloseScratchFile
+ * @brief Closes a scratch file and releases its handle.
+ * @param lppScratch Address of the scratch file handle.  The value it points
+ * to is set to NULL.
+ * @remarks Unless LinkScratchFile was called, the file and its contents are
+ * discarded.
+ */
+void CloseScratchFile(LPSCRATCHFILE* lppScratch);
+
+/**
+ * @name ComputeBufferChecksum
+ * @brief Computes the checksum of a block of memory.
+ * @param pData Address of the data.
+ * @param nLength Number of bytes of data.
+ * @param nAlgorithm CHECKSUM_CRC32C or CHECKSUM_HASH64.
+ * @param pnChecksum Address of a variable that receives the checksum.  A
+ * CRC-32C occupies the low 32 bits.
+ * @return OK on success; ERROR otherwise, in which case errno is set.
+ * @remarks Gives the same value as ComputeFileChecksum does for a file with
+ * the same content.
+ */
+int ComputeBufferChecksum(const char* pData, size_t nLength, int nAlgorithm,
+    uint64_t* pnChecksum);
+
+/**
+ * @name ComputeFileChecksum
+ * @brief Computes the checksum of a file's content.
+ * @param pszPath Path of the file.
+ * @param nAlgorithm CHECKSUM_CRC32C or CHECKSUM_HASH64.
+ * @param pnChecksum Address of a variable that receives the checksum.  A
+ * CRC-32C occupies the low 32 bits.
+ * @return OK on success; ERROR otherwise, in which case errno is set.
+ * @remarks The file is streamed through a 1 MB buffer rather than read into
+ * memory, so it may be of any size, and binary content is fine.  Files over
+ * 64 MB are cut into 64 MB segments that are checksummed on a pool of
+ * threads and combined afterwards; the result does not depend on the
+ * number of threads.  CRC-32C uses the CPU's CRC32 instruction, with
+ * PCLMULQDQ to run three streams at once, where available, and a table
+ * otherwise; the value matches other CRC-32C implementations, such as the
+ * one in iSCSI and ext4.  CHECKSUM_HASH64 is a fast non-cryptographic hash
+ * for detecting corruption, not tampering: each 1 MB chunk is hashed with
+ * xxHash64, and for files of more than one chunk the chunk hashes are
+ * hashed again, seeded with the file's length.  Files of 1 MB or less
+ * therefore hash to the same value as xxh64sum gives.  This function is
+ * capable of expanding strings like the Bash shell.
+ */
+int ComputeFileChecksum(const char* pszPath, int nAlgorithm,
+    uint64_t* pnChecksum);
+
+/**
+ * @name CopyFile
+ * @brief Copies a file.
+ * @param pszSourcePath Path of the file to copy.
+ * @param pszTargetPath Path of the copy.
+ * @param nFlags COPY_FLAG_* values.  Unless COPY_FLAG_OVERWRITE is given,
+ * the function fails with EEXIST if the target exists.
+ * @return OK on success; ERROR otherwise, in which case errno is set and no
+ * partial copy is left behind.
+ * @remarks The data is copied into a temporary file beside the target,
+ * which is renamed over it once complete, so an existing target is only
+ * replaced by a finished copy.  The data never passes through user space
+ * if it can be helped.
+ * First the target is made a reflink of the source (FICLONE), which shares
+ * the source's extents on file systems such as Btrfs and XFS; failing that,
+ * the kernel copies the data with copy_file_range(), then sendfile(), and
+ * only as a last resort with a read()/write() loop through a 1 MB buffer.
+ * Holes in sparse files are found with SEEK_DATA and SEEK_HOLE and left as
+ * holes in the copy.  With COPY_FLAG_PARALLEL, large files are cut into
+ * 64 MB pieces that are copied on a pool of threads, which pays off on
+ * storage that serves many requests at once.  The copy gets the source's
+ * permission bits.  There is no size limit.  NOTE: This function is capable
+ * of handling strings that can be expanded by the Bash shell, such as
+ * ~/my/dir/file.txt.
+ */
+int CopyFile(const char* pszSourcePath, const char* pszTargetPath,
+    int nFlags);
+
+/**
+ * @name CreateGroupCommitWriter
+ * @brief Creates a group-commit writer and starts its flusher thread.
+ * @param nMaxFiles Maximum number of files that may be added to the writer.
+ * @param nFlags WRITE_FLAG_DATASYNC or WRITE_FLAG_FULLSYNC to synchronize
+ * each file once per batch, or WRITE_FLAG_NONE to skip synchronization.
+ * @return Handle to the new writer, or NULL on failure, in which case errno
+ * is set.
+ * @remarks Any number of threads may append through the writer at once.
+ * Records are pushed onto a lock-free queue; the flusher thread drains it,
+ * gathers the records for each file into writev() calls, and then issues a
+ * single fdatasync() or fsync() per file for the whole batch, so concurrent
+ * producers share the cost of each flush.  The handle must be released with
+ * DestroyGroupCommitWriter.
+ */
+LPGROUPCOMMITWRITER CreateGroupCommitWriter(int nMaxFiles, int nFlags);
+
 /**
  * @name CreateDirectory
  * @brief Creates all the directories in a specified path.
  * @param pszPath The directory to create.
+ * @return OK if the directory exists upon return, whether it was created by
+ * this call or already existed; ERROR otherwise, in which case errno is set.
  * @remarks Attempts to create the directory(ies) indicated by the specified
- * path.  The caller of this function must have the appropriate access
- * privileges granted by the operating system.  Fails if this is not the
- * case, or if the directory indicated already exists, or if the path is blank.
- * Upon failure, this function will simply give up and return to the caller,
- * except if the mkdir() system call fails; in which case, the function
- * raises an error message to STDERR and exits the application. NOTE: This
+ * path, like mkdir -p.  The caller of this function must have the
+ * appropriate access privileges granted by the operating system.  Only the
+ * missing tail of the path is created: the function probes backward from
+ * the deepest component for the first ancestor that exists, then creates
+ * each missing component relative to its parent's directory descriptor.
+ * If another process creates a component at the same time, that is treated
+ * as success, so concurrent callers may safely create overlapping trees.
+ * Fails with ENOTDIR if a component of the path exists but is not a
+ * directory, or with EINVAL if the path is blank.  NOTE: This
  * function is capable of expanding strings like the Bash shell; i.e.,
  * ~/my/dir will be expanded to /home/user/my/dir, where user is the username
  * of the currently-logged-in user.
  */
-void CreateDirectory(const char* pszPath);
+int CreateDirectory(const char* pszPath);
+
+/**
+ * @name CreateDirectoryAt
+ * @brief As CreateDirectory, relative to a context's directory.
+ * @param lpContext Context whose directory a relative path is resolved
+ * against, or NULL for the current working directory.
+ * @param pszPath Path of the directory to create.
+ * @return OK if the directory exists upon return; ERROR otherwise, in which
+ * case errno is set.
+ */
+int CreateDirectoryAt(LPFILECORECONTEXT lpContext, const char* pszPath);
 
 /**
  * @name CreateDirIfNotExists
  * @brief Determines whether the specified directory exists at the specified
  * path; if this is not the case, attempts to create the directory.
  * @param pszPath The directory to create.
- * @remarks Attempts to discover whether the specified directory exists.  If
- * this is not the case, attempts to create the specified directory.  If the
- * path is blank, then this function simply gives up.  Otherwise, the function
- * will throw an error to STDERR if if it cannot get the operating system to
- * assist it in the process.  If this happens, the function will forcibly
- * terminate the application as well. NOTE: This
+ * @return OK if the directory exists upon return; ERROR otherwise, in which
+ * case errno is set.
+ * @remarks Equivalent to CreateDirectory, which already succeeds when the
+ * directory exists.  Kept for compatibility.  NOTE: This
  * function is capable of expanding strings like the Bash shell; i.e.,
  * ~/my/dir will be expanded to /home/user/my/dir, where user is the username
  * of the currently-logged-in user.
  */
-void CreateDirIfNotExists(const char* pszPath);
+int CreateDirIfNotExists(const char* pszPath);
+
+/**
+ * @name CreateDirIfNotExistsAt
+ * @brief As CreateDirIfNotExists, relative to a context's directory.
+ * @param lpContext Context whose directory a relative path is resolved
+ * against, or NULL for the current working directory.
+ * @param pszPath The directory to create.
+ * @return OK if the directory exists upon return; ERROR otherwise, in which
+ * case errno is set.
+ */
+int CreateDirIfNotExistsAt(LPFILECORECONTEXT lpContext, const char* pszPath);
+
+/**
+ * @name CreateFileCoreContext
+ * @brief Creates a context whose *At functions resolve relative paths
+ * against the specified directory instead of the working directory.
+ * @param pszDirectoryPath Path of the directory, or NULL or blank for the
+ * current working directory as of this call.
+ * @return Handle to the new context, or NULL if the directory cannot be
+ * opened, in which case errno is set.
+ * @remarks The context holds an open descriptor of the directory, so it
+ * keeps referring to the same directory even if that is renamed, and
+ * lookups through it do not walk the directory's own path again.  Unlike
+ * SetCurrentWorkingDirectory, which changes state shared by every thread,
+ * each thread may have a context of its own.  A context may also be shared
+ * by threads.  Release it with DestroyFileCoreContext.  This function is
+ * capable of expanding strings like the Bash shell.
+ */
+LPFILECORECONTEXT CreateFileCoreContext(const char* pszDirectoryPath);
+
+/**
+ * @name CreateFileCoreContextEx
+ * @brief Creates a context, as CreateFileCoreContext does, with options.
+ * @param pszDirectoryPath Path of the directory, or NULL or blank for the
+ * current working directory as of this call.
+ * @param nFlags CONTEXT_FLAG_NONE, or CONTEXT_FLAG_LITERAL_PATHS to use
+ * every path given to the context exactly as written.
+ * @return Handle to the new context, or NULL if the directory cannot be
+ * opened, in which case errno is set.
+ * @remarks With CONTEXT_FLAG_LITERAL_PATHS, neither pszDirectoryPath nor the
+ * paths later passed to SetContextDirectory and the *At functions are
+ * expanded, so a name containing characters such as $ or ~ can be reached.
+ * Such a path must fit in MAX_PATH bytes; a longer one fails with
+ * ENAMETOOLONG instead of being truncated.
+ */
+LPFILECORECONTEXT CreateFileCoreContextEx(const char* pszDirectoryPath,
+    int nFlags);
+
+/**
+ * @name CreateScratchFile
+ * @brief Creates an anonymous file for spilling intermediate results.
+ * @param pszDirectoryPath Directory on whose file system the file is
+ * created.  LinkScratchFile can only publish the file within that file
+ * system.
+ * @param nExpectedSize Number of bytes to reserve up front, or zero.
+ * @param nFlags SCRATCH_FLAG_* values.
+ * @return Handle to the scratch file, or NULL on failure, in which case
+ * errno is set.  Fails with ENOSPC if nExpectedSize bytes cannot be
+ * reserved.
+ * @remarks The file is opened with O_TMPFILE, so it has no name until
+ * LinkScratchFile gives it one, and the kernel reclaims it if the process
+ * dies first.  Where the file system does not support O_TMPFILE, a hidden
+ * file in the directory is used instead and removed by CloseScratchFile.
+ * The expected size is reserved with fallocate(), which lets the file
+ * system lay the file out in few, large extents.  With SCRATCH_FLAG_MAP the
+ * file is also mapped shared and read-write, and GetScratchBuffer gives
+ * access to what has been appended.  The handle is not thread-safe and must
+ * be released with CloseScratchFile.  This function is capable of
+ * expanding strings like the Bash shell.
+ */
+LPSCRATCHFILE CreateScratchFile(const char* pszDirectoryPath,
+    uint64_t nExpectedSize, int nFlags);
+
+/**
+ * @name DeleteMany
+ * @brief Deletes many files at once.
+ * @param ppszPaths Array of nCount paths.
+ * @param nCount Number of paths.
+ * @param pnErrors Array of nCount values that receive, in the same order,
+ * zero for each path that was deleted and the errno value for each one that
+ * was not; or NULL.
+ * @return OK if every path was deleted; ERROR otherwise, in which case errno
+ * holds the error for the first path that failed.
+ * @remarks Each path is unlinked; an empty directory is removed as well,
+ * but a directory with anything in it fails with ENOTEMPTY (see
+ * RemoveDirectoryTree).  A path that does not exist fails with ENOENT.
+ * Large batches are spread over a pool of worker threads, and a failure on
+ * one path never stops the others.  This function is capable of expanding
+ * strings like the Bash shell.
+ */
+int DeleteMany(const char** ppszPaths, int nCount, int* pnErrors);
+
+/**
+ * @name DestroyGroupCommitWriter
+ * @brief Commits any queued records, stops the flusher thread, and closes
+ * every file added to a group-commit writer.
+ * @param lppWriter Address of the writer handle.  The value it points to is
+ * set to NULL.
+ * @return OK on success; ERROR if a file could not be closed, in which case
+ * errno is set.
+ * @remarks No thread may be appending through the writer when this
+ * function is called.
+ */
+int DestroyGroupCommitWriter(LPGROUPCOMMITWRITER* lppWriter);
+
+/**
+ * @name DestroyFileCoreContext
+ * @brief Releases a context created by CreateFileCoreContext.
+ * @param lppContext Address of the context handle, which is set to NULL.
+ */
+void DestroyFileCoreContext(LPFILECORECONTEXT* lppContext);
+
+/**
+ * @name DisableTextCache
+ * @brief Turns off the text cache, stopping its inotify thread and
+ * releasing its memory.  Text already handed out stays valid until it is
+ * released.
+ */
+void DisableTextCache(void);
 
 /**
  * @name DirectoryExists
  * @brief Determines whether the directory exists at the path specified.
  * @param pszPath The directory to search for.
- * @return TRUE if the directory exists at the path specified; FALSE
- * otherwise.
+ * @return TRUE if a directory, or a symbolic link to one, exists at the
+ * path specified; FALSE otherwise, including when the path names some other
+ * kind of file.
  * @remarks This function is capable of handling strings that can be
  * expanded by the Bash shell, such as ~/my/dir.
  */
 BOOL DirectoryExists(const char* pszPath);
 
+/**
+ * @name DirectoryExistsAt
+ * @brief As DirectoryExists, relative to a context's directory.
+ * @param lpContext Context whose directory a relative path is resolved
+ * against, or NULL for the current working directory.
+ * @param pszPath The directory to search for.
+ * @return TRUE if a directory, or a symbolic link to one, exists at the
+ * path specified; FALSE otherwise.
+ */
+BOOL DirectoryExistsAt(LPFILECORECONTEXT lpContext, const char* pszPath);
+
+/**
+ * @name DropFromCache
+ * @brief Evicts a file's pages from the kernel's page cache.
+ * @param pszPath Path of the file.
+ * @return OK on success; ERROR otherwise, in which case errno is set.
+ * @remarks Meant for data that is read or written once, such as a large
+ * export, so that it does not push hot files out of memory.  Dirty pages
+ * are written back first, since the kernel only drops clean ones.  The
+ * file's content is unaffected; the next reader just goes to the disk.
+ * This function is capable of expanding strings like the Bash shell.
+ */
+int DropFromCache(const char* pszPath);
+
+/**
+ * @name EnableTextCache
+ * @brief Turns on caching of the files read by CachedReadAllText.
+ * @param nMemoryBudget Most bytes the cache may hold, counting its own
+ * bookkeeping.  When a new file would exceed it, the least-recently-used
+ * files are discarded.  No single file is cached if it needs more than
+ * nMemoryBudget / TEXT_CACHE_SHARD_COUNT bytes (a sixteenth by default),
+ * bookkeeping included, so the budget should be at least
+ * TEXT_CACHE_SHARD_COUNT times the largest file worth caching.
+ * @param nFlags TEXT_CACHE_FLAG_NONE, or TEXT_CACHE_FLAG_WATCH to start a
+ * thread that drops a file from the cache as soon as inotify reports that
+ * it changed.
+ * @return OK if the cache was enabled; ERROR otherwise, in which case errno
+ * is set.
+ * @remarks The cache is split into shards, each with its own lock,
+ * least-recently-used list and equal share of the budget, so threads reading
+ * different files rarely contend; that share is also the per-file limit
+ * given above.  Checking modification time and size misses a change that keeps
+ * the size and lands within the file system's timestamp granularity;
+ * TEXT_CACHE_FLAG_WATCH closes that gap, and also frees the memory of
+ * changed files right away.  Calling this function again discards the
+ * current contents and applies the new settings.
+ */
+int EnableTextCache(size_t nMemoryBudget, int nFlags);
+
+/**
+ * @name EnumerateDirectory
+ * @brief Lists the entries of a directory.
+ * @param pszPath Path of the directory to list.
+ * @param lpListing Address of a DIRECTORYLISTING that receives the entries.
+ * @return OK on success; ERROR otherwise, in which case errno is set and the
+ * listing is left empty.
+ * @remarks The entries . and .. are omitted, and the rest appear in the
+ * order the file system returns them.  Entries are read with getdents64()
+ * in large batches, and each entry's type is taken from the directory
+ * itself, so no file is stat()ed unless the file system does not record
+ * types.  The listing is held in two blocks of memory, one for the entries
+ * and one for their names, which FreeDirectoryListing releases.  NOTE: This
+ * function is capable of handling strings that can be expanded by the Bash
+ * shell, such as ~/my/dir.
+ */
+int EnumerateDirectory(const char* pszPath, LPDIRECTORYLISTING lpListing);
+
+/**
+ * @name EnumerateDirectoryAt
+ * @brief As EnumerateDirectory, relative to a context's directory.
+ * @param lpContext Context whose directory a relative path is resolved
+ * against, or NULL for the current working directory.
+ * @param pszPath Path of the directory to list.
+ * @param lpListing Address of a DIRECTORYLISTING that receives the entries.
+ * @return OK on success; ERROR otherwise, in which case errno is set and the
+ * listing is left empty.
+ */
+int EnumerateDirectoryAt(LPFILECORECONTEXT lpContext, const char* pszPath,
+    LPDIRECTORYLISTING lpListing);
+
 /**
  * @name FileExists
  * @brief Determines whether a file exists at the path specified.
@@ -82,10 +781,401 @@ BOOL DirectoryExists(const char* pszPath);
  */
 BOOL FileExists(const char* pszPath);
 
+/**
+ * @name FileExistsAt
+ * @brief As FileExists, relative to a context's directory.
+ * @param lpContext Context whose directory a relative path is resolved
+ * against, or NULL for the current working directory.
+ * @param pszPath The file to search for.
+ * @return TRUE if anything exists at the path specified; FALSE otherwise.
+ */
+BOOL FileExistsAt(LPFILECORECONTEXT lpContext, const char* pszPath);
+
+/**
+ * @name FlushAppender
+ * @brief Writes every record buffered by an appender to its file.
+ * @param lpAppender Appender handle obtained from OpenAppender.
+ * @return OK on success; ERROR otherwise, in which case errno is set and the
+ * records remain buffered.
+ * @remarks Issues a single write().  No fsync() is performed.
+ */
+int FlushAppender(LPAPPENDER lpAppender);
+
+/**
+ * @name FlushGroupCommitWriter
+ * @brief Waits until every record queued so far by any thread has been
+ * written and synchronized.
+ * @param lpWriter Writer handle obtained from CreateGroupCommitWriter.
+ * @return OK on success; ERROR otherwise, in which case errno is set.
+ * Fails if the write or synchronization of any record has failed since the
+ * writer was created, whether or not anyone waited on that record; errno is
+ * then that of the first failure.
+ */
+int FlushGroupCommitWriter(LPGROUPCOMMITWRITER lpWriter);
+
+/**
+ * @name FreeDirectoryListing
+ * @brief Releases the memory held by a listing from EnumerateDirectory.
+ * @param lpListing Address of the listing, which is left empty.
+ */
+void FreeDirectoryListing(LPDIRECTORYLISTING lpListing);
+
+/**
+ * @name FreeLineIndex
+ * @brief Releases an index that was built by BuildLineIndex.
+ * @param lppIndex Address of the index handle, which is set to NULL.
+ * @remarks Any lines previously handed out by GetLine become invalid.
+ */
+void FreeLineIndex(LPLINEINDEX* lppIndex);
+
+/**
+ * @name FreeReadManyResults
+ * @brief Releases the buffers handed out by ReadManyFiles.
+ * @param pResults Address of the array of results.
+ * @param nCount Number of elements in the array.
+ */
+void FreeReadManyResults(LPREADMANYRESULT pResults, int nCount);
+
+/**
+ * @name GetContextDirectory
+ * @brief Gets the path of a context's directory.
+ * @param lpContext Context handle, or NULL for the current working
+ * directory.
+ * @param pszBuffer Address of a buffer that receives the NUL-terminated
+ * path.
+ * @param nBufferSize Size of the buffer, in bytes.
+ * @return OK on success; ERROR otherwise, in which case errno is set.  Fails
+ * with ERANGE if the buffer is too small.
+ * @remarks The path is where the directory is now, as reported by the
+ * kernel, which may differ from the path the context was created with.
+ */
+int GetContextDirectory(LPFILECORECONTEXT lpContext, char* pszBuffer,
+    size_t nBufferSize);
+
 void GetCurrentWorkingDirectory(char* pszCurrentWorkingDir, int nBufferSize);
 
+/**
+ * @name GetFileInfo
+ * @brief Retrieves the metadata of a file.
+ * @param pszPath Path of the file.  Symbolic links are followed.
+ * @param nMask FILE_INFO_* values naming the fields to retrieve.
+ * @param lpInfo Address of a FILEINFO that receives the metadata.
+ * @return OK on success; ERROR otherwise, in which case errno is set, as is
+ * the nError member of lpInfo.
+ * @remarks Uses statx() with only the fields asked for, and accepts the
+ * attributes the kernel has cached rather than revalidating them with a
+ * network file system's server.  NOTE: This function is capable of
+ * handling strings that can be expanded by the Bash shell, such as
+ * ~/my/dir/file.txt.
+ */
+int GetFileInfo(const char* pszPath, int nMask, LPFILEINFO lpInfo);
+
+/**
+ * @name GetFileInfoAt
+ * @brief As GetFileInfo, relative to a context's directory.
+ * @param lpContext Context whose directory a relative path is resolved
+ * against, or NULL for the current working directory.
+ * @param pszPath Path of the file.  Symbolic links are followed.
+ * @param nMask FILE_INFO_* values naming the fields to retrieve.
+ * @param lpInfo Address of a FILEINFO that receives the metadata.
+ * @return OK on success; ERROR otherwise, in which case errno is set, as is
+ * the nError member of lpInfo.
+ */
+int GetFileInfoAt(LPFILECORECONTEXT lpContext, const char* pszPath,
+    int nMask, LPFILEINFO lpInfo);
+
 void GetHomeDirectoryPath(char* pszDirectoryPath);
 
+/**
+ * @name GetScratchBuffer
+ * @brief Gets the mapping of a scratch file created with SCRATCH_FLAG_MAP.
+ * @param lpScratch Scratch file handle obtained from CreateScratchFile.
+ * @param ppBuffer Address of a pointer that receives the start of the
+ * mapping, or NULL if nothing has been reserved yet.
+ * @param pnLength Address of a value that receives the number of bytes
+ * appended so far.
+ * @return OK on success; ERROR otherwise, in which case errno is set.  Fails
+ * with EINVAL if the file is not mapped.
+ * @remarks The buffer may be read and modified in place, up to *pnLength
+ * bytes.  It is valid until the next call to AppendScratchFile or
+ * CloseScratchFile.
+ */
+int GetScratchBuffer(LPSCRATCHFILE lpScratch, char** ppBuffer,
+    uint64_t* pnLength);
+
+/**
+ * @name GetScratchFileDescriptor
+ * @brief Gets the file descriptor behind a scratch file.
+ * @param lpScratch Scratch file handle obtained from CreateScratchFile.
+ * @return The descriptor, or ERROR if lpScratch is NULL.
+ * @remarks The descriptor is owned by the handle, which assumes that it
+ * alone changes the file's length; use it to read the file back, e.g. with
+ * ReadDescriptorRange.
+ */
+int GetScratchFileDescriptor(LPSCRATCHFILE lpScratch);
+
+/**
+ * @name GetLine
+ * @brief Finds a line of an indexed file.
+ * @param lpIndex Index produced by BuildLineIndex.
+ * @param nLine Zero-based number of the line.
+ * @param ppLine Address of a pointer that receives the address of the
+ * line's first character, within the mapped file.  The line is not
+ * NUL-terminated.
+ * @param pnLength Address of a variable that receives the length of the
+ * line, not counting its newline.
+ * @return OK on success; ERROR otherwise, in which case errno is set.  Fails
+ * with ERANGE if nLine is not less than GetLineCount(lpIndex).
+ * @remarks Takes constant time.  A carriage return before the newline is
+ * left in place.  Safe to call from any number of threads.
+ */
+int GetLine(LPLINEINDEX lpIndex, uint64_t nLine, const char** ppLine,
+    size_t* pnLength);
+
+/**
+ * @name GetLineCount
+ * @brief Gets the number of lines in an indexed file.
+ * @param lpIndex Index produced by BuildLineIndex.
+ * @return Number of lines, which is zero for an empty file.  A final line
+ * without a newline counts; a final newline does not begin another line.
+ */
+uint64_t GetLineCount(LPLINEINDEX lpIndex);
+
+/**
+ * @name GroupCommitAppend
+ * @brief Queues a record to be appended to a file by a group-commit writer.
+ * @param lpWriter Writer handle obtained from CreateGroupCommitWriter.
+ * @param nFile Index of the file, as returned by AddGroupCommitFile.
+ * @param pData Address of the bytes to append.  The bytes are copied, so
+ * the caller may reuse the memory as soon as this function returns.
+ * @param nLength Number of bytes to append.
+ * @param bWait TRUE to block until the batch containing this record has
+ * been written and synchronized; FALSE to return as soon as it is queued.
+ * @return OK on success; ERROR otherwise, in which case errno is set.  When
+ * bWait is TRUE, the result reflects the write and synchronization of the
+ * record's batch.  Once any commit has failed, every later call fails with
+ * the errno of that failure.
+ * @remarks Records from one thread reach the file in the order they were
+ * appended.  Records from different threads are interleaved whole.
+ */
+int GroupCommitAppend(LPGROUPCOMMITWRITER lpWriter, int nFile,
+    const char* pData, size_t nLength, BOOL bWait);
+
+/**
+ * @name LinkScratchFile
+ * @brief Publishes a scratch file under a path.
+ * @param lpScratch Scratch file handle obtained from CreateScratchFile.
+ * @param pszPath Path under which the file is published.  It must be on the
+ * same file system as the directory given to CreateScratchFile.
+ * @param nFlags WRITE_FLAG_DATASYNC or WRITE_FLAG_FULLSYNC to synchronize
+ * the file (and, with WRITE_FLAG_FULLSYNC, its directory) as WriteAllBytes
+ * does, or WRITE_FLAG_NONE.
+ * @return OK on success; ERROR otherwise, in which case errno is set.  Fails
+ * with EALREADY if the file has already been linked, or with EXDEV if the
+ * path is on another file system.
+ * @remarks Unused reserved space is released, and the file is then renamed
+ * over any file already at pszPath, so readers see either the old file or
+ * the finished one, never a partial file.  The handle stays open, for
+ * reading only, until CloseScratchFile is called.  This function is capable
+ * of expanding strings like the Bash shell.
+ */
+int LinkScratchFile(LPSCRATCHFILE lpScratch, const char* pszPath,
+    int nFlags);
+
+/**
+ * @name MapFile
+ * @brief Maps the specified file into memory as a read-only view.
+ * @param pszPath Pathname to the file to be mapped.  The file must exist.
+ * @param lpView Address of a FILEVIEW structure that receives the address
+ * and length of the mapped data.
+ * @param nHints Zero or more MAP_FILE_HINT_* values OR-ed together.
+ * @return OK if the file was mapped; ERROR otherwise, in which case errno
+ * is set.
+ * @remarks No bytes are copied; the view is backed by the page cache, so
+ * every process mapping the same file shares a single copy.  The hints are
+ * advisory only and are silently ignored if the kernel rejects them.  An
+ * empty file produces a view of zero length.  The view must be released
+ * with UnmapFile.  This function is capable of expanding strings like the
+ * Bash shell.
+ */
+int MapFile(const char* pszPath, LPFILEVIEW lpView, int nHints);
+
+/**
+ * @name MapFileAt
+ * @brief As MapFile, relative to a context's directory.
+ * @param lpContext Context whose directory a relative path is resolved
+ * against, or NULL for the current working directory.
+ * @param pszPath Pathname to the file to be mapped.
+ * @param lpView Address of a FILEVIEW structure that receives the address
+ * and length of the mapped data.
+ * @param nHints MAP_FILE_HINT_* values.
+ * @return OK on success; ERROR otherwise, in which case errno is set.
+ */
+int MapFileAt(LPFILECORECONTEXT lpContext, const char* pszPath,
+    LPFILEVIEW lpView, int nHints);
+
+/**
+ * @name MoveFile
+ * @brief Moves or renames a file or directory.
+ * @param pszSourcePath Path of the file to move.
+ * @param pszTargetPath New path of the file.
+ * @param nFlags COPY_FLAG_* values.  Unless COPY_FLAG_OVERWRITE is given,
+ * the function fails with EEXIST if the target exists.
+ * @return OK on success; ERROR otherwise, in which case errno is set.
+ * @remarks Within one file system this is a single rename(), or a
+ * renameat2() with RENAME_NOREPLACE so that an existing target is never
+ * replaced, even by a racing process.  Across file systems a regular file is
+ * copied with CopyFile and the original is then removed; anything else
+ * fails with EXDEV.  NOTE: This function is capable of handling strings
+ * that can be expanded by the Bash shell, such as ~/my/dir/file.txt.
+ */
+int MoveFile(const char* pszSourcePath, const char* pszTargetPath,
+    int nFlags);
+
+/**
+ * @name PrefetchFiles
+ * @brief Starts reading a set of files into the page cache, so that later
+ * reads of them do not wait on the disk.
+ * @param ppszPaths Address of an array of paths.
+ * @param nCount Number of elements in the array.
+ * @return OK if every file could be prefetched; ERROR otherwise, in which
+ * case errno holds the error of one of the files that failed.  Every file
+ * is attempted regardless.
+ * @remarks Meant for warming a working set, for example right after a
+ * deployment.  The files are opened on a pool of worker threads, and each
+ * one's reads are queued with readahead(), or posix_fadvise() with
+ * POSIX_FADV_WILLNEED on file systems without it.  Neither waits for the
+ * data, so the function returns long before a large set is fully cached.
+ * This function is capable of expanding strings like the Bash shell.
+ */
+int PrefetchFiles(const char** ppszPaths, int nCount);
+
+/**
+ * @name OpenAppender
+ * @brief Opens the specified file for buffered, append-only writing.
+ * @param pszPath Path of the file to append to.  The file is created if it
+ * does not exist.
+ * @param nBufferSize Size, in bytes, of the appender's buffer.  Pass zero to
+ * use a default size.
+ * @param nFlushPolicy APPENDER_FLUSH_WHEN_FULL, APPENDER_FLUSH_EVERY_RECORD,
+ * or a positive number of milliseconds after which buffered records are
+ * written out by the next call to Append.
+ * @return Handle to the new appender, or NULL on failure, in which case
+ * errno is set.
+ * @remarks The file stays open with O_APPEND for the life of the handle, so
+ * the path is expanded and looked up only once.  Small records accumulate
+ * in the buffer and reach the file in batches; with a time-based policy,
+ * records appended just before a quiet period stay buffered until the next
+ * Append, FlushAppender or CloseAppender call.  The handle must be released
+ * with CloseAppender.  This function is capable of expanding strings like
+ * the Bash shell.
+ */
+LPAPPENDER OpenAppender(const char* pszPath, size_t nBufferSize,
+    int nFlushPolicy);
+
+/**
+ * @name OpenAppenderAt
+ * @brief As OpenAppender, relative to a context's directory.
+ * @param lpContext Context whose directory a relative path is resolved
+ * against, or NULL for the current working directory.
+ * @param pszPath Path of the file to append to.
+ * @param nBufferSize Size, in bytes, of the appender's buffer, or zero.
+ * @param nFlushPolicy As for OpenAppender.
+ * @return Handle to the new appender, or NULL on failure, in which case
+ * errno is set.  Release it with CloseAppender.
+ */
+LPAPPENDER OpenAppenderAt(LPFILECORECONTEXT lpContext, const char* pszPath,
+    size_t nBufferSize, int nFlushPolicy);
+
+/**
+ * @name OpenFileReader
+ * @brief Opens the specified file for streaming, chunk- or line-at-a-time
+ * reading.
+ * @param pszPath Pathname to the file to be read.  May name a regular file,
+ * a FIFO, or a device such as /dev/stdin.
+ * @param nBufferSize Size, in bytes, of the reader's buffer.  Pass zero to
+ * use a default size.
+ * @return Handle to the new reader, or NULL if the file cannot be opened or
+ * the buffer cannot be allocated, in which case errno is set.
+ * @remarks The reader allocates its buffer once and reuses it for the life
+ * of the handle, so memory use is constant regardless of the size of the
+ * input.  The handle must be released with CloseFileReader.  This function
+ * is capable of expanding strings like the Bash shell.
+ */
+LPFILEREADER OpenFileReader(const char* pszPath, size_t nBufferSize);
+
+/**
+ * @name OpenFileReaderAt
+ * @brief As OpenFileReader, relative to a context's directory.
+ * @param lpContext Context whose directory a relative path is resolved
+ * against, or NULL for the current working directory.
+ * @param pszPath Pathname to the file to be read.
+ * @param nBufferSize Size, in bytes, of the reader's buffer, or zero.
+ * @return Handle to the new reader, or NULL on failure, in which case errno
+ * is set.  Release it with CloseFileReader.
+ */
+LPFILEREADER OpenFileReaderAt(LPFILECORECONTEXT lpContext,
+    const char* pszPath, size_t nBufferSize);
+
+/**
+ * @name ReadAllBytes
+ * @brief Gets all the bytes in the specified file.
+ * @param pszPath Pathname to the file to be read.  The file must exist.
+ * @param ppOutput Address of a pointer variable that will be filled with
+ * the address of memory containing the file's bytes.  This memory is
+ * allocated dynamically on the heap and must be released with free().
+ * @param pnLength Address of a size_t variable to be filled with the
+ * number of bytes read from the file.
+ * @return OK if the file was read in its entirety; ERROR otherwise, in which
+ * case errno is set and nothing is allocated.
+ * @remarks The data is binary-safe; embedded NUL bytes are preserved.  For
+ * convenience, a NUL terminator is written just past the last byte, so text
+ * files can be used as C strings directly.  Regular files are read into a
+ * single allocation sized from fstat(); pipes and procfs files, whose size
+ * is not known up front, are read into a buffer that grows geometrically.
+ * This function is capable of expanding strings like the Bash shell.
+ */
+int ReadAllBytes(const char* pszPath, char** ppOutput, size_t* pnLength);
+
+/**
+ * @name ReadAllBytesAt
+ * @brief As ReadAllBytesEx, relative to a context's directory.
+ * @param lpContext Context whose directory a relative path is resolved
+ * against, or NULL for the current working directory.
+ * @param pszPath Pathname to the file to be read.
+ * @param ppOutput Address of a pointer variable that will be filled with
+ * the address of the file's bytes, which must be released with free().
+ * @param pnLength Address of a size_t variable to be filled with the
+ * number of bytes read from the file.
+ * @param nFlags READ_FLAG_* values.
+ * @return OK if the file was read in its entirety; ERROR otherwise, in which
+ * case errno is set and nothing is allocated.
+ */
+int ReadAllBytesAt(LPFILECORECONTEXT lpContext, const char* pszPath,
+    char** ppOutput, size_t* pnLength, int nFlags);
+
+/**
+ * @name ReadAllBytesEx
+ * @brief Gets all the bytes in the specified file, with options.
+ * @param pszPath Pathname to the file to be read.  The file must exist.
+ * @param ppOutput Address of a pointer variable that will be filled with
+ * the address of memory containing the file's bytes, which must be
+ * released with free().
+ * @param pnLength Address of a size_t variable to be filled with the
+ * number of bytes read from the file.
+ * @param nFlags READ_FLAG_NONE, or READ_FLAG_DIRECT to read with O_DIRECT.
+ * @return OK if the file was read in its entirety; ERROR otherwise, in which
+ * case errno is set and nothing is allocated.
+ * @remarks Behaves as ReadAllBytes.  READ_FLAG_DIRECT suits large files
+ * that are read once: the data goes straight from the device into the
+ * output buffer, which the function aligns as O_DIRECT requires, instead
+ * of passing through and displacing the page cache.  Where direct I/O is
+ * not supported, such as on tmpfs or for pipes, the file is read normally.
+ * This function is capable of expanding strings like the Bash shell.
+ */
+int ReadAllBytesEx(const char* pszPath, char** ppOutput, size_t* pnLength,
+    int nFlags);
+
 /**
  * @name ReadAllText
  * @brief Gets all the text in the specified file.
@@ -97,13 +1187,361 @@ void GetHomeDirectoryPath(char* pszDirectoryPath);
  * @param pnFileSize Address of an integer variable to be filled with the
  * number of bytes in the file.
  * @remarks This function can only cope with files that are 2 GB or less
- * in size.
+ * in size.  Use ReadAllBytes for larger files.  Upon failure, this function
+ * raises an error message to STDERR and exits the application.
  */
 void ReadAllText(const char* pszPath, char** ppszOutput,
     int *pnFileSize);
 
+/**
+ * @name ReadAllTextAt
+ * @brief As ReadAllText, relative to a context's directory.
+ * @param lpContext Context whose directory a relative path is resolved
+ * against, or NULL for the current working directory.
+ * @param pszPath Pathname to the file to be read.
+ * @param ppszOutput Address of a pointer variable that will be filled with
+ * the address of the file's text, which must be released with free().
+ * @param pnFileSize Address of an integer variable to be filled with the
+ * number of bytes in the file.
+ * @remarks Fails as ReadAllText does.
+ */
+void ReadAllTextAt(LPFILECORECONTEXT lpContext, const char* pszPath,
+    char** ppszOutput, int* pnFileSize);
+
+/**
+ * @name ReadDescriptorAll
+ * @brief Reads an open file from its current position to end-of-file.
+ * @param nFileDescriptor Descriptor of the file, open for reading.  It is
+ * not closed.
+ * @param ppOutput Address of a pointer variable that will be filled with
+ * the address of memory containing the bytes read, followed by a NUL, which
+ * must be released with free().
+ * @param pnLength Address of a size_t variable to be filled with the
+ * number of bytes read.
+ * @return OK on success; ERROR otherwise, in which case errno is set and
+ * nothing is allocated.
+ * @remarks Reads with read(), so it works on pipes, sockets and terminals
+ * as well as on files, and it advances the file position.  As in
+ * ReadAllBytes, a regular file is read into one block sized from fstat();
+ * anything whose size is not known is read into a block that grows
+ * geometrically.  The descriptor must not have O_DIRECT set.
+ */
+int ReadDescriptorAll(int nFileDescriptor, char** ppOutput,
+    size_t* pnLength);
+
+/**
+ * @name ReadDescriptorRange
+ * @brief Reads part of an open file at a 64-bit offset.
+ * @param nFileDescriptor Descriptor of the file, open for reading.
+ * @param nOffset Offset of the first byte to read.
+ * @param nLength Number of bytes to read.
+ * @param pBuffer Address of a buffer of at least nLength bytes.
+ * @param pnBytesRead Address of a variable that receives the number of
+ * bytes read, which is less than nLength only if end-of-file was reached.
+ * May be NULL.
+ * @return OK on success; ERROR otherwise, in which case errno is set and
+ * *pnBytesRead says how much was read before the failure.
+ * @remarks Uses pread(), which leaves the file position alone, so any
+ * number of threads may read from the same descriptor at once.
+ */
+int ReadDescriptorRange(int nFileDescriptor, off_t nOffset, size_t nLength,
+    char* pBuffer, size_t* pnBytesRead);
+
+/**
+ * @name ReadDescriptorRangeV
+ * @brief Reads a contiguous part of an open file into several buffers.
+ * @param nFileDescriptor Descriptor of the file, open for reading.
+ * @param nOffset Offset of the first byte to read.
+ * @param pIovecs Address of an array of iovec structures describing the
+ * buffers, which are filled in order.  The array is not modified.
+ * @param nCount Number of elements in the array.
+ * @param pnBytesRead Address of a variable that receives the total number
+ * of bytes read, which falls short only at end-of-file.  May be NULL.
+ * @return OK on success; ERROR otherwise, in which case errno is set.
+ * @remarks Uses preadv(), so a header and a body, or a run of fixed-size
+ * records, arrive in separate buffers with a single system call.  Like
+ * ReadDescriptorRange, it is safe on a descriptor shared between threads.
+ */
+int ReadDescriptorRangeV(int nFileDescriptor, off_t nOffset,
+    const struct iovec* pIovecs, int nCount, size_t* pnBytesRead);
+
+/**
+ * @name ReadFileRange
+ * @brief Reads part of a file at a 64-bit offset.
+ * @param pszPath Path of the file to read.
+ * @param nOffset Offset of the first byte to read.
+ * @param nLength Number of bytes to read.
+ * @param pBuffer Address of a buffer of at least nLength bytes.
+ * @param pnBytesRead Address of a variable that receives the number of
+ * bytes read, which is less than nLength only if end-of-file was reached.
+ * May be NULL.
+ * @return OK on success; ERROR otherwise, in which case errno is set.
+ * @remarks Opens the file, calls ReadDescriptorRange and closes it again.
+ * Callers reading many ranges of one file should open it once and use
+ * ReadDescriptorRange instead.  This function is capable of expanding
+ * strings like the Bash shell.
+ */
+int ReadFileRange(const char* pszPath, off_t nOffset, size_t nLength,
+    char* pBuffer, size_t* pnBytesRead);
+
+/**
+ * @name ReadManyFiles
+ * @brief Reads the entire contents of many files at once.
+ * @param ppszPaths Array of pathnames of the files to be read.
+ * @param nCount Number of elements in ppszPaths and pResults.
+ * @param pResults Array that receives the outcome for each file, in the
+ * same order as ppszPaths.
+ * @param lpOptions Tuning knobs, or NULL for the defaults.
+ * @return OK if every file was read; ERROR if any could not be, in which
+ * case errno is set from the first failure and the per-file results say
+ * which ones failed.
+ * @remarks Where the kernel supports io_uring, the opens, statx calls and
+ * reads of up to nQueueDepth files are kept in flight together on a single
+ * ring, so the per-file latencies overlap instead of adding up; files whose
+ * size is not known up front, such as pipes and those under /proc, are
+ * read on a pool of worker threads once the ring is done.  Otherwise, the
+ * files are read with ReadAllBytes on a pool of worker threads.  A
+ * failure on one file never stops the others.  Each buffer is handled like
+ * those from ReadAllBytes and must be released, for instance with
+ * FreeReadManyResults.  This function is capable of expanding strings like
+ * the Bash shell.
+ */
+int ReadManyFiles(const char** ppszPaths, int nCount,
+    LPREADMANYRESULT pResults, LPREADMANYOPTIONS lpOptions);
+
+/**
+ * @name ReadNextChunk
+ * @brief Reads the next block of bytes from a streaming reader.
+ * @param lpReader Reader handle obtained from OpenFileReader.
+ * @param ppData Address of a pointer that receives the address of the data.
+ * @param pnLength Address of a variable that receives the number of bytes.
+ * @return OK if data was returned; FILE_READER_EOF if the input has been
+ * exhausted; ERROR otherwise, in which case errno is set.
+ * @remarks The data points into the reader's buffer and is only valid until
+ * the next call on the same reader.  Bytes left over from prior calls to
+ * ReadNextLine are returned first.
+ */
+int ReadNextChunk(LPFILEREADER lpReader, const char** ppData,
+    size_t* pnLength);
+
+/**
+ * @name ReadNextLine
+ * @brief Reads the next line of text from a streaming reader.
+ * @param lpReader Reader handle obtained from OpenFileReader.
+ * @param ppszLine Address of a pointer that receives the address of the
+ * first character of the line.
+ * @param pnLength Address of a variable that receives the length of the
+ * line, not counting the line terminator.
+ * @return OK if a line was returned; FILE_READER_EOF if the input has been
+ * exhausted; ERROR otherwise, in which case errno is set.
+ * @remarks The line is not NUL-terminated and points into the reader's
+ * buffer; it is only valid until the next call on the same reader.  The
+ * trailing newline is stripped.  A line longer than the reader's buffer is
+ * returned in buffer-sized pieces.
+ */
+int ReadNextLine(LPFILEREADER lpReader, const char** ppszLine,
+    size_t* pnLength);
+
+/**
+ * @name ReleaseCachedText
+ * @brief Gives back text obtained from CachedReadAllText.
+ * @param pszText Address returned through ppszText.  NULL is ignored.
+ */
+void ReleaseCachedText(const char* pszText);
+
+/**
+ * @name RemoveDirectoryTree
+ * @brief Removes a directory and everything beneath it, like rm -rf.
+ * @param pszPath Path of the directory.  A symbolic link is not followed;
+ * it fails with ENOTDIR or ELOOP.
+ * @param lpOptions Tuning knobs, or NULL for the defaults.
+ * @param lpResult Address of a REMOVETREERESULT that receives the counts of
+ * entries removed and of failures, or NULL.
+ * @return OK if the whole tree was removed; ERROR otherwise, in which case
+ * errno holds the first failure.
+ * @remarks The top of the tree is cleared on the calling thread until it
+ * has a few subdirectories per thread; those subtrees are then removed in
+ * parallel, each depth-first.  Every entry is read with getdents64() and
+ * removed with unlinkat() relative to its directory's descriptor, so no
+ * path is ever built.  Each subtree is walked iteratively with at most two
+ * descriptors open, returning to a parent through "..", so trees of any
+ * depth, including those deeper than MAX_PATH, can be removed; a subtree
+ * moved during the removal fails with ESTALE.
+ * Symbolic links are removed, never followed.  A failure leaves its
+ * ancestors in place but does not stop the removal of anything else, so
+ * one call removes as much as it can.  Entries that vanish meanwhile are
+ * not counted as failures.  This function is capable of expanding strings
+ * like the Bash shell.
+ */
+int RemoveDirectoryTree(const char* pszPath, LPREMOVETREEOPTIONS lpOptions,
+    LPREMOVETREERESULT lpResult);
+
+/**
+ * @name SetContextDirectory
+ * @brief Changes the directory of a context, as chdir() does for the
+ * process.
+ * @param lpContext Context handle.
+ * @param pszDirectoryPath Path of the new directory.  A relative path is
+ * resolved against the context's current directory.
+ * @return OK on success; ERROR otherwise, in which case errno is set and the
+ * context is unchanged.
+ * @remarks The change is atomic: a call using the context on another thread
+ * at the same time works entirely in the old directory or entirely in the
+ * new one.  This function is capable of expanding strings like the Bash
+ * shell.
+ */
+int SetContextDirectory(LPFILECORECONTEXT lpContext,
+    const char* pszDirectoryPath);
+
 BOOL SetCurrentWorkingDirectory(const char* pszDirectoryPath);
 
+/**
+ * @name StatMany
+ * @brief Retrieves the metadata of many files at once.
+ * @param ppszPaths Array of nCount paths.
+ * @param nCount Number of paths.
+ * @param nMask FILE_INFO_* values naming the fields to retrieve.
+ * @param pResults Array of nCount FILEINFO structures that receive the
+ * outcome for each path, in the same order.
+ * @return OK if every path could be queried; ERROR otherwise, in which case
+ * errno holds the error for the first path that failed.  Every element of
+ * pResults is filled in either way.
+ * @remarks Each path is queried as by GetFileInfo.  Large batches are
+ * spread over a pool of worker threads, one per few hundred paths.
+ */
+int StatMany(const char** ppszPaths, int nCount, int nMask,
+    LPFILEINFO pResults);
+
+/**
+ * @name UnmapFile
+ * @brief Releases a view that was created by MapFile.
+ * @param lpView Address of the FILEVIEW structure to be released.
+ * @remarks The structure is zeroed out upon return, so calling this function
+ * twice on the same view is harmless.
+ */
+void UnmapFile(LPFILEVIEW lpView);
+
+/**
+ * @name WalkDirectoryTree
+ * @brief Visits every entry beneath a directory.
+ * @param pszPath Path of the directory at the root of the tree.
+ * @param nThreads Number of threads to walk with, or zero for a default
+ * based on the number of processors.  At most MAX_WORKER_COUNT are used.
+ * @param lpfnCallback Called for each entry with its full path.  Return
+ * WALK_SKIP from it to keep the walk out of a subdirectory, or WALK_STOP to
+ * end the walk.
+ * @param pContext Passed through to lpfnCallback.
+ * @return OK if every directory in the tree was read; ERROR otherwise, in
+ * which case errno holds the first failure.  Unreadable directories do not
+ * end the walk.
+ * @remarks Subdirectories are spread over the threads through per-thread
+ * queues: each thread walks its own subtrees depth-first and, when it runs
+ * dry, steals the oldest pending subtree from another thread.  The callback
+ * is therefore called concurrently, in no particular order, and the entry
+ * it is given is only valid until it returns.  The root is opened through a
+ * symbolic link; links beneath it are reported but never followed.  NOTE:
+ * This function is capable of handling strings that can be expanded by the
+ * Bash shell, such as ~/my/dir.
+ */
+int WalkDirectoryTree(const char* pszPath, int nThreads,
+    DIRECTORY_WALK_CALLBACK lpfnCallback, void* pContext);
+
+/**
+ * @name WalkDirectoryTreeAt
+ * @brief As WalkDirectoryTree, relative to a context's directory.
+ * @param lpContext Context whose directory a relative path is resolved
+ * against, or NULL for the current working directory.
+ * @param pszPath Path of the directory at the root of the tree.
+ * @param nThreads Number of threads to walk with, or zero for a default.
+ * @param lpfnCallback Called for each entry, as for WalkDirectoryTree.
+ * @param pContext Passed through to lpfnCallback.
+ * @return OK if every directory in the tree was read; ERROR otherwise, in
+ * which case errno holds the first failure.
+ * @remarks The paths given to the callback begin with pszPath as written,
+ * so they too are relative to the context's directory when pszPath is.
+ */
+int WalkDirectoryTreeAt(LPFILECORECONTEXT lpContext, const char* pszPath,
+    int nThreads, DIRECTORY_WALK_CALLBACK lpfnCallback, void* pContext);
+
+/**
+ * @name WriteAllBytes
+ * @brief Writes the bytes provided to the file at the specified path.
+ * @param pszPath Path of the file to be written.
+ * @param pData Address of the bytes to be written.  May contain NUL bytes.
+ * @param nLength Number of bytes to be written.
+ * @param nFlags Zero or more WRITE_FLAG_* values OR-ed together.
+ * @return OK if every byte was written (and synchronized, if requested);
+ * ERROR otherwise, in which case errno is set.
+ * @remarks The file is created if it does not exist.  Unless
+ * WRITE_FLAG_APPEND is given, any existing content is replaced.  With
+ * WRITE_FLAG_ATOMIC, the data is written to an anonymous O_TMPFILE (or,
+ * where that is not supported, to a hidden temporary file in the same
+ * directory) and then renamed over the destination, so readers see either
+ * the old content or the new content, never a partial file.  The existing
+ * file's permissions are carried over.  WRITE_FLAG_ATOMIC cannot be
+ * combined with WRITE_FLAG_APPEND.  WRITE_FLAG_DATASYNC flushes the file's
+ * data before returning; WRITE_FLAG_FULLSYNC also flushes its metadata and
+ * the directory entry, so that a newly-created or replaced file survives a
+ * crash.  WRITE_FLAG_DIRECT writes with O_DIRECT, keeping a large one-off
+ * file out of the page cache; the data is copied through an aligned buffer
+ * if pData is not aligned itself, and the file is written normally where
+ * direct I/O is not supported.  It cannot be combined with WRITE_FLAG_APPEND
+ * or WRITE_FLAG_ATOMIC.  This function is capable of expanding strings like
+ * the Bash shell.
+ */
+int WriteAllBytes(const char* pszPath, const char* pData, size_t nLength,
+    int nFlags);
+
+/**
+ * @name WriteAllBytesAt
+ * @brief As WriteAllBytes, relative to a context's directory.
+ * @param lpContext Context whose directory a relative path is resolved
+ * against, or NULL for the current working directory.
+ * @param pszPath Pathname of the file to write.
+ * @param pData Address of the bytes to write.
+ * @param nLength Number of bytes to write.
+ * @param nFlags WRITE_FLAG_* values.
+ * @return OK on success; ERROR otherwise, in which case errno is set.
+ * @remarks Temporary files for WRITE_FLAG_ATOMIC, and the directory synced
+ * for WRITE_FLAG_FULLSYNC, are found relative to the context as well.
+ */
+int WriteAllBytesAt(LPFILECORECONTEXT lpContext, const char* pszPath,
+    const char* pData, size_t nLength, int nFlags);
+
+/**
+ * @name WriteAllParts
+ * @brief Writes the contents of several buffers, in order, to a file.
+ * @param pszPath Pathname of the file to write.
+ * @param pParts Array of buffers to write, such as a header, any number of
+ * body fragments and a footer.  It is not modified.
+ * @param nCount Number of elements in pParts.
+ * @param nFlags Zero or more WRITE_FLAG_* values OR-ed together.
+ * @return OK if every byte was written (and synchronized, if requested);
+ * ERROR otherwise, in which case errno is set.
+ * @remarks Behaves as WriteAllBytes would given the parts joined together,
+ * but the parts go to the kernel with writev(), IOV_MAX at a time and
+ * resumed after short writes, so they are never copied into one buffer
+ * first.  WRITE_FLAG_DIRECT may only be given with a single part.  This
+ * function is capable of expanding strings like the Bash shell.
+ */
+int WriteAllParts(const char* pszPath, const struct iovec* pParts,
+    int nCount, int nFlags);
+
+/**
+ * @name WriteAllPartsAt
+ * @brief As WriteAllParts, relative to a context's directory.
+ * @param lpContext Context whose directory a relative path is resolved
+ * against, or NULL for the current working directory.
+ * @param pszPath Pathname of the file to write.
+ * @param pParts Array of buffers to write.  It is not modified.
+ * @param nCount Number of elements in pParts.
+ * @param nFlags Zero or more WRITE_FLAG_* values OR-ed together.
+ * @return OK if every byte was written; ERROR otherwise, in which case errno
+ * is set.
+ */
+int WriteAllPartsAt(LPFILECORECONTEXT lpContext, const char* pszPath,
+    const struct iovec* pParts, int nCount, int nFlags);
+
 /**
  * @name WriteAllText
  * @brief Writes all the bytes provided to the file at the specified path.
@@ -113,11 +1551,82 @@ BOOL SetCurrentWorkingDirectory(const char* pszDirectoryPath);
  * to open the file for appending.
  * @param pnBytesWritten Address of an integer variable that receives the
  * number of bytes written.
- * @remark This function can only work with 2 GB or less of content.
+ * @remark This function can only work with 2 GB or less of content.  If the
+ * content is blank and bOverwrite is FALSE, an existing file is deleted
+ * instead.  Upon failure, this function throws a file access exception.
+ * See WriteAllBytes for binary data and for atomic or durable writes.
  */
 void WriteAllText(const char* pszPath, const char* pszContent,
     BOOL bOverwrite, int* pnBytesWritten);
 
+/**
+ * @name WriteAllTextAt
+ * @brief As WriteAllText, relative to a context's directory.
+ * @param lpContext Context whose directory a relative path is resolved
+ * against, or NULL for the current working directory.
+ * @param pszPath Pathname of the file to write.
+ * @param pszContent Text to write.
+ * @param bOverwrite TRUE to replace the file's content; FALSE to append.
+ * @param pnBytesWritten Address of a variable that receives the number of
+ * bytes written.
+ * @remarks Fails as WriteAllText does.
+ */
+void WriteAllTextAt(LPFILECORECONTEXT lpContext, const char* pszPath,
+    const char* pszContent, BOOL bOverwrite, int* pnBytesWritten);
+
+/**
+ * @name WriteDescriptorRange
+ * @brief Writes bytes into an open file at a 64-bit offset.
+ * @param nFileDescriptor Descriptor of the file, open for writing.  It
+ * must not have been opened with O_APPEND, under which Linux ignores the
+ * offset.
+ * @param nOffset Offset at which to write the first byte.  Writing past the
+ * end of the file extends it, leaving a hole in between.
+ * @param pData Address of the bytes to write.
+ * @param nLength Number of bytes to write.
+ * @return OK if every byte was written; ERROR otherwise, in which case
+ * errno is set.
+ * @remarks Uses pwrite(), which leaves the file position alone, so threads
+ * may write disjoint ranges of the same descriptor at once.
+ */
+int WriteDescriptorRange(int nFileDescriptor, off_t nOffset,
+    const char* pData, size_t nLength);
+
+/**
+ * @name WriteDescriptorRangeV
+ * @brief Writes the contents of several buffers into an open file, one
+ * after the other, starting at a 64-bit offset.
+ * @param nFileDescriptor Descriptor of the file, open for writing, without
+ * O_APPEND.
+ * @param nOffset Offset at which to write the first byte.
+ * @param pIovecs Address of an array of iovec structures describing the
+ * buffers.  The array is not modified.
+ * @param nCount Number of elements in the array.
+ * @return OK if every byte was written; ERROR otherwise, in which case
+ * errno is set.
+ * @remarks Uses pwritev(), gathering the buffers in a single system call.
+ */
+int WriteDescriptorRangeV(int nFileDescriptor, off_t nOffset,
+    const struct iovec* pIovecs, int nCount);
+
+/**
+ * @name WriteFileRange
+ * @brief Overwrites part of a file in place, at a 64-bit offset.
+ * @param pszPath Path of the file to write.  It is created if it does not
+ * exist; otherwise the bytes outside the range are left as they are.
+ * @param nOffset Offset at which to write the first byte.
+ * @param pData Address of the bytes to write.
+ * @param nLength Number of bytes to write.
+ * @param nFlags WRITE_FLAG_DATASYNC or WRITE_FLAG_FULLSYNC, as for
+ * WriteAllBytes.  WRITE_FLAG_APPEND and WRITE_FLAG_ATOMIC are rejected
+ * with EINVAL.
+ * @return OK on success; ERROR otherwise, in which case errno is set.
+ * @remarks Useful for patching a header or a record without rewriting the
+ * file.  This function is capable of expanding strings like the Bash shell.
+ */
+int WriteFileRange(const char* pszPath, off_t nOffset, const char* pData,
+    size_t nLength, int nFlags);
+
 /**
  * @name WriteFormattedTextToFile
  * @brief Writes formatted data to the specified file.
@@ -129,15 +1638,36 @@ void WriteAllText(const char* pszPath, const char* pszContent,
  * number of bytes written.
  * @param pszPath Path of the file to be written.
  * @param pszContentFormat Format for the data to be written.
+ * @remarks The text is formatted once, into a stack buffer when it is
+ * short and into a heap buffer sized by a first formatting pass when it is
+ * not, and is then written with a single open of the file.  If the format
+ * is blank and bOverwrite is TRUE, the file is deleted instead.  Upon
+ * failure, this function throws a file access exception.
  */
 void WriteFormattedTextToFile(BOOL bOverwrite, int* pnBytesWritten,
     const char* pszPath, const char* pszContentFormat, ...);
 
+/**
+ * @name WriteFormattedTextToFileAt
+ * @brief As WriteFormattedTextToFile, relative to a context's directory.
+ * @param lpContext Context whose directory a relative path is resolved
+ * against, or NULL for the current working directory.
+ * @param bOverwrite TRUE to replace the file's content; FALSE to append.
+ * @param pnBytesWritten Address of an integer variable that receives the
+ * number of bytes written.
+ * @param pszPath Path of the file to be written.
+ * @param pszContentFormat Format for the data to be written.
+ * @remarks Fails as WriteFormattedTextToFile does.
+ */
+void WriteFormattedTextToFileAt(LPFILECORECONTEXT lpContext, BOOL bOverwrite,
+    int* pnBytesWritten, const char* pszPath, const char* pszContentFormat,
+    ...);
+
 void do_prompt_file_name(const char* prompt, char* path, int path_size);
 
 
 /**
- * @brief Expands strings a la Bash. Wraps the wordexp function.
+ * @brief Expands strings a la Bash.
  * @param pszPathName Address of a buffer containing the content to be
  * expanded.
  * @param pszBuffer Address of a buffer into which the result should
@@ -146,9 +1676,226 @@ void do_prompt_file_name(const char* prompt, char* path, int path_size);
  * enough to hold the expanded filename.
  * @remarks It is sufficient to allocate a buffer of size 255 chars (not
  * including the null-terminator).  This function turns '~/dir' into
- * '/home/user/dir', for example.
+ * '/home/user/dir', for example.  Plain paths, which contain nothing the
+ * shell would expand, are copied through unchanged.  Leading '~' and
+ * '~user' and references to environment variables are expanded natively.
+ * Anything else (globs, quoting) is handed to the wordexp function.
+ * Command substitution, with $(...) or backquotes, is never performed: such
+ * strings leave the buffer empty.  See EnableShellExpandCache to memoize
+ * the results.
  */
 void ShellExpand(const char* pszPathName,
     char* pszBuffer, int nBufferSize);
 
+/**
+ * @name EnableShellExpandCache
+ * @brief Turns on memoization of the results of ShellExpand.
+ * @param nCapacity Maximum number of expansions to remember.  When the cache
+ * is full, the least-recently-used entry is discarded.
+ * @return OK if the cache was enabled; ERROR otherwise.
+ * @remarks The cache is shared by all threads and is safe to use
+ * concurrently.  Calling this function again discards the current contents
+ * and resizes the cache.  Plain paths are never cached, since they are
+ * already returned without any work.  Because expansions depend on the
+ * environment, call ClearShellExpandCache after changing HOME or any other
+ * variable that cached paths refer to.
+ */
+int EnableShellExpandCache(int nCapacity);
+
+/**
+ * @name DisableShellExpandCache
+ * @brief Turns off memoization of the results of ShellExpand and releases
+ * the memory held by the cache.
+ */
+void DisableShellExpandCache(void);
+
+/**
+ * @name ClearShellExpandCache
+ * @brief Discards every expansion remembered by the ShellExpand cache, as
+ * well as the cached home directories used to expand '~' and '~user'.
+ */
+void ClearShellExpandCache(void);
+
+/**
+ * @brief Identifies each public function in the statistics kept when the
+ * library is built with FILE_CORE_ENABLE_STATS defined.
+ */
+#define FILE_CORE_API_ADD_GROUP_COMMIT_FILE            0
+#define FILE_CORE_API_APPEND                           1
+#define FILE_CORE_API_APPEND_FORMATTED                 2
+#define FILE_CORE_API_CLEAR_SHELL_EXPAND_CACHE         3
+#define FILE_CORE_API_CLOSE_APPENDER                   4
+#define FILE_CORE_API_CLOSE_FILE                       5
+#define FILE_CORE_API_CLOSE_FILE_READER                6
+#define FILE_CORE_API_CREATE_DIR_IF_NOT_EXISTS         7
+#define FILE_CORE_API_CREATE_DIRECTORY                 8
+#define FILE_CORE_API_CREATE_GROUP_COMMIT_WRITER       9
+#define FILE_CORE_API_DESTROY_GROUP_COMMIT_WRITER      10
+#define FILE_CORE_API_DIRECTORY_EXISTS                 11
+#define FILE_CORE_API_DISABLE_SHELL_EXPAND_CACHE       12
+#define FILE_CORE_API_ENABLE_SHELL_EXPAND_CACHE        13
+#define FILE_CORE_API_ENUMERATE_DIRECTORY              14
+#define FILE_CORE_API_FILE_EXISTS                      15
+#define FILE_CORE_API_FLUSH_APPENDER                   16
+#define FILE_CORE_API_FLUSH_GROUP_COMMIT_WRITER        17
+#define FILE_CORE_API_FREE_DIRECTORY_LISTING           18
+#define FILE_CORE_API_FREE_READ_MANY_RESULTS           19
+#define FILE_CORE_API_GET_CURRENT_WORKING_DIRECTORY    20
+#define FILE_CORE_API_GET_FILE_INFO                    21
+#define FILE_CORE_API_GET_HOME_DIRECTORY_PATH          22
+#define FILE_CORE_API_GROUP_COMMIT_APPEND              23
+#define FILE_CORE_API_MAP_FILE                         24
+#define FILE_CORE_API_OPEN_APPENDER                    25
+#define FILE_CORE_API_OPEN_FILE_READER                 26
+#define FILE_CORE_API_READ_ALL_BYTES                   27
+#define FILE_CORE_API_READ_ALL_TEXT                    28
+#define FILE_CORE_API_READ_MANY_FILES                  29
+#define FILE_CORE_API_READ_NEXT_CHUNK                  30
+#define FILE_CORE_API_READ_NEXT_LINE                   31
+#define FILE_CORE_API_SET_CURRENT_WORKING_DIRECTORY    32
+#define FILE_CORE_API_SHELL_EXPAND                     33
+#define FILE_CORE_API_STAT_MANY                        34
+#define FILE_CORE_API_UNMAP_FILE                       35
+#define FILE_CORE_API_WALK_DIRECTORY_TREE              36
+#define FILE_CORE_API_WRITE_ALL_BYTES                  37
+#define FILE_CORE_API_WRITE_ALL_TEXT                   38
+#define FILE_CORE_API_WRITE_FORMATTED_TEXT_TO_FILE     39
+#define FILE_CORE_API_PROMPT_FILE_NAME                 40
+#define FILE_CORE_API_COPY_FILE                        41
+#define FILE_CORE_API_MOVE_FILE                        42
+#define FILE_CORE_API_READ_DESCRIPTOR_RANGE            43
+#define FILE_CORE_API_READ_DESCRIPTOR_RANGE_V          44
+#define FILE_CORE_API_READ_FILE_RANGE                  45
+#define FILE_CORE_API_WRITE_DESCRIPTOR_RANGE           46
+#define FILE_CORE_API_WRITE_DESCRIPTOR_RANGE_V         47
+#define FILE_CORE_API_WRITE_FILE_RANGE                 48
+#define FILE_CORE_API_DROP_FROM_CACHE                  49
+#define FILE_CORE_API_PREFETCH_FILES                   50
+#define FILE_CORE_API_READ_ALL_BYTES_EX                51
+#define FILE_CORE_API_CACHED_READ_ALL_TEXT             52
+#define FILE_CORE_API_CLEAR_TEXT_CACHE                 53
+#define FILE_CORE_API_DISABLE_TEXT_CACHE               54
+#define FILE_CORE_API_ENABLE_TEXT_CACHE                55
+#define FILE_CORE_API_RELEASE_CACHED_TEXT              56
+#define FILE_CORE_API_COMPUTE_BUFFER_CHECKSUM          57
+#define FILE_CORE_API_COMPUTE_FILE_CHECKSUM            58
+#define FILE_CORE_API_BUILD_LINE_INDEX                 59
+#define FILE_CORE_API_FREE_LINE_INDEX                  60
+#define FILE_CORE_API_GET_LINE                         61
+#define FILE_CORE_API_GET_LINE_COUNT                   62
+#define FILE_CORE_API_CREATE_FILE_CORE_CONTEXT         63
+#define FILE_CORE_API_DESTROY_FILE_CORE_CONTEXT        64
+#define FILE_CORE_API_GET_CONTEXT_DIRECTORY            65
+#define FILE_CORE_API_SET_CONTEXT_DIRECTORY            66
+#define FILE_CORE_API_CREATE_DIRECTORY_AT              67
+#define FILE_CORE_API_DIRECTORY_EXISTS_AT              68
+#define FILE_CORE_API_FILE_EXISTS_AT                   69
+#define FILE_CORE_API_GET_FILE_INFO_AT                 70
+#define FILE_CORE_API_MAP_FILE_AT                      71
+#define FILE_CORE_API_READ_ALL_BYTES_AT                72
+#define FILE_CORE_API_READ_ALL_TEXT_AT                 73
+#define FILE_CORE_API_WRITE_ALL_BYTES_AT               74
+#define FILE_CORE_API_WRITE_ALL_TEXT_AT                75
+#define FILE_CORE_API_APPEND_SCRATCH_FILE              76
+#define FILE_CORE_API_CLOSE_SCRATCH_FILE               77
+#define FILE_CORE_API_CREATE_SCRATCH_FILE              78
+#define FILE_CORE_API_GET_SCRATCH_BUFFER               79
+#define FILE_CORE_API_GET_SCRATCH_FILE_DESCRIPTOR      80
+#define FILE_CORE_API_LINK_SCRATCH_FILE                81
+#define FILE_CORE_API_DELETE_MANY                      82
+#define FILE_CORE_API_REMOVE_DIRECTORY_TREE            83
+#define FILE_CORE_API_APPEND_ALL_PARTS                 84
+#define FILE_CORE_API_WRITE_ALL_PARTS                  85
+#define FILE_CORE_API_READ_DESCRIPTOR_ALL              86
+#define FILE_CORE_API_CREATE_DIR_IF_NOT_EXISTS_AT      87
+#define FILE_CORE_API_ENUMERATE_DIRECTORY_AT           88
+#define FILE_CORE_API_OPEN_APPENDER_AT                 89
+#define FILE_CORE_API_OPEN_FILE_READER_AT              90
+#define FILE_CORE_API_WRITE_FORMATTED_TEXT_TO_FILE_AT  91
+#define FILE_CORE_API_CREATE_FILE_CORE_CONTEXT_EX      92
+#define FILE_CORE_API_WALK_DIRECTORY_TREE_AT           93
+#define FILE_CORE_API_WRITE_ALL_PARTS_AT               94
+#define FILE_CORE_API_COUNT                            95
+
+/**
+ * @brief Identifies the events counted alongside the per-function
+ * statistics.
+ */
+#define FILE_CORE_COUNTER_WORDEXP_CALLS           0   /* wordexp() runs */
+#define FILE_CORE_COUNTER_SHELL_EXPAND_CACHE_HITS 1
+#define FILE_CORE_COUNTER_STATX_CALLS             2
+#define FILE_CORE_COUNTER_SYNC_CALLS              3   /* fsync/fdatasync */
+#define FILE_CORE_COUNTER_TEXT_CACHE_HITS         4
+#define FILE_CORE_COUNTER_TEXT_CACHE_MISSES       5
+#define FILE_CORE_COUNTER_COUNT                   6
+
+/**
+ * @brief Number of latency buckets per function.  Bucket i counts calls
+ * that took at least 2^i and less than 2^(i+1) nanoseconds; the first and
+ * last buckets also take everything below and above.
+ */
+#define FILE_CORE_STATS_BUCKETS                   40
+
+/**
+ * @brief Formats that DumpFileCoreStats can produce.
+ */
+#define FILE_CORE_STATS_FORMAT_TEXT               0
+#define FILE_CORE_STATS_FORMAT_JSON               1
+
+/**
+ * @brief Statistics gathered for one public function.
+ */
+typedef struct _tagFILECOREAPISTATS {
+  const char* pszName;            /* Name of the function */
+  uint64_t nCalls;                /* Number of calls */
+  uint64_t nBytes;                /* Bytes read or written by the calls */
+  uint64_t nNanoseconds;          /* Total time spent in the calls */
+  uint64_t nHistogram[FILE_CORE_STATS_BUCKETS];
+} FILECOREAPISTATS, *LPFILECOREAPISTATS;
+
+/**
+ * @brief Snapshot of the library's statistics, as produced by
+ * GetFileCoreStats.
+ */
+typedef struct _tagFILECORESTATS {
+  BOOL bEnabled;                  /* FALSE if built without statistics */
+  FILECOREAPISTATS apis[FILE_CORE_API_COUNT];
+  uint64_t nCounters[FILE_CORE_COUNTER_COUNT];
+} FILECORESTATS, *LPFILECORESTATS;
+
+/**
+ * @name GetFileCoreStats
+ * @brief Takes a snapshot of the statistics gathered by the library.
+ * @param lpStats Address of a FILECORESTATS that receives the totals over
+ * every thread that has called into the library.
+ * @return OK on success; ERROR if lpStats is NULL, in which case errno is
+ * set.
+ * @remarks Statistics are gathered only when the library is built with
+ * FILE_CORE_ENABLE_STATS defined; otherwise the bEnabled member is FALSE
+ * and every total is zero, and the library carries no instrumentation at
+ * all.  Each thread records into its own block of counters, so gathering
+ * costs no shared cache-line traffic; a snapshot sums the blocks without
+ * stopping the threads, so totals for calls in progress may be slightly
+ * behind.  Times are inclusive: a call that uses another public function,
+ * as WriteAllText uses WriteAllBytes, is counted under both.
+ */
+int GetFileCoreStats(LPFILECORESTATS lpStats);
+
+/**
+ * @name DumpFileCoreStats
+ * @brief Writes the library's statistics to a file descriptor.
+ * @param nFileDescriptor Descriptor to write to, such as STDERR_FILENO.
+ * @param nFormat FILE_CORE_STATS_FORMAT_TEXT for a table meant for people,
+ * or FILE_CORE_STATS_FORMAT_JSON for a document meant for programs.
+ * @return OK on success; ERROR otherwise, in which case errno is set.
+ * @remarks Only functions that have been called are listed.  The p50 and
+ * p99 latencies are estimated from the histogram, as the upper bound of the
+ * bucket in which the percentile falls.
+ */
+int DumpFileCoreStats(int nFileDescriptor, int nFormat);
+
+#ifdef __cplusplus
+}
+#endif //__cplusplus
+
 #endif /* __FILE_CORE_H__ */
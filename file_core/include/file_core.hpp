@@ -0,0 +1,815 @@
+/*
+ * file_core.hpp
+ *
+ *  Header-only C++20 layer over file_core.  Handles are move-only and
+ *  release what they own when destroyed; reads hand back the library's own
+ *  buffers and mappings as std::span or std::string_view instead of
+ *  copying them; and every failure comes back as a Result holding an
+ *  std::error_code, never as an exception or a call to exit().
+ *
+ *  Include stdafx.h (or whatever provides the types file_core.h needs)
+ *  first, as for file_core.h.
+ */
+
+#ifndef __FILE_CORE_HPP__
+#define __FILE_CORE_HPP__
+
+#include "file_core.h"
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+namespace file_core {
+
+/**
+ * @brief How a path given to the C++ layer is interpreted.  Expand treats
+ * it as the C functions do, expanding it like the Bash shell; Literal uses
+ * it exactly as given, which skips ShellExpand altogether and is the only
+ * way to reach a file whose name contains characters such as $ or ~.
+ */
+enum class PathMode {
+  Expand,
+  Literal
+};
+
+/**
+ * @brief Either a value or the error that prevented producing one, in the
+ * manner of std::expected<T, std::error_code>.
+ * @remarks value() on a Result that holds an error throws std::system_error;
+ * check has_value() (or test the Result as a bool) first to avoid that.
+ */
+template <typename T>
+class [[nodiscard]] Result {
+ public:
+  Result(T value) : m_state(std::in_place_index<0>, std::move(value)) { }
+  Result(std::error_code error) : m_state(std::in_place_index<1>, error) { }
+
+  bool has_value() const noexcept { return m_state.index() == 0; }
+  explicit operator bool() const noexcept { return has_value(); }
+
+  T& value() & { Check(); return std::get<0>(m_state); }
+  const T& value() const & { Check(); return std::get<0>(m_state); }
+  T&& value() && { Check(); return std::get<0>(std::move(m_state)); }
+
+  T& operator*() & noexcept { return *std::get_if<0>(&m_state); }
+  const T& operator*() const & noexcept { return *std::get_if<0>(&m_state); }
+  T&& operator*() && noexcept { return std::move(*std::get_if<0>(&m_state)); }
+  T* operator->() noexcept { return std::get_if<0>(&m_state); }
+  const T* operator->() const noexcept { return std::get_if<0>(&m_state); }
+
+  std::error_code error() const noexcept {
+    const std::error_code* lpError = std::get_if<1>(&m_state);
+    return lpError == nullptr ? std::error_code() : *lpError;
+  }
+
+ private:
+  void Check() const {
+    if (!has_value()) {
+      throw std::system_error(error());
+    }
+  }
+
+  std::variant<T, std::error_code> m_state;
+};
+
+/**
+ * @brief Outcome of an operation that produces nothing but may fail.
+ */
+template <>
+class [[nodiscard]] Result<void> {
+ public:
+  Result() noexcept = default;
+  Result(std::error_code error) noexcept : m_error(error) { }
+
+  bool has_value() const noexcept { return !m_error; }
+  explicit operator bool() const noexcept { return has_value(); }
+
+  void value() const {
+    if (m_error) {
+      throw std::system_error(m_error);
+    }
+  }
+
+  std::error_code error() const noexcept { return m_error; }
+
+ private:
+  std::error_code m_error;
+};
+
+namespace detail {
+
+/**
+ * @brief Error code for the current value of errno.
+ */
+inline std::error_code LastError() noexcept {
+  return std::error_code(errno, std::generic_category());
+}
+
+/**
+ * @brief Result<void> from one of the library's OK/ERROR return values.
+ */
+inline Result<void> FromStatus(int nResult) noexcept {
+  if (nResult == OK) {
+    return Result<void>();
+  }
+  return LastError();
+}
+
+/**
+ * @brief A path copied out of a std::string_view into a NUL-terminated
+ * buffer on the stack, and expanded in place if asked.  The buffer is not
+ * cleared first: only the bytes of the path are written.
+ */
+class PathBuffer {
+ public:
+  PathBuffer(std::string_view path, PathMode mode) noexcept {
+    if (path.empty() || path.size() > MAX_PATH
+        || path.find('\0') != std::string_view::npos) {
+      m_nError = path.size() > MAX_PATH ? ENAMETOOLONG : EINVAL;
+      return;
+    }
+
+    std::memcpy(m_szPath, path.data(), path.size());
+    m_szPath[path.size()] = '\0';
+
+    /* ShellExpand copies the input aside before it writes, so it may
+     * expand the buffer in place. */
+    if (mode == PathMode::Expand) {
+      ShellExpand(m_szPath, m_szPath, MAX_PATH + 1);
+    }
+  }
+
+  PathBuffer(const PathBuffer&) = delete;
+  PathBuffer& operator=(const PathBuffer&) = delete;
+
+  const char* c_str() const noexcept { return m_szPath; }
+  int error() const noexcept { return m_nError; }
+
+ private:
+  int m_nError = 0;
+  char m_szPath[MAX_PATH + 1];
+};
+
+/**
+ * @brief The context to hand an *At function for a path in a given mode:
+ * none for Expand, so the library expands the path as usual, and for
+ * Literal one on the current working directory that takes every path
+ * exactly as written.
+ */
+class PathContext {
+ public:
+  explicit PathContext(PathMode mode) noexcept {
+    if (mode == PathMode::Literal) {
+      m_lpContext = CreateFileCoreContextEx(nullptr,
+          CONTEXT_FLAG_LITERAL_PATHS);
+      if (m_lpContext == nullptr) {
+        m_nError = errno;
+      }
+    }
+  }
+
+  PathContext(const PathContext&) = delete;
+  PathContext& operator=(const PathContext&) = delete;
+
+  ~PathContext() {
+    if (m_lpContext != nullptr) {
+      DestroyFileCoreContext(&m_lpContext);
+    }
+  }
+
+  LPFILECORECONTEXT get() const noexcept { return m_lpContext; }
+  int error() const noexcept { return m_nError; }
+
+ private:
+  LPFILECORECONTEXT m_lpContext = nullptr;
+  int m_nError = 0;
+};
+
+/**
+ * @brief Deleter for the heap blocks that the library allocates with
+ * malloc().
+ */
+struct FreeDeleter {
+  void operator()(char* pData) const noexcept { std::free(pData); }
+};
+
+} // namespace detail
+
+/**
+ * @brief Owns the bytes of a file read by ReadAllBytes, in the block the
+ * library allocated for them; nothing is copied.
+ * @remarks As with ReadAllBytes, a NUL byte follows the data, so Text()
+ * may also be handed to functions that take a C string.
+ */
+class Buffer {
+ public:
+  Buffer() noexcept = default;
+  Buffer(char* pData, size_t nLength) noexcept
+      : m_pData(pData), m_nLength(nLength) { }
+
+  Buffer(Buffer&& other) noexcept
+      : m_pData(std::move(other.m_pData)),
+        m_nLength(std::exchange(other.m_nLength, 0)) { }
+
+  Buffer& operator=(Buffer&& other) noexcept {
+    m_pData = std::move(other.m_pData);
+    m_nLength = std::exchange(other.m_nLength, 0);
+    return *this;
+  }
+
+  const char* Data() const noexcept { return m_pData.get(); }
+  char* Data() noexcept { return m_pData.get(); }
+  size_t Size() const noexcept { return m_nLength; }
+
+  std::span<const std::byte> Bytes() const noexcept {
+    return std::as_bytes(std::span<const char>(m_pData.get(), m_nLength));
+  }
+
+  std::string_view Text() const noexcept {
+    return std::string_view(m_pData.get(), m_nLength);
+  }
+
+  /**
+   * @brief Gives up ownership.  The block must then be released with
+   * free().
+   */
+  char* Release() noexcept {
+    m_nLength = 0;
+    return m_pData.release();
+  }
+
+ private:
+  std::unique_ptr<char, detail::FreeDeleter> m_pData;
+  size_t m_nLength = 0;
+};
+
+/**
+ * @brief An open file descriptor, closed when the File is destroyed.
+ * @remarks Reads and writes take explicit offsets (pread()/pwrite()), so a
+ * File may be shared between threads that work on different ranges.
+ */
+class File {
+ public:
+  File() noexcept = default;
+  explicit File(int nFileDescriptor) noexcept
+      : m_nFileDescriptor(nFileDescriptor) { }
+
+  File(File&& other) noexcept
+      : m_nFileDescriptor(std::exchange(other.m_nFileDescriptor, -1)) { }
+
+  File& operator=(File&& other) noexcept {
+    if (this != &other) {
+      Reset(std::exchange(other.m_nFileDescriptor, -1));
+    }
+    return *this;
+  }
+
+  File(const File&) = delete;
+  File& operator=(const File&) = delete;
+
+  ~File() { Reset(-1); }
+
+  /**
+   * @brief Opens a file, as open() would.
+   * @param path Path of the file.
+   * @param nOpenFlags O_* flags; O_CLOEXEC is always added.
+   * @param nMode Permissions for a file created by O_CREAT.
+   * @param mode Whether to expand the path like the Bash shell.
+   */
+  static Result<File> Open(std::string_view path, int nOpenFlags = O_RDONLY,
+      mode_t nMode = 0666, PathMode mode = PathMode::Expand) {
+    detail::PathBuffer pathBuffer(path, mode);
+    if (pathBuffer.error() != 0) {
+      return std::error_code(pathBuffer.error(), std::generic_category());
+    }
+
+    int nFileDescriptor = open(pathBuffer.c_str(), nOpenFlags | O_CLOEXEC,
+        nMode);
+    if (nFileDescriptor < 0) {
+      return detail::LastError();
+    }
+
+    return File(nFileDescriptor);
+  }
+
+  bool IsOpen() const noexcept { return m_nFileDescriptor >= 0; }
+  int Descriptor() const noexcept { return m_nFileDescriptor; }
+
+  /**
+   * @brief Gives up ownership of the descriptor without closing it.
+   */
+  int Release() noexcept { return std::exchange(m_nFileDescriptor, -1); }
+
+  /**
+   * @brief Closes the descriptor now, reporting any error that close()
+   * returns.
+   */
+  Result<void> Close() noexcept {
+    int nFileDescriptor = Release();
+    if (nFileDescriptor >= 0 && close(nFileDescriptor) != OK
+        && errno != EINTR) {
+      return detail::LastError();
+    }
+    return Result<void>();
+  }
+
+  Result<uint64_t> Size() const noexcept {
+    struct stat st;
+    if (fstat(m_nFileDescriptor, &st) != OK) {
+      return detail::LastError();
+    }
+    return (uint64_t) st.st_size;
+  }
+
+  /**
+   * @brief Reads into buffer from nOffset, as ReadDescriptorRange does.
+   * @return The number of bytes read, fewer than requested only at
+   * end-of-file.
+   */
+  Result<size_t> Read(uint64_t nOffset, std::span<std::byte> buffer) const
+      noexcept {
+    size_t nBytesRead = 0;
+    if (ReadDescriptorRange(m_nFileDescriptor, (off_t) nOffset,
+        buffer.size(), reinterpret_cast<char*>(buffer.data()),
+        &nBytesRead) != OK) {
+      return detail::LastError();
+    }
+    return nBytesRead;
+  }
+
+  /**
+   * @brief Writes all of data at nOffset, as WriteDescriptorRange does.
+   */
+  Result<void> Write(uint64_t nOffset, std::span<const std::byte> data)
+      noexcept {
+    return detail::FromStatus(WriteDescriptorRange(m_nFileDescriptor,
+        (off_t) nOffset, reinterpret_cast<const char*>(data.data()),
+        data.size()));
+  }
+
+  /**
+   * @brief Reads the whole file to end-of-file, as ReadDescriptorAll does.
+   * Anything seekable is read from offset zero; a pipe or socket is read
+   * from wherever it stands.
+   * @remarks Unlike Read, this moves the file position, so it is not for a
+   * File that other threads are reading at the same time.
+   */
+  Result<Buffer> ReadAll() const {
+    if (lseek(m_nFileDescriptor, 0, SEEK_SET) < 0 && errno != ESPIPE) {
+      return detail::LastError();
+    }
+
+    char* pData = nullptr;
+    size_t nLength = 0;
+    if (ReadDescriptorAll(m_nFileDescriptor, &pData, &nLength) != OK) {
+      return detail::LastError();
+    }
+    return Buffer(pData, nLength);
+  }
+
+  /**
+   * @brief fsync()s the file, or fdatasync()s it given WRITE_FLAG_DATASYNC.
+   */
+  Result<void> Sync(int nFlags = WRITE_FLAG_FULLSYNC) noexcept {
+    return detail::FromStatus((nFlags & WRITE_FLAG_DATASYNC)
+        ? fdatasync(m_nFileDescriptor) : fsync(m_nFileDescriptor));
+  }
+
+ private:
+  void Reset(int nFileDescriptor) noexcept {
+    if (m_nFileDescriptor >= 0) {
+      close(m_nFileDescriptor);
+    }
+    m_nFileDescriptor = nFileDescriptor;
+  }
+
+  int m_nFileDescriptor = -1;
+};
+
+/**
+ * @brief A read-only mapping of a whole file, as made by MapFile, unmapped
+ * when the MappedFile is destroyed.
+ */
+class MappedFile {
+ public:
+  MappedFile() noexcept = default;
+
+  MappedFile(MappedFile&& other) noexcept : m_view(other.m_view) {
+    other.m_view = FILEVIEW { nullptr, 0 };
+  }
+
+  MappedFile& operator=(MappedFile&& other) noexcept {
+    if (this != &other) {
+      UnmapFile(&m_view);
+      m_view = std::exchange(other.m_view, FILEVIEW { nullptr, 0 });
+    }
+    return *this;
+  }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  ~MappedFile() { UnmapFile(&m_view); }
+
+  /**
+   * @brief Maps a file.
+   * @param path Path of the file.
+   * @param nHints MAP_FILE_HINT_* values.
+   * @param mode Whether to expand the path like the Bash shell.
+   */
+  static Result<MappedFile> Open(std::string_view path,
+      int nHints = MAP_FILE_HINT_NONE, PathMode mode = PathMode::Expand) {
+    if (mode == PathMode::Literal) {
+      Result<File> file = File::Open(path, O_RDONLY, 0, mode);
+      if (!file) {
+        return file.error();
+      }
+      return Map(*file, nHints);
+    }
+
+    /* MapFile expands the path itself. */
+    detail::PathBuffer pathBuffer(path, PathMode::Literal);
+    if (pathBuffer.error() != 0) {
+      return std::error_code(pathBuffer.error(), std::generic_category());
+    }
+
+    MappedFile mapped;
+    if (MapFile(pathBuffer.c_str(), &mapped.m_view, nHints) != OK) {
+      return detail::LastError();
+    }
+    return mapped;
+  }
+
+  /**
+   * @brief Maps the whole of a file that is already open.  The mapping
+   * keeps the file alive, so the File may be closed afterward.
+   */
+  static Result<MappedFile> Map(const File& file,
+      int nHints = MAP_FILE_HINT_NONE) {
+    struct stat st;
+    if (fstat(file.Descriptor(), &st) != OK) {
+      return detail::LastError();
+    }
+    if (!S_ISREG(st.st_mode)) {
+      return std::error_code(S_ISDIR(st.st_mode) ? EISDIR : ENODEV,
+          std::generic_category());
+    }
+    if ((uint64_t) st.st_size > (uint64_t) SIZE_MAX) {
+      return std::error_code(EFBIG, std::generic_category());
+    }
+
+    /* mmap() refuses zero-length mappings, so hand back an empty view. */
+    MappedFile mapped;
+    if (st.st_size == 0) {
+      mapped.m_view.pData = "";
+      return mapped;
+    }
+
+    void* pMapping = mmap(nullptr, (size_t) st.st_size, PROT_READ,
+        MAP_SHARED, file.Descriptor(), 0);
+    if (pMapping == MAP_FAILED) {
+      return detail::LastError();
+    }
+    mapped.m_view.pData = static_cast<const char*>(pMapping);
+    mapped.m_view.nLength = (uint64_t) st.st_size;
+
+    /* Hints are advice; a kernel that ignores one is no reason to fail. */
+    if (nHints & MAP_FILE_HINT_SEQUENTIAL) {
+      madvise(pMapping, (size_t) st.st_size, MADV_SEQUENTIAL);
+    }
+    if (nHints & MAP_FILE_HINT_RANDOM) {
+      madvise(pMapping, (size_t) st.st_size, MADV_RANDOM);
+    }
+    if (nHints & MAP_FILE_HINT_WILLNEED) {
+      madvise(pMapping, (size_t) st.st_size, MADV_WILLNEED);
+    }
+#ifdef MADV_HUGEPAGE
+    if (nHints & MAP_FILE_HINT_HUGEPAGE) {
+      madvise(pMapping, (size_t) st.st_size, MADV_HUGEPAGE);
+    }
+#endif //MADV_HUGEPAGE
+
+    return mapped;
+  }
+
+  bool IsMapped() const noexcept { return m_view.pData != nullptr; }
+  size_t Size() const noexcept { return (size_t) m_view.nLength; }
+
+  std::span<const std::byte> Bytes() const noexcept {
+    return std::as_bytes(std::span<const char>(m_view.pData,
+        (size_t) m_view.nLength));
+  }
+
+  std::string_view Text() const noexcept {
+    return std::string_view(m_view.pData, (size_t) m_view.nLength);
+  }
+
+ private:
+  FILEVIEW m_view { nullptr, 0 };
+};
+
+/**
+ * @brief A buffered, append-only writer, as opened by OpenAppender.
+ * Destroying it flushes and closes it; call Close() to learn whether that
+ * final flush succeeded.
+ */
+class Appender {
+ public:
+  Appender() noexcept = default;
+
+  Appender(Appender&& other) noexcept
+      : m_lpAppender(std::exchange(other.m_lpAppender, nullptr)) { }
+
+  Appender& operator=(Appender&& other) noexcept {
+    if (this != &other) {
+      (void) Close();
+      m_lpAppender = std::exchange(other.m_lpAppender, nullptr);
+    }
+    return *this;
+  }
+
+  Appender(const Appender&) = delete;
+  Appender& operator=(const Appender&) = delete;
+
+  ~Appender() { (void) Close(); }
+
+  /**
+   * @brief Opens a file for appending, as OpenAppender does.  Unless mode
+   * is PathMode::Literal, the path is expanded like the Bash shell.
+   */
+  static Result<Appender> Open(std::string_view path,
+      size_t nBufferSize = 0, int nFlushPolicy = APPENDER_FLUSH_WHEN_FULL,
+      PathMode mode = PathMode::Expand) {
+    detail::PathBuffer pathBuffer(path, PathMode::Literal);
+    if (pathBuffer.error() != 0) {
+      return std::error_code(pathBuffer.error(), std::generic_category());
+    }
+    detail::PathContext context(mode);
+    if (context.error() != 0) {
+      return std::error_code(context.error(), std::generic_category());
+    }
+
+    Appender appender;
+    appender.m_lpAppender = OpenAppenderAt(context.get(), pathBuffer.c_str(),
+        nBufferSize, nFlushPolicy);
+    if (appender.m_lpAppender == nullptr) {
+      return detail::LastError();
+    }
+    return appender;
+  }
+
+  bool IsOpen() const noexcept { return m_lpAppender != nullptr; }
+
+  Result<void> Append(std::string_view record) noexcept {
+    return detail::FromStatus(::Append(m_lpAppender, record.data(),
+        record.size()));
+  }
+
+  Result<void> Append(std::span<const std::byte> record) noexcept {
+    return detail::FromStatus(::Append(m_lpAppender,
+        reinterpret_cast<const char*>(record.data()), record.size()));
+  }
+
+  Result<void> Flush() noexcept {
+    return detail::FromStatus(FlushAppender(m_lpAppender));
+  }
+
+  Result<void> Close() noexcept {
+    if (m_lpAppender == nullptr) {
+      return Result<void>();
+    }
+    return detail::FromStatus(CloseAppender(&m_lpAppender));
+  }
+
+ private:
+  LPAPPENDER m_lpAppender = nullptr;
+};
+
+/**
+ * @brief The entries of one directory, as listed by EnumerateDirectory and
+ * iterable with a range-based for loop; and, through Walk, a parallel walk
+ * of a whole tree.
+ */
+class DirectoryWalker {
+ public:
+  DirectoryWalker() noexcept { std::memset(&m_listing, 0, sizeof(m_listing)); }
+
+  DirectoryWalker(DirectoryWalker&& other) noexcept
+      : m_listing(other.m_listing) {
+    std::memset(&other.m_listing, 0, sizeof(other.m_listing));
+  }
+
+  DirectoryWalker& operator=(DirectoryWalker&& other) noexcept {
+    if (this != &other) {
+      FreeDirectoryListing(&m_listing);
+      m_listing = other.m_listing;
+      std::memset(&other.m_listing, 0, sizeof(other.m_listing));
+    }
+    return *this;
+  }
+
+  DirectoryWalker(const DirectoryWalker&) = delete;
+  DirectoryWalker& operator=(const DirectoryWalker&) = delete;
+
+  ~DirectoryWalker() { FreeDirectoryListing(&m_listing); }
+
+  /**
+   * @brief Lists a directory.  Unless mode is PathMode::Literal, the path
+   * is expanded like the Bash shell.
+   */
+  static Result<DirectoryWalker> Open(std::string_view path,
+      PathMode mode = PathMode::Expand) {
+    detail::PathBuffer pathBuffer(path, PathMode::Literal);
+    if (pathBuffer.error() != 0) {
+      return std::error_code(pathBuffer.error(), std::generic_category());
+    }
+    detail::PathContext context(mode);
+    if (context.error() != 0) {
+      return std::error_code(context.error(), std::generic_category());
+    }
+
+    DirectoryWalker walker;
+    if (EnumerateDirectoryAt(context.get(), pathBuffer.c_str(),
+        &walker.m_listing) != OK) {
+      return detail::LastError();
+    }
+    return walker;
+  }
+
+  const DIRECTORYENTRY* begin() const noexcept {
+    return m_listing.pEntries;
+  }
+
+  const DIRECTORYENTRY* end() const noexcept {
+    return m_listing.pEntries + m_listing.nCount;
+  }
+
+  size_t Size() const noexcept { return m_listing.nCount; }
+
+  /**
+   * @brief Calls fn for every entry beneath a directory, as
+   * WalkDirectoryTree does.
+   * @param fn Called as fn(const DIRECTORYENTRY&), concurrently from
+   * several threads.  It may return one of the WALK_* values, or nothing to
+   * mean WALK_CONTINUE.  If it throws, the walk stops and the first
+   * exception is rethrown here once every thread has finished.
+   * @param nThreads Number of threads, or zero for the library's default.
+   * @param mode PathMode::Literal to use the path exactly as written.
+   */
+  template <typename Fn>
+  static Result<void> Walk(std::string_view path, Fn&& fn,
+      int nThreads = 0, PathMode mode = PathMode::Expand) {
+    detail::PathBuffer pathBuffer(path, PathMode::Literal);
+    if (pathBuffer.error() != 0) {
+      return std::error_code(pathBuffer.error(), std::generic_category());
+    }
+    detail::PathContext context(mode);
+    if (context.error() != 0) {
+      return std::error_code(context.error(), std::generic_category());
+    }
+
+    WalkState<std::remove_reference_t<Fn>> state { fn, { }, nullptr };
+    int nResult = WalkDirectoryTreeAt(context.get(), pathBuffer.c_str(),
+        nThreads, &WalkThunk<std::remove_reference_t<Fn>>, &state);
+    std::error_code error = nResult == OK ? std::error_code()
+        : detail::LastError();
+
+    if (state.exception != nullptr) {
+      std::rethrow_exception(state.exception);
+    }
+    if (error) {
+      return error;
+    }
+    return Result<void>();
+  }
+
+ private:
+  template <typename Fn>
+  struct WalkState {
+    Fn& fn;
+    std::mutex mutex;
+    std::exception_ptr exception;
+  };
+
+  /* Exceptions must not unwind through the library's C frames. */
+  template <typename Fn>
+  static int WalkThunk(LPDIRECTORYENTRY lpEntry, void* pContext) noexcept {
+    WalkState<Fn>* lpState = static_cast<WalkState<Fn>*>(pContext);
+    try {
+      if constexpr (std::is_void_v<std::invoke_result_t<Fn&,
+          const DIRECTORYENTRY&>>) {
+        lpState->fn(static_cast<const DIRECTORYENTRY&>(*lpEntry));
+        return WALK_CONTINUE;
+      } else {
+        return static_cast<int>(lpState->fn(
+            static_cast<const DIRECTORYENTRY&>(*lpEntry)));
+      }
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(lpState->mutex);
+      if (lpState->exception == nullptr) {
+        lpState->exception = std::current_exception();
+      }
+      return WALK_STOP;
+    }
+  }
+
+  DIRECTORYLISTING m_listing;
+};
+
+/**
+ * @brief Reads a whole file into a Buffer.  With PathMode::Expand this is
+ * ReadAllBytes, and the library's buffer is adopted as is; with
+ * PathMode::Literal the file is opened exactly as named and read with
+ * File::ReadAll, which likewise reads to end-of-file whatever size the file
+ * reports.
+ */
+inline Result<Buffer> ReadAll(std::string_view path,
+    PathMode mode = PathMode::Expand) {
+  if (mode == PathMode::Literal) {
+    Result<File> file = File::Open(path, O_RDONLY, 0, mode);
+    if (!file) {
+      return file.error();
+    }
+    return file->ReadAll();
+  }
+
+  detail::PathBuffer pathBuffer(path, PathMode::Literal);
+  if (pathBuffer.error() != 0) {
+    return std::error_code(pathBuffer.error(), std::generic_category());
+  }
+
+  char* pData = nullptr;
+  size_t nLength = 0;
+  if (ReadAllBytes(pathBuffer.c_str(), &pData, &nLength) != OK) {
+    return detail::LastError();
+  }
+  return Buffer(pData, nLength);
+}
+
+/**
+ * @brief Writes bytes to a file, as WriteAllBytes does, WRITE_FLAG_* values
+ * and all.  Unless mode is PathMode::Literal, the path is expanded like the
+ * Bash shell.
+ */
+inline Result<void> WriteAll(std::string_view path,
+    std::span<const std::byte> data, int nFlags = WRITE_FLAG_NONE,
+    PathMode mode = PathMode::Expand) {
+  detail::PathBuffer pathBuffer(path, PathMode::Literal);
+  if (pathBuffer.error() != 0) {
+    return std::error_code(pathBuffer.error(), std::generic_category());
+  }
+  detail::PathContext context(mode);
+  if (context.error() != 0) {
+    return std::error_code(context.error(), std::generic_category());
+  }
+
+  return detail::FromStatus(WriteAllBytesAt(context.get(),
+      pathBuffer.c_str(), reinterpret_cast<const char*>(data.data()),
+      data.size(), nFlags));
+}
+
+/**
+ * @brief Writes text to a file, as WriteAllBytes does.
+ */
+inline Result<void> WriteAll(std::string_view path, std::string_view text,
+    int nFlags = WRITE_FLAG_NONE, PathMode mode = PathMode::Expand) {
+  return WriteAll(path, std::as_bytes(std::span<const char>(text.data(),
+      text.size())), nFlags, mode);
+}
+
+/**
+ * @brief Writes several buffers, in order, to a file with writev(), as
+ * WriteAllParts does; with WRITE_FLAG_APPEND they are appended instead.
+ */
+inline Result<void> WriteAll(std::string_view path,
+    std::span<const struct iovec> parts, int nFlags = WRITE_FLAG_NONE,
+    PathMode mode = PathMode::Expand) {
+  detail::PathBuffer pathBuffer(path, PathMode::Literal);
+  if (pathBuffer.error() != 0) {
+    return std::error_code(pathBuffer.error(), std::generic_category());
+  }
+  if (parts.size() > (size_t) INT_MAX) {
+    return std::error_code(EINVAL, std::generic_category());
+  }
+  detail::PathContext context(mode);
+  if (context.error() != 0) {
+    return std::error_code(context.error(), std::generic_category());
+  }
+
+  return detail::FromStatus(WriteAllPartsAt(context.get(),
+      pathBuffer.c_str(), parts.data(), (int) parts.size(), nFlags));
+}
+
+} // namespace file_core
+
+#endif /* __FILE_CORE_HPP__ */
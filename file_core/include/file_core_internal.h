@@ -0,0 +1,267 @@
+// file_core_internal.h - Declares helper routines that are shared between
+// the translation units of the file_core library, but are not part of its
+// public interface.
+//
+
+#ifndef __FILE_CORE_INTERNAL_H__
+#define __FILE_CORE_INTERNAL_H__
+
+/**
+ * @brief State of one instrumented call, kept on the caller's stack.
+ */
+typedef struct _tagAPI_TRACE {
+  int nApi;
+  uint64_t nStart;
+  uint64_t nBytes;
+} API_TRACE, *LPAPI_TRACE;
+
+/**
+ * @name BeginApiTrace
+ * @brief Starts timing a call to a public function.
+ * @param lpTrace Address of the call's trace state.
+ * @param nApi FILE_CORE_API_* value of the function.
+ */
+void BeginApiTrace(LPAPI_TRACE lpTrace, int nApi);
+
+/**
+ * @name EndApiTrace
+ * @brief Records the time and bytes of a call in the calling thread's
+ * statistics.  Run automatically when the traced function returns.
+ */
+void EndApiTrace(LPAPI_TRACE lpTrace);
+
+/**
+ * @name CountFileCoreEvent
+ * @brief Adds one to a FILE_CORE_COUNTER_* value for the calling thread.
+ */
+void CountFileCoreEvent(int nCounter);
+
+/**
+ * @brief Instrumentation hooks.  FILE_CORE_TRACE_CALL goes at the top of
+ * each public function and times it until it returns, however it returns;
+ * FILE_CORE_TRACE_BYTES adds to the bytes attributed to that call.  All of
+ * them compile to nothing unless FILE_CORE_ENABLE_STATS is defined.
+ */
+#ifdef FILE_CORE_ENABLE_STATS
+#define FILE_CORE_TRACE_CALL(nApi) \
+  API_TRACE apiTrace __attribute__((cleanup(EndApiTrace))); \
+  BeginApiTrace(&apiTrace, (nApi))
+#define FILE_CORE_TRACE_BYTES(nCount) \
+  (apiTrace.nBytes += (uint64_t) (nCount))
+#define FILE_CORE_COUNT_EVENT(nCounter) \
+  CountFileCoreEvent(nCounter)
+#else
+#define FILE_CORE_TRACE_CALL(nApi)        do { } while (0)
+#define FILE_CORE_TRACE_BYTES(nCount)     ((void) 0)
+#define FILE_CORE_COUNT_EVENT(nCounter)   ((void) 0)
+#endif //FILE_CORE_ENABLE_STATS
+
+/**
+ * @brief Signature of the routine run by RunInParallel for each item.
+ */
+typedef void (*PARALLEL_WORK_PROC)(void* pContext, int nIndex);
+
+/**
+ * @name GetDefaultWorkerCount
+ * @brief Gets the number of worker threads the batch routines use when the
+ * caller does not specify one: twice the number of online processors, since
+ * the work is mostly waiting on I/O, capped at MAX_DEFAULT_WORKER_COUNT.
+ */
+int GetDefaultWorkerCount(void);
+
+/**
+ * @name FormatTemporaryFileName
+ * @brief Builds the name of a hidden, unique sibling of a file, for use
+ * while the file is being replaced.
+ * @param pszPath Path of the file.  Must already be expanded.
+ * @param pszBuffer Address of a buffer that receives the name.
+ * @param nBufferSize Size of the buffer, in bytes.
+ */
+void FormatTemporaryFileName(const char* pszPath, char* pszBuffer,
+    size_t nBufferSize);
+
+/**
+ * @name ExpandContextPath
+ * @brief Prepares a path given to an *At function for the system calls:
+ * copies it as is if the context was created with
+ * CONTEXT_FLAG_LITERAL_PATHS, and expands it a la Bash otherwise, as for a
+ * NULL context.
+ * @param lpContext Context the path is relative to, or NULL.
+ * @param pszPath Path to prepare.
+ * @param pszBuffer Address of a buffer that receives the result.
+ * @param nBufferSize Size of the buffer, in bytes.
+ * @return OK on success; ERROR, with errno set to ENAMETOOLONG, if a literal
+ * path does not fit.
+ */
+int ExpandContextPath(LPFILECORECONTEXT lpContext, const char* pszPath,
+    char* pszBuffer, int nBufferSize);
+
+/**
+ * @name GetContextDescriptor
+ * @brief Gets the directory descriptor that the *At functions pass to the
+ * system calls for a context: the context's own, or AT_FDCWD if lpContext
+ * is NULL.
+ */
+int GetContextDescriptor(LPFILECORECONTEXT lpContext);
+
+/**
+ * @name LinkAnonymousFile
+ * @brief Gives a file opened with O_TMPFILE a hidden name beside the file
+ * it is to replace, ready to be renamed over it.
+ * @param nFileDescriptor Descriptor of the anonymous file.
+ * @param nDirectoryDescriptor Directory that a relative path is resolved
+ * against, or AT_FDCWD for the current working directory.
+ * @param pszPath Path of the file to be replaced.  Must already be
+ * expanded.
+ * @param pszTemporaryPath Address of a buffer that receives the hidden
+ * name, as built by FormatTemporaryFileName.
+ * @param nBufferSize Size of that buffer, in bytes.
+ * @return OK on success; ERROR otherwise, in which case errno is set.
+ */
+int LinkAnonymousFile(int nFileDescriptor, int nDirectoryDescriptor,
+    const char* pszPath, char* pszTemporaryPath, size_t nBufferSize);
+
+/**
+ * @name QueryPathInfo
+ * @brief Retrieves the metadata of a file, as GetFileInfo does, without
+ * counting a call in the statistics, for the functions built on it.
+ * @param nDirectoryDescriptor Directory that a relative path is resolved
+ * against, or AT_FDCWD for the current working directory.
+ * @param pszPath Path of the file.  It is expanded like the Bash shell.
+ * @param nMask FILE_INFO_* values naming the fields to retrieve.
+ * @param lpInfo Address of a FILEINFO that receives the metadata.
+ * @return OK on success; ERROR otherwise, in which case errno is set.
+ */
+int QueryPathInfo(LPFILECORECONTEXT lpContext, const char* pszPath,
+    int nMask, LPFILEINFO lpInfo);
+
+/**
+ * @name ReadAllFromDescriptor
+ * @brief Reads everything remaining in an open file into a single heap
+ * buffer, as ReadAllBytes does.
+ * @param nFileDescriptor Descriptor to read from.  It is not closed.
+ * @param ppOutput Address of a pointer that receives the NUL-terminated
+ * buffer, which must be released with free().
+ * @param pnLength Address of a variable that receives the number of bytes.
+ * @return OK on success; ERROR otherwise, in which case errno is set and
+ * nothing is allocated.
+ */
+int ReadAllFromDescriptor(int nFileDescriptor, char** ppOutput,
+    size_t* pnLength);
+
+/**
+ * @name ReadAllDirect
+ * @brief As ReadAllFromDescriptor, for a descriptor opened with O_DIRECT.
+ * @remarks Regular files are read straight into a buffer whose address and
+ * size are multiples of DIRECT_IO_ALIGNMENT, bypassing the page cache.
+ * Anything else, and any part of the file that cannot be read directly,
+ * has O_DIRECT cleared and goes through the page cache.  The buffer may be
+ * released with free().
+ */
+int ReadAllDirect(int nFileDescriptor, char** ppOutput, size_t* pnLength);
+
+/**
+ * @name RunInParallel
+ * @brief Calls a routine once for every index in [0, nCount), spreading the
+ * calls over a set of worker threads.
+ * @param nCount Number of items.
+ * @param nThreads Maximum number of threads to use, including the calling
+ * thread; zero or less means GetDefaultWorkerCount().  Never more than
+ * MAX_WORKER_COUNT or nCount are used.
+ * @param lpfnWork Routine to call for each item.
+ * @param pContext Value passed through to lpfnWork.
+ * @remarks Workers claim indices from a shared atomic counter, so uneven
+ * items balance themselves.  The calling thread takes part, and the function
+ * returns once every item has been processed.  If threads cannot be
+ * created, the remaining work is done on the calling thread.
+ */
+void RunInParallel(int nCount, int nThreads, PARALLEL_WORK_PROC lpfnWork,
+    void* pContext);
+
+/**
+ * @name SyncFile
+ * @brief Applies the durability requested by the WRITE_FLAG_* values to an
+ * open file.
+ * @param nFileDescriptor Descriptor of the file to be synchronized.
+ * @param nFlags WRITE_FLAG_* values.  WRITE_FLAG_FULLSYNC calls fsync();
+ * WRITE_FLAG_DATASYNC calls fdatasync(); anything else does nothing.
+ * @return OK on success; ERROR otherwise, in which case errno is set.
+ */
+int SyncFile(int nFileDescriptor, int nFlags);
+
+/**
+ * @name SyncParentDirectory
+ * @brief Flushes the directory containing the specified path to stable
+ * storage, so that a newly-created or renamed entry survives a crash.
+ * @param nDirectoryDescriptor Directory that a relative path is resolved
+ * against, or AT_FDCWD for the current working directory.
+ * @param pszPath Path whose parent directory is to be synchronized.  Must
+ * already be expanded.
+ * @return OK on success; ERROR otherwise, in which case errno is set.
+ */
+int SyncParentDirectory(int nDirectoryDescriptor, const char* pszPath);
+
+/**
+ * @name WriteAtomically
+ * @brief Replaces the content of a file in a single step, by writing the
+ * data to an unnamed or hidden file beside it and renaming that into place.
+ * @param nDirectoryDescriptor Directory that a relative path is resolved
+ * against, or AT_FDCWD for the current working directory.
+ * @param pszPath Path of the file to write.  Must already be expanded.
+ * @param pParts Array of buffers whose contents, in order, make up the new
+ * content of the file.
+ * @param nCount Number of elements in pParts.
+ * @param nFlags WRITE_FLAG_* values giving the durability required.
+ * @return OK on success; ERROR otherwise, in which case errno is set and the
+ * file is left as it was.
+ */
+int WriteAtomically(int nDirectoryDescriptor, const char* pszPath,
+    const struct iovec* pParts, int nCount, int nFlags);
+
+/**
+ * @name WriteFully
+ * @brief Writes all of the specified bytes to a file descriptor, retrying
+ * after short writes and interruptions.
+ * @param nFileDescriptor Descriptor to write to.
+ * @param pData Address of the bytes to write.
+ * @param nLength Number of bytes to write.
+ * @param nOffset Offset at which to write with pwrite(), or -1 to write at
+ * the current file position with write().
+ * @return OK if every byte was written; ERROR otherwise, in which case errno
+ * is set.
+ */
+int WriteFully(int nFileDescriptor, const char* pData, size_t nLength,
+    off_t nOffset);
+
+/**
+ * @name WriteAllDirect
+ * @brief Writes the whole content of a new or truncated file through a
+ * descriptor opened with O_DIRECT.
+ * @param nFileDescriptor Descriptor to write to, positioned at the start of
+ * an empty file.
+ * @param pData Address of the bytes to write.
+ * @param nLength Number of bytes to write.
+ * @return OK if every byte was written; ERROR otherwise, in which case errno
+ * is set.
+ * @remarks Whole blocks of DIRECT_IO_ALIGNMENT bytes are written directly,
+ * from the caller's buffer if it is suitably aligned and through an aligned
+ * bounce buffer of DIRECT_IO_BUFFER_SIZE bytes if not.  O_DIRECT is then
+ * cleared for the final partial block.
+ */
+int WriteAllDirect(int nFileDescriptor, const char* pData, size_t nLength);
+
+/**
+ * @name WritevFully
+ * @brief Writes every byte described by an array of iovec structures to a
+ * file descriptor, respecting IOV_MAX and retrying after short writes and
+ * interruptions.
+ * @param nFileDescriptor Descriptor to write to.
+ * @param pIovecs Address of the array.  Its contents are modified as the
+ * write progresses.
+ * @param nCount Number of elements in the array.
+ * @return OK if every byte was written; ERROR otherwise, in which case errno
+ * is set.
+ */
+int WritevFully(int nFileDescriptor, struct iovec* pIovecs, int nCount);
+
+#endif //__FILE_CORE_INTERNAL_H__
@@ -10,4 +10,131 @@
   "HOME"
 #endif //HOME_ENVIRONMENT_VARIABLE_NAME
 
+#ifndef READ_ALL_BYTES_INITIAL_SIZE
+#define READ_ALL_BYTES_INITIAL_SIZE \
+  65536
+#endif //READ_ALL_BYTES_INITIAL_SIZE
+
+#ifndef MAX_READ_CHUNK_SIZE
+#define MAX_READ_CHUNK_SIZE \
+  0x40000000
+#endif //MAX_READ_CHUNK_SIZE
+
+#ifndef FILE_READER_DEFAULT_BUFFER_SIZE
+#define FILE_READER_DEFAULT_BUFFER_SIZE \
+  65536
+#endif //FILE_READER_DEFAULT_BUFFER_SIZE
+
+#ifndef MAX_CACHED_USER_HOMES
+#define MAX_CACHED_USER_HOMES \
+  16
+#endif //MAX_CACHED_USER_HOMES
+
+#ifndef MAX_USER_NAME_LENGTH
+#define MAX_USER_NAME_LENGTH \
+  256
+#endif //MAX_USER_NAME_LENGTH
+
+#ifndef APPENDER_DEFAULT_BUFFER_SIZE
+#define APPENDER_DEFAULT_BUFFER_SIZE \
+  65536
+#endif //APPENDER_DEFAULT_BUFFER_SIZE
+
+#ifndef GROUP_COMMIT_MAX_BATCH_SIZE
+#define GROUP_COMMIT_MAX_BATCH_SIZE \
+  1024
+#endif //GROUP_COMMIT_MAX_BATCH_SIZE
+
+#ifndef MAX_DEFAULT_WORKER_COUNT
+#define MAX_DEFAULT_WORKER_COUNT \
+  32
+#endif //MAX_DEFAULT_WORKER_COUNT
+
+/* Upper bound on any thread count a caller asks for. */
+#ifndef MAX_WORKER_COUNT
+#define MAX_WORKER_COUNT \
+  256
+#endif //MAX_WORKER_COUNT
+
+#ifndef READ_MANY_DEFAULT_QUEUE_DEPTH
+#define READ_MANY_DEFAULT_QUEUE_DEPTH \
+  64
+#endif //READ_MANY_DEFAULT_QUEUE_DEPTH
+
+#ifndef DIRECTORY_READ_BUFFER_SIZE
+#define DIRECTORY_READ_BUFFER_SIZE \
+  131072
+#endif //DIRECTORY_READ_BUFFER_SIZE
+
+#ifndef FORMATTED_TEXT_STACK_BUFFER_SIZE
+#define FORMATTED_TEXT_STACK_BUFFER_SIZE \
+  1024
+#endif //FORMATTED_TEXT_STACK_BUFFER_SIZE
+
+#ifndef STAT_MANY_PATHS_PER_THREAD
+#define STAT_MANY_PATHS_PER_THREAD \
+  512
+#endif //STAT_MANY_PATHS_PER_THREAD
+
+#ifndef DELETE_MANY_PATHS_PER_THREAD
+#define DELETE_MANY_PATHS_PER_THREAD \
+  64
+#endif //DELETE_MANY_PATHS_PER_THREAD
+
+#ifndef REMOVE_TREE_SUBTREES_PER_THREAD
+#define REMOVE_TREE_SUBTREES_PER_THREAD \
+  8
+#endif //REMOVE_TREE_SUBTREES_PER_THREAD
+
+#ifndef REMOVE_TREE_MAX_OPEN_DIRECTORIES
+#define REMOVE_TREE_MAX_OPEN_DIRECTORIES \
+  64
+#endif //REMOVE_TREE_MAX_OPEN_DIRECTORIES
+
+#ifndef COPY_BUFFER_SIZE
+#define COPY_BUFFER_SIZE \
+  1048576
+#endif //COPY_BUFFER_SIZE
+
+#ifndef COPY_PARALLEL_CHUNK_SIZE
+#define COPY_PARALLEL_CHUNK_SIZE \
+  (64 * 1024 * 1024)
+#endif //COPY_PARALLEL_CHUNK_SIZE
+
+#ifndef DIRECT_IO_ALIGNMENT
+#define DIRECT_IO_ALIGNMENT \
+  4096
+#endif //DIRECT_IO_ALIGNMENT
+
+#ifndef DIRECT_IO_BUFFER_SIZE
+#define DIRECT_IO_BUFFER_SIZE \
+  (4 * 1024 * 1024)
+#endif //DIRECT_IO_BUFFER_SIZE
+
+#ifndef TEXT_CACHE_SHARD_COUNT
+#define TEXT_CACHE_SHARD_COUNT \
+  16
+#endif //TEXT_CACHE_SHARD_COUNT
+
+#ifndef TEXT_CACHE_BUCKETS_PER_SHARD
+#define TEXT_CACHE_BUCKETS_PER_SHARD \
+  1024
+#endif //TEXT_CACHE_BUCKETS_PER_SHARD
+
+#ifndef CHECKSUM_CHUNK_SIZE
+#define CHECKSUM_CHUNK_SIZE \
+  (1024 * 1024)
+#endif //CHECKSUM_CHUNK_SIZE
+
+/* Must be a multiple of CHECKSUM_CHUNK_SIZE. */
+#ifndef CHECKSUM_SEGMENT_SIZE
+#define CHECKSUM_SEGMENT_SIZE \
+  (64 * 1024 * 1024)
+#endif //CHECKSUM_SEGMENT_SIZE
+
+#ifndef LINE_INDEX_RANGE_SIZE
+#define LINE_INDEX_RANGE_SIZE \
+  (64 * 1024 * 1024)
+#endif //LINE_INDEX_RANGE_SIZE
+
 #endif //__FILE_CORE_SYMBOLS_H__
@@ -4,15 +4,31 @@
 #ifndef __FILE_CORE_STDAFX_H__
 #define __FILE_CORE_STDAFX_H__
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif //_GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <stdarg.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <inttypes.h>
 #include <wordexp.h>
 #include <unistd.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
 #include <pwd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
 
 #include "symbols.h"
 
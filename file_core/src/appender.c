@@ -0,0 +1,333 @@
+/*
+ * appender.c
+ *
+ *  Buffered, append-only writer that keeps its file open between records.
+ */
+
+#include "stdafx.h"
+#include "file_core.h"
+
+#include "file_core_internal.h"
+#include "file_core_symbols.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// APPENDER structure
+
+struct _tagAPPENDER {
+  pthread_mutex_t mutex;  /* Serializes access from multiple threads */
+  int nFileDescriptor;    /* Descriptor opened with O_APPEND */
+  char* pBuffer;          /* Records not yet written to the file */
+  size_t nBufferSize;     /* Capacity of pBuffer, in bytes */
+  size_t nBuffered;       /* Number of bytes in pBuffer */
+  int nFlushPolicy;       /* One of the APPENDER_FLUSH_* values, or ms */
+  int64_t nOldestRecord;  /* Time, in ms, the buffer stopped being empty */
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Internal functions
+
+///////////////////////////////////////////////////////////////////////////////
+// GetMonotonicMilliseconds function
+
+static int64_t GetMonotonicMilliseconds(void) {
+  struct timespec ts = { 0 };
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+  return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// FlushLocked function - Writes out the buffer.  If a write fails part way,
+// the bytes that did reach the file are dropped from the buffer, so that a
+// later flush does not append them twice.  The appender's mutex must be
+// held.
+
+static int FlushLocked(LPAPPENDER lpAppender) {
+  size_t nWritten = 0;
+
+  while (nWritten < lpAppender->nBuffered) {
+    ssize_t nBytesWritten = write(lpAppender->nFileDescriptor,
+        lpAppender->pBuffer + nWritten, lpAppender->nBuffered - nWritten);
+    if (nBytesWritten < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+
+      int nError = errno;
+      lpAppender->nBuffered -= nWritten;
+      memmove(lpAppender->pBuffer, lpAppender->pBuffer + nWritten,
+          lpAppender->nBuffered);
+      errno = nError;
+      return ERROR;
+    }
+
+    nWritten += (size_t) nBytesWritten;
+  }
+
+  lpAppender->nBuffered = 0;
+  return OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ApplyFlushPolicy function - Called after a record has been buffered.  The
+// appender's mutex must be held.
+
+static int ApplyFlushPolicy(LPAPPENDER lpAppender, BOOL bWasEmpty) {
+  if (lpAppender->nFlushPolicy == APPENDER_FLUSH_EVERY_RECORD) {
+    return FlushLocked(lpAppender);
+  }
+
+  if (lpAppender->nFlushPolicy > 0) {
+    int64_t nNow = GetMonotonicMilliseconds();
+    if (bWasEmpty) {
+      lpAppender->nOldestRecord = nNow;
+    } else if (nNow - lpAppender->nOldestRecord
+        >= lpAppender->nFlushPolicy) {
+      return FlushLocked(lpAppender);
+    }
+  }
+
+  return OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// CreateAppender function - Does the work of OpenAppender and OpenAppenderAt.
+
+static LPAPPENDER CreateAppender(LPFILECORECONTEXT lpContext,
+    const char* pszPath, size_t nBufferSize, int nFlushPolicy) {
+  if (IsNullOrWhiteSpace(pszPath)
+      || nFlushPolicy < APPENDER_FLUSH_EVERY_RECORD) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  if (nBufferSize == 0) {
+    nBufferSize = APPENDER_DEFAULT_BUFFER_SIZE;
+  }
+
+  /* Expand the path name a la Bash */
+  char szExpandedPathName[MAX_PATH + 1];
+  if (OK != ExpandContextPath(lpContext, pszPath, szExpandedPathName,
+      MAX_PATH + 1)) {
+    return NULL;
+  }
+
+  LPAPPENDER lpAppender = (LPAPPENDER) calloc(1, sizeof(APPENDER));
+  if (lpAppender == NULL) {
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  lpAppender->pBuffer = (char*) malloc(nBufferSize);
+  if (lpAppender->pBuffer == NULL) {
+    free(lpAppender);
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  lpAppender->nFileDescriptor = openat(GetContextDescriptor(lpContext),
+      szExpandedPathName, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+  if (lpAppender->nFileDescriptor < 0) {
+    int nError = errno;
+    free(lpAppender->pBuffer);
+    free(lpAppender);
+    errno = nError;
+    return NULL;
+  }
+
+  pthread_mutex_init(&lpAppender->mutex, NULL);
+  lpAppender->nBufferSize = nBufferSize;
+  lpAppender->nFlushPolicy = nFlushPolicy;
+
+  return lpAppender;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Publicly-exposed functions
+
+///////////////////////////////////////////////////////////////////////////////
+// Append function
+
+int Append(LPAPPENDER lpAppender, const char* pData, size_t nLength) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_APPEND);
+
+  if (lpAppender == NULL || (pData == NULL && nLength > 0)) {
+    errno = EINVAL;
+    return ERROR;
+  }
+
+  if (nLength == 0) {
+    return OK;
+  }
+
+  pthread_mutex_lock(&lpAppender->mutex);
+
+  int nResult = OK;
+
+  /* Make room, so that a record never straddles two write() calls. */
+  if (nLength > lpAppender->nBufferSize - lpAppender->nBuffered) {
+    nResult = FlushLocked(lpAppender);
+  }
+
+  if (nResult == OK) {
+    if (nLength > lpAppender->nBufferSize) {
+      /* Too big to buffer; write it straight through. */
+      nResult = WriteFully(lpAppender->nFileDescriptor, pData, nLength, -1);
+    } else {
+      BOOL bWasEmpty = lpAppender->nBuffered == 0;
+      memcpy(lpAppender->pBuffer + lpAppender->nBuffered, pData, nLength);
+      lpAppender->nBuffered += nLength;
+      nResult = ApplyFlushPolicy(lpAppender, bWasEmpty);
+    }
+  }
+
+  int nError = errno;
+  pthread_mutex_unlock(&lpAppender->mutex);
+  errno = nError;
+
+  FILE_CORE_TRACE_BYTES(nLength);
+  return nResult;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// AppendFormatted function
+
+int AppendFormatted(LPAPPENDER lpAppender, const char* pszFormat, ...) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_APPEND_FORMATTED);
+
+  if (lpAppender == NULL || pszFormat == NULL) {
+    errno = EINVAL;
+    return ERROR;
+  }
+
+  pthread_mutex_lock(&lpAppender->mutex);
+
+  int nResult = OK;
+  BOOL bWasEmpty = lpAppender->nBuffered == 0;
+
+  /* Try to format straight into the free space at the end of the buffer. */
+  size_t nFree = lpAppender->nBufferSize - lpAppender->nBuffered;
+
+  va_list args;
+  va_start(args, pszFormat);
+  int nLength = vsnprintf(lpAppender->pBuffer + lpAppender->nBuffered,
+      nFree, pszFormat, args);
+  va_end(args);
+
+  if (nLength < 0) {
+    nResult = ERROR;
+  } else if ((size_t) nLength < nFree) {
+    lpAppender->nBuffered += (size_t) nLength;
+    nResult = ApplyFlushPolicy(lpAppender, bWasEmpty);
+  } else if ((size_t) nLength < lpAppender->nBufferSize) {
+    /* It fits once the buffer has been emptied. */
+    nResult = FlushLocked(lpAppender);
+    if (nResult == OK) {
+      va_start(args, pszFormat);
+      vsnprintf(lpAppender->pBuffer, lpAppender->nBufferSize, pszFormat,
+          args);
+      va_end(args);
+
+      lpAppender->nBuffered = (size_t) nLength;
+      nResult = ApplyFlushPolicy(lpAppender, TRUE);
+    }
+  } else {
+    /* Bigger than the whole buffer; format on the heap and write it
+     * straight through. */
+    char* pszRecord = (char*) malloc((size_t) nLength + 1);
+    nResult = pszRecord == NULL ? ERROR : FlushLocked(lpAppender);
+    if (nResult == OK) {
+      va_start(args, pszFormat);
+      vsnprintf(pszRecord, (size_t) nLength + 1, pszFormat, args);
+      va_end(args);
+
+      nResult = WriteFully(lpAppender->nFileDescriptor, pszRecord,
+          (size_t) nLength, -1);
+    }
+    if (pszRecord == NULL) {
+      errno = ENOMEM;
+    }
+    free(pszRecord);
+  }
+
+  int nError = errno;
+  pthread_mutex_unlock(&lpAppender->mutex);
+  errno = nError;
+
+  if (nLength > 0) {
+    FILE_CORE_TRACE_BYTES(nLength);
+  }
+  return nResult;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// CloseAppender function
+
+int CloseAppender(LPAPPENDER* lppAppender) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_CLOSE_APPENDER);
+
+  if (lppAppender == NULL || *lppAppender == NULL) {
+    errno = EINVAL;
+    return ERROR;
+  }
+
+  LPAPPENDER lpAppender = *lppAppender;
+  *lppAppender = NULL;
+
+  pthread_mutex_lock(&lpAppender->mutex);
+  int nResult = FlushLocked(lpAppender);
+  int nError = errno;
+  pthread_mutex_unlock(&lpAppender->mutex);
+
+  if (OK != close(lpAppender->nFileDescriptor) && nResult == OK
+      && errno != EINTR) {
+    nResult = ERROR;
+    nError = errno;
+  }
+
+  pthread_mutex_destroy(&lpAppender->mutex);
+  free(lpAppender->pBuffer);
+  free(lpAppender);
+
+  errno = nError;
+  return nResult;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// FlushAppender function
+
+int FlushAppender(LPAPPENDER lpAppender) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_FLUSH_APPENDER);
+
+  if (lpAppender == NULL) {
+    errno = EINVAL;
+    return ERROR;
+  }
+
+  pthread_mutex_lock(&lpAppender->mutex);
+  int nResult = FlushLocked(lpAppender);
+  int nError = errno;
+  pthread_mutex_unlock(&lpAppender->mutex);
+
+  errno = nError;
+  return nResult;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// OpenAppender function
+
+LPAPPENDER OpenAppender(const char* pszPath, size_t nBufferSize,
+    int nFlushPolicy) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_OPEN_APPENDER);
+
+  return CreateAppender(NULL, pszPath, nBufferSize, nFlushPolicy);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// OpenAppenderAt function
+
+LPAPPENDER OpenAppenderAt(LPFILECORECONTEXT lpContext, const char* pszPath,
+    size_t nBufferSize, int nFlushPolicy) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_OPEN_APPENDER_AT);
+
+  return CreateAppender(lpContext, pszPath, nBufferSize, nFlushPolicy);
+}
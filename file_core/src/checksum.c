@@ -0,0 +1,698 @@
+/*
+ * checksum.c
+ *
+ *  Streaming CRC32C and 64-bit content hashes of files and buffers.  The
+ *  CRC uses the SSE4.2 CRC32 instruction, interleaved three ways and
+ *  recombined with PCLMULQDQ, on CPUs that have them; large files are cut
+ *  into segments that are checksummed in parallel and then combined.
+ */
+
+#include "stdafx.h"
+#include "file_core.h"
+
+#include "file_core_internal.h"
+#include "file_core_symbols.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define CHECKSUM_HAVE_X86 1
+#endif
+
+/**
+ * @brief The Castagnoli polynomial, bit-reflected.
+ */
+#define CRC32C_POLYNOMIAL         0x82F63B78u
+
+/**
+ * @brief Bytes handled by each of the three interleaved CRC streams per
+ * step.  Large enough that the cost of recombining is noise.
+ */
+#define CRC32C_INTERLEAVE_BLOCK   8192
+
+/**
+ * @brief The xxHash64 primes.
+ */
+#define HASH64_PRIME1             0x9E3779B185EBCA87ULL
+#define HASH64_PRIME2             0xC2B2AE3D27D4EB4FULL
+#define HASH64_PRIME3             0x165667B19E3779F9ULL
+#define HASH64_PRIME4             0x85EBCA77C2B2AE63ULL
+#define HASH64_PRIME5             0x27D4EB2F165667C5ULL
+
+/**
+ * @brief Signature of a CRC32C kernel.  The CRC is passed and returned
+ * without the initial and final inversion.
+ */
+typedef uint32_t (*CRC32C_PROC)(uint32_t nCrc, const char* pData,
+    size_t nLength);
+
+///////////////////////////////////////////////////////////////////////////////
+// CHECKSUM_JOB structure - Shared by the workers checksumming one file.
+
+typedef struct _tagCHECKSUM_JOB {
+  int nFileDescriptor;
+  int nAlgorithm;
+  uint64_t nFileSize;
+  uint32_t* pSegmentCrcs;     /* One finished CRC per segment */
+  uint64_t* pChunkHashes;     /* One hash per CHECKSUM_CHUNK_SIZE bytes */
+  int nFirstError;
+} CHECKSUM_JOB, *LPCHECKSUM_JOB;
+
+static pthread_once_t g_checksumOnce = PTHREAD_ONCE_INIT;
+static uint32_t g_crcTables[8][256];
+static uint32_t g_powersOfX[64];            /* x^(2^n) modulo the polynomial */
+static CRC32C_PROC g_lpfnCrc32c = NULL;
+
+#ifdef CHECKSUM_HAVE_X86
+static uint32_t g_nShiftOneBlock = 0;
+static uint32_t g_nShiftTwoBlocks = 0;
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// Internal functions
+
+///////////////////////////////////////////////////////////////////////////////
+// ReadLittleEndian32 function
+
+static inline uint32_t ReadLittleEndian32(const char* pData) {
+  uint32_t nValue;
+  memcpy(&nValue, pData, sizeof(nValue));
+  return nValue;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ReadLittleEndian64 function
+
+static inline uint64_t ReadLittleEndian64(const char* pData) {
+  uint64_t nValue;
+  memcpy(&nValue, pData, sizeof(nValue));
+  return nValue;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// MultiplyModP function - Multiplies two polynomials modulo the CRC32C
+// polynomial, in the bit-reflected representation.  a must not be zero.
+
+static uint32_t MultiplyModP(uint32_t a, uint32_t b) {
+  uint32_t nMask = 1u << 31;
+  uint32_t nProduct = 0;
+
+  while (TRUE) {
+    if (a & nMask) {
+      nProduct ^= b;
+      if ((a & (nMask - 1)) == 0) {
+        break;
+      }
+    }
+    nMask >>= 1;
+    b = (b & 1) ? (b >> 1) ^ CRC32C_POLYNOMIAL : b >> 1;
+  }
+
+  return nProduct;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// PowerOfXModP function - Computes x^n modulo the CRC32C polynomial.
+
+static uint32_t PowerOfXModP(uint64_t n) {
+  uint32_t nResult = 1u << 31;                /* x^0 */
+
+  for (int k = 0; n != 0; n >>= 1, k++) {
+    if (n & 1) {
+      nResult = MultiplyModP(g_powersOfX[k], nResult);
+    }
+  }
+
+  return nResult;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Crc32cScalar function - Slicing-by-8 table kernel, for any CPU.
+
+static uint32_t Crc32cScalar(uint32_t nCrc, const char* pData,
+    size_t nLength) {
+  const unsigned char* pBytes = (const unsigned char*) pData;
+
+  while (nLength >= 8) {
+    uint32_t nOne = ReadLittleEndian32((const char*) pBytes) ^ nCrc;
+    uint32_t nTwo = ReadLittleEndian32((const char*) pBytes + 4);
+    nCrc = g_crcTables[7][nOne & 0xFF] ^ g_crcTables[6][(nOne >> 8) & 0xFF]
+        ^ g_crcTables[5][(nOne >> 16) & 0xFF] ^ g_crcTables[4][nOne >> 24]
+        ^ g_crcTables[3][nTwo & 0xFF] ^ g_crcTables[2][(nTwo >> 8) & 0xFF]
+        ^ g_crcTables[1][(nTwo >> 16) & 0xFF] ^ g_crcTables[0][nTwo >> 24];
+    pBytes += 8;
+    nLength -= 8;
+  }
+
+  while (nLength-- > 0) {
+    nCrc = (nCrc >> 8) ^ g_crcTables[0][(nCrc ^ *pBytes++) & 0xFF];
+  }
+
+  return nCrc;
+}
+
+#ifdef CHECKSUM_HAVE_X86
+
+///////////////////////////////////////////////////////////////////////////////
+// Crc32cSse42 function - One stream of CRC32 instructions, eight bytes at a
+// time.
+
+__attribute__((target("sse4.2")))
+static uint32_t Crc32cSse42(uint32_t nCrc, const char* pData,
+    size_t nLength) {
+  uint64_t nCrc64 = nCrc;
+
+  while (nLength >= 8) {
+    nCrc64 = _mm_crc32_u64(nCrc64, ReadLittleEndian64(pData));
+    pData += 8;
+    nLength -= 8;
+  }
+
+  nCrc = (uint32_t) nCrc64;
+  while (nLength-- > 0) {
+    nCrc = _mm_crc32_u8(nCrc, (unsigned char) *pData++);
+  }
+
+  return nCrc;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ShiftCrc function - Advances a CRC over nBytes zero bytes, where nShift
+// is x^(8 * nBytes - 33) modulo the polynomial.  The carry-less product
+// carries an extra factor of x, and the CRC32 instruction multiplies by
+// x^32 as it reduces, which the exponent accounts for.
+
+__attribute__((target("sse4.2,pclmul")))
+static inline uint32_t ShiftCrc(uint32_t nCrc, uint32_t nShift) {
+  __m128i product = _mm_clmulepi64_si128(_mm_cvtsi32_si128((int) nCrc),
+      _mm_cvtsi32_si128((int) nShift), 0x00);
+  return (uint32_t) _mm_crc32_u64(0, (uint64_t) _mm_cvtsi128_si64(product));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Crc32cPclmul function - Three independent streams of CRC32 instructions
+// over adjacent blocks, hiding the instruction's latency, stitched back
+// together with carry-less multiplication.
+
+__attribute__((target("sse4.2,pclmul")))
+static uint32_t Crc32cPclmul(uint32_t nCrc, const char* pData,
+    size_t nLength) {
+  while (nLength >= 3 * CRC32C_INTERLEAVE_BLOCK) {
+    uint64_t nCrcA = nCrc;
+    uint64_t nCrcB = 0;
+    uint64_t nCrcC = 0;
+
+    const char* pA = pData;
+    const char* pB = pData + CRC32C_INTERLEAVE_BLOCK;
+    const char* pC = pData + 2 * CRC32C_INTERLEAVE_BLOCK;
+    for (size_t i = 0; i < CRC32C_INTERLEAVE_BLOCK; i += 8) {
+      nCrcA = _mm_crc32_u64(nCrcA, ReadLittleEndian64(pA + i));
+      nCrcB = _mm_crc32_u64(nCrcB, ReadLittleEndian64(pB + i));
+      nCrcC = _mm_crc32_u64(nCrcC, ReadLittleEndian64(pC + i));
+    }
+
+    nCrc = ShiftCrc((uint32_t) nCrcA, g_nShiftTwoBlocks)
+        ^ ShiftCrc((uint32_t) nCrcB, g_nShiftOneBlock) ^ (uint32_t) nCrcC;
+
+    pData += 3 * CRC32C_INTERLEAVE_BLOCK;
+    nLength -= 3 * CRC32C_INTERLEAVE_BLOCK;
+  }
+
+  return Crc32cSse42(nCrc, pData, nLength);
+}
+
+#endif //CHECKSUM_HAVE_X86
+
+///////////////////////////////////////////////////////////////////////////////
+// InitializeChecksums function - Builds the tables and picks the fastest
+// CRC32C kernel the CPU supports, once.
+
+static void InitializeChecksums(void) {
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t nCrc = i;
+    for (int nBit = 0; nBit < 8; nBit++) {
+      nCrc = (nCrc & 1) ? (nCrc >> 1) ^ CRC32C_POLYNOMIAL : nCrc >> 1;
+    }
+    g_crcTables[0][i] = nCrc;
+  }
+  for (int k = 1; k < 8; k++) {
+    for (int i = 0; i < 256; i++) {
+      g_crcTables[k][i] = (g_crcTables[k - 1][i] >> 8)
+          ^ g_crcTables[0][g_crcTables[k - 1][i] & 0xFF];
+    }
+  }
+
+  g_powersOfX[0] = 1u << 30;                  /* x^1 */
+  for (int k = 1; k < 64; k++) {
+    g_powersOfX[k] = MultiplyModP(g_powersOfX[k - 1], g_powersOfX[k - 1]);
+  }
+
+  g_lpfnCrc32c = Crc32cScalar;
+
+#ifdef CHECKSUM_HAVE_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse4.2")) {
+    g_lpfnCrc32c = Crc32cSse42;
+
+    if (__builtin_cpu_supports("pclmul")) {
+      g_nShiftOneBlock = PowerOfXModP(8 * CRC32C_INTERLEAVE_BLOCK - 33);
+      g_nShiftTwoBlocks = PowerOfXModP(16 * CRC32C_INTERLEAVE_BLOCK - 33);
+      g_lpfnCrc32c = Crc32cPclmul;
+    }
+  }
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// CombineCrc32c function - Computes the CRC of the concatenation of two
+// pieces of data from the finished CRCs of each and the second's length.
+
+static uint32_t CombineCrc32c(uint32_t nCrc1, uint32_t nCrc2,
+    uint64_t nLength2) {
+  return MultiplyModP(PowerOfXModP(8 * nLength2), nCrc1) ^ nCrc2;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// RotateLeft64 function
+
+static inline uint64_t RotateLeft64(uint64_t nValue, int nBits) {
+  return (nValue << nBits) | (nValue >> (64 - nBits));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Hash64Round function
+
+static inline uint64_t Hash64Round(uint64_t nAccumulator, uint64_t nInput) {
+  nAccumulator += nInput * HASH64_PRIME2;
+  nAccumulator = RotateLeft64(nAccumulator, 31);
+  return nAccumulator * HASH64_PRIME1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Hash64Merge function
+
+static inline uint64_t Hash64Merge(uint64_t nHash, uint64_t nAccumulator) {
+  nHash ^= Hash64Round(0, nAccumulator);
+  return nHash * HASH64_PRIME1 + HASH64_PRIME4;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Hash64 function - xxHash64 of a buffer.  Four independent accumulators
+// keep the multipliers busy, so this runs near memory bandwidth without
+// vector instructions.
+
+static uint64_t Hash64(const char* pData, size_t nLength, uint64_t nSeed) {
+  const char* pEnd = pData + nLength;
+  uint64_t nHash;
+
+  if (nLength >= 32) {
+    uint64_t v1 = nSeed + HASH64_PRIME1 + HASH64_PRIME2;
+    uint64_t v2 = nSeed + HASH64_PRIME2;
+    uint64_t v3 = nSeed;
+    uint64_t v4 = nSeed - HASH64_PRIME1;
+
+    do {
+      v1 = Hash64Round(v1, ReadLittleEndian64(pData));
+      v2 = Hash64Round(v2, ReadLittleEndian64(pData + 8));
+      v3 = Hash64Round(v3, ReadLittleEndian64(pData + 16));
+      v4 = Hash64Round(v4, ReadLittleEndian64(pData + 24));
+      pData += 32;
+    } while (pEnd - pData >= 32);
+
+    nHash = RotateLeft64(v1, 1) + RotateLeft64(v2, 7) + RotateLeft64(v3, 12)
+        + RotateLeft64(v4, 18);
+    nHash = Hash64Merge(nHash, v1);
+    nHash = Hash64Merge(nHash, v2);
+    nHash = Hash64Merge(nHash, v3);
+    nHash = Hash64Merge(nHash, v4);
+  } else {
+    nHash = nSeed + HASH64_PRIME5;
+  }
+
+  nHash += (uint64_t) nLength;
+
+  while (pEnd - pData >= 8) {
+    nHash ^= Hash64Round(0, ReadLittleEndian64(pData));
+    nHash = RotateLeft64(nHash, 27) * HASH64_PRIME1 + HASH64_PRIME4;
+    pData += 8;
+  }
+
+  if (pEnd - pData >= 4) {
+    nHash ^= (uint64_t) ReadLittleEndian32(pData) * HASH64_PRIME1;
+    nHash = RotateLeft64(nHash, 23) * HASH64_PRIME2 + HASH64_PRIME3;
+    pData += 4;
+  }
+
+  while (pData < pEnd) {
+    nHash ^= (uint64_t) (unsigned char) *pData++ * HASH64_PRIME5;
+    nHash = RotateLeft64(nHash, 11) * HASH64_PRIME1;
+  }
+
+  nHash ^= nHash >> 33;
+  nHash *= HASH64_PRIME2;
+  nHash ^= nHash >> 29;
+  nHash *= HASH64_PRIME3;
+  nHash ^= nHash >> 32;
+
+  return nHash;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// FinishHash64 function - Turns the hashes of the CHECKSUM_CHUNK_SIZE
+// chunks of some data into the hash of the whole.  Data of one chunk or
+// less hashes to its plain xxHash64, so small files agree with xxh64sum.
+
+static uint64_t FinishHash64(const uint64_t* pChunkHashes, size_t nChunks,
+    uint64_t nTotalLength) {
+  if (nChunks == 0) {
+    return Hash64("", 0, 0);
+  }
+
+  if (nChunks == 1) {
+    return pChunkHashes[0];
+  }
+
+  return Hash64((const char*) pChunkHashes, nChunks * sizeof(uint64_t),
+      nTotalLength);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ChecksumSegmentProc function - Work routine that checksums one segment of
+// CHECKSUM_SEGMENT_SIZE bytes of a file through its own buffer.
+
+static void ChecksumSegmentProc(void* pContext, int nIndex) {
+  LPCHECKSUM_JOB lpJob = (LPCHECKSUM_JOB) pContext;
+  if (__atomic_load_n(&lpJob->nFirstError, __ATOMIC_RELAXED) != 0) {
+    return;
+  }
+
+  char* pBuffer = (char*) malloc(CHECKSUM_CHUNK_SIZE);
+  if (pBuffer == NULL) {
+    int nExpected = 0;
+    __atomic_compare_exchange_n(&lpJob->nFirstError, &nExpected, ENOMEM,
+        FALSE, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+    return;
+  }
+
+  uint64_t nOffset = (uint64_t) nIndex * CHECKSUM_SEGMENT_SIZE;
+  uint64_t nEnd = nOffset + CHECKSUM_SEGMENT_SIZE;
+  if (nEnd > lpJob->nFileSize) {
+    nEnd = lpJob->nFileSize;
+  }
+
+  uint32_t nCrc = 0xFFFFFFFFu;
+  int nError = 0;
+
+  while (nOffset < nEnd) {
+    size_t nChunk = nEnd - nOffset < CHECKSUM_CHUNK_SIZE
+        ? (size_t) (nEnd - nOffset) : CHECKSUM_CHUNK_SIZE;
+    ssize_t nBytesRead = pread(lpJob->nFileDescriptor, pBuffer, nChunk,
+        (off_t) nOffset);
+    if (nBytesRead < 0 && errno == EINTR) {
+      continue;
+    }
+    if (nBytesRead < 0) {
+      nError = errno;
+      break;
+    }
+    if ((size_t) nBytesRead != nChunk) {
+      /* A short read from a regular file means it was truncated while we
+       * were reading it; the checksum would be of neither version. */
+      nError = EIO;
+      break;
+    }
+
+    if (lpJob->nAlgorithm == CHECKSUM_CRC32C) {
+      nCrc = g_lpfnCrc32c(nCrc, pBuffer, nChunk);
+    } else {
+      lpJob->pChunkHashes[nOffset / CHECKSUM_CHUNK_SIZE] = Hash64(pBuffer,
+          nChunk, 0);
+    }
+
+    nOffset += nChunk;
+  }
+
+  free(pBuffer);
+
+  if (nError != 0) {
+    int nExpected = 0;
+    __atomic_compare_exchange_n(&lpJob->nFirstError, &nExpected, nError,
+        FALSE, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+    return;
+  }
+
+  if (lpJob->pSegmentCrcs != NULL) {
+    lpJob->pSegmentCrcs[nIndex] = nCrc ^ 0xFFFFFFFFu;
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ChecksumInParallel function - Checksums a regular file of known size,
+// one segment per work item, and combines the results.
+
+static int ChecksumInParallel(int nFileDescriptor, uint64_t nFileSize,
+    int nAlgorithm, uint64_t* pnChecksum) {
+  int nSegments = (int) ((nFileSize + CHECKSUM_SEGMENT_SIZE - 1)
+      / CHECKSUM_SEGMENT_SIZE);
+  size_t nChunks = (size_t) ((nFileSize + CHECKSUM_CHUNK_SIZE - 1)
+      / CHECKSUM_CHUNK_SIZE);
+
+  CHECKSUM_JOB job;
+  memset(&job, 0, sizeof(CHECKSUM_JOB));
+  job.nFileDescriptor = nFileDescriptor;
+  job.nAlgorithm = nAlgorithm;
+  job.nFileSize = nFileSize;
+
+  if (nAlgorithm == CHECKSUM_CRC32C) {
+    job.pSegmentCrcs = (uint32_t*) malloc(nSegments * sizeof(uint32_t));
+  } else {
+    job.pChunkHashes = (uint64_t*) malloc(nChunks * sizeof(uint64_t));
+  }
+  if (job.pSegmentCrcs == NULL && job.pChunkHashes == NULL) {
+    errno = ENOMEM;
+    return ERROR;
+  }
+
+  RunInParallel(nSegments, 0, ChecksumSegmentProc, &job);
+
+  if (job.nFirstError == 0) {
+    if (nAlgorithm == CHECKSUM_CRC32C) {
+      uint32_t nCrc = job.pSegmentCrcs[0];
+      for (int i = 1; i < nSegments; i++) {
+        uint64_t nLength = i < nSegments - 1 ? CHECKSUM_SEGMENT_SIZE
+            : nFileSize - (uint64_t) i * CHECKSUM_SEGMENT_SIZE;
+        nCrc = CombineCrc32c(nCrc, job.pSegmentCrcs[i], nLength);
+      }
+      *pnChecksum = nCrc;
+    } else {
+      *pnChecksum = FinishHash64(job.pChunkHashes, nChunks, nFileSize);
+    }
+  }
+
+  free(job.pSegmentCrcs);
+  free(job.pChunkHashes);
+
+  if (job.nFirstError != 0) {
+    errno = job.nFirstError;
+    return ERROR;
+  }
+
+  return OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ChecksumStream function - Checksums whatever remains of an open file, a
+// chunk at a time, on the calling thread.  Works for pipes as well.
+
+static int ChecksumStream(int nFileDescriptor, int nAlgorithm,
+    uint64_t* pnChecksum) {
+  char* pBuffer = (char*) malloc(CHECKSUM_CHUNK_SIZE);
+  if (pBuffer == NULL) {
+    errno = ENOMEM;
+    return ERROR;
+  }
+
+  uint32_t nCrc = 0xFFFFFFFFu;
+  uint64_t* pChunkHashes = NULL;
+  size_t nChunks = 0;
+  size_t nCapacity = 0;
+  uint64_t nTotalLength = 0;
+  int nResult = OK;
+
+  while (nResult == OK) {
+    /* Fill the whole buffer, so that chunk boundaries fall in the same
+     * places however the data arrives. */
+    size_t nFilled = 0;
+    while (nFilled < CHECKSUM_CHUNK_SIZE) {
+      ssize_t nBytesRead = read(nFileDescriptor, pBuffer + nFilled,
+          CHECKSUM_CHUNK_SIZE - nFilled);
+      if (nBytesRead < 0 && errno == EINTR) {
+        continue;
+      }
+      if (nBytesRead < 0) {
+        nResult = ERROR;
+      }
+      if (nBytesRead <= 0) {
+        break;
+      }
+      nFilled += (size_t) nBytesRead;
+    }
+
+    if (nResult != OK || nFilled == 0) {
+      break;
+    }
+
+    nTotalLength += nFilled;
+    if (nAlgorithm == CHECKSUM_CRC32C) {
+      nCrc = g_lpfnCrc32c(nCrc, pBuffer, nFilled);
+    } else {
+      if (nChunks == nCapacity) {
+        nCapacity = nCapacity == 0 ? 64 : nCapacity * 2;
+        uint64_t* pGrown = (uint64_t*) realloc(pChunkHashes,
+            nCapacity * sizeof(uint64_t));
+        if (pGrown == NULL) {
+          errno = ENOMEM;
+          nResult = ERROR;
+          break;
+        }
+        pChunkHashes = pGrown;
+      }
+      pChunkHashes[nChunks++] = Hash64(pBuffer, nFilled, 0);
+    }
+
+    if (nFilled < CHECKSUM_CHUNK_SIZE) {
+      break;
+    }
+  }
+
+  if (nResult == OK) {
+    *pnChecksum = nAlgorithm == CHECKSUM_CRC32C ? nCrc ^ 0xFFFFFFFFu
+        : FinishHash64(pChunkHashes, nChunks, nTotalLength);
+  }
+
+  int nError = errno;
+  free(pChunkHashes);
+  free(pBuffer);
+  errno = nError;
+
+  return nResult;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ChecksumBuffer function - Does the work of ComputeBufferChecksum.
+
+static int ChecksumBuffer(const char* pData, size_t nLength, int nAlgorithm,
+    uint64_t* pnChecksum) {
+  if (nAlgorithm == CHECKSUM_CRC32C) {
+    *pnChecksum = g_lpfnCrc32c(0xFFFFFFFFu, pData, nLength) ^ 0xFFFFFFFFu;
+    return OK;
+  }
+
+  if (nLength <= CHECKSUM_CHUNK_SIZE) {
+    *pnChecksum = Hash64(pData, nLength, 0);
+    return OK;
+  }
+
+  size_t nChunks = (nLength + CHECKSUM_CHUNK_SIZE - 1) / CHECKSUM_CHUNK_SIZE;
+  uint64_t* pChunkHashes = (uint64_t*) malloc(nChunks * sizeof(uint64_t));
+  if (pChunkHashes == NULL) {
+    errno = ENOMEM;
+    return ERROR;
+  }
+
+  for (size_t i = 0; i < nChunks; i++) {
+    size_t nOffset = i * CHECKSUM_CHUNK_SIZE;
+    size_t nChunk = nLength - nOffset < CHECKSUM_CHUNK_SIZE
+        ? nLength - nOffset : CHECKSUM_CHUNK_SIZE;
+    pChunkHashes[i] = Hash64(pData + nOffset, nChunk, 0);
+  }
+
+  *pnChecksum = FinishHash64(pChunkHashes, nChunks, nLength);
+  free(pChunkHashes);
+
+  return OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Publicly-exposed functions
+
+///////////////////////////////////////////////////////////////////////////////
+// ComputeBufferChecksum function
+
+int ComputeBufferChecksum(const char* pData, size_t nLength, int nAlgorithm,
+    uint64_t* pnChecksum) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_COMPUTE_BUFFER_CHECKSUM);
+
+  if ((pData == NULL && nLength > 0) || pnChecksum == NULL
+      || (nAlgorithm != CHECKSUM_CRC32C && nAlgorithm != CHECKSUM_HASH64)) {
+    errno = EINVAL;
+    return ERROR;
+  }
+
+  pthread_once(&g_checksumOnce, InitializeChecksums);
+  FILE_CORE_TRACE_BYTES(nLength);
+
+  return ChecksumBuffer(pData, nLength, nAlgorithm, pnChecksum);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ComputeFileChecksum function
+
+int ComputeFileChecksum(const char* pszPath, int nAlgorithm,
+    uint64_t* pnChecksum) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_COMPUTE_FILE_CHECKSUM);
+
+  if (IsNullOrWhiteSpace(pszPath) || pnChecksum == NULL
+      || (nAlgorithm != CHECKSUM_CRC32C && nAlgorithm != CHECKSUM_HASH64)) {
+    errno = EINVAL;
+    return ERROR;
+  }
+
+  pthread_once(&g_checksumOnce, InitializeChecksums);
+
+  /* Expand the path name a la Bash */
+  char szExpandedPathName[MAX_PATH + 1];
+  memset(szExpandedPathName, 0, MAX_PATH + 1);
+  ShellExpand(pszPath, szExpandedPathName, MAX_PATH + 1);
+
+  int nFileDescriptor = open(szExpandedPathName, O_RDONLY | O_CLOEXEC);
+  if (nFileDescriptor < 0) {
+    return ERROR;
+  }
+
+  struct stat st = { 0 };
+  if (OK != fstat(nFileDescriptor, &st)) {
+    int nError = errno;
+    close(nFileDescriptor);
+    errno = nError;
+    return ERROR;
+  }
+
+  int nResult = ERROR;
+  if (S_ISREG(st.st_mode) && st.st_size < CHECKSUM_CHUNK_SIZE) {
+    /* Small files are most of the calls; one read into a buffer of the
+     * right size beats setting up the streaming buffer. */
+    char* pData = NULL;
+    size_t nLength = 0;
+    nResult = ReadAllFromDescriptor(nFileDescriptor, &pData, &nLength);
+    if (nResult == OK) {
+      nResult = ChecksumBuffer(pData, nLength, nAlgorithm, pnChecksum);
+      free(pData);
+    }
+    FILE_CORE_TRACE_BYTES(nLength);
+  } else if (S_ISREG(st.st_mode) && st.st_size > CHECKSUM_SEGMENT_SIZE) {
+    nResult = ChecksumInParallel(nFileDescriptor, (uint64_t) st.st_size,
+        nAlgorithm, pnChecksum);
+    FILE_CORE_TRACE_BYTES(st.st_size);
+  } else {
+    /* One segment's worth is over before a second thread would start. */
+    posix_fadvise(nFileDescriptor, 0, 0, POSIX_FADV_SEQUENTIAL);
+    nResult = ChecksumStream(nFileDescriptor, nAlgorithm, pnChecksum);
+    FILE_CORE_TRACE_BYTES(S_ISREG(st.st_mode) ? st.st_size : 0);
+  }
+
+  int nError = errno;
+  close(nFileDescriptor);
+  errno = nError;
+
+  return nResult;
+}
@@ -0,0 +1,1246 @@
+/*
+ * directory_walk.c
+ *
+ *  Directory enumeration built on large getdents64() batches, a parallel
+ *  tree walker that spreads subtrees over a work-stealing pool, and
+ *  parallel removal of trees and of lists of files.  Removal works relative
+ *  to directory descriptors, with unlinkat(), so no entry's path is ever
+ *  built.
+ */
+
+#include "stdafx.h"
+#include "file_core.h"
+
+#include "file_core_internal.h"
+#include "file_core_symbols.h"
+
+#include <sys/syscall.h>
+
+///////////////////////////////////////////////////////////////////////////////
+// LINUX_DIRENT64 structure - Layout of the records returned by getdents64.
+
+typedef struct _tagLINUX_DIRENT64 {
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+} LINUX_DIRENT64, *LPLINUX_DIRENT64;
+
+///////////////////////////////////////////////////////////////////////////////
+// WALK_ITEM structure - A directory waiting to be read.
+
+typedef struct _tagWALK_ITEM {
+  int nDepth;
+  char szPath[];
+} WALK_ITEM, *LPWALK_ITEM;
+
+///////////////////////////////////////////////////////////////////////////////
+// WALK_DEQUE structure - Per-worker double-ended queue.  The owner pushes
+// and pops at the tail; idle workers steal from the head.
+
+typedef struct _tagWALK_DEQUE {
+  pthread_mutex_t mutex;
+  LPWALK_ITEM* ppItems;
+  size_t nCapacity;     /* Always a power of two */
+  size_t nHead;
+  size_t nTail;
+} WALK_DEQUE, *LPWALK_DEQUE;
+
+///////////////////////////////////////////////////////////////////////////////
+// WALK_STATE structure - Shared by every worker of one WalkDirectoryTree.
+
+typedef struct _tagWALK_STATE {
+  LPWALK_DEQUE pDeques;
+  int nWorkers;
+  long nPending;        /* Directories queued or being read */
+  BOOL bStop;
+  int nFirstError;
+  DIRECTORY_WALK_CALLBACK lpfnCallback;
+  void* pContext;
+  int nBaseDescriptor;  /* What a relative root is resolved against */
+} WALK_STATE, *LPWALK_STATE;
+
+///////////////////////////////////////////////////////////////////////////////
+// WALK_WORKER structure
+
+typedef struct _tagWALK_WORKER {
+  LPWALK_STATE lpState;
+  int nIndex;
+} WALK_WORKER, *LPWALK_WORKER;
+
+///////////////////////////////////////////////////////////////////////////////
+// REMOVE_NODE structure - A directory near the top of a tree being removed.
+// Its children always come after it in the array.
+
+typedef struct _tagREMOVE_NODE {
+  int nParent;              /* Index of the parent node, or -1 for the root */
+  int nDirectoryDescriptor; /* Open while its subdirectories are removed */
+  BOOL bIncomplete;         /* Something beneath it could not be removed */
+  char* pszName;            /* Name in the parent; expanded path for root */
+} REMOVE_NODE, *LPREMOVE_NODE;
+
+///////////////////////////////////////////////////////////////////////////////
+// REMOVE_STATE structure - Shared by every worker of one
+// RemoveDirectoryTree.
+
+typedef struct _tagREMOVE_STATE {
+  LPREMOVE_NODE pNodes;
+  size_t nNodes;
+  size_t nCapacity;
+  size_t nFirstSubtree;     /* Nodes from here on are removed in parallel */
+  uint64_t nRemoved;
+  uint64_t nFailed;
+  int nFirstError;
+} REMOVE_STATE, *LPREMOVE_STATE;
+
+///////////////////////////////////////////////////////////////////////////////
+// NAME_LIST structure - NUL-terminated names packed end to end.
+
+typedef struct _tagNAME_LIST {
+  char* pNames;
+  size_t nUsed;
+  size_t nCapacity;
+} NAME_LIST, *LPNAME_LIST;
+
+///////////////////////////////////////////////////////////////////////////////
+// REMOVE_FRAME structure - A directory on the path from the root of a
+// subtree being removed to the directory being cleared.  Only the deepest
+// one is open; the others are reached again through "..".
+
+typedef struct _tagREMOVE_FRAME {
+  const char* pszName;      /* Name in the parent directory */
+  dev_t nDevice;            /* Identify the directory when it is */
+  ino_t nInode;             /* reopened through ".." */
+  NAME_LIST subdirectories;
+  size_t nNextOffset;       /* Next subdirectory to remove */
+  BOOL bComplete;           /* Nothing beneath it has been left behind */
+} REMOVE_FRAME, *LPREMOVE_FRAME;
+
+///////////////////////////////////////////////////////////////////////////////
+// DELETE_MANY_JOB structure - Shared by the workers of DeleteMany.
+
+typedef struct _tagDELETE_MANY_JOB {
+  const char** ppszPaths;
+  int* pnErrors;
+} DELETE_MANY_JOB, *LPDELETE_MANY_JOB;
+
+///////////////////////////////////////////////////////////////////////////////
+// Internal functions
+
+///////////////////////////////////////////////////////////////////////////////
+// ReadDirectoryBatch function - Fills the buffer with as many entries as
+// the kernel will give us in one call.
+
+static ssize_t ReadDirectoryBatch(int nDirectoryDescriptor, char* pBuffer,
+    size_t nBufferSize) {
+  ssize_t nBytes = 0;
+  do {
+    nBytes = (ssize_t) syscall(SYS_getdents64, nDirectoryDescriptor, pBuffer,
+        nBufferSize);
+  } while (nBytes < 0 && errno == EINTR);
+
+  return nBytes;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// IsDotOrDotDot function
+
+static BOOL IsDotOrDotDot(const char* pszName) {
+  return pszName[0] == '.' && (pszName[1] == '\0'
+      || (pszName[1] == '.' && pszName[2] == '\0'));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ResolveEntryType function - Falls back to fstatat() only when the file
+// system did not fill in d_type.
+
+static unsigned char ResolveEntryType(int nDirectoryDescriptor,
+    const char* pszName, unsigned char nType) {
+  if (nType != DT_UNKNOWN) {
+    return nType;
+  }
+
+  struct stat st = { 0 };
+  if (OK != fstatat(nDirectoryDescriptor, pszName, &st,
+      AT_SYMLINK_NOFOLLOW)) {
+    return DT_UNKNOWN;
+  }
+
+  return IFTODT(st.st_mode);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// PushWalkItem function - Called by the owner of the deque.
+
+static int PushWalkItem(LPWALK_DEQUE lpDeque, LPWALK_ITEM lpItem) {
+  pthread_mutex_lock(&lpDeque->mutex);
+
+  if (lpDeque->nTail - lpDeque->nHead == lpDeque->nCapacity) {
+    size_t nCapacity = lpDeque->nCapacity * 2;
+    LPWALK_ITEM* ppItems = (LPWALK_ITEM*) malloc(
+        nCapacity * sizeof(LPWALK_ITEM));
+    if (ppItems == NULL) {
+      pthread_mutex_unlock(&lpDeque->mutex);
+      errno = ENOMEM;
+      return ERROR;
+    }
+
+    size_t nCount = lpDeque->nTail - lpDeque->nHead;
+    for (size_t i = 0; i < nCount; i++) {
+      ppItems[i] = lpDeque->ppItems[(lpDeque->nHead + i)
+          & (lpDeque->nCapacity - 1)];
+    }
+
+    free(lpDeque->ppItems);
+    lpDeque->ppItems = ppItems;
+    lpDeque->nCapacity = nCapacity;
+    lpDeque->nHead = 0;
+    lpDeque->nTail = nCount;
+  }
+
+  lpDeque->ppItems[lpDeque->nTail++ & (lpDeque->nCapacity - 1)] = lpItem;
+
+  pthread_mutex_unlock(&lpDeque->mutex);
+  return OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// TakeWalkItem function - Pops from the tail of the worker's own deque
+// (depth first, which keeps the working set small), or else steals from the
+// head of another worker's deque (the oldest, and so largest, subtree).
+
+static LPWALK_ITEM TakeWalkItem(LPWALK_STATE lpState, int nWorker) {
+  LPWALK_DEQUE lpOwn = &lpState->pDeques[nWorker];
+  LPWALK_ITEM lpItem = NULL;
+
+  pthread_mutex_lock(&lpOwn->mutex);
+  if (lpOwn->nTail != lpOwn->nHead) {
+    lpItem = lpOwn->ppItems[--lpOwn->nTail & (lpOwn->nCapacity - 1)];
+  }
+  pthread_mutex_unlock(&lpOwn->mutex);
+
+  for (int i = 1; lpItem == NULL && i < lpState->nWorkers; i++) {
+    LPWALK_DEQUE lpVictim =
+        &lpState->pDeques[(nWorker + i) % lpState->nWorkers];
+
+    if (pthread_mutex_trylock(&lpVictim->mutex) != OK) {
+      continue;
+    }
+    if (lpVictim->nTail != lpVictim->nHead) {
+      lpItem = lpVictim->ppItems[lpVictim->nHead++
+          & (lpVictim->nCapacity - 1)];
+    }
+    pthread_mutex_unlock(&lpVictim->mutex);
+  }
+
+  return lpItem;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// RecordWalkError function
+
+static void RecordWalkError(LPWALK_STATE lpState, int nError) {
+  int nExpected = 0;
+  __atomic_compare_exchange_n(&lpState->nFirstError, &nExpected, nError,
+      FALSE, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// NewWalkItem function
+
+static LPWALK_ITEM NewWalkItem(const char* pszPath, size_t nPathLength,
+    int nDepth) {
+  LPWALK_ITEM lpItem = (LPWALK_ITEM) malloc(sizeof(WALK_ITEM)
+      + nPathLength + 1);
+  if (lpItem == NULL) {
+    return NULL;
+  }
+
+  lpItem->nDepth = nDepth;
+  memcpy(lpItem->szPath, pszPath, nPathLength);
+  lpItem->szPath[nPathLength] = '\0';
+
+  return lpItem;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// WalkOneDirectory function - Reports every entry of one directory to the
+// callback and queues its subdirectories on the worker's own deque.  The
+// root is opened through a symbolic link, as EnumerateDirectory would; the
+// directories beneath it never are.
+
+static void WalkOneDirectory(LPWALK_STATE lpState, int nWorker,
+    LPWALK_ITEM lpItem, char* pBuffer, char* pszPath) {
+  int nDirectoryDescriptor = openat(lpState->nBaseDescriptor, lpItem->szPath,
+      O_RDONLY | O_DIRECTORY | O_CLOEXEC
+      | (lpItem->nDepth > 0 ? O_NOFOLLOW : 0));
+  if (nDirectoryDescriptor < 0) {
+    RecordWalkError(lpState, errno);
+    return;
+  }
+
+  /* Build each entry's path in place behind the directory's path. */
+  size_t nPrefixLength = strlen(lpItem->szPath);
+  memcpy(pszPath, lpItem->szPath, nPrefixLength);
+  if (nPrefixLength == 0 || pszPath[nPrefixLength - 1] != '/') {
+    pszPath[nPrefixLength++] = '/';
+  }
+
+  while (!__atomic_load_n(&lpState->bStop, __ATOMIC_RELAXED)) {
+    ssize_t nBytes = ReadDirectoryBatch(nDirectoryDescriptor, pBuffer,
+        DIRECTORY_READ_BUFFER_SIZE);
+    if (nBytes < 0) {
+      RecordWalkError(lpState, errno);
+      break;
+    }
+    if (nBytes == 0) {
+      break;
+    }
+
+    for (ssize_t nOffset = 0; nOffset < nBytes;) {
+      LPLINUX_DIRENT64 lpDirent = (LPLINUX_DIRENT64) (pBuffer + nOffset);
+      nOffset += lpDirent->d_reclen;
+
+      if (IsDotOrDotDot(lpDirent->d_name)) {
+        continue;
+      }
+
+      size_t nNameLength = strlen(lpDirent->d_name);
+      if (nPrefixLength + nNameLength > MAX_PATH) {
+        RecordWalkError(lpState, ENAMETOOLONG);
+        continue;
+      }
+      memcpy(pszPath + nPrefixLength, lpDirent->d_name, nNameLength + 1);
+
+      DIRECTORYENTRY entry;
+      entry.pszPath = pszPath;
+      entry.pszName = pszPath + nPrefixLength;
+      entry.nInode = lpDirent->d_ino;
+      entry.nType = ResolveEntryType(nDirectoryDescriptor, lpDirent->d_name,
+          lpDirent->d_type);
+      entry.nDepth = lpItem->nDepth + 1;
+
+      int nAction = lpState->lpfnCallback(&entry, lpState->pContext);
+      if (nAction == WALK_STOP) {
+        __atomic_store_n(&lpState->bStop, TRUE, __ATOMIC_RELAXED);
+        break;
+      }
+
+      if (entry.nType != DT_DIR || nAction == WALK_SKIP) {
+        continue;
+      }
+
+      LPWALK_ITEM lpChild = NewWalkItem(pszPath, nPrefixLength + nNameLength,
+          entry.nDepth);
+      if (lpChild == NULL) {
+        RecordWalkError(lpState, ENOMEM);
+        continue;
+      }
+
+      __atomic_add_fetch(&lpState->nPending, 1, __ATOMIC_SEQ_CST);
+      if (OK != PushWalkItem(&lpState->pDeques[nWorker], lpChild)) {
+        __atomic_sub_fetch(&lpState->nPending, 1, __ATOMIC_SEQ_CST);
+        RecordWalkError(lpState, ENOMEM);
+        free(lpChild);
+      }
+    }
+  }
+
+  close(nDirectoryDescriptor);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// WalkWorkerThreadProc function
+
+static void* WalkWorkerThreadProc(void* pArg) {
+  LPWALK_WORKER lpWorker = (LPWALK_WORKER) pArg;
+  LPWALK_STATE lpState = lpWorker->lpState;
+
+  char* pBuffer = (char*) malloc(DIRECTORY_READ_BUFFER_SIZE);
+  char* pszPath = (char*) malloc(MAX_PATH + 2);
+  if (pBuffer == NULL || pszPath == NULL) {
+    RecordWalkError(lpState, ENOMEM);
+    free(pBuffer);
+    free(pszPath);
+    return NULL;
+  }
+
+  int nIdleRounds = 0;
+  while (__atomic_load_n(&lpState->nPending, __ATOMIC_SEQ_CST) > 0) {
+    LPWALK_ITEM lpItem = TakeWalkItem(lpState, lpWorker->nIndex);
+    if (lpItem == NULL) {
+      /* Someone is still reading a directory that may yield more work. */
+      if (++nIdleRounds < 64) {
+        sched_yield();
+      } else {
+        usleep(100);
+      }
+      continue;
+    }
+
+    nIdleRounds = 0;
+    if (!__atomic_load_n(&lpState->bStop, __ATOMIC_RELAXED)) {
+      WalkOneDirectory(lpState, lpWorker->nIndex, lpItem, pBuffer, pszPath);
+    }
+    free(lpItem);
+
+    __atomic_sub_fetch(&lpState->nPending, 1, __ATOMIC_SEQ_CST);
+  }
+
+  free(pBuffer);
+  free(pszPath);
+  return NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// RecordRemoveFailure function
+
+static void RecordRemoveFailure(LPREMOVE_STATE lpState, int nError) {
+  __atomic_add_fetch(&lpState->nFailed, 1, __ATOMIC_RELAXED);
+
+  int nExpected = 0;
+  __atomic_compare_exchange_n(&lpState->nFirstError, &nExpected, nError,
+      FALSE, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// RemoveEntry function - Removes one name from an open directory.  A name
+// that is already gone counts as removed by someone else.
+
+static BOOL RemoveEntry(LPREMOVE_STATE lpState, int nDirectoryDescriptor,
+    const char* pszName, int nFlags) {
+  if (OK == unlinkat(nDirectoryDescriptor, pszName, nFlags)) {
+    __atomic_add_fetch(&lpState->nRemoved, 1, __ATOMIC_RELAXED);
+    return TRUE;
+  }
+
+  if (errno == ENOENT) {
+    return TRUE;
+  }
+
+  RecordRemoveFailure(lpState, errno);
+  return FALSE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// AddName function
+
+static int AddName(LPNAME_LIST lpList, const char* pszName) {
+  size_t nLength = strlen(pszName) + 1;
+
+  if (lpList->nUsed + nLength > lpList->nCapacity) {
+    size_t nCapacity = lpList->nCapacity == 0 ? 1024 : lpList->nCapacity * 2;
+    while (lpList->nUsed + nLength > nCapacity) {
+      nCapacity *= 2;
+    }
+    char* pNames = (char*) realloc(lpList->pNames, nCapacity);
+    if (pNames == NULL) {
+      errno = ENOMEM;
+      return ERROR;
+    }
+    lpList->pNames = pNames;
+    lpList->nCapacity = nCapacity;
+  }
+
+  memcpy(lpList->pNames + lpList->nUsed, pszName, nLength);
+  lpList->nUsed += nLength;
+  return OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ClearDirectoryFiles function - Unlinks everything in an open directory
+// except its subdirectories, whose names are collected instead.  Returns
+// FALSE if anything was left behind.
+
+static BOOL ClearDirectoryFiles(LPREMOVE_STATE lpState,
+    int nDirectoryDescriptor, char* pBuffer, LPNAME_LIST lpSubdirectories) {
+  BOOL bComplete = TRUE;
+
+  for (;;) {
+    ssize_t nBytes = ReadDirectoryBatch(nDirectoryDescriptor, pBuffer,
+        DIRECTORY_READ_BUFFER_SIZE);
+    if (nBytes < 0) {
+      RecordRemoveFailure(lpState, errno);
+      return FALSE;
+    }
+    if (nBytes == 0) {
+      return bComplete;
+    }
+
+    for (ssize_t nOffset = 0; nOffset < nBytes;) {
+      LPLINUX_DIRENT64 lpDirent = (LPLINUX_DIRENT64) (pBuffer + nOffset);
+      nOffset += lpDirent->d_reclen;
+
+      if (IsDotOrDotDot(lpDirent->d_name)) {
+        continue;
+      }
+
+      unsigned char nType = ResolveEntryType(nDirectoryDescriptor,
+          lpDirent->d_name, lpDirent->d_type);
+
+      /* A stale d_type is caught by EISDIR. */
+      if (nType != DT_DIR) {
+        if (OK == unlinkat(nDirectoryDescriptor, lpDirent->d_name, 0)) {
+          __atomic_add_fetch(&lpState->nRemoved, 1, __ATOMIC_RELAXED);
+          continue;
+        }
+        if (errno == ENOENT) {
+          continue;
+        }
+        if (errno != EISDIR) {
+          RecordRemoveFailure(lpState, errno);
+          bComplete = FALSE;
+          continue;
+        }
+      }
+
+      if (OK != AddName(lpSubdirectories, lpDirent->d_name)) {
+        RecordRemoveFailure(lpState, ENOMEM);
+        bComplete = FALSE;
+      }
+    }
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// EnterRemoveFrame function - Opens a subdirectory of the current directory,
+// clears the files out of it, and pushes it as the new deepest frame.
+// Returns the subdirectory's descriptor, or -1 if it could not be entered.
+
+static int EnterRemoveFrame(LPREMOVE_STATE lpState, LPREMOVE_FRAME* ppFrames,
+    size_t* pnFrames, size_t* pnCapacity, int nDirectoryDescriptor,
+    const char* pszName, char* pBuffer) {
+  int nSubdirectoryDescriptor = openat(nDirectoryDescriptor, pszName,
+      O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  if (nSubdirectoryDescriptor < 0) {
+    return ERROR;
+  }
+
+  struct stat st = { 0 };
+  if (OK != fstat(nSubdirectoryDescriptor, &st)) {
+    int nError = errno;
+    close(nSubdirectoryDescriptor);
+    errno = nError;
+    return ERROR;
+  }
+
+  if (*pnFrames == *pnCapacity) {
+    size_t nCapacity = *pnCapacity == 0 ? 16 : *pnCapacity * 2;
+    LPREMOVE_FRAME pFrames = (LPREMOVE_FRAME) realloc(*ppFrames,
+        nCapacity * sizeof(REMOVE_FRAME));
+    if (pFrames == NULL) {
+      close(nSubdirectoryDescriptor);
+      errno = ENOMEM;
+      return ERROR;
+    }
+    *ppFrames = pFrames;
+    *pnCapacity = nCapacity;
+  }
+
+  LPREMOVE_FRAME lpFrame = &(*ppFrames)[(*pnFrames)++];
+  memset(lpFrame, 0, sizeof(REMOVE_FRAME));
+  lpFrame->pszName = pszName;
+  lpFrame->nDevice = st.st_dev;
+  lpFrame->nInode = st.st_ino;
+  lpFrame->bComplete = ClearDirectoryFiles(lpState, nSubdirectoryDescriptor,
+      pBuffer, &lpFrame->subdirectories);
+
+  return nSubdirectoryDescriptor;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// RemoveSubtree function - Removes a directory and everything beneath it,
+// depth first, on the calling thread.  The walk is iterative and holds at
+// most two descriptors open, climbing back up through "..", so neither the
+// stack nor the descriptor table grows with the depth of the tree.  Returns
+// FALSE if anything was left behind.
+
+static BOOL RemoveSubtree(LPREMOVE_STATE lpState, int nParentDescriptor,
+    const char* pszName, char* pBuffer) {
+  LPREMOVE_FRAME pFrames = NULL;
+  size_t nFrames = 0;
+  size_t nCapacity = 0;
+  BOOL bComplete = TRUE;
+
+  /* The names of subdirectories live in their parent's frame, which
+   * outlasts them, so entering one needs no copy.  The read buffer is free
+   * again whenever a directory is entered, so every level shares it. */
+  int nDirectoryDescriptor = nParentDescriptor;
+  const char* pszEnter = pszName;
+
+  for (;;) {
+    if (pszEnter != NULL) {
+      int nSubdirectoryDescriptor = EnterRemoveFrame(lpState, &pFrames,
+          &nFrames, &nCapacity, nDirectoryDescriptor, pszEnter, pBuffer);
+      pszEnter = NULL;
+
+      if (nSubdirectoryDescriptor < 0) {
+        if (errno != ENOENT) {
+          RecordRemoveFailure(lpState, errno);
+          if (nFrames > 0) {
+            pFrames[nFrames - 1].bComplete = FALSE;
+          } else {
+            bComplete = FALSE;
+          }
+        }
+        continue;
+      }
+
+      if (nDirectoryDescriptor != nParentDescriptor) {
+        close(nDirectoryDescriptor);
+      }
+      nDirectoryDescriptor = nSubdirectoryDescriptor;
+      continue;
+    }
+
+    if (nFrames == 0) {
+      break;
+    }
+
+    LPREMOVE_FRAME lpFrame = &pFrames[nFrames - 1];
+    if (lpFrame->nNextOffset < lpFrame->subdirectories.nUsed) {
+      pszEnter = lpFrame->subdirectories.pNames + lpFrame->nNextOffset;
+      lpFrame->nNextOffset += strlen(pszEnter) + 1;
+      continue;
+    }
+
+    /* Everything beneath this directory has been dealt with; go back up
+     * to its parent, making sure it is still the directory we came from,
+     * and remove it there. */
+    int nUpperDescriptor = nParentDescriptor;
+    if (nFrames > 1) {
+      struct stat st = { 0 };
+      nUpperDescriptor = openat(nDirectoryDescriptor, "..",
+          O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+      if (nUpperDescriptor >= 0 && (OK != fstat(nUpperDescriptor, &st)
+          || st.st_dev != pFrames[nFrames - 2].nDevice
+          || st.st_ino != pFrames[nFrames - 2].nInode)) {
+        close(nUpperDescriptor);
+        nUpperDescriptor = -1;
+        errno = ESTALE;
+      }
+
+      if (nUpperDescriptor < 0) {
+        /* The subtree was moved while it was being removed; whatever is
+         * left of it is left alone. */
+        RecordRemoveFailure(lpState, errno);
+        close(nDirectoryDescriptor);
+        for (size_t i = 0; i < nFrames; i++) {
+          free(pFrames[i].subdirectories.pNames);
+        }
+        free(pFrames);
+        return FALSE;
+      }
+    }
+    close(nDirectoryDescriptor);
+    nDirectoryDescriptor = nUpperDescriptor;
+
+    BOOL bRemoved = lpFrame->bComplete && RemoveEntry(lpState,
+        nUpperDescriptor, lpFrame->pszName, AT_REMOVEDIR);
+    free(lpFrame->subdirectories.pNames);
+    nFrames--;
+
+    if (!bRemoved) {
+      if (nFrames > 0) {
+        pFrames[nFrames - 1].bComplete = FALSE;
+      } else {
+        bComplete = FALSE;
+      }
+    }
+  }
+
+  free(pFrames);
+  return bComplete;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// GetParentDescriptor function
+
+static int GetParentDescriptor(LPREMOVE_STATE lpState, size_t nNode) {
+  int nParent = lpState->pNodes[nNode].nParent;
+  return nParent < 0 ? AT_FDCWD
+      : lpState->pNodes[nParent].nDirectoryDescriptor;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// AddRemoveNode function
+
+static int AddRemoveNode(LPREMOVE_STATE lpState, int nParent,
+    const char* pszName) {
+  if (lpState->nNodes == lpState->nCapacity) {
+    size_t nCapacity = lpState->nCapacity == 0 ? 64 : lpState->nCapacity * 2;
+    LPREMOVE_NODE pNodes = (LPREMOVE_NODE) realloc(lpState->pNodes,
+        nCapacity * sizeof(REMOVE_NODE));
+    if (pNodes == NULL) {
+      errno = ENOMEM;
+      return ERROR;
+    }
+    lpState->pNodes = pNodes;
+    lpState->nCapacity = nCapacity;
+  }
+
+  char* pszCopy = strdup(pszName);
+  if (pszCopy == NULL) {
+    errno = ENOMEM;
+    return ERROR;
+  }
+
+  LPREMOVE_NODE lpNode = &lpState->pNodes[lpState->nNodes++];
+  lpNode->nParent = nParent;
+  lpNode->nDirectoryDescriptor = -1;
+  lpNode->bIncomplete = FALSE;
+  lpNode->pszName = pszCopy;
+
+  return OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ExpandRemoveNode function - Clears the files out of one directory near
+// the top of the tree and adds its subdirectories as nodes, keeping the
+// directory open so they can be removed relative to it.
+
+static void ExpandRemoveNode(LPREMOVE_STATE lpState, size_t nNode,
+    char* pBuffer) {
+  int nDirectoryDescriptor = lpState->pNodes[nNode].nDirectoryDescriptor;
+  if (nDirectoryDescriptor < 0) {
+    nDirectoryDescriptor = openat(GetParentDescriptor(lpState, nNode),
+        lpState->pNodes[nNode].pszName,
+        O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (nDirectoryDescriptor < 0) {
+      if (errno != ENOENT) {
+        RecordRemoveFailure(lpState, errno);
+        lpState->pNodes[nNode].bIncomplete = TRUE;
+      }
+      return;
+    }
+    lpState->pNodes[nNode].nDirectoryDescriptor = nDirectoryDescriptor;
+  }
+
+  NAME_LIST subdirectories = { NULL, 0, 0 };
+  if (!ClearDirectoryFiles(lpState, nDirectoryDescriptor, pBuffer,
+      &subdirectories)) {
+    lpState->pNodes[nNode].bIncomplete = TRUE;
+  }
+
+  for (size_t nOffset = 0; nOffset < subdirectories.nUsed;) {
+    const char* pszSubdirectory = subdirectories.pNames + nOffset;
+    nOffset += strlen(pszSubdirectory) + 1;
+
+    if (OK != AddRemoveNode(lpState, (int) nNode, pszSubdirectory)) {
+      RecordRemoveFailure(lpState, ENOMEM);
+      lpState->pNodes[nNode].bIncomplete = TRUE;
+    }
+  }
+
+  free(subdirectories.pNames);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// RemoveSubtreeProc function - Work routine for RemoveDirectoryTree.
+
+static void RemoveSubtreeProc(void* pContext, int nIndex) {
+  LPREMOVE_STATE lpState = (LPREMOVE_STATE) pContext;
+  size_t nNode = lpState->nFirstSubtree + (size_t) nIndex;
+
+  char* pBuffer = (char*) malloc(DIRECTORY_READ_BUFFER_SIZE);
+  BOOL bComplete = FALSE;
+  if (pBuffer == NULL) {
+    RecordRemoveFailure(lpState, ENOMEM);
+  } else {
+    bComplete = RemoveSubtree(lpState, GetParentDescriptor(lpState, nNode),
+        lpState->pNodes[nNode].pszName, pBuffer);
+  }
+  free(pBuffer);
+
+  if (!bComplete) {
+    __atomic_store_n(&lpState->pNodes[lpState->pNodes[nNode].nParent]
+        .bIncomplete, TRUE, __ATOMIC_RELAXED);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// DeleteOnePathProc function - Work routine for DeleteMany.
+
+static void DeleteOnePathProc(void* pContext, int nIndex) {
+  LPDELETE_MANY_JOB lpJob = (LPDELETE_MANY_JOB) pContext;
+
+  const char* pszPath = lpJob->ppszPaths[nIndex];
+  if (IsNullOrWhiteSpace(pszPath)) {
+    lpJob->pnErrors[nIndex] = EINVAL;
+    return;
+  }
+
+  /* Expand the path name a la Bash */
+  char szExpandedPathName[MAX_PATH + 1];
+  memset(szExpandedPathName, 0, MAX_PATH + 1);
+  ShellExpand(pszPath, szExpandedPathName, MAX_PATH + 1);
+
+  if (OK == unlink(szExpandedPathName)
+      || (errno == EISDIR && OK == rmdir(szExpandedPathName))) {
+    lpJob->pnErrors[nIndex] = 0;
+    return;
+  }
+
+  lpJob->pnErrors[nIndex] = errno;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ListDirectory function - Does the work of EnumerateDirectory and
+// EnumerateDirectoryAt.
+
+static int ListDirectory(LPFILECORECONTEXT lpContext, const char* pszPath,
+    LPDIRECTORYLISTING lpListing) {
+  if (IsNullOrWhiteSpace(pszPath) || lpListing == NULL) {
+    errno = EINVAL;
+    return ERROR;
+  }
+
+  memset(lpListing, 0, sizeof(DIRECTORYLISTING));
+
+  /* Expand the path name a la Bash */
+  char szExpandedPathName[MAX_PATH + 1];
+  if (OK != ExpandContextPath(lpContext, pszPath, szExpandedPathName,
+      MAX_PATH + 1)) {
+    return ERROR;
+  }
+
+  int nDirectoryDescriptor = openat(GetContextDescriptor(lpContext),
+      szExpandedPathName, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (nDirectoryDescriptor < 0) {
+    return ERROR;
+  }
+
+  char* pBuffer = (char*) malloc(DIRECTORY_READ_BUFFER_SIZE);
+
+  /* Entries and names each live in one block that grows geometrically.
+   * While the names block may still move, entries hold offsets into it
+   * (stashed in pszName); they are turned into pointers at the end. */
+  size_t nEntryCapacity = 64;
+  size_t nNameCapacity = 4096;
+  size_t nNamesUsed = 0;
+  LPDIRECTORYENTRY pEntries = (LPDIRECTORYENTRY) malloc(
+      nEntryCapacity * sizeof(DIRECTORYENTRY));
+  char* pNames = (char*) malloc(nNameCapacity);
+
+  int nResult = OK;
+  int nError = 0;
+
+  if (pBuffer == NULL || pEntries == NULL || pNames == NULL) {
+    nResult = ERROR;
+    nError = ENOMEM;
+  }
+
+  while (nResult == OK) {
+    ssize_t nBytes = ReadDirectoryBatch(nDirectoryDescriptor, pBuffer,
+        DIRECTORY_READ_BUFFER_SIZE);
+    if (nBytes < 0) {
+      nResult = ERROR;
+      nError = errno;
+      break;
+    }
+    if (nBytes == 0) {
+      break;
+    }
+
+    for (ssize_t nOffset = 0; nOffset < nBytes && nResult == OK;) {
+      LPLINUX_DIRENT64 lpDirent = (LPLINUX_DIRENT64) (pBuffer + nOffset);
+      nOffset += lpDirent->d_reclen;
+
+      if (IsDotOrDotDot(lpDirent->d_name)) {
+        continue;
+      }
+
+      size_t nNameLength = strlen(lpDirent->d_name) + 1;
+
+      if (lpListing->nCount == nEntryCapacity) {
+        LPDIRECTORYENTRY pGrown = (LPDIRECTORYENTRY) realloc(pEntries,
+            nEntryCapacity * 2 * sizeof(DIRECTORYENTRY));
+        if (pGrown == NULL) {
+          nResult = ERROR;
+          nError = ENOMEM;
+          break;
+        }
+        pEntries = pGrown;
+        nEntryCapacity *= 2;
+      }
+
+      if (nNamesUsed + nNameLength > nNameCapacity) {
+        size_t nGrownCapacity = nNameCapacity * 2;
+        while (nNamesUsed + nNameLength > nGrownCapacity) {
+          nGrownCapacity *= 2;
+        }
+        char* pGrown = (char*) realloc(pNames, nGrownCapacity);
+        if (pGrown == NULL) {
+          nResult = ERROR;
+          nError = ENOMEM;
+          break;
+        }
+        pNames = pGrown;
+        nNameCapacity = nGrownCapacity;
+      }
+
+      memcpy(pNames + nNamesUsed, lpDirent->d_name, nNameLength);
+
+      LPDIRECTORYENTRY lpEntry = &pEntries[lpListing->nCount++];
+      lpEntry->pszName = (const char*) (uintptr_t) nNamesUsed;
+      lpEntry->pszPath = NULL;
+      lpEntry->nInode = lpDirent->d_ino;
+      lpEntry->nType = ResolveEntryType(nDirectoryDescriptor,
+          lpDirent->d_name, lpDirent->d_type);
+      lpEntry->nDepth = 1;
+
+      nNamesUsed += nNameLength;
+    }
+  }
+
+  close(nDirectoryDescriptor);
+  free(pBuffer);
+
+  if (nResult != OK) {
+    free(pEntries);
+    free(pNames);
+    memset(lpListing, 0, sizeof(DIRECTORYLISTING));
+    errno = nError;
+    return ERROR;
+  }
+
+  for (size_t i = 0; i < lpListing->nCount; i++) {
+    pEntries[i].pszName = pNames + (uintptr_t) pEntries[i].pszName;
+    pEntries[i].pszPath = pEntries[i].pszName;
+  }
+
+  lpListing->pEntries = pEntries;
+  lpListing->pNames = pNames;
+
+  return OK;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// WalkTree function - Does the work of WalkDirectoryTree and
+// WalkDirectoryTreeAt.
+
+static int WalkTree(LPFILECORECONTEXT lpContext, const char* pszPath,
+    int nThreads, DIRECTORY_WALK_CALLBACK lpfnCallback, void* pContext) {
+  if (IsNullOrWhiteSpace(pszPath) || lpfnCallback == NULL) {
+    errno = EINVAL;
+    return ERROR;
+  }
+
+  if (nThreads <= 0) {
+    nThreads = GetDefaultWorkerCount();
+  }
+  if (nThreads > MAX_WORKER_COUNT) {
+    nThreads = MAX_WORKER_COUNT;
+  }
+
+  /* Expand the path name a la Bash */
+  char szExpandedPathName[MAX_PATH + 1];
+  if (OK != ExpandContextPath(lpContext, pszPath, szExpandedPathName,
+      MAX_PATH + 1)) {
+    return ERROR;
+  }
+
+  WALK_STATE state;
+  memset(&state, 0, sizeof(WALK_STATE));
+  state.nWorkers = nThreads;
+  state.lpfnCallback = lpfnCallback;
+  state.pContext = pContext;
+  state.nBaseDescriptor = GetContextDescriptor(lpContext);
+  state.pDeques = (LPWALK_DEQUE) calloc(nThreads, sizeof(WALK_DEQUE));
+  if (state.pDeques == NULL) {
+    errno = ENOMEM;
+    return ERROR;
+  }
+
+  int nResult = OK;
+  int nInitialized = 0;
+  for (; nInitialized < nThreads; nInitialized++) {
+    LPWALK_DEQUE lpDeque = &state.pDeques[nInitialized];
+    lpDeque->nCapacity = 64;
+    lpDeque->ppItems = (LPWALK_ITEM*) malloc(
+        lpDeque->nCapacity * sizeof(LPWALK_ITEM));
+    if (lpDeque->ppItems == NULL) {
+      nResult = ERROR;
+      break;
+    }
+    pthread_mutex_init(&lpDeque->mutex, NULL);
+  }
+
+  LPWALK_ITEM lpRoot = nResult == OK ? NewWalkItem(szExpandedPathName,
+      strlen(szExpandedPathName), 0) : NULL;
+  if (lpRoot == NULL) {
+    nResult = ERROR;
+  }
+
+  if (nResult == OK) {
+    state.nPending = 1;
+    PushWalkItem(&state.pDeques[0], lpRoot);
+
+    WALK_WORKER workers[nThreads];
+    pthread_t threads[nThreads];
+    int nStarted = 0;
+
+    for (int i = 0; i < nThreads; i++) {
+      workers[i].lpState = &state;
+      workers[i].nIndex = i;
+    }
+
+    /* The calling thread acts as worker zero. */
+    for (int i = 1; i < nThreads; i++) {
+      if (OK != pthread_create(&threads[i], NULL, WalkWorkerThreadProc,
+          &workers[i])) {
+        break;
+      }
+      nStarted = i;
+    }
+
+    WalkWorkerThreadProc(&workers[0]);
+
+    for (int i = 1; i <= nStarted; i++) {
+      pthread_join(threads[i], NULL);
+    }
+
+    /* Only left over if the walk was stopped early: every deque is drained
+     * by the workers otherwise. */
+    for (int i = 0; i < nThreads; i++) {
+      LPWALK_DEQUE lpDeque = &state.pDeques[i];
+      for (size_t j = lpDeque->nHead; j != lpDeque->nTail; j++) {
+        free(lpDeque->ppItems[j & (lpDeque->nCapacity - 1)]);
+      }
+    }
+  }
+
+  for (int i = 0; i < nInitialized; i++) {
+    pthread_mutex_destroy(&state.pDeques[i].mutex);
+    free(state.pDeques[i].ppItems);
+  }
+  free(state.pDeques);
+
+  if (nResult != OK) {
+    errno = ENOMEM;
+    return ERROR;
+  }
+
+  if (state.nFirstError != 0) {
+    errno = state.nFirstError;
+    return ERROR;
+  }
+
+  return OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Publicly-exposed functions
+
+///////////////////////////////////////////////////////////////////////////////
+// DeleteMany function
+
+int DeleteMany(const char** ppszPaths, int nCount, int* pnErrors) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_DELETE_MANY);
+
+  if (ppszPaths == NULL || nCount < 0) {
+    errno = EINVAL;
+    return ERROR;
+  }
+
+  DELETE_MANY_JOB job = { ppszPaths, pnErrors };
+  if (job.pnErrors == NULL && nCount > 0) {
+    job.pnErrors = (int*) calloc(nCount, sizeof(int));
+    if (job.pnErrors == NULL) {
+      errno = ENOMEM;
+      return ERROR;
+    }
+  }
+
+  /* Unlinking costs more than a statx() but still far less than starting
+   * a thread, so bring in a thread per batch of paths. */
+  int nThreads = (nCount + DELETE_MANY_PATHS_PER_THREAD - 1)
+      / DELETE_MANY_PATHS_PER_THREAD;
+  int nMaxThreads = GetDefaultWorkerCount();
+  if (nThreads > nMaxThreads) {
+    nThreads = nMaxThreads;
+  }
+
+  RunInParallel(nCount, nThreads, DeleteOnePathProc, &job);
+
+  int nError = 0;
+  for (int i = 0; i < nCount && nError == 0; i++) {
+    nError = job.pnErrors[i];
+  }
+
+  if (job.pnErrors != pnErrors) {
+    free(job.pnErrors);
+  }
+
+  if (nError != 0) {
+    errno = nError;
+    return ERROR;
+  }
+
+  return OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// EnumerateDirectory function
+
+int EnumerateDirectory(const char* pszPath, LPDIRECTORYLISTING lpListing) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_ENUMERATE_DIRECTORY);
+
+  return ListDirectory(NULL, pszPath, lpListing);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// EnumerateDirectoryAt function
+
+int EnumerateDirectoryAt(LPFILECORECONTEXT lpContext, const char* pszPath,
+    LPDIRECTORYLISTING lpListing) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_ENUMERATE_DIRECTORY_AT);
+
+  return ListDirectory(lpContext, pszPath, lpListing);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// FreeDirectoryListing function
+
+void FreeDirectoryListing(LPDIRECTORYLISTING lpListing) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_FREE_DIRECTORY_LISTING);
+
+  if (lpListing == NULL) {
+    return;
+  }
+
+  free(lpListing->pEntries);
+  free(lpListing->pNames);
+  memset(lpListing, 0, sizeof(DIRECTORYLISTING));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// RemoveDirectoryTree function
+
+int RemoveDirectoryTree(const char* pszPath, LPREMOVETREEOPTIONS lpOptions,
+    LPREMOVETREERESULT lpResult) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_REMOVE_DIRECTORY_TREE);
+
+  if (lpResult != NULL) {
+    memset(lpResult, 0, sizeof(REMOVETREERESULT));
+  }
+
+  if (IsNullOrWhiteSpace(pszPath)) {
+    errno = EINVAL;
+    return ERROR;
+  }
+
+  int nThreads = lpOptions != NULL ? lpOptions->nThreads : 0;
+  int nFlags = lpOptions != NULL ? lpOptions->nFlags : REMOVE_TREE_FLAG_NONE;
+  if (nThreads <= 0) {
+    nThreads = GetDefaultWorkerCount();
+  }
+
+  /* Expand the path name a la Bash */
+  char szExpandedPathName[MAX_PATH + 1];
+  memset(szExpandedPathName, 0, MAX_PATH + 1);
+  ShellExpand(pszPath, szExpandedPathName, MAX_PATH + 1);
+
+  int nRootDescriptor = open(szExpandedPathName,
+      O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  if (nRootDescriptor < 0) {
+    return errno == ENOENT && (nFlags & REMOVE_TREE_FLAG_MISSING_OK)
+        ? OK : ERROR;
+  }
+
+  REMOVE_STATE state;
+  memset(&state, 0, sizeof(REMOVE_STATE));
+
+  char* pBuffer = (char*) malloc(DIRECTORY_READ_BUFFER_SIZE);
+  if (pBuffer == NULL || OK != AddRemoveNode(&state, -1,
+      szExpandedPathName)) {
+    free(pBuffer);
+    free(state.pNodes);
+    close(nRootDescriptor);
+    errno = ENOMEM;
+    return ERROR;
+  }
+  state.pNodes[0].nDirectoryDescriptor = nRootDescriptor;
+
+  /* Clear the top of the tree one level at a time, on this thread, until
+   * there are enough subtrees to keep every worker busy.  Every node
+   * expanded stays open until the end, so a deep, narrow tree stops being
+   * expanded once that many are open.  Nodes are added only here, so the
+   * array holds still once the workers start. */
+  size_t nTargetSubtrees = (size_t) nThreads
+      * REMOVE_TREE_SUBTREES_PER_THREAD;
+  size_t nLevelStart = 0;
+  size_t nLevelEnd = 1;
+  while (nLevelEnd > nLevelStart
+      && nLevelEnd - nLevelStart < nTargetSubtrees
+      && nLevelEnd <= REMOVE_TREE_MAX_OPEN_DIRECTORIES) {
+    for (size_t i = nLevelStart; i < nLevelEnd; i++) {
+      ExpandRemoveNode(&state, i, pBuffer);
+    }
+    nLevelStart = nLevelEnd;
+    nLevelEnd = state.nNodes;
+  }
+  free(pBuffer);
+
+  state.nFirstSubtree = nLevelStart;
+  RunInParallel((int) (state.nNodes - nLevelStart), nThreads,
+      RemoveSubtreeProc, &state);
+
+  /* Children come after their parents, so walking backward removes each
+   * directory once everything beneath it is gone. */
+  for (size_t i = nLevelStart; i-- > 0;) {
+    LPREMOVE_NODE lpNode = &state.pNodes[i];
+    if (lpNode->nDirectoryDescriptor >= 0) {
+      close(lpNode->nDirectoryDescriptor);
+    }
+
+    BOOL bComplete = !lpNode->bIncomplete;
+    if (bComplete && (i > 0 || !(nFlags & REMOVE_TREE_FLAG_KEEP_ROOT))) {
+      bComplete = RemoveEntry(&state, GetParentDescriptor(&state, i),
+          lpNode->pszName, AT_REMOVEDIR);
+    }
+    if (!bComplete && lpNode->nParent >= 0) {
+      state.pNodes[lpNode->nParent].bIncomplete = TRUE;
+    }
+  }
+
+  for (size_t i = 0; i < state.nNodes; i++) {
+    free(state.pNodes[i].pszName);
+  }
+  free(state.pNodes);
+
+  if (lpResult != NULL) {
+    lpResult->nRemoved = state.nRemoved;
+    lpResult->nFailed = state.nFailed;
+    lpResult->nFirstError = state.nFirstError;
+  }
+
+  if (state.nFirstError != 0) {
+    errno = state.nFirstError;
+    return ERROR;
+  }
+
+  return OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// WalkDirectoryTree function
+
+int WalkDirectoryTree(const char* pszPath, int nThreads,
+    DIRECTORY_WALK_CALLBACK lpfnCallback, void* pContext) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_WALK_DIRECTORY_TREE);
+
+  return WalkTree(NULL, pszPath, nThreads, lpfnCallback, pContext);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// WalkDirectoryTreeAt function
+
+int WalkDirectoryTreeAt(LPFILECORECONTEXT lpContext, const char* pszPath,
+    int nThreads, DIRECTORY_WALK_CALLBACK lpfnCallback, void* pContext) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_WALK_DIRECTORY_TREE_AT);
+
+  return WalkTree(lpContext, pszPath, nThreads, lpfnCallback, pContext);
+}
@@ -0,0 +1,218 @@
+/*
+ * file_context.c
+ *
+ *  Per-context base directories.  A FILECORECONTEXT holds a descriptor of a
+ *  directory, and the *At functions resolve relative paths against it with
+ *  openat(), mkdirat(), statx() and unlinkat() rather than against the
+ *  process-wide working directory, so each thread can keep its own.
+ */
+
+#include "stdafx.h"
+#include "file_core.h"
+
+#include "file_core_internal.h"
+#include "file_core_symbols.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// FILECORECONTEXT structure
+
+struct _tagFILECORECONTEXT {
+  int nDirectoryDescriptor;   /* O_PATH descriptor of the base directory */
+  int nFlags;                 /* CONTEXT_FLAG_* values */
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Internal functions
+
+///////////////////////////////////////////////////////////////////////////////
+// CopyContextPath function - Copies a path into a buffer of nBufferSize bytes,
+// expanding it a la Bash unless nFlags asks for it to be taken literally.
+
+static int CopyContextPath(int nFlags, const char* pszPath, char* pszBuffer,
+    int nBufferSize) {
+  memset(pszBuffer, 0, nBufferSize);
+
+  if (!(nFlags & CONTEXT_FLAG_LITERAL_PATHS)) {
+    ShellExpand(pszPath, pszBuffer, nBufferSize);
+    return OK;
+  }
+
+  /* A literal path that was cut short would name some other file. */
+  size_t nLength = strlen(pszPath);
+  if (nLength >= (size_t) nBufferSize) {
+    errno = ENAMETOOLONG;
+    return ERROR;
+  }
+
+  memcpy(pszBuffer, pszPath, nLength);
+  return OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// OpenBaseDirectory function - Opens a directory for use as a base for
+// relative paths.  Search permission is all that is needed, so O_PATH.
+
+static int OpenBaseDirectory(int nDirectoryDescriptor,
+    const char* pszDirectoryPath, int nFlags) {
+  char szExpandedPathName[MAX_PATH + 1];
+  if (OK != CopyContextPath(nFlags, pszDirectoryPath, szExpandedPathName,
+      MAX_PATH + 1)) {
+    return -1;
+  }
+
+  return openat(nDirectoryDescriptor, szExpandedPathName,
+      O_PATH | O_DIRECTORY | O_CLOEXEC);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ExpandContextPath function
+
+int ExpandContextPath(LPFILECORECONTEXT lpContext, const char* pszPath,
+    char* pszBuffer, int nBufferSize) {
+  return CopyContextPath(lpContext == NULL ? CONTEXT_FLAG_NONE
+      : lpContext->nFlags, pszPath, pszBuffer, nBufferSize);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// GetContextDescriptor function
+
+int GetContextDescriptor(LPFILECORECONTEXT lpContext) {
+  return lpContext == NULL ? AT_FDCWD : lpContext->nDirectoryDescriptor;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// NewContext function - Does the work of CreateFileCoreContext and
+// CreateFileCoreContextEx.
+
+static LPFILECORECONTEXT NewContext(const char* pszDirectoryPath,
+    int nFlags) {
+  int nDirectoryDescriptor = IsNullOrWhiteSpace(pszDirectoryPath)
+      ? open(".", O_PATH | O_DIRECTORY | O_CLOEXEC)
+      : OpenBaseDirectory(AT_FDCWD, pszDirectoryPath, nFlags);
+  if (nDirectoryDescriptor < 0) {
+    return NULL;
+  }
+
+  LPFILECORECONTEXT lpContext = (LPFILECORECONTEXT) malloc(
+      sizeof(FILECORECONTEXT));
+  if (lpContext == NULL) {
+    close(nDirectoryDescriptor);
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  lpContext->nDirectoryDescriptor = nDirectoryDescriptor;
+  lpContext->nFlags = nFlags;
+  return lpContext;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Publicly-exposed functions
+
+///////////////////////////////////////////////////////////////////////////////
+// CreateFileCoreContext function
+
+LPFILECORECONTEXT CreateFileCoreContext(const char* pszDirectoryPath) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_CREATE_FILE_CORE_CONTEXT);
+
+  return NewContext(pszDirectoryPath, CONTEXT_FLAG_NONE);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// CreateFileCoreContextEx function
+
+LPFILECORECONTEXT CreateFileCoreContextEx(const char* pszDirectoryPath,
+    int nFlags) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_CREATE_FILE_CORE_CONTEXT_EX);
+
+  if (nFlags & ~CONTEXT_FLAG_LITERAL_PATHS) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  return NewContext(pszDirectoryPath, nFlags);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// DestroyFileCoreContext function
+
+void DestroyFileCoreContext(LPFILECORECONTEXT* lppContext) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_DESTROY_FILE_CORE_CONTEXT);
+
+  if (lppContext == NULL || *lppContext == NULL) {
+    return;
+  }
+
+  close((*lppContext)->nDirectoryDescriptor);
+  free(*lppContext);
+  *lppContext = NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// GetContextDirectory function
+
+int GetContextDirectory(LPFILECORECONTEXT lpContext, char* pszBuffer,
+    size_t nBufferSize) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_GET_CONTEXT_DIRECTORY);
+
+  if (pszBuffer == NULL || nBufferSize == 0) {
+    errno = EINVAL;
+    return ERROR;
+  }
+
+  if (lpContext == NULL) {
+    return getcwd(pszBuffer, nBufferSize) == NULL ? ERROR : OK;
+  }
+
+  char szProcPath[64];
+  snprintf(szProcPath, sizeof(szProcPath), "/proc/self/fd/%d",
+      lpContext->nDirectoryDescriptor);
+
+  /* readlink() truncates silently, so a full buffer may not be the whole
+   * path. */
+  ssize_t nLength = readlink(szProcPath, pszBuffer, nBufferSize);
+  if (nLength < 0) {
+    return ERROR;
+  }
+  if ((size_t) nLength >= nBufferSize) {
+    errno = ERANGE;
+    return ERROR;
+  }
+
+  pszBuffer[nLength] = '\0';
+  return OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// SetContextDirectory function
+
+int SetContextDirectory(LPFILECORECONTEXT lpContext,
+    const char* pszDirectoryPath) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_SET_CONTEXT_DIRECTORY);
+
+  if (lpContext == NULL || IsNullOrWhiteSpace(pszDirectoryPath)) {
+    errno = EINVAL;
+    return ERROR;
+  }
+
+  int nDirectoryDescriptor = OpenBaseDirectory(
+      lpContext->nDirectoryDescriptor, pszDirectoryPath, lpContext->nFlags);
+  if (nDirectoryDescriptor < 0) {
+    return ERROR;
+  }
+
+  /* dup3() swaps the directory in under the same descriptor number in one
+   * step, so a call running meanwhile on another thread sees either the
+   * old directory or the new one, never a closed descriptor. */
+  int nResult = dup3(nDirectoryDescriptor, lpContext->nDirectoryDescriptor,
+      O_CLOEXEC);
+  int nError = errno;
+  close(nDirectoryDescriptor);
+
+  if (nResult < 0) {
+    errno = nError;
+    return ERROR;
+  }
+
+  return OK;
+}
@@ -0,0 +1,634 @@
+/*
+ * file_copy.c
+ *
+ *  Copying and moving of files without pulling their contents through user
+ *  space: reflinks where the file system shares extents, then in-kernel
+ *  copies, with a buffered loop as the last resort.
+ */
+
+#include "stdafx.h"
+#include "file_core.h"
+
+#include "file_core_internal.h"
+#include "file_core_symbols.h"
+
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+
+///////////////////////////////////////////////////////////////////////////////
+// COPY_RANGE structure - A run of data to copy.
+
+typedef struct _tagCOPY_RANGE {
+  off_t nOffset;
+  off_t nLength;
+} COPY_RANGE, *LPCOPY_RANGE;
+
+///////////////////////////////////////////////////////////////////////////////
+// COPY_JOB structure - Shared by everything copying one file.
+
+typedef struct _tagCOPY_JOB {
+  int nSourceDescriptor;
+  int nTargetDescriptor;
+  BOOL bNoCopyFileRange;      /* copy_file_range() is unsupported here */
+  BOOL bNoSendfile;           /* sendfile() is unsupported here */
+  int nFirstError;
+  uint64_t nBytesCopied;
+  LPCOPY_RANGE pRanges;       /* Used by the parallel copy */
+} COPY_JOB, *LPCOPY_JOB;
+
+///////////////////////////////////////////////////////////////////////////////
+// Internal functions
+
+///////////////////////////////////////////////////////////////////////////////
+// IsUnsupportedError function - Errors that mean an in-kernel copy cannot be
+// used between these two files, as opposed to a genuine I/O failure.
+
+static BOOL IsUnsupportedError(int nError) {
+  return nError == EXDEV || nError == EINVAL || nError == ENOSYS
+      || nError == EOPNOTSUPP || nError == ENOTSUP || nError == EBADF
+      || nError == EPERM;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// RecordCopyError function
+
+static void RecordCopyError(LPCOPY_JOB lpJob, int nError) {
+  int nExpected = 0;
+  __atomic_compare_exchange_n(&lpJob->nFirstError, &nExpected, nError,
+      FALSE, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// CopyWithReadWrite function - Positional copy through a user-space buffer,
+// so any number of threads can work on the same pair of files.
+
+static int CopyWithReadWrite(LPCOPY_JOB lpJob, off_t nOffset, off_t nLength,
+    char** ppBuffer) {
+  if (*ppBuffer == NULL) {
+    *ppBuffer = (char*) malloc(COPY_BUFFER_SIZE);
+    if (*ppBuffer == NULL) {
+      errno = ENOMEM;
+      return ERROR;
+    }
+  }
+
+  while (nLength > 0) {
+    size_t nToRead = nLength < COPY_BUFFER_SIZE ? (size_t) nLength
+        : COPY_BUFFER_SIZE;
+    ssize_t nBytesRead = pread(lpJob->nSourceDescriptor, *ppBuffer, nToRead,
+        nOffset);
+    if (nBytesRead < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return ERROR;
+    }
+    if (nBytesRead == 0) {
+      /* The source shrank while we were copying it. */
+      break;
+    }
+
+    if (OK != WriteFully(lpJob->nTargetDescriptor, *ppBuffer,
+        (size_t) nBytesRead, nOffset)) {
+      return ERROR;
+    }
+
+    nOffset += nBytesRead;
+    nLength -= nBytesRead;
+    __atomic_add_fetch(&lpJob->nBytesCopied, (uint64_t) nBytesRead,
+        __ATOMIC_RELAXED);
+  }
+
+  return OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// CopyRange function - Copies one run of data at the same offset in both
+// files, with the fastest mechanism that works.  sendfile() moves the
+// target's file position, so it is only tried when bAllowSendfile says that
+// no other thread shares the target.
+
+static int CopyRange(LPCOPY_JOB lpJob, off_t nOffset, off_t nLength,
+    BOOL bAllowSendfile, char** ppBuffer) {
+  while (nLength > 0
+      && !__atomic_load_n(&lpJob->bNoCopyFileRange, __ATOMIC_RELAXED)) {
+    loff_t nSourceOffset = nOffset;
+    loff_t nTargetOffset = nOffset;
+    size_t nChunk = nLength < MAX_READ_CHUNK_SIZE ? (size_t) nLength
+        : MAX_READ_CHUNK_SIZE;
+
+    ssize_t nCopied = copy_file_range(lpJob->nSourceDescriptor,
+        &nSourceOffset, lpJob->nTargetDescriptor, &nTargetOffset, nChunk, 0);
+    if (nCopied < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (!IsUnsupportedError(errno)) {
+        return ERROR;
+      }
+      __atomic_store_n(&lpJob->bNoCopyFileRange, TRUE, __ATOMIC_RELAXED);
+      break;
+    }
+    if (nCopied == 0) {
+      return OK;
+    }
+
+    nOffset += nCopied;
+    nLength -= nCopied;
+    __atomic_add_fetch(&lpJob->nBytesCopied, (uint64_t) nCopied,
+        __ATOMIC_RELAXED);
+  }
+
+  if (nLength > 0 && bAllowSendfile && !lpJob->bNoSendfile) {
+    if (lseek(lpJob->nTargetDescriptor, nOffset, SEEK_SET) < 0) {
+      return ERROR;
+    }
+
+    while (nLength > 0) {
+      off_t nSourceOffset = nOffset;
+      size_t nChunk = nLength < MAX_READ_CHUNK_SIZE ? (size_t) nLength
+          : MAX_READ_CHUNK_SIZE;
+
+      ssize_t nCopied = sendfile(lpJob->nTargetDescriptor,
+          lpJob->nSourceDescriptor, &nSourceOffset, nChunk);
+      if (nCopied < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        if (!IsUnsupportedError(errno)) {
+          return ERROR;
+        }
+        lpJob->bNoSendfile = TRUE;
+        break;
+      }
+      if (nCopied == 0) {
+        return OK;
+      }
+
+      nOffset += nCopied;
+      nLength -= nCopied;
+      lpJob->nBytesCopied += (uint64_t) nCopied;
+    }
+  }
+
+  if (nLength > 0) {
+    return CopyWithReadWrite(lpJob, nOffset, nLength, ppBuffer);
+  }
+
+  return OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// CopyStream function - Copies from the source's current position until
+// end-of-file, for sources that cannot be read at an offset.
+
+static int CopyStream(LPCOPY_JOB lpJob) {
+  char* pBuffer = (char*) malloc(COPY_BUFFER_SIZE);
+  if (pBuffer == NULL) {
+    errno = ENOMEM;
+    return ERROR;
+  }
+
+  int nResult = OK;
+  while (TRUE) {
+    ssize_t nBytesRead = read(lpJob->nSourceDescriptor, pBuffer,
+        COPY_BUFFER_SIZE);
+    if (nBytesRead < 0 && errno == EINTR) {
+      continue;
+    }
+    if (nBytesRead <= 0) {
+      nResult = nBytesRead == 0 ? OK : ERROR;
+      break;
+    }
+
+    if (OK != WriteFully(lpJob->nTargetDescriptor, pBuffer,
+        (size_t) nBytesRead, -1)) {
+      nResult = ERROR;
+      break;
+    }
+    lpJob->nBytesCopied += (uint64_t) nBytesRead;
+  }
+
+  int nError = errno;
+  free(pBuffer);
+  errno = nError;
+
+  return nResult;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// GetNextDataRange function - Finds the next run of data at or after
+// nOffset, skipping holes.  Returns FALSE once there is no more data.  File
+// systems that cannot report holes describe the whole file as data.
+
+static BOOL GetNextDataRange(int nFileDescriptor, off_t nOffset,
+    off_t nFileSize, LPCOPY_RANGE lpRange) {
+  if (nOffset >= nFileSize) {
+    return FALSE;
+  }
+
+  off_t nDataStart = lseek(nFileDescriptor, nOffset, SEEK_DATA);
+  if (nDataStart < 0) {
+    if (errno == ENXIO) {
+      /* Nothing but a hole from here to the end. */
+      return FALSE;
+    }
+    lpRange->nOffset = nOffset;
+    lpRange->nLength = nFileSize - nOffset;
+    return TRUE;
+  }
+
+  off_t nDataEnd = lseek(nFileDescriptor, nDataStart, SEEK_HOLE);
+  if (nDataEnd < 0 || nDataEnd > nFileSize) {
+    nDataEnd = nFileSize;
+  }
+
+  lpRange->nOffset = nDataStart;
+  lpRange->nLength = nDataEnd - nDataStart;
+  return lpRange->nLength > 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// CopyRangeProc function - Work routine for the parallel copy.
+
+static void CopyRangeProc(void* pContext, int nIndex) {
+  LPCOPY_JOB lpJob = (LPCOPY_JOB) pContext;
+  if (__atomic_load_n(&lpJob->nFirstError, __ATOMIC_RELAXED) != 0) {
+    return;
+  }
+
+  char* pBuffer = NULL;
+  if (OK != CopyRange(lpJob, lpJob->pRanges[nIndex].nOffset,
+      lpJob->pRanges[nIndex].nLength, FALSE, &pBuffer)) {
+    RecordCopyError(lpJob, errno);
+  }
+  free(pBuffer);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// CopyDataInParallel function - Cuts the data runs of the source into
+// pieces of COPY_PARALLEL_CHUNK_SIZE and copies them on worker threads.
+
+static int CopyDataInParallel(LPCOPY_JOB lpJob, off_t nFileSize) {
+  int nCapacity = 64;
+  int nCount = 0;
+  lpJob->pRanges = (LPCOPY_RANGE) malloc(nCapacity * sizeof(COPY_RANGE));
+  if (lpJob->pRanges == NULL) {
+    errno = ENOMEM;
+    return ERROR;
+  }
+
+  COPY_RANGE range;
+  off_t nOffset = 0;
+  while (GetNextDataRange(lpJob->nSourceDescriptor, nOffset, nFileSize,
+      &range)) {
+    nOffset = range.nOffset + range.nLength;
+
+    while (range.nLength > 0) {
+      if (nCount == nCapacity) {
+        LPCOPY_RANGE pGrown = (LPCOPY_RANGE) realloc(lpJob->pRanges,
+            nCapacity * 2 * sizeof(COPY_RANGE));
+        if (pGrown == NULL) {
+          free(lpJob->pRanges);
+          lpJob->pRanges = NULL;
+          errno = ENOMEM;
+          return ERROR;
+        }
+        lpJob->pRanges = pGrown;
+        nCapacity *= 2;
+      }
+
+      off_t nPiece = range.nLength < COPY_PARALLEL_CHUNK_SIZE
+          ? range.nLength : COPY_PARALLEL_CHUNK_SIZE;
+      lpJob->pRanges[nCount].nOffset = range.nOffset;
+      lpJob->pRanges[nCount].nLength = nPiece;
+      nCount++;
+
+      range.nOffset += nPiece;
+      range.nLength -= nPiece;
+    }
+  }
+
+  RunInParallel(nCount, 0, CopyRangeProc, lpJob);
+
+  free(lpJob->pRanges);
+  lpJob->pRanges = NULL;
+
+  if (lpJob->nFirstError != 0) {
+    errno = lpJob->nFirstError;
+    return ERROR;
+  }
+
+  return OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// CopyData function - Copies every data run of the source, one after the
+// other.
+
+static int CopyData(LPCOPY_JOB lpJob, off_t nFileSize) {
+  char* pBuffer = NULL;
+  int nResult = OK;
+
+  COPY_RANGE range;
+  off_t nOffset = 0;
+  while (nResult == OK && GetNextDataRange(lpJob->nSourceDescriptor,
+      nOffset, nFileSize, &range)) {
+    nResult = CopyRange(lpJob, range.nOffset, range.nLength, TRUE, &pBuffer);
+    nOffset = range.nOffset + range.nLength;
+  }
+
+  int nError = errno;
+  free(pBuffer);
+  errno = nError;
+
+  return nResult;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// PublishCopy function - Gives a finished copy its final name.  Without
+// COPY_FLAG_OVERWRITE, a target that appeared during the copy is left alone
+// and the function fails with EEXIST.
+
+static int PublishCopy(const char* pszTemporaryPath, const char* pszTarget,
+    int nFlags) {
+  if (nFlags & COPY_FLAG_OVERWRITE) {
+    return rename(pszTemporaryPath, pszTarget) == OK ? OK : ERROR;
+  }
+
+  if (OK == renameat2(AT_FDCWD, pszTemporaryPath, AT_FDCWD, pszTarget,
+      RENAME_NOREPLACE)) {
+    return OK;
+  }
+
+  /* Older kernels and some file systems lack RENAME_NOREPLACE; link()
+   * never replaces an existing name either. */
+  if ((errno != EINVAL && errno != ENOSYS)
+      || OK != link(pszTemporaryPath, pszTarget)) {
+    return ERROR;
+  }
+
+  unlink(pszTemporaryPath);
+  return OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// CopyExpandedFile function - Does the work of CopyFile on expanded paths.
+
+static int CopyExpandedFile(const char* pszSource, const char* pszTarget,
+    int nFlags, uint64_t* pnBytesCopied) {
+  int nSourceDescriptor = open(pszSource, O_RDONLY | O_CLOEXEC);
+  if (nSourceDescriptor < 0) {
+    return ERROR;
+  }
+
+  struct stat st = { 0 };
+  if (OK != fstat(nSourceDescriptor, &st)) {
+    int nError = errno;
+    close(nSourceDescriptor);
+    errno = nError;
+    return ERROR;
+  }
+
+  if (S_ISDIR(st.st_mode)) {
+    close(nSourceDescriptor);
+    errno = EISDIR;
+    return ERROR;
+  }
+
+  /* Opening the target with O_TRUNC would destroy the source if the two
+   * paths named the same file. */
+  struct stat stTarget = { 0 };
+  BOOL bTargetExists = OK == stat(pszTarget, &stTarget);
+  if (bTargetExists && stTarget.st_dev == st.st_dev
+      && stTarget.st_ino == st.st_ino) {
+    close(nSourceDescriptor);
+    errno = EINVAL;
+    return ERROR;
+  }
+
+  struct stat stLink = { 0 };
+  if (!(nFlags & COPY_FLAG_OVERWRITE) && OK == lstat(pszTarget, &stLink)) {
+    close(nSourceDescriptor);
+    errno = EEXIST;
+    return ERROR;
+  }
+
+  /* A regular target is replaced by renaming a finished copy over it, so a
+   * failed copy leaves the old file untouched; a symbolic link to one is
+   * followed first, as open() would.  Devices and FIFOs are written in
+   * place. */
+  char szResolvedTarget[MAX_PATH + 1];
+  if (bTargetExists && S_ISREG(stTarget.st_mode)
+      && OK == lstat(pszTarget, &stLink) && S_ISLNK(stLink.st_mode)
+      && realpath(pszTarget, szResolvedTarget) != NULL) {
+    pszTarget = szResolvedTarget;
+  }
+
+  BOOL bInPlace = bTargetExists && !S_ISREG(stTarget.st_mode);
+  char szTemporaryPath[MAX_PATH + 1];
+  int nTargetDescriptor = -1;
+
+  if (bInPlace) {
+    nTargetDescriptor = open(pszTarget, O_WRONLY | O_TRUNC | O_CLOEXEC);
+  } else {
+    for (int nAttempt = 0; nAttempt < 16 && nTargetDescriptor < 0;
+        nAttempt++) {
+      FormatTemporaryFileName(pszTarget, szTemporaryPath, MAX_PATH + 1);
+      nTargetDescriptor = open(szTemporaryPath,
+          O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, st.st_mode & 07777);
+      if (nTargetDescriptor < 0 && errno != EEXIST) {
+        break;
+      }
+    }
+  }
+
+  if (nTargetDescriptor < 0) {
+    int nError = errno;
+    close(nSourceDescriptor);
+    errno = nError;
+    return ERROR;
+  }
+
+  COPY_JOB job;
+  memset(&job, 0, sizeof(COPY_JOB));
+  job.nSourceDescriptor = nSourceDescriptor;
+  job.nTargetDescriptor = nTargetDescriptor;
+
+  int nResult = ERROR;
+  BOOL bCloned = FALSE;
+
+  if (S_ISREG(st.st_mode) && !(nFlags & COPY_FLAG_NO_CLONE)) {
+    /* Shares the source's extents on file systems that support it, so
+     * the copy is instant and takes no space until either file changes. */
+    bCloned = OK == ioctl(nTargetDescriptor, FICLONE, nSourceDescriptor);
+    if (bCloned) {
+      job.nBytesCopied = (uint64_t) st.st_size;
+      nResult = OK;
+    }
+  }
+
+  if (!bCloned && S_ISREG(st.st_mode) && st.st_size > 0) {
+    /* Setting the size first leaves every range we do not write as a
+     * hole, which keeps the target as sparse as the source. */
+    nResult = ftruncate(nTargetDescriptor, st.st_size) == OK ? OK : ERROR;
+    if (nResult == OK) {
+      nResult = (nFlags & COPY_FLAG_PARALLEL)
+          && st.st_size > COPY_PARALLEL_CHUNK_SIZE
+          ? CopyDataInParallel(&job, st.st_size)
+          : CopyData(&job, st.st_size);
+    }
+  } else if (!bCloned) {
+    /* Pipes, devices and files whose size is not known up front (such as
+     * those in procfs): copy until end-of-file. */
+    nResult = CopyStream(&job);
+  }
+
+  if (nResult == OK) {
+    nResult = SyncFile(nTargetDescriptor,
+        (nFlags & COPY_FLAG_SYNC) ? WRITE_FLAG_FULLSYNC : WRITE_FLAG_NONE);
+  }
+
+  int nError = errno;
+  close(nSourceDescriptor);
+  if (OK != close(nTargetDescriptor) && nResult == OK && errno != EINTR) {
+    nError = errno;
+    nResult = ERROR;
+  }
+
+  if (nResult == OK && !bInPlace
+      && OK != PublishCopy(szTemporaryPath, pszTarget, nFlags)) {
+    nError = errno;
+    nResult = ERROR;
+  }
+
+  if (nResult != OK) {
+    if (!bInPlace) {
+      unlink(szTemporaryPath);
+    }
+    errno = nError;
+    return ERROR;
+  }
+
+  if ((nFlags & COPY_FLAG_SYNC)
+      && OK != SyncParentDirectory(AT_FDCWD, pszTarget)) {
+    return ERROR;
+  }
+
+  if (pnBytesCopied != NULL) {
+    *pnBytesCopied = job.nBytesCopied;
+  }
+
+  return OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Publicly-exposed functions
+
+///////////////////////////////////////////////////////////////////////////////
+// CopyFile function
+
+int CopyFile(const char* pszSourcePath, const char* pszTargetPath,
+    int nFlags) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_COPY_FILE);
+
+  if (IsNullOrWhiteSpace(pszSourcePath)
+      || IsNullOrWhiteSpace(pszTargetPath)) {
+    errno = EINVAL;
+    return ERROR;
+  }
+
+  /* Expand the path names a la Bash */
+  char szExpandedSourcePath[MAX_PATH + 1];
+  memset(szExpandedSourcePath, 0, MAX_PATH + 1);
+  ShellExpand(pszSourcePath, szExpandedSourcePath, MAX_PATH + 1);
+
+  char szExpandedTargetPath[MAX_PATH + 1];
+  memset(szExpandedTargetPath, 0, MAX_PATH + 1);
+  ShellExpand(pszTargetPath, szExpandedTargetPath, MAX_PATH + 1);
+
+  uint64_t nBytesCopied = 0;
+  int nResult = CopyExpandedFile(szExpandedSourcePath, szExpandedTargetPath,
+      nFlags, &nBytesCopied);
+
+  FILE_CORE_TRACE_BYTES(nBytesCopied);
+  return nResult;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// MoveFile function
+
+int MoveFile(const char* pszSourcePath, const char* pszTargetPath,
+    int nFlags) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_MOVE_FILE);
+
+  if (IsNullOrWhiteSpace(pszSourcePath)
+      || IsNullOrWhiteSpace(pszTargetPath)) {
+    errno = EINVAL;
+    return ERROR;
+  }
+
+  /* Expand the path names a la Bash */
+  char szExpandedSourcePath[MAX_PATH + 1];
+  memset(szExpandedSourcePath, 0, MAX_PATH + 1);
+  ShellExpand(pszSourcePath, szExpandedSourcePath, MAX_PATH + 1);
+
+  char szExpandedTargetPath[MAX_PATH + 1];
+  memset(szExpandedTargetPath, 0, MAX_PATH + 1);
+  ShellExpand(pszTargetPath, szExpandedTargetPath, MAX_PATH + 1);
+
+  int nResult = OK;
+  if (nFlags & COPY_FLAG_OVERWRITE) {
+    nResult = rename(szExpandedSourcePath, szExpandedTargetPath);
+  } else {
+    nResult = renameat2(AT_FDCWD, szExpandedSourcePath, AT_FDCWD,
+        szExpandedTargetPath, RENAME_NOREPLACE);
+
+    /* Older kernels and some file systems lack RENAME_NOREPLACE; fall back
+     * to checking first, which is not atomic. */
+    if (nResult != OK && (errno == EINVAL || errno == ENOSYS)) {
+      struct stat st = { 0 };
+      if (OK == lstat(szExpandedTargetPath, &st)) {
+        errno = EEXIST;
+        return ERROR;
+      }
+      nResult = rename(szExpandedSourcePath, szExpandedTargetPath);
+    }
+  }
+
+  if (nResult != OK && errno == EXDEV) {
+    /* A different file system: only a regular file can be carried over,
+     * by copying it and then removing the original. */
+    struct stat st = { 0 };
+    if (OK != lstat(szExpandedSourcePath, &st)) {
+      return ERROR;
+    }
+    if (!S_ISREG(st.st_mode)) {
+      errno = EXDEV;
+      return ERROR;
+    }
+
+    uint64_t nBytesCopied = 0;
+    if (OK != CopyExpandedFile(szExpandedSourcePath, szExpandedTargetPath,
+        nFlags, &nBytesCopied)) {
+      return ERROR;
+    }
+    FILE_CORE_TRACE_BYTES(nBytesCopied);
+
+    return unlink(szExpandedSourcePath) == OK ? OK : ERROR;
+  }
+
+  if (nResult != OK) {
+    return ERROR;
+  }
+
+  if (nFlags & COPY_FLAG_SYNC) {
+    if (OK != SyncParentDirectory(AT_FDCWD, szExpandedTargetPath)
+        || OK != SyncParentDirectory(AT_FDCWD, szExpandedSourcePath)) {
+      return ERROR;
+    }
+  }
+
+  return OK;
+}
@@ -9,116 +9,1071 @@
 #include "stdafx.h"
 #include "file_core.h"
 
+#include "file_core_internal.h"
 #include "file_core_symbols.h"
 
 ///////////////////////////////////////////////////////////////////////////////
-// Publicly-exposed functions
+// Internal functions
 
 ///////////////////////////////////////////////////////////////////////////////
-// CloseFile function
+// GetParentDirectory function - Gets the directory portion of a path, or "."
+// if the path has none.
+
+static void GetParentDirectory(const char* pszPath, char* pszDirectory,
+    size_t nBufferSize) {
+  snprintf(pszDirectory, nBufferSize, "%s", pszPath);
+
+  char* pszLastSlash = strrchr(pszDirectory, '/');
+  if (pszLastSlash == NULL) {
+    snprintf(pszDirectory, nBufferSize, ".");
+  } else if (pszLastSlash == pszDirectory) {
+    pszDirectory[1] = '\0';
+  } else {
+    *pszLastSlash = '\0';
+  }
+}
 
-void CloseFile(FILE** fppFile) {
-  if (fppFile == NULL) {
-    return; // Required parameter
+///////////////////////////////////////////////////////////////////////////////
+// SyncParentDirectory function
+
+int SyncParentDirectory(int nDirectoryDescriptor, const char* pszPath) {
+  char szDirectory[MAX_PATH + 1];
+  GetParentDirectory(pszPath, szDirectory, MAX_PATH + 1);
+
+  int nParentDescriptor = openat(nDirectoryDescriptor, szDirectory,
+      O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (nParentDescriptor < 0) {
+    return ERROR;
   }
 
-  if (*fppFile == NULL) {
-    return; // Required parameter - or file is already closed
+  int nResult = fsync(nParentDescriptor);
+  int nError = errno;
+  close(nParentDescriptor);
+  errno = nError;
+
+  return nResult == OK ? OK : ERROR;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// WriteFully function
+
+int WriteFully(int nFileDescriptor, const char* pData, size_t nLength,
+    off_t nOffset) {
+  while (nLength > 0) {
+    ssize_t nBytesWritten = nOffset < 0
+        ? write(nFileDescriptor, pData, nLength)
+        : pwrite(nFileDescriptor, pData, nLength, nOffset);
+    if (nBytesWritten < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return ERROR;
+    }
+
+    pData += nBytesWritten;
+    nLength -= (size_t) nBytesWritten;
+    if (nOffset >= 0) {
+      nOffset += nBytesWritten;
+    }
   }
 
-  fclose(*fppFile);
-  *fppFile = NULL;
+  return OK;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-// CreateDirectory function
+// WritevFully function
+
+int WritevFully(int nFileDescriptor, struct iovec* pIovecs, int nCount) {
+  while (nCount > 0) {
+    /* Skip over any buffers that are already done (or were empty). */
+    if (pIovecs->iov_len == 0) {
+      pIovecs++;
+      nCount--;
+      continue;
+    }
+
+    ssize_t nBytesWritten = writev(nFileDescriptor, pIovecs,
+        nCount > IOV_MAX ? IOV_MAX : nCount);
+    if (nBytesWritten < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return ERROR;
+    }
+
+    /* Advance past whatever was written, which may end part way through
+     * one of the buffers. */
+    size_t nRemaining = (size_t) nBytesWritten;
+    while (nCount > 0 && nRemaining >= pIovecs->iov_len) {
+      nRemaining -= pIovecs->iov_len;
+      pIovecs++;
+      nCount--;
+    }
+
+    if (nCount > 0 && nRemaining > 0) {
+      pIovecs->iov_base = (char*) pIovecs->iov_base + nRemaining;
+      pIovecs->iov_len -= nRemaining;
+    }
+  }
+
+  return OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// SyncFile function
+
+int SyncFile(int nFileDescriptor, int nFlags) {
+  if (nFlags & (WRITE_FLAG_FULLSYNC | WRITE_FLAG_DATASYNC)) {
+    FILE_CORE_COUNT_EVENT(FILE_CORE_COUNTER_SYNC_CALLS);
+  }
+
+  if (nFlags & WRITE_FLAG_FULLSYNC) {
+    return fsync(nFileDescriptor) == OK ? OK : ERROR;
+  }
+
+  if (nFlags & WRITE_FLAG_DATASYNC) {
+    return fdatasync(nFileDescriptor) == OK ? OK : ERROR;
+  }
+
+  return OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// FormatTemporaryFileName function
+
+void FormatTemporaryFileName(const char* pszPath, char* pszBuffer,
+    size_t nBufferSize) {
+  static unsigned int s_nCounter = 0;
+
+  unsigned int nUnique = __atomic_add_fetch(&s_nCounter, 1, __ATOMIC_RELAXED);
+  struct timespec ts = { 0 };
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  const char* pszLastSlash = strrchr(pszPath, '/');
+  int nDirectoryLength = pszLastSlash == NULL ? 0
+      : (int) (pszLastSlash - pszPath) + 1;
+  const char* pszName = pszPath + nDirectoryLength;
+
+  snprintf(pszBuffer, nBufferSize, "%.*s.%s.%d.%u.%lx.tmp", nDirectoryLength,
+      pszPath, pszName, (int) getpid(), nUnique, (unsigned long) ts.tv_nsec);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// LinkAnonymousFile function
+
+int LinkAnonymousFile(int nFileDescriptor, int nDirectoryDescriptor,
+    const char* pszPath, char* pszTemporaryPath, size_t nBufferSize) {
+  /* AT_EMPTY_PATH needs CAP_DAC_READ_SEARCH; the /proc link does not. */
+  char szProcPath[64];
+  snprintf(szProcPath, sizeof(szProcPath), "/proc/self/fd/%d",
+      nFileDescriptor);
+
+  for (int nAttempt = 0; nAttempt < 16; nAttempt++) {
+    FormatTemporaryFileName(pszPath, pszTemporaryPath, nBufferSize);
+    if (OK == linkat(nFileDescriptor, "", nDirectoryDescriptor,
+        pszTemporaryPath, AT_EMPTY_PATH)
+        || OK == linkat(AT_FDCWD, szProcPath, nDirectoryDescriptor,
+            pszTemporaryPath, AT_SYMLINK_FOLLOW)) {
+      return OK;
+    }
+    if (errno != EEXIST) {
+      return ERROR;
+    }
+  }
+
+  return ERROR;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// WritePartsFully function - As WritevFully, but leaves the caller's array
+// untouched: it is copied IOV_MAX elements at a time into a scratch array
+// that is adjusted as the write progresses.
+
+static int WritePartsFully(int nFileDescriptor, const struct iovec* pParts,
+    int nCount) {
+  struct iovec iovecs[IOV_MAX];
+
+  while (nCount > 0) {
+    int nBatch = nCount > IOV_MAX ? IOV_MAX : nCount;
+    memcpy(iovecs, pParts, nBatch * sizeof(struct iovec));
+    pParts += nBatch;
+    nCount -= nBatch;
+
+    if (OK != WritevFully(nFileDescriptor, iovecs, nBatch)) {
+      return ERROR;
+    }
+  }
+
+  return OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// WriteAtomically function
+
+int WriteAtomically(int nDirectoryDescriptor, const char* pszPath,
+    const struct iovec* pParts, int nCount, int nFlags) {
+  char szDirectory[MAX_PATH + 1];
+  GetParentDirectory(pszPath, szDirectory, MAX_PATH + 1);
+
+  /* Carry the permissions of the file being replaced over to its
+   * replacement. */
+  struct stat st = { 0 };
+  BOOL bPreserveMode = fstatat(nDirectoryDescriptor, pszPath, &st, 0) == OK;
+
+  char szTemporaryPath[MAX_PATH + 1];
+  memset(szTemporaryPath, 0, MAX_PATH + 1);
+
+  BOOL bLinked = FALSE;
+  int nFileDescriptor = -1;
+
+#ifdef O_TMPFILE
+  /* An O_TMPFILE has no name until it is linked, so nothing is left behind
+   * if we crash part way through. */
+  nFileDescriptor = openat(nDirectoryDescriptor, szDirectory,
+      O_TMPFILE | O_WRONLY | O_CLOEXEC, 0666);
+  if (nFileDescriptor >= 0) {
+    if ((bPreserveMode && OK != fchmod(nFileDescriptor, st.st_mode & 07777))
+        || OK != WritePartsFully(nFileDescriptor, pParts, nCount)
+        || OK != SyncFile(nFileDescriptor, nFlags)) {
+      int nError = errno;
+      close(nFileDescriptor);
+      errno = nError;
+      return ERROR;
+    }
+
+    bLinked = OK == LinkAnonymousFile(nFileDescriptor, nDirectoryDescriptor,
+        pszPath, szTemporaryPath, MAX_PATH + 1);
+
+    close(nFileDescriptor);
+    nFileDescriptor = -1;
+  }
+#endif //O_TMPFILE
+
+  /* Without O_TMPFILE support (or without a way to link it), fall back to
+   * an ordinary hidden file with a unique name. */
+  if (!bLinked) {
+    for (int nAttempt = 0; nAttempt < 16 && nFileDescriptor < 0;
+        nAttempt++) {
+      FormatTemporaryFileName(pszPath, szTemporaryPath, MAX_PATH + 1);
+      nFileDescriptor = openat(nDirectoryDescriptor, szTemporaryPath,
+          O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+      if (nFileDescriptor < 0 && errno != EEXIST) {
+        return ERROR;
+      }
+    }
+
+    if (nFileDescriptor < 0) {
+      return ERROR;
+    }
+
+    if ((bPreserveMode && OK != fchmod(nFileDescriptor, st.st_mode & 07777))
+        || OK != WritePartsFully(nFileDescriptor, pParts, nCount)
+        || OK != SyncFile(nFileDescriptor, nFlags)) {
+      int nError = errno;
+      close(nFileDescriptor);
+      unlinkat(nDirectoryDescriptor, szTemporaryPath, 0);
+      errno = nError;
+      return ERROR;
+    }
+
+    close(nFileDescriptor);
+  }
 
-void CreateDirectory(const char* pszPath) {
+  if (OK != renameat(nDirectoryDescriptor, szTemporaryPath,
+      nDirectoryDescriptor, pszPath)) {
+    int nError = errno;
+    unlinkat(nDirectoryDescriptor, szTemporaryPath, 0);
+    errno = nError;
+    return ERROR;
+  }
+
+  if (nFlags & WRITE_FLAG_FULLSYNC) {
+    return SyncParentDirectory(nDirectoryDescriptor, pszPath);
+  }
+
+  return OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ReadAllFromDescriptor function
+
+int ReadAllFromDescriptor(int nFileDescriptor, char** ppOutput,
+    size_t* pnLength) {
+  /* Size the buffer once from fstat when the file is a regular file.  Pipes,
+   * sockets and procfs entries report a size of zero (or nothing useful), so
+   * for those we start small and grow geometrically. */
+  struct stat st = { 0 };
+  if (OK != fstat(nFileDescriptor, &st)) {
+    return ERROR;
+  }
+
+  BOOL bSizeKnown = S_ISREG(st.st_mode) && st.st_size > 0;
+  size_t nCapacity = bSizeKnown ? (size_t) st.st_size + 1
+      : READ_ALL_BYTES_INITIAL_SIZE;
+  size_t nTotalBytesRead = 0;
+
+  char* pBuffer = (char*) malloc(nCapacity);
+  if (pBuffer == NULL) {
+    errno = ENOMEM;
+    return ERROR;
+  }
+
+  while (TRUE) {
+    /* Always keep one byte in reserve for the NUL terminator. */
+    if (nTotalBytesRead == nCapacity - 1) {
+      if (bSizeKnown) {
+        /* The buffer is exactly the size fstat reported.  Probe for EOF
+         * before paying for a reallocation, in case the file grew. */
+        char chProbe = '\0';
+        ssize_t nProbed = read(nFileDescriptor, &chProbe, 1);
+        if (nProbed < 0 && errno == EINTR) {
+          continue;
+        }
+        if (nProbed <= 0) {
+          if (nProbed < 0) {
+            free(pBuffer);
+            return ERROR;
+          }
+          break;
+        }
+
+        bSizeKnown = FALSE;
+        pBuffer[nTotalBytesRead++] = chProbe;
+      }
+
+      if (nCapacity > SIZE_MAX / 2) {
+        free(pBuffer);
+        errno = EFBIG;
+        return ERROR;
+      }
+
+      char* pGrown = (char*) realloc(pBuffer, nCapacity * 2);
+      if (pGrown == NULL) {
+        free(pBuffer);
+        errno = ENOMEM;
+        return ERROR;
+      }
+      pBuffer = pGrown;
+      nCapacity *= 2;
+    }
+
+    size_t nToRead = nCapacity - 1 - nTotalBytesRead;
+    if (nToRead > MAX_READ_CHUNK_SIZE) {
+      nToRead = MAX_READ_CHUNK_SIZE;
+    }
+
+    ssize_t nBytesRead = read(nFileDescriptor, pBuffer + nTotalBytesRead,
+        nToRead);
+    if (nBytesRead < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+
+      free(pBuffer);
+      return ERROR;
+    }
+
+    if (nBytesRead == 0) {
+      break; /* EOF */
+    }
+
+    nTotalBytesRead += (size_t) nBytesRead;
+  }
+
+  /* Give back the slack left over from geometric growth. */
+  if (nCapacity > nTotalBytesRead + 1) {
+    char* pShrunk = (char*) realloc(pBuffer, nTotalBytesRead + 1);
+    if (pShrunk != NULL) {
+      pBuffer = pShrunk;
+    }
+  }
+  pBuffer[nTotalBytesRead] = '\0';
+
+  *ppOutput = pBuffer;
+  *pnLength = nTotalBytesRead;
+
+  return OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// WriteFileWithFlags function - Does the work of WriteAllBytes,
+// WriteAllBytesAt, WriteAllParts and WriteAllPartsAt.  The parts are gathered
+// with writev(), so they are never copied into one buffer.
+
+static int WriteFileWithFlags(LPFILECORECONTEXT lpContext,
+    const char* pszPath, const struct iovec* pParts, int nCount,
+    int nFlags) {
+  if (IsNullOrWhiteSpace(pszPath) || nCount < 0
+      || (pParts == NULL && nCount > 0)) {
+    errno = EINVAL;
+    return ERROR;
+  }
+
+  for (int i = 0; i < nCount; i++) {
+    if (pParts[i].iov_base == NULL && pParts[i].iov_len > 0) {
+      errno = EINVAL;
+      return ERROR;
+    }
+  }
+
+  if ((nFlags & WRITE_FLAG_ATOMIC) && (nFlags & WRITE_FLAG_APPEND)) {
+    errno = EINVAL;
+    return ERROR;
+  }
+
+  /* Direct I/O goes through one aligned buffer, so takes one part. */
+  if ((nFlags & WRITE_FLAG_DIRECT) && (nCount > 1
+      || (nFlags & (WRITE_FLAG_ATOMIC | WRITE_FLAG_APPEND)))) {
+    errno = EINVAL;
+    return ERROR;
+  }
+
+  /* Expand the path name a la Bash */
+  char szExpandedPathName[MAX_PATH + 1];
+  if (OK != ExpandContextPath(lpContext, pszPath, szExpandedPathName,
+      MAX_PATH + 1)) {
+    return ERROR;
+  }
+
+  int nDirectoryDescriptor = GetContextDescriptor(lpContext);
+
+  if (nFlags & WRITE_FLAG_ATOMIC) {
+    return WriteAtomically(nDirectoryDescriptor, szExpandedPathName, pParts,
+        nCount, nFlags);
+  }
+
+  BOOL bAppend = (nFlags & WRITE_FLAG_APPEND) != 0;
+  BOOL bDirect = (nFlags & WRITE_FLAG_DIRECT) != 0;
+  int nOpenFlags = O_WRONLY | O_CREAT | O_CLOEXEC
+      | (bAppend ? O_APPEND : O_TRUNC);
+
+  int nFileDescriptor = openat(nDirectoryDescriptor, szExpandedPathName,
+      nOpenFlags | (bDirect ? O_DIRECT : 0), 0666);
+  if (nFileDescriptor < 0 && bDirect && errno == EINVAL) {
+    /* The file system (tmpfs, for one) does not do direct I/O. */
+    bDirect = FALSE;
+    nFileDescriptor = openat(nDirectoryDescriptor, szExpandedPathName,
+        nOpenFlags, 0666);
+  }
+  if (nFileDescriptor < 0) {
+    return ERROR;
+  }
+
+  int nResult = bDirect && nCount > 0
+      ? WriteAllDirect(nFileDescriptor, (const char*) pParts[0].iov_base,
+          pParts[0].iov_len)
+      : WritePartsFully(nFileDescriptor, pParts, nCount);
+  if (OK != nResult || OK != SyncFile(nFileDescriptor, nFlags)) {
+    int nError = errno;
+    close(nFileDescriptor);
+    errno = nError;
+    return ERROR;
+  }
+
+  if (OK != close(nFileDescriptor) && errno != EINTR) {
+    return ERROR;
+  }
+
+  if (nFlags & WRITE_FLAG_FULLSYNC) {
+    return SyncParentDirectory(nDirectoryDescriptor, szExpandedPathName);
+  }
+
+  return OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// WriteText function - Shared by WriteAllText and WriteFormattedTextToFile.
+// Opens the file once and writes the text with as few write() calls as the
+// kernel allows.  Throws a file access exception on failure.  Returns TRUE
+// only if the text was written.
+
+static BOOL WriteText(const char* pszFunctionName,
+    LPFILECORECONTEXT lpContext, const char* pszPath, const char* pszContent,
+    size_t nLength, BOOL bOverwrite, int* pnBytesWritten) {
+  /* If the file exists, but content is blank, and we are appending, then
+   * delete the file.  If there is no file, fall through and create it. */
+  if (!bOverwrite && IsNullOrWhiteSpace(pszContent)) {
+    char szExpandedPathName[MAX_PATH + 1];
+    if (OK == ExpandContextPath(lpContext, pszPath, szExpandedPathName,
+        MAX_PATH + 1) && OK == unlinkat(GetContextDescriptor(lpContext),
+        szExpandedPathName, 0)) {
+      return FALSE;
+    }
+  }
+
+  if (nLength > INT_MAX) {
+    ThrowFileAccessFailedException(pszFunctionName, pszPath, NULL);
+    return FALSE;
+  }
+
+  struct iovec part = { (void*) pszContent, nLength };
+  if (OK != WriteFileWithFlags(lpContext, pszPath, &part, 1,
+      bOverwrite ? WRITE_FLAG_NONE : WRITE_FLAG_APPEND)) {
+    ThrowFileAccessFailedException(pszFunctionName, pszPath, NULL);
+    return FALSE;
+  }
+
+  *pnBytesWritten = (int) nLength;
+  return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// WriteFormattedText function - Does the work of WriteFormattedTextToFile and
+// WriteFormattedTextToFileAt.  Returns TRUE only if the text was written.
+
+static BOOL WriteFormattedText(const char* pszFunctionName,
+    LPFILECORECONTEXT lpContext, BOOL bOverwrite, int* pnBytesWritten,
+    const char* pszPath, const char* pszContentFormat, va_list args) {
+  /* Can't proceed if the pathname is blank */
+  if (IsNullOrWhiteSpace(pszPath)) {
+    return FALSE;
+  }
+
+  /* If there is nowhere to store the number of bytes written,
+   * can't proceed. */
+  if (pnBytesWritten == NULL) {
+    return FALSE;
+  }
+
+  /* If the format is blank, and the overwrite flag is set, then delete the
+   * file using the unlink syscall */
+  if (IsNullOrWhiteSpace(pszContentFormat)) {
+    if (bOverwrite) {
+      char szExpandedPathName[MAX_PATH + 1];
+      if (OK == ExpandContextPath(lpContext, pszPath, szExpandedPathName,
+          MAX_PATH + 1)) {
+        unlinkat(GetContextDescriptor(lpContext), szExpandedPathName, 0);
+      }
+      *pnBytesWritten = 0;
+      return FALSE;
+    }
+    pszContentFormat = "";
+  }
+
+  /* Format into a buffer on the stack; only output that does not fit there
+   * is formatted a second time, into a buffer of exactly the right size. */
+  char szBuffer[FORMATTED_TEXT_STACK_BUFFER_SIZE];
+  char* pszContent = szBuffer;
+
+  va_list argsCopy;
+  va_copy(argsCopy, args);
+
+  int nLength = vsnprintf(szBuffer, sizeof(szBuffer), pszContentFormat,
+      args);
+
+  if (nLength < 0) {
+    va_end(argsCopy);
+    ThrowFileAccessFailedException(pszFunctionName, pszPath, NULL);
+    return FALSE;
+  }
+
+  if ((size_t) nLength >= sizeof(szBuffer)) {
+    pszContent = (char*) malloc((size_t) nLength + 1);
+    if (pszContent == NULL) {
+      va_end(argsCopy);
+      ThrowFileAccessFailedException(pszFunctionName, pszPath, NULL);
+      return FALSE;
+    }
+    vsnprintf(pszContent, (size_t) nLength + 1, pszContentFormat, argsCopy);
+  }
+  va_end(argsCopy);
+
+  BOOL bWritten = WriteText(pszFunctionName, lpContext, pszPath,
+      pszContent, (size_t) nLength, bOverwrite, pnBytesWritten);
+
+  if (pszContent != szBuffer) {
+    free(pszContent);
+  }
+
+  return bWritten;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ReadFileWithFlags function - Does the work of ReadAllBytes,
+// ReadAllBytesAt and ReadAllBytesEx.
+
+static int ReadFileWithFlags(LPFILECORECONTEXT lpContext, const char* pszPath,
+    int nFlags, char** ppOutput, size_t* pnLength) {
+  if (IsNullOrWhiteSpace(pszPath) || ppOutput == NULL || pnLength == NULL) {
+    errno = EINVAL;
+    return ERROR;
+  }
+
+  *ppOutput = NULL;
+  *pnLength = 0;
+
+  /* Expand the file name string a la Bash */
+  char szExpandedFileName[MAX_PATH + 1];
+  if (OK != ExpandContextPath(lpContext, pszPath, szExpandedFileName,
+      MAX_PATH + 1)) {
+    return ERROR;
+  }
+
+  int nDirectoryDescriptor = GetContextDescriptor(lpContext);
+
+  BOOL bDirect = (nFlags & READ_FLAG_DIRECT) != 0;
+  int nFileDescriptor = openat(nDirectoryDescriptor, szExpandedFileName,
+      O_RDONLY | O_CLOEXEC | (bDirect ? O_DIRECT : 0));
+  if (nFileDescriptor < 0 && bDirect && errno == EINVAL) {
+    /* The file system (tmpfs, for one) does not do direct I/O. */
+    bDirect = FALSE;
+    nFileDescriptor = openat(nDirectoryDescriptor, szExpandedFileName,
+        O_RDONLY | O_CLOEXEC);
+  }
+  if (nFileDescriptor < 0) {
+    return ERROR;
+  }
+
+  int nResult = bDirect
+      ? ReadAllDirect(nFileDescriptor, ppOutput, pnLength)
+      : ReadAllFromDescriptor(nFileDescriptor, ppOutput, pnLength);
+  int nError = errno;
+  close(nFileDescriptor);
+  errno = nError;
+
+  return nResult;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ReadText function - Shared by ReadAllText and ReadAllTextAt.  Reads the
+// whole file, exiting the process on failure.  The number of bytes read is
+// stored in *pnBytesRead as well as, if it is not NULL, *pnFileSize.
+
+static void ReadText(const char* pszFunctionName,
+    LPFILECORECONTEXT lpContext, const char* pszPath, char** ppszOutput,
+    int* pnFileSize, size_t* pnBytesRead) {
+  /* Nothing to do if the pathname is blank. */
   if (IsNullOrWhiteSpace(pszPath)) {
     return;
   }
 
-  /* Be sure to expand the path name string just like Bash would */
-  char szExpandedPathName[MAX_PATH + 1];
-  memset(szExpandedPathName, 0, MAX_PATH + 1);
-  ShellExpand(pszPath, szExpandedPathName, MAX_PATH + 1);
+  if (ppszOutput == NULL) {
+    fprintf(stderr, "%s: Missing required parameter 'output'.\n",
+        pszFunctionName);
+    exit(EXIT_FAILURE);
+    return;
+  }
+
+  size_t nTotalBytesRead = 0;
+  if (OK != ReadFileWithFlags(lpContext, pszPath, READ_FLAG_NONE, ppszOutput,
+      &nTotalBytesRead)) {
+    if (errno == ENOENT) {
+      ThrowFileNotFoundException(pszFunctionName, pszPath, NULL);
+    }
 
-  /* Be sure the directory does not already exist */
-  if (DirectoryExists(szExpandedPathName)) {
+    fprintf(stderr, "ERROR: Failed to read %s: %s\n", pszPath,
+        strerror(errno));
+    exit(EXIT_FAILURE);
     return;
   }
 
-  /* Raise an exception if mkdir call fails */
-  if (OK != mkdir(szExpandedPathName, 0777)) {
-    perror("CreateDirectory");
+  if (nTotalBytesRead > INT_MAX) {
+    fprintf(stderr, "ERROR: %s is too large for %s; use ReadAllBytes "
+        "instead.\n", pszPath, pszFunctionName);
+    free(*ppszOutput);
+    *ppszOutput = NULL;
     exit(EXIT_FAILURE);
+    return;
   }
+
+  if (pnFileSize != NULL) {
+    *pnFileSize = (int) nTotalBytesRead;
+  }
+  *pnBytesRead = nTotalBytesRead;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-// CreateDirIfNotExists function
+// CreateDirectoryWithParents function - Does the work of CreateDirectory
+// and CreateDirectoryAt.
 
-void CreateDirIfNotExists(const char* pszPath) {
-  /* If the path name provided is blank, then
-   * there is nothing to do. */
+static int CreateDirectoryWithParents(LPFILECORECONTEXT lpContext,
+    const char* pszPath) {
   if (IsNullOrWhiteSpace(pszPath)) {
-    return;
+    errno = EINVAL;
+    return ERROR;
   }
 
   /* Be sure to expand the path name string just like Bash would */
   char szExpandedPathName[MAX_PATH + 1];
-  memset(szExpandedPathName, 0, MAX_PATH + 1);
-  ShellExpand(pszPath, szExpandedPathName, MAX_PATH + 1);
+  if (OK != ExpandContextPath(lpContext, pszPath, szExpandedPathName,
+      MAX_PATH + 1)) {
+    return ERROR;
+  }
 
-  /* Check whether the specified directory exists.  If it does not,
-   * then try to create it. */
-  if (!DirectoryExists(szExpandedPathName)) {
-    CreateDirectory(szExpandedPathName);
+  int nDirectoryDescriptor = GetContextDescriptor(lpContext);
+
+  /* Trim trailing slashes, but never the root directory itself. */
+  size_t nLength = strlen(szExpandedPathName);
+  while (nLength > 1 && szExpandedPathName[nLength - 1] == '/') {
+    szExpandedPathName[--nLength] = '\0';
+  }
+
+  if (nLength == 0) {
+    errno = EINVAL;
+    return ERROR;
+  }
+
+  /* In the common case, the parent already exists: one syscall. */
+  if (OK == mkdirat(nDirectoryDescriptor, szExpandedPathName, 0777)) {
+    return OK;
+  }
+
+  if (errno == EEXIST) {
+    struct stat st = { 0 };
+    if (OK != fstatat(nDirectoryDescriptor, szExpandedPathName, &st, 0)) {
+      return ERROR;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+      errno = ENOTDIR;
+      return ERROR;
+    }
+    return OK;
+  }
+
+  if (errno != ENOENT) {
+    return ERROR;
+  }
+
+  /* Probe backward, one component at a time, for the deepest ancestor that
+   * already exists.  nTail marks the start of the first missing component. */
+  int nParentDescriptor = nDirectoryDescriptor;
+  size_t nTail = 0;
+
+  for (size_t i = nLength; i > 0; i--) {
+    if (szExpandedPathName[i - 1] != '/') {
+      continue;
+    }
+
+    /* Collapse runs of slashes, as in a//b. */
+    size_t nEnd = i - 1;
+    while (nEnd > 0 && szExpandedPathName[nEnd - 1] == '/') {
+      nEnd--;
+    }
+
+    if (nEnd == 0) {
+      /* Only the root directory is left, and it always exists. */
+      nParentDescriptor = open("/", O_PATH | O_DIRECTORY | O_CLOEXEC);
+      if (nParentDescriptor < 0) {
+        return ERROR;
+      }
+      nTail = i;
+      break;
+    }
+
+    szExpandedPathName[nEnd] = '\0';
+    int nDescriptor = openat(nDirectoryDescriptor, szExpandedPathName,
+        O_PATH | O_DIRECTORY | O_CLOEXEC);
+    szExpandedPathName[nEnd] = '/';
+
+    if (nDescriptor >= 0) {
+      nParentDescriptor = nDescriptor;
+      nTail = i;
+      break;
+    }
+
+    if (errno != ENOENT) {
+      return ERROR;
+    }
+
+    i = nEnd + 1;
+  }
+
+  /* Create each missing component relative to its parent. */
+  char* pszComponent = szExpandedPathName + nTail;
+  while (*pszComponent != '\0') {
+    char* pszSeparator = strchr(pszComponent, '/');
+    if (pszSeparator != NULL) {
+      *pszSeparator = '\0';
+    }
+
+    BOOL bLast = pszSeparator == NULL
+        || pszSeparator[1 + strspn(pszSeparator + 1, "/")] == '\0';
+
+    /* EEXIST means another process got there first; that is fine, as long
+     * as what it created is a directory.  For intermediate components the
+     * openat below verifies that; for the last one, check it here. */
+    if (*pszComponent != '\0'
+        && OK != mkdirat(nParentDescriptor, pszComponent, 0777)) {
+      int nError = errno;
+      if (nError == EEXIST && bLast) {
+        struct stat st = { 0 };
+        if (OK != fstatat(nParentDescriptor, pszComponent, &st, 0)) {
+          nError = errno;
+        } else if (!S_ISDIR(st.st_mode)) {
+          nError = ENOTDIR;
+        } else {
+          nError = OK;
+        }
+      }
+
+      if (nError != EEXIST && nError != OK) {
+        if (nParentDescriptor != nDirectoryDescriptor) {
+          close(nParentDescriptor);
+        }
+        errno = nError;
+        return ERROR;
+      }
+    }
+
+    if (bLast) {
+      break;
+    }
+
+    if (*pszComponent != '\0') {
+      int nDescriptor = openat(nParentDescriptor, pszComponent,
+          O_PATH | O_DIRECTORY | O_CLOEXEC);
+      int nError = errno;
+      if (nParentDescriptor != nDirectoryDescriptor) {
+        close(nParentDescriptor);
+      }
+      if (nDescriptor < 0) {
+        errno = nError;
+        return ERROR;
+      }
+      nParentDescriptor = nDescriptor;
+    }
+
+    pszComponent = pszSeparator + 1;
+  }
+
+  if (nParentDescriptor != nDirectoryDescriptor) {
+    close(nParentDescriptor);
+  }
+
+  return OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// MapFileWithHints function - Does the work of MapFile and MapFileAt.
+
+static int MapFileWithHints(LPFILECORECONTEXT lpContext, const char* pszPath,
+    LPFILEVIEW lpView, int nHints) {
+  if (IsNullOrWhiteSpace(pszPath) || lpView == NULL) {
+    errno = EINVAL;
+    return ERROR;
+  }
+
+  memset(lpView, 0, sizeof(FILEVIEW));
+
+  /* Expand the file name string a la Bash */
+  char szExpandedFileName[MAX_PATH + 1];
+  if (OK != ExpandContextPath(lpContext, pszPath, szExpandedFileName,
+      MAX_PATH + 1)) {
+    return ERROR;
+  }
+
+  int nDirectoryDescriptor = GetContextDescriptor(lpContext);
+
+  int nFileDescriptor = openat(nDirectoryDescriptor, szExpandedFileName,
+      O_RDONLY | O_CLOEXEC);
+  if (nFileDescriptor < 0) {
+    return ERROR;
+  }
+
+  struct stat st = { 0 };
+  if (OK != fstat(nFileDescriptor, &st)) {
+    int nError = errno;
+    close(nFileDescriptor);
+    errno = nError;
+    return ERROR;
+  }
+
+  if (!S_ISREG(st.st_mode)) {
+    close(nFileDescriptor);
+    errno = S_ISDIR(st.st_mode) ? EISDIR : ENODEV;
+    return ERROR;
+  }
+
+  /* mmap() refuses zero-length mappings, so hand back an empty view. */
+  if (st.st_size == 0) {
+    close(nFileDescriptor);
+    lpView->pData = "";
+    lpView->nLength = 0;
+    return OK;
+  }
+
+  if ((uint64_t) st.st_size > (uint64_t) SIZE_MAX) {
+    close(nFileDescriptor);
+    errno = EFBIG;
+    return ERROR;
+  }
+
+  void* pMapping = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED,
+      nFileDescriptor, 0);
+
+  /* The mapping holds its own reference to the file. */
+  int nError = errno;
+  close(nFileDescriptor);
+
+  if (pMapping == MAP_FAILED) {
+    errno = nError;
+    return ERROR;
+  }
+
+  if (nHints & MAP_FILE_HINT_SEQUENTIAL) {
+    madvise(pMapping, (size_t) st.st_size, MADV_SEQUENTIAL);
   }
+  if (nHints & MAP_FILE_HINT_RANDOM) {
+    madvise(pMapping, (size_t) st.st_size, MADV_RANDOM);
+  }
+  if (nHints & MAP_FILE_HINT_WILLNEED) {
+    madvise(pMapping, (size_t) st.st_size, MADV_WILLNEED);
+  }
+#ifdef MADV_HUGEPAGE
+  if (nHints & MAP_FILE_HINT_HUGEPAGE) {
+    madvise(pMapping, (size_t) st.st_size, MADV_HUGEPAGE);
+  }
+#endif //MADV_HUGEPAGE
+
+  lpView->pData = (const char*) pMapping;
+  lpView->nLength = (uint64_t) st.st_size;
+
+  return OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Publicly-exposed functions
+
+///////////////////////////////////////////////////////////////////////////////
+// AppendAllParts function
+
+int AppendAllParts(const char* pszPath, const struct iovec* pParts,
+    int nCount, int nFlags) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_APPEND_ALL_PARTS);
+
+  int nResult = WriteFileWithFlags(NULL, pszPath, pParts, nCount,
+      nFlags | WRITE_FLAG_APPEND);
+
+  if (nResult == OK) {
+    for (int i = 0; i < nCount; i++) {
+      FILE_CORE_TRACE_BYTES(pParts[i].iov_len);
+    }
+  }
+  return nResult;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// CloseFile function
+
+void CloseFile(FILE** fppFile) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_CLOSE_FILE);
+
+  if (fppFile == NULL) {
+    return; // Required parameter
+  }
+
+  if (*fppFile == NULL) {
+    return; // Required parameter - or file is already closed
+  }
+
+  fclose(*fppFile);
+  *fppFile = NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// CreateDirectory function
+
+int CreateDirectory(const char* pszPath) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_CREATE_DIRECTORY);
+
+  return CreateDirectoryWithParents(NULL, pszPath);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// CreateDirectoryAt function
+
+int CreateDirectoryAt(LPFILECORECONTEXT lpContext, const char* pszPath) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_CREATE_DIRECTORY_AT);
+
+  return CreateDirectoryWithParents(lpContext, pszPath);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// CreateDirIfNotExists function
+
+int CreateDirIfNotExists(const char* pszPath) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_CREATE_DIR_IF_NOT_EXISTS);
+
+  /* CreateDirectory already succeeds if the directory exists, so there is
+   * no need to expand the path and probe for it separately here. */
+  return CreateDirectoryWithParents(NULL, pszPath);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// CreateDirIfNotExistsAt function
+
+int CreateDirIfNotExistsAt(LPFILECORECONTEXT lpContext, const char* pszPath) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_CREATE_DIR_IF_NOT_EXISTS_AT);
+
+  return CreateDirectoryWithParents(lpContext, pszPath);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 // DirectoryExists function
 
 BOOL DirectoryExists(const char* pszPath) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_DIRECTORY_EXISTS);
+
   /* If the path is blank, then we have nothing to do. */
   if (IsNullOrWhiteSpace(pszPath)) {
     return FALSE;
   }
 
-  /* Be sure to expand the path name string just like Bash would */
-  char szExpandedPathName[MAX_PATH + 1];
-  memset(szExpandedPathName, 0, MAX_PATH + 1);
-  ShellExpand(pszPath, szExpandedPathName, MAX_PATH + 1);
+  FILEINFO info;
+  return OK == QueryPathInfo(NULL, pszPath, FILE_INFO_TYPE, &info)
+      && S_ISDIR(info.nMode);
+}
 
-  /* Check for the existence of the specified directory using
-   * the stat syscall. */
-  struct stat st = { 0 };
-  return stat(szExpandedPathName, &st) == 0;
+///////////////////////////////////////////////////////////////////////////////
+// DirectoryExistsAt function
+
+BOOL DirectoryExistsAt(LPFILECORECONTEXT lpContext, const char* pszPath) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_DIRECTORY_EXISTS_AT);
+
+  if (IsNullOrWhiteSpace(pszPath)) {
+    return FALSE;
+  }
+
+  FILEINFO info;
+  return OK == QueryPathInfo(lpContext, pszPath, FILE_INFO_TYPE, &info)
+      && S_ISDIR(info.nMode);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 // FileExists function
 
 BOOL FileExists(const char* pszPath) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_FILE_EXISTS);
+
   /* If the path is blank, then we have nothing to do. */
   if (IsNullOrWhiteSpace(pszPath)) {
     return FALSE;
   }
 
-  /* Be sure to expand the path name string just like Bash would */
-  char szExpandedPathName[MAX_PATH + 1];
-  memset(szExpandedPathName, 0, MAX_PATH + 1);
-  ShellExpand(pszPath, szExpandedPathName, MAX_PATH + 1);
+  FILEINFO info;
+  return OK == QueryPathInfo(NULL, pszPath, FILE_INFO_NONE, &info);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// FileExistsAt function
+
+BOOL FileExistsAt(LPFILECORECONTEXT lpContext, const char* pszPath) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_FILE_EXISTS_AT);
+
+  if (IsNullOrWhiteSpace(pszPath)) {
+    return FALSE;
+  }
 
-  /* Use the access syscall to determine whether the file exists. */
-  return access(szExpandedPathName, F_OK) == OK;
+  FILEINFO info;
+  return OK == QueryPathInfo(lpContext, pszPath, FILE_INFO_NONE, &info);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 // GetCurrentWorkingDirectory function
 
 void GetCurrentWorkingDirectory(char* pszCurrentWorkingDir, int nBufferSize) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_GET_CURRENT_WORKING_DIRECTORY);
+
   memset(pszCurrentWorkingDir, 0, nBufferSize);
 
   char szResult[nBufferSize];
@@ -133,6 +1088,8 @@ void GetCurrentWorkingDirectory(char* pszCurrentWorkingDir, int nBufferSize) {
 }
 
 void GetHomeDirectoryPath(char* pszDirectoryPath) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_GET_HOME_DIRECTORY_PATH);
+
   if (pszDirectoryPath == NULL) {
     return;
   }
@@ -156,82 +1113,134 @@ void GetHomeDirectoryPath(char* pszDirectoryPath) {
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-// ReadAllText function
+// MapFile function
 
-void ReadAllText(const char* pszPath, char** ppszOutput,
-    int *pnFileSize) {
+int MapFile(const char* pszPath, LPFILEVIEW lpView, int nHints) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_MAP_FILE);
 
-  const int CHUNK_SIZE = 1035; /* chunk size, in bytes */
+  int nResult = MapFileWithHints(NULL, pszPath, lpView, nHints);
 
-  char szBuffer[CHUNK_SIZE + 1];
-  memset(szBuffer, 0, CHUNK_SIZE + 1);
+  if (nResult == OK) {
+    FILE_CORE_TRACE_BYTES(lpView->nLength);
+  }
+  return nResult;
+}
 
-  char szExpandedFileName[MAX_PATH + 1];
-  memset(szExpandedFileName, 0, MAX_PATH + 1);
+///////////////////////////////////////////////////////////////////////////////
+// MapFileAt function
 
-  int nBytesRead = 0;
-  int nTotalBytesRead = 0;
+int MapFileAt(LPFILECORECONTEXT lpContext, const char* pszPath,
+    LPFILEVIEW lpView, int nHints) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_MAP_FILE_AT);
 
-  /* Nothing to do if the pathname is blank. */
-  if (IsNullOrWhiteSpace(pszPath)) {
-    return;
+  int nResult = MapFileWithHints(lpContext, pszPath, lpView, nHints);
+
+  if (nResult == OK) {
+    FILE_CORE_TRACE_BYTES(lpView->nLength);
   }
+  return nResult;
+}
 
-  /* Expand the file name string a la Bash */
-  ShellExpand(pszPath, szExpandedFileName, MAX_PATH + 1);
+///////////////////////////////////////////////////////////////////////////////
+// ReadAllBytes function
 
-  if (!FileExists(szExpandedFileName)) {
-    ThrowFileNotFoundException("ReadAllText", pszPath, NULL);
-  }
+int ReadAllBytes(const char* pszPath, char** ppOutput, size_t* pnLength) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_READ_ALL_BYTES);
 
-  if (ppszOutput == NULL) {
-    fprintf(stderr, "ReadAllText: Missing required parameter 'output'.\n");
-    exit(EXIT_FAILURE);
-    return;
+  int nResult = ReadFileWithFlags(NULL, pszPath, READ_FLAG_NONE,
+      ppOutput, pnLength);
+
+  if (pnLength != NULL) {
+    FILE_CORE_TRACE_BYTES(*pnLength);
   }
+  return nResult;
+}
 
-  FILE* fp = fopen(szExpandedFileName, "r");
-  if (fp == NULL) {
-    fprintf(stderr, "ERROR: Failed to open %s for reading.\n",
-        szExpandedFileName);
+///////////////////////////////////////////////////////////////////////////////
+// ReadAllBytesAt function
 
-    CloseFile(&fp);
-    exit(EXIT_FAILURE);
-    return;
+int ReadAllBytesAt(LPFILECORECONTEXT lpContext, const char* pszPath,
+    char** ppOutput, size_t* pnLength, int nFlags) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_READ_ALL_BYTES_AT);
+
+  int nResult = ReadFileWithFlags(lpContext, pszPath, nFlags, ppOutput,
+      pnLength);
+
+  if (pnLength != NULL) {
+    FILE_CORE_TRACE_BYTES(*pnLength);
   }
+  return nResult;
+}
 
-  *ppszOutput = (char*) malloc((CHUNK_SIZE + 1) * sizeof(char));
-  if (ppszOutput == NULL) {
-    fprintf(stderr, "ERROR: Failed to allocate memory.\n");
-    CloseFile(&fp);
-    exit(EXIT_FAILURE);
-    return;
+///////////////////////////////////////////////////////////////////////////////
+// ReadAllBytesEx function
+
+int ReadAllBytesEx(const char* pszPath, char** ppOutput, size_t* pnLength,
+    int nFlags) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_READ_ALL_BYTES_EX);
+
+  int nResult = ReadFileWithFlags(NULL, pszPath, nFlags, ppOutput,
+      pnLength);
+
+  if (pnLength != NULL) {
+    FILE_CORE_TRACE_BYTES(*pnLength);
   }
-  memset(*ppszOutput, 0, (CHUNK_SIZE + 1) * sizeof(char));
+  return nResult;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ReadAllText function
+
+void ReadAllText(const char* pszPath, char** ppszOutput,
+    int *pnFileSize) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_READ_ALL_TEXT);
+
+  size_t nTotalBytesRead = 0;
+  ReadText("ReadAllText", NULL, pszPath, ppszOutput, pnFileSize,
+      &nTotalBytesRead);
+  FILE_CORE_TRACE_BYTES(nTotalBytesRead);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ReadAllTextAt function
+
+void ReadAllTextAt(LPFILECORECONTEXT lpContext, const char* pszPath,
+    char** ppszOutput, int* pnFileSize) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_READ_ALL_TEXT_AT);
 
-  while ((nBytesRead = fread(szBuffer, sizeof(char), CHUNK_SIZE, fp)) != 0) {
-    nTotalBytesRead += nBytesRead;
-    strcat(*ppszOutput, szBuffer);
+  size_t nTotalBytesRead = 0;
+  ReadText("ReadAllTextAt", lpContext, pszPath, ppszOutput, pnFileSize,
+      &nTotalBytesRead);
+  FILE_CORE_TRACE_BYTES(nTotalBytesRead);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ReadDescriptorAll function
 
-    *ppszOutput = (char*) realloc(*ppszOutput,
-        sizeof(char) * (nTotalBytesRead + CHUNK_SIZE + 1));
+int ReadDescriptorAll(int nFileDescriptor, char** ppOutput,
+    size_t* pnLength) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_READ_DESCRIPTOR_ALL);
 
-    memset(szBuffer, 0, CHUNK_SIZE + 1);
+  if (nFileDescriptor < 0 || ppOutput == NULL || pnLength == NULL) {
+    errno = EINVAL;
+    return ERROR;
   }
 
-  CloseFile(&fp);
+  *ppOutput = NULL;
+  *pnLength = 0;
 
-  *ppszOutput = (char*) realloc(*ppszOutput,
-      (nTotalBytesRead + 1) * sizeof(char));
-  (*ppszOutput)[nTotalBytesRead] = '\0';
+  int nResult = ReadAllFromDescriptor(nFileDescriptor, ppOutput, pnLength);
 
-  *pnFileSize = nTotalBytesRead;
+  FILE_CORE_TRACE_BYTES(*pnLength);
+  return nResult;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 // SetCurrentWorkingDirectory function
 
 BOOL SetCurrentWorkingDirectory(const char* pszDirectoryPath) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_SET_CURRENT_WORKING_DIRECTORY);
+
   if (IsNullOrWhiteSpace(pszDirectoryPath)) {
     return FALSE;
   }
@@ -255,63 +1264,96 @@ BOOL SetCurrentWorkingDirectory(const char* pszDirectoryPath) {
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-// WriteAllText function
+// UnmapFile function
 
-void WriteAllText(const char* pszPath, const char* pszContent,
-    BOOL bOverwrite, int* pnBytesWritten) {
-  /* Can't proceed if the pathname is blank */
-  if (IsNullOrWhiteSpace(pszPath)) {
-    return;
+void UnmapFile(LPFILEVIEW lpView) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_UNMAP_FILE);
+
+  if (lpView == NULL) {
+    return; // Required parameter
   }
 
-  /* If there is nowhere to store the number of bytes written,
-   * can't proceed. */
-  if (pnBytesWritten == NULL) {
-    return;
+  if (lpView->pData != NULL && lpView->nLength > 0) {
+    munmap((void*) lpView->pData, (size_t) lpView->nLength);
   }
 
-  /* Expand the path name a la Bash */
-  char szExpandedPathName[MAX_PATH + 1];
-  memset(szExpandedPathName, 0, MAX_PATH + 1);
-  ShellExpand(pszPath, szExpandedPathName, MAX_PATH + 1);
+  memset(lpView, 0, sizeof(FILEVIEW));
+}
 
-  /* If the file already exists, and the overwrite flag is set, then
-   * delete the file from the file system first.  */
-  if (FileExists(szExpandedPathName) && bOverwrite) {
-    remove(szExpandedPathName);
-  }
+///////////////////////////////////////////////////////////////////////////////
+// WriteAllBytes function
 
-  /* If the file exists, but content is blank (regardless of the state of
-   * the overwrite flag), then delete the file using the remove syscall. */
-  if (FileExists(szExpandedPathName)
-      && IsNullOrWhiteSpace(pszContent)) {
-    remove(szExpandedPathName);
-    return;
+int WriteAllBytes(const char* pszPath, const char* pData, size_t nLength,
+    int nFlags) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_WRITE_ALL_BYTES);
+
+  struct iovec part = { (void*) pData, nLength };
+  int nResult = WriteFileWithFlags(NULL, pszPath, &part, 1, nFlags);
+
+  if (nResult == OK) {
+    FILE_CORE_TRACE_BYTES(nLength);
   }
+  return nResult;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// WriteAllBytesAt function
 
-  const char* FILE_MODE = bOverwrite ? "w+" : "a+";
-  FILE* fp = fopen(szExpandedPathName, FILE_MODE);
-  if (fp == NULL) {
-    CloseFile(&fp);
-    ThrowFileAccessFailedException("WriteAllText",
-        szExpandedPathName, NULL);
+int WriteAllBytesAt(LPFILECORECONTEXT lpContext, const char* pszPath,
+    const char* pData, size_t nLength, int nFlags) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_WRITE_ALL_BYTES_AT);
+
+  struct iovec part = { (void*) pData, nLength };
+  int nResult = WriteFileWithFlags(lpContext, pszPath, &part, 1, nFlags);
+
+  if (nResult == OK) {
+    FILE_CORE_TRACE_BYTES(nLength);
   }
+  return nResult;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// WriteAllParts function
+
+int WriteAllParts(const char* pszPath, const struct iovec* pParts,
+    int nCount, int nFlags) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_WRITE_ALL_PARTS);
+
+  int nResult = WriteFileWithFlags(NULL, pszPath, pParts, nCount, nFlags);
 
-  *pnBytesWritten = fprintf(fp, "%s", pszContent);
-  if (*pnBytesWritten < 0) {
-    CloseFile(&fp);
-    ThrowFileAccessFailedException("WriteAllText",
-        szExpandedPathName, NULL);
+  if (nResult == OK) {
+    for (int i = 0; i < nCount; i++) {
+      FILE_CORE_TRACE_BYTES(pParts[i].iov_len);
+    }
   }
+  return nResult;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// WriteAllPartsAt function
+
+int WriteAllPartsAt(LPFILECORECONTEXT lpContext, const char* pszPath,
+    const struct iovec* pParts, int nCount, int nFlags) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_WRITE_ALL_PARTS_AT);
 
-  CloseFile(&fp);
+  int nResult = WriteFileWithFlags(lpContext, pszPath, pParts, nCount,
+      nFlags);
+
+  if (nResult == OK) {
+    for (int i = 0; i < nCount; i++) {
+      FILE_CORE_TRACE_BYTES(pParts[i].iov_len);
+    }
+  }
+  return nResult;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-// WriteFormattedTextToFile function
+// WriteAllText function
+
+void WriteAllText(const char* pszPath, const char* pszContent,
+    BOOL bOverwrite, int* pnBytesWritten) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_WRITE_ALL_TEXT);
 
-void WriteFormattedTextToFile(BOOL bOverwrite, int* pnBytesWritten,
-    const char* pszPath, const char* pszContentFormat, ...) {
   /* Can't proceed if the pathname is blank */
   if (IsNullOrWhiteSpace(pszPath)) {
     return;
@@ -323,36 +1365,72 @@ void WriteFormattedTextToFile(BOOL bOverwrite, int* pnBytesWritten,
     return;
   }
 
-  /* Expand the path name a la Bash */
-  char szExpandedPathName[MAX_PATH + 1];
-  memset(szExpandedPathName, 0, MAX_PATH + 1);
-  ShellExpand(pszPath, szExpandedPathName, MAX_PATH + 1);
+  if (pszContent == NULL) {
+    pszContent = "";
+  }
 
-  /* If the file already exists, and the overwrite flag is set, then
-   * delete the file from the file system first.  */
-  if (FileExists(szExpandedPathName) && bOverwrite) {
-    remove(szExpandedPathName);
+  if (WriteText("WriteAllText", NULL, pszPath, pszContent,
+      strlen(pszContent), bOverwrite, pnBytesWritten)) {
+    FILE_CORE_TRACE_BYTES(*pnBytesWritten);
   }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// WriteAllTextAt function
+
+void WriteAllTextAt(LPFILECORECONTEXT lpContext, const char* pszPath,
+    const char* pszContent, BOOL bOverwrite, int* pnBytesWritten) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_WRITE_ALL_TEXT_AT);
 
-  /* If the file exists, but content is blank, and overwrite flag is set,
-   * then delete the file using the remove syscall */
-  if (FileExists(szExpandedPathName)
-      && IsNullOrWhiteSpace(pszContentFormat)
-      && bOverwrite) {
-    remove(szExpandedPathName);
+  if (IsNullOrWhiteSpace(pszPath) || pnBytesWritten == NULL) {
     return;
   }
 
+  if (pszContent == NULL) {
+    pszContent = "";
+  }
+
+  if (WriteText("WriteAllTextAt", lpContext, pszPath, pszContent,
+      strlen(pszContent), bOverwrite, pnBytesWritten)) {
+    FILE_CORE_TRACE_BYTES(*pnBytesWritten);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// WriteFormattedTextToFile function
+
+void WriteFormattedTextToFile(BOOL bOverwrite, int* pnBytesWritten,
+    const char* pszPath, const char* pszContentFormat, ...) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_WRITE_FORMATTED_TEXT_TO_FILE);
+
   va_list args;
   va_start(args, pszContentFormat);
+  BOOL bWritten = WriteFormattedText("WriteFormattedTextToFile", NULL,
+      bOverwrite, pnBytesWritten, pszPath, pszContentFormat, args);
+  va_end(args);
 
-  const int CONTENT_SIZE = strlen(pszContentFormat) + 1;
-  char szBuffer[CONTENT_SIZE];
-  memset(szBuffer, 0, CONTENT_SIZE);
+  if (bWritten) {
+    FILE_CORE_TRACE_BYTES(*pnBytesWritten);
+  }
+}
 
-  vsprintf(szBuffer, pszContentFormat, args);
+///////////////////////////////////////////////////////////////////////////////
+// WriteFormattedTextToFileAt function
 
-  WriteAllText(pszPath, szBuffer, bOverwrite, pnBytesWritten);
+void WriteFormattedTextToFileAt(LPFILECORECONTEXT lpContext, BOOL bOverwrite,
+    int* pnBytesWritten, const char* pszPath, const char* pszContentFormat,
+    ...) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_WRITE_FORMATTED_TEXT_TO_FILE_AT);
+
+  va_list args;
+  va_start(args, pszContentFormat);
+  BOOL bWritten = WriteFormattedText("WriteFormattedTextToFileAt", lpContext,
+      bOverwrite, pnBytesWritten, pszPath, pszContentFormat, args);
+  va_end(args);
+
+  if (bWritten) {
+    FILE_CORE_TRACE_BYTES(*pnBytesWritten);
+  }
 }
 
 /** Prompts the user for the name to use for either saving or opening a file.
@@ -369,6 +1447,8 @@ void WriteFormattedTextToFile(BOOL bOverwrite, int* pnBytesWritten,
  *
  */
 void do_prompt_file_name(const char* prompt, char* path, int path_size) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_PROMPT_FILE_NAME);
+
   if (path == NULL) {
     LogError(
         "Null path variable in do_prompt_file_name.  Required parameter.");
@@ -401,38 +1481,3 @@ void do_prompt_file_name(const char* prompt, char* path, int path_size) {
    * that the user wants to work with.
    */
 }
-
-///////////////////////////////////////////////////////////////////////////////
-// ShellExpand function
-
-void ShellExpand(const char* pszPathName,
-    char* pszBuffer, int nBufferSize) {
-  if (IsNullOrWhiteSpace(pszPathName)) {
-    return;
-  }
-
-  if (pszBuffer == NULL) {
-    return;
-  }
-
-  if (nBufferSize <= 0) {
-    return;
-  }
-
-  memset(pszBuffer, 0, nBufferSize);
-
-  wordexp_t p;
-  wordexp(pszPathName, &p, 0);
-  if (p.we_wordv == NULL) {
-    return;
-  }
-  char **w = p.we_wordv;
-  if (p.we_wordc <= 0 || IsNullOrWhiteSpace(w[0])) {
-    return;
-  }
-
-  strncpy(pszBuffer, w[0], nBufferSize);
-
-  wordfree(&p);
-}
-
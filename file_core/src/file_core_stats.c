@@ -0,0 +1,453 @@
+/*
+ * file_core_stats.c
+ *
+ *  Per-thread call counters and latency histograms for the public functions
+ *  of the library, compiled in when FILE_CORE_ENABLE_STATS is defined.
+ */
+
+#include "stdafx.h"
+#include "file_core.h"
+
+#include "file_core_internal.h"
+#include "file_core_symbols.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Names of the functions, indexed by their FILE_CORE_API_* values
+
+static const char* g_ppszApiNames[FILE_CORE_API_COUNT] = {
+  "AddGroupCommitFile",
+  "Append",
+  "AppendFormatted",
+  "ClearShellExpandCache",
+  "CloseAppender",
+  "CloseFile",
+  "CloseFileReader",
+  "CreateDirIfNotExists",
+  "CreateDirectory",
+  "CreateGroupCommitWriter",
+  "DestroyGroupCommitWriter",
+  "DirectoryExists",
+  "DisableShellExpandCache",
+  "EnableShellExpandCache",
+  "EnumerateDirectory",
+  "FileExists",
+  "FlushAppender",
+  "FlushGroupCommitWriter",
+  "FreeDirectoryListing",
+  "FreeReadManyResults",
+  "GetCurrentWorkingDirectory",
+  "GetFileInfo",
+  "GetHomeDirectoryPath",
+  "GroupCommitAppend",
+  "MapFile",
+  "OpenAppender",
+  "OpenFileReader",
+  "ReadAllBytes",
+  "ReadAllText",
+  "ReadManyFiles",
+  "ReadNextChunk",
+  "ReadNextLine",
+  "SetCurrentWorkingDirectory",
+  "ShellExpand",
+  "StatMany",
+  "UnmapFile",
+  "WalkDirectoryTree",
+  "WriteAllBytes",
+  "WriteAllText",
+  "WriteFormattedTextToFile",
+  "do_prompt_file_name",
+  "CopyFile",
+  "MoveFile",
+  "ReadDescriptorRange",
+  "ReadDescriptorRangeV",
+  "ReadFileRange",
+  "WriteDescriptorRange",
+  "WriteDescriptorRangeV",
+  "WriteFileRange",
+  "DropFromCache",
+  "PrefetchFiles",
+  "ReadAllBytesEx",
+  "CachedReadAllText",
+  "ClearTextCache",
+  "DisableTextCache",
+  "EnableTextCache",
+  "ReleaseCachedText",
+  "ComputeBufferChecksum",
+  "ComputeFileChecksum",
+  "BuildLineIndex",
+  "FreeLineIndex",
+  "GetLine",
+  "GetLineCount",
+  "CreateFileCoreContext",
+  "DestroyFileCoreContext",
+  "GetContextDirectory",
+  "SetContextDirectory",
+  "CreateDirectoryAt",
+  "DirectoryExistsAt",
+  "FileExistsAt",
+  "GetFileInfoAt",
+  "MapFileAt",
+  "ReadAllBytesAt",
+  "ReadAllTextAt",
+  "WriteAllBytesAt",
+  "WriteAllTextAt",
+  "AppendScratchFile",
+  "CloseScratchFile",
+  "CreateScratchFile",
+  "GetScratchBuffer",
+  "GetScratchFileDescriptor",
+  "LinkScratchFile",
+  "DeleteMany",
+  "RemoveDirectoryTree",
+  "AppendAllParts",
+  "WriteAllParts",
+  "ReadDescriptorAll",
+  "CreateDirIfNotExistsAt",
+  "EnumerateDirectoryAt",
+  "OpenAppenderAt",
+  "OpenFileReaderAt",
+  "WriteFormattedTextToFileAt",
+  "CreateFileCoreContextEx",
+  "WalkDirectoryTreeAt",
+  "WriteAllPartsAt",
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Names of the counters, indexed by their FILE_CORE_COUNTER_* values
+
+static const char* g_ppszCounterNames[FILE_CORE_COUNTER_COUNT] = {
+  "wordexp_calls",
+  "shell_expand_cache_hits",
+  "statx_calls",
+  "sync_calls",
+  "text_cache_hits",
+  "text_cache_misses",
+};
+
+#ifdef FILE_CORE_ENABLE_STATS
+
+///////////////////////////////////////////////////////////////////////////////
+// API_COUNTERS structure
+
+typedef struct _tagAPI_COUNTERS {
+  uint64_t nCalls;
+  uint64_t nBytes;
+  uint64_t nNanoseconds;
+  uint64_t nHistogram[FILE_CORE_STATS_BUCKETS];
+} API_COUNTERS, *LPAPI_COUNTERS;
+
+///////////////////////////////////////////////////////////////////////////////
+// THREAD_STATS structure - One thread's counters.  Only the owning thread
+// writes them, so updates need no read-modify-write atomics; the stores are
+// atomic only so that a concurrent snapshot never sees a torn value.  Blocks
+// are never freed: when a thread exits its block is handed to the next new
+// thread, so totals survive and memory stays bounded by the peak number of
+// threads.
+
+typedef struct _tagTHREAD_STATS {
+  struct _tagTHREAD_STATS* lpNext;
+  int bInUse;
+  API_COUNTERS apis[FILE_CORE_API_COUNT];
+  uint64_t nCounters[FILE_CORE_COUNTER_COUNT];
+} __attribute__((aligned(64))) THREAD_STATS, *LPTHREAD_STATS;
+
+static LPTHREAD_STATS g_lpThreadStatsList = NULL;
+static pthread_key_t g_threadStatsKey;
+static pthread_once_t g_threadStatsOnce = PTHREAD_ONCE_INIT;
+static __thread LPTHREAD_STATS t_lpThreadStats = NULL;
+
+///////////////////////////////////////////////////////////////////////////////
+// Internal functions
+
+///////////////////////////////////////////////////////////////////////////////
+// ReleaseThreadStats function - Key destructor; runs as a thread exits.
+
+static void ReleaseThreadStats(void* pValue) {
+  LPTHREAD_STATS lpStats = (LPTHREAD_STATS) pValue;
+  __atomic_store_n(&lpStats->bInUse, FALSE, __ATOMIC_RELEASE);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// CreateThreadStatsKey function
+
+static void CreateThreadStatsKey(void) {
+  pthread_key_create(&g_threadStatsKey, ReleaseThreadStats);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// GetThreadStats function - Gets the calling thread's block, adopting one
+// left by a thread that has exited, or adding a new one to the list.
+
+static LPTHREAD_STATS GetThreadStats(void) {
+  if (t_lpThreadStats != NULL) {
+    return t_lpThreadStats;
+  }
+
+  pthread_once(&g_threadStatsOnce, CreateThreadStatsKey);
+
+  LPTHREAD_STATS lpStats = __atomic_load_n(&g_lpThreadStatsList,
+      __ATOMIC_ACQUIRE);
+  for (; lpStats != NULL; lpStats = lpStats->lpNext) {
+    int bInUse = FALSE;
+    if (__atomic_compare_exchange_n(&lpStats->bInUse, &bInUse, TRUE, FALSE,
+        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+      break;
+    }
+  }
+
+  if (lpStats == NULL) {
+    if (OK != posix_memalign((void**) &lpStats, 64, sizeof(THREAD_STATS))) {
+      return NULL;
+    }
+    memset(lpStats, 0, sizeof(THREAD_STATS));
+    lpStats->bInUse = TRUE;
+
+    lpStats->lpNext = __atomic_load_n(&g_lpThreadStatsList,
+        __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&g_lpThreadStatsList,
+        &lpStats->lpNext, lpStats, TRUE, __ATOMIC_RELEASE,
+        __ATOMIC_RELAXED)) {
+    }
+  }
+
+  pthread_setspecific(g_threadStatsKey, lpStats);
+  t_lpThreadStats = lpStats;
+  return lpStats;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// AddToCounter function - Single-writer increment.
+
+static inline void AddToCounter(uint64_t* pnCounter, uint64_t nValue) {
+  __atomic_store_n(pnCounter,
+      __atomic_load_n(pnCounter, __ATOMIC_RELAXED) + nValue,
+      __ATOMIC_RELAXED);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// GetBucket function - Index of the log2 bucket for a latency.
+
+static inline int GetBucket(uint64_t nNanoseconds) {
+  if (nNanoseconds < 2) {
+    return 0;
+  }
+  int nBucket = 63 - __builtin_clzll(nNanoseconds);
+  return nBucket < FILE_CORE_STATS_BUCKETS ? nBucket
+      : FILE_CORE_STATS_BUCKETS - 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// GetTraceClock function
+
+static inline uint64_t GetTraceClock(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// BeginApiTrace function
+
+void BeginApiTrace(LPAPI_TRACE lpTrace, int nApi) {
+  lpTrace->nApi = nApi;
+  lpTrace->nBytes = 0;
+  lpTrace->nStart = GetTraceClock();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// EndApiTrace function
+
+void EndApiTrace(LPAPI_TRACE lpTrace) {
+  uint64_t nElapsed = GetTraceClock() - lpTrace->nStart;
+
+  /* Runs after the traced function has set errno for its caller. */
+  int nError = errno;
+  LPTHREAD_STATS lpStats = GetThreadStats();
+  errno = nError;
+  if (lpStats == NULL) {
+    return;
+  }
+
+  LPAPI_COUNTERS lpCounters = &lpStats->apis[lpTrace->nApi];
+  AddToCounter(&lpCounters->nCalls, 1);
+  AddToCounter(&lpCounters->nBytes, lpTrace->nBytes);
+  AddToCounter(&lpCounters->nNanoseconds, nElapsed);
+  AddToCounter(&lpCounters->nHistogram[GetBucket(nElapsed)], 1);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// CountFileCoreEvent function
+
+void CountFileCoreEvent(int nCounter) {
+  int nError = errno;
+  LPTHREAD_STATS lpStats = GetThreadStats();
+  errno = nError;
+  if (lpStats != NULL) {
+    AddToCounter(&lpStats->nCounters[nCounter], 1);
+  }
+}
+
+#else
+
+///////////////////////////////////////////////////////////////////////////////
+// Internal functions
+
+void BeginApiTrace(LPAPI_TRACE lpTrace, int nApi) {
+}
+
+void EndApiTrace(LPAPI_TRACE lpTrace) {
+}
+
+void CountFileCoreEvent(int nCounter) {
+}
+
+#endif //FILE_CORE_ENABLE_STATS
+
+///////////////////////////////////////////////////////////////////////////////
+// GetPercentileFromHistogram function - Upper bound, in nanoseconds, of the
+// bucket holding the given percentile.
+
+static uint64_t GetPercentileFromHistogram(LPFILECOREAPISTATS lpApi,
+    int nPercent) {
+  uint64_t nRank = (lpApi->nCalls * nPercent + 99) / 100;
+  uint64_t nSeen = 0;
+
+  for (int i = 0; i < FILE_CORE_STATS_BUCKETS; i++) {
+    nSeen += lpApi->nHistogram[i];
+    if (nSeen >= nRank && nSeen > 0) {
+      return (2ULL << i) - 1;
+    }
+  }
+
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Publicly-exposed functions
+
+///////////////////////////////////////////////////////////////////////////////
+// GetFileCoreStats function
+
+int GetFileCoreStats(LPFILECORESTATS lpStats) {
+  if (lpStats == NULL) {
+    errno = EINVAL;
+    return ERROR;
+  }
+
+  memset(lpStats, 0, sizeof(FILECORESTATS));
+  for (int i = 0; i < FILE_CORE_API_COUNT; i++) {
+    lpStats->apis[i].pszName = g_ppszApiNames[i];
+  }
+
+#ifdef FILE_CORE_ENABLE_STATS
+  lpStats->bEnabled = TRUE;
+
+  LPTHREAD_STATS lpThread = __atomic_load_n(&g_lpThreadStatsList,
+      __ATOMIC_ACQUIRE);
+  for (; lpThread != NULL; lpThread = lpThread->lpNext) {
+    for (int i = 0; i < FILE_CORE_API_COUNT; i++) {
+      LPAPI_COUNTERS lpSource = &lpThread->apis[i];
+      LPFILECOREAPISTATS lpTarget = &lpStats->apis[i];
+
+      lpTarget->nCalls += __atomic_load_n(&lpSource->nCalls,
+          __ATOMIC_RELAXED);
+      lpTarget->nBytes += __atomic_load_n(&lpSource->nBytes,
+          __ATOMIC_RELAXED);
+      lpTarget->nNanoseconds += __atomic_load_n(&lpSource->nNanoseconds,
+          __ATOMIC_RELAXED);
+      for (int j = 0; j < FILE_CORE_STATS_BUCKETS; j++) {
+        lpTarget->nHistogram[j] += __atomic_load_n(
+            &lpSource->nHistogram[j], __ATOMIC_RELAXED);
+      }
+    }
+
+    for (int i = 0; i < FILE_CORE_COUNTER_COUNT; i++) {
+      lpStats->nCounters[i] += __atomic_load_n(&lpThread->nCounters[i],
+          __ATOMIC_RELAXED);
+    }
+  }
+#endif //FILE_CORE_ENABLE_STATS
+
+  return OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// DumpFileCoreStats function
+
+int DumpFileCoreStats(int nFileDescriptor, int nFormat) {
+  if (nFileDescriptor < 0 || (nFormat != FILE_CORE_STATS_FORMAT_TEXT
+      && nFormat != FILE_CORE_STATS_FORMAT_JSON)) {
+    errno = EINVAL;
+    return ERROR;
+  }
+
+  LPFILECORESTATS lpStats = (LPFILECORESTATS) malloc(sizeof(FILECORESTATS));
+  if (lpStats == NULL) {
+    errno = ENOMEM;
+    return ERROR;
+  }
+  GetFileCoreStats(lpStats);
+
+  BOOL bJson = nFormat == FILE_CORE_STATS_FORMAT_JSON;
+  BOOL bFirst = TRUE;
+  int nResult = 0;
+
+  if (bJson) {
+    nResult = dprintf(nFileDescriptor, "{\n  \"enabled\": %s,\n"
+        "  \"apis\": [", lpStats->bEnabled ? "true" : "false");
+  } else {
+    nResult = dprintf(nFileDescriptor, "%-28s %12s %14s %12s %10s %10s\n",
+        lpStats->bEnabled ? "function" : "function (stats disabled)",
+        "calls", "bytes", "total_ms", "p50_us", "p99_us");
+  }
+
+  for (int i = 0; i < FILE_CORE_API_COUNT && nResult >= 0; i++) {
+    LPFILECOREAPISTATS lpApi = &lpStats->apis[i];
+    if (lpApi->nCalls == 0) {
+      continue;
+    }
+
+    uint64_t nP50 = GetPercentileFromHistogram(lpApi, 50);
+    uint64_t nP99 = GetPercentileFromHistogram(lpApi, 99);
+
+    if (!bJson) {
+      nResult = dprintf(nFileDescriptor,
+          "%-28s %12" PRIu64 " %14" PRIu64 " %12.3f %10.3f %10.3f\n",
+          lpApi->pszName, lpApi->nCalls, lpApi->nBytes,
+          lpApi->nNanoseconds / 1e6, nP50 / 1e3, nP99 / 1e3);
+      continue;
+    }
+
+    nResult = dprintf(nFileDescriptor, "%s\n    {\"name\": \"%s\", "
+        "\"calls\": %" PRIu64 ", \"bytes\": %" PRIu64 ", "
+        "\"total_ns\": %" PRIu64 ", \"p50_ns\": %" PRIu64 ", "
+        "\"p99_ns\": %" PRIu64 ", \"histogram\": [", bFirst ? "" : ",",
+        lpApi->pszName, lpApi->nCalls, lpApi->nBytes, lpApi->nNanoseconds,
+        nP50, nP99);
+    for (int j = 0; j < FILE_CORE_STATS_BUCKETS && nResult >= 0; j++) {
+      nResult = dprintf(nFileDescriptor, "%s%" PRIu64, j == 0 ? "" : ", ",
+          lpApi->nHistogram[j]);
+    }
+    if (nResult >= 0) {
+      nResult = dprintf(nFileDescriptor, "]}");
+    }
+    bFirst = FALSE;
+  }
+
+  if (bJson && nResult >= 0) {
+    nResult = dprintf(nFileDescriptor, "\n  ],\n  \"counters\": {");
+  }
+  for (int i = 0; i < FILE_CORE_COUNTER_COUNT && nResult >= 0; i++) {
+    nResult = bJson
+        ? dprintf(nFileDescriptor, "%s\n    \"%s\": %" PRIu64,
+            i == 0 ? "" : ",", g_ppszCounterNames[i], lpStats->nCounters[i])
+        : dprintf(nFileDescriptor, "%-28s %12" PRIu64 "\n",
+            g_ppszCounterNames[i], lpStats->nCounters[i]);
+  }
+  if (bJson && nResult >= 0) {
+    nResult = dprintf(nFileDescriptor, "\n  }\n}\n");
+  }
+
+  free(lpStats);
+  return nResult < 0 ? ERROR : OK;
+}
@@ -0,0 +1,322 @@
+/*
+ * file_range.c
+ *
+ *  Positional reads and writes of part of a file, at 64-bit offsets.  None
+ *  of these move the file position, so any number of threads may share one
+ *  descriptor.
+ */
+
+#include "stdafx.h"
+#include "file_core.h"
+
+#include "file_core_internal.h"
+#include "file_core_symbols.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Internal functions
+
+///////////////////////////////////////////////////////////////////////////////
+// TransferRange function - Reads or writes nLength bytes at nOffset with
+// pread() or pwrite(), retrying after short transfers and interruptions.  A
+// read stops early, successfully, at end-of-file.
+
+static int TransferRange(int nFileDescriptor, off_t nOffset, char* pBuffer,
+    size_t nLength, BOOL bWrite, size_t* pnTransferred) {
+  size_t nTransferred = 0;
+  int nResult = OK;
+
+  while (nTransferred < nLength) {
+    size_t nChunk = nLength - nTransferred;
+    if (nChunk > MAX_READ_CHUNK_SIZE) {
+      nChunk = MAX_READ_CHUNK_SIZE;
+    }
+
+    ssize_t nCount = bWrite
+        ? pwrite(nFileDescriptor, pBuffer + nTransferred, nChunk, nOffset)
+        : pread(nFileDescriptor, pBuffer + nTransferred, nChunk, nOffset);
+    if (nCount < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      nResult = ERROR;
+      break;
+    }
+    if (nCount == 0) {
+      /* End-of-file; pwrite() does not return zero for a nonzero length. */
+      break;
+    }
+
+    nTransferred += (size_t) nCount;
+    nOffset += nCount;
+  }
+
+  if (pnTransferred != NULL) {
+    *pnTransferred = nTransferred;
+  }
+
+  return nResult;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// TransferRangeVector function - As TransferRange, but scatters into or
+// gathers from an array of buffers with preadv() or pwritev().  The caller's
+// array is left untouched: it is copied IOV_MAX elements at a time into a
+// scratch array that is adjusted as the transfer progresses.
+
+static int TransferRangeVector(int nFileDescriptor, off_t nOffset,
+    const struct iovec* pIovecs, int nCount, BOOL bWrite,
+    size_t* pnTransferred) {
+  struct iovec iovecs[IOV_MAX];
+  size_t nTransferred = 0;
+  int nResult = OK;
+  BOOL bEndOfFile = FALSE;
+
+  while (nCount > 0 && nResult == OK && !bEndOfFile) {
+    int nBatch = nCount > IOV_MAX ? IOV_MAX : nCount;
+    memcpy(iovecs, pIovecs, nBatch * sizeof(struct iovec));
+    pIovecs += nBatch;
+    nCount -= nBatch;
+
+    struct iovec* pCurrent = iovecs;
+    int nRemaining = nBatch;
+    while (nRemaining > 0) {
+      /* Skip over any buffers that are already done (or were empty). */
+      if (pCurrent->iov_len == 0) {
+        pCurrent++;
+        nRemaining--;
+        continue;
+      }
+
+      ssize_t nDone = bWrite
+          ? pwritev(nFileDescriptor, pCurrent, nRemaining, nOffset)
+          : preadv(nFileDescriptor, pCurrent, nRemaining, nOffset);
+      if (nDone < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        nResult = ERROR;
+        break;
+      }
+      if (nDone == 0) {
+        bEndOfFile = TRUE;
+        break;
+      }
+
+      nTransferred += (size_t) nDone;
+      nOffset += nDone;
+
+      /* Advance past whatever was transferred, which may end part way
+       * through one of the buffers. */
+      size_t nLeft = (size_t) nDone;
+      while (nRemaining > 0 && nLeft >= pCurrent->iov_len) {
+        nLeft -= pCurrent->iov_len;
+        pCurrent++;
+        nRemaining--;
+      }
+
+      if (nRemaining > 0 && nLeft > 0) {
+        pCurrent->iov_base = (char*) pCurrent->iov_base + nLeft;
+        pCurrent->iov_len -= nLeft;
+      }
+    }
+  }
+
+  if (pnTransferred != NULL) {
+    *pnTransferred = nTransferred;
+  }
+
+  return nResult;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Publicly-exposed functions
+
+///////////////////////////////////////////////////////////////////////////////
+// ReadDescriptorRange function
+
+int ReadDescriptorRange(int nFileDescriptor, off_t nOffset, size_t nLength,
+    char* pBuffer, size_t* pnBytesRead) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_READ_DESCRIPTOR_RANGE);
+
+  if (pnBytesRead != NULL) {
+    *pnBytesRead = 0;
+  }
+
+  if (nFileDescriptor < 0 || nOffset < 0
+      || (pBuffer == NULL && nLength > 0)) {
+    errno = EINVAL;
+    return ERROR;
+  }
+
+  size_t nBytesRead = 0;
+  int nResult = TransferRange(nFileDescriptor, nOffset, pBuffer, nLength,
+      FALSE, &nBytesRead);
+
+  FILE_CORE_TRACE_BYTES(nBytesRead);
+  if (pnBytesRead != NULL) {
+    *pnBytesRead = nBytesRead;
+  }
+
+  return nResult;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ReadDescriptorRangeV function
+
+int ReadDescriptorRangeV(int nFileDescriptor, off_t nOffset,
+    const struct iovec* pIovecs, int nCount, size_t* pnBytesRead) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_READ_DESCRIPTOR_RANGE_V);
+
+  if (pnBytesRead != NULL) {
+    *pnBytesRead = 0;
+  }
+
+  if (nFileDescriptor < 0 || nOffset < 0 || nCount < 0
+      || (pIovecs == NULL && nCount > 0)) {
+    errno = EINVAL;
+    return ERROR;
+  }
+
+  size_t nBytesRead = 0;
+  int nResult = TransferRangeVector(nFileDescriptor, nOffset, pIovecs,
+      nCount, FALSE, &nBytesRead);
+
+  FILE_CORE_TRACE_BYTES(nBytesRead);
+  if (pnBytesRead != NULL) {
+    *pnBytesRead = nBytesRead;
+  }
+
+  return nResult;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ReadFileRange function
+
+int ReadFileRange(const char* pszPath, off_t nOffset, size_t nLength,
+    char* pBuffer, size_t* pnBytesRead) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_READ_FILE_RANGE);
+
+  if (pnBytesRead != NULL) {
+    *pnBytesRead = 0;
+  }
+
+  if (IsNullOrWhiteSpace(pszPath) || nOffset < 0
+      || (pBuffer == NULL && nLength > 0)) {
+    errno = EINVAL;
+    return ERROR;
+  }
+
+  /* Expand the path name a la Bash */
+  char szExpandedPathName[MAX_PATH + 1];
+  memset(szExpandedPathName, 0, MAX_PATH + 1);
+  ShellExpand(pszPath, szExpandedPathName, MAX_PATH + 1);
+
+  int nFileDescriptor = open(szExpandedPathName, O_RDONLY | O_CLOEXEC);
+  if (nFileDescriptor < 0) {
+    return ERROR;
+  }
+
+  size_t nBytesRead = 0;
+  int nResult = TransferRange(nFileDescriptor, nOffset, pBuffer, nLength,
+      FALSE, &nBytesRead);
+
+  int nError = errno;
+  close(nFileDescriptor);
+  errno = nError;
+
+  FILE_CORE_TRACE_BYTES(nBytesRead);
+  if (pnBytesRead != NULL) {
+    *pnBytesRead = nBytesRead;
+  }
+
+  return nResult;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// WriteDescriptorRange function
+
+int WriteDescriptorRange(int nFileDescriptor, off_t nOffset,
+    const char* pData, size_t nLength) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_WRITE_DESCRIPTOR_RANGE);
+
+  if (nFileDescriptor < 0 || nOffset < 0 || (pData == NULL && nLength > 0)) {
+    errno = EINVAL;
+    return ERROR;
+  }
+
+  FILE_CORE_TRACE_BYTES(nLength);
+
+  return WriteFully(nFileDescriptor, pData, nLength, nOffset);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// WriteDescriptorRangeV function
+
+int WriteDescriptorRangeV(int nFileDescriptor, off_t nOffset,
+    const struct iovec* pIovecs, int nCount) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_WRITE_DESCRIPTOR_RANGE_V);
+
+  if (nFileDescriptor < 0 || nOffset < 0 || nCount < 0
+      || (pIovecs == NULL && nCount > 0)) {
+    errno = EINVAL;
+    return ERROR;
+  }
+
+  size_t nBytesWritten = 0;
+  int nResult = TransferRangeVector(nFileDescriptor, nOffset, pIovecs,
+      nCount, TRUE, &nBytesWritten);
+
+  FILE_CORE_TRACE_BYTES(nBytesWritten);
+  return nResult;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// WriteFileRange function
+
+int WriteFileRange(const char* pszPath, off_t nOffset, const char* pData,
+    size_t nLength, int nFlags) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_WRITE_FILE_RANGE);
+
+  if (IsNullOrWhiteSpace(pszPath) || nOffset < 0
+      || (pData == NULL && nLength > 0)) {
+    errno = EINVAL;
+    return ERROR;
+  }
+
+  /* Writing in place is incompatible with appending or replacing. */
+  if (nFlags & (WRITE_FLAG_APPEND | WRITE_FLAG_ATOMIC)) {
+    errno = EINVAL;
+    return ERROR;
+  }
+
+  FILE_CORE_TRACE_BYTES(nLength);
+
+  /* Expand the path name a la Bash */
+  char szExpandedPathName[MAX_PATH + 1];
+  memset(szExpandedPathName, 0, MAX_PATH + 1);
+  ShellExpand(pszPath, szExpandedPathName, MAX_PATH + 1);
+
+  int nFileDescriptor = open(szExpandedPathName,
+      O_WRONLY | O_CREAT | O_CLOEXEC, 0666);
+  if (nFileDescriptor < 0) {
+    return ERROR;
+  }
+
+  if (OK != WriteFully(nFileDescriptor, pData, nLength, nOffset)
+      || OK != SyncFile(nFileDescriptor, nFlags)) {
+    int nError = errno;
+    close(nFileDescriptor);
+    errno = nError;
+    return ERROR;
+  }
+
+  if (OK != close(nFileDescriptor) && errno != EINTR) {
+    return ERROR;
+  }
+
+  if (nFlags & WRITE_FLAG_FULLSYNC) {
+    return SyncParentDirectory(AT_FDCWD, szExpandedPathName);
+  }
+
+  return OK;
+}
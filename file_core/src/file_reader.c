@@ -0,0 +1,255 @@
+/*
+ * file_reader.c
+ *
+ *  Streaming, constant-memory reader over a file, FIFO or device.
+ */
+
+#include "stdafx.h"
+#include "file_core.h"
+
+#include "file_core_internal.h"
+#include "file_core_symbols.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// FILEREADER structure
+
+struct _tagFILEREADER {
+  int nFileDescriptor;    /* Descriptor of the file being read */
+  char* pBuffer;          /* Reusable buffer owned by the reader */
+  size_t nBufferSize;     /* Capacity of pBuffer, in bytes */
+  size_t nStart;          /* Offset of the first unconsumed byte */
+  size_t nEnd;            /* Offset just past the last buffered byte */
+  BOOL bEndOfFile;        /* TRUE once read() has reported EOF */
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Internal functions
+
+///////////////////////////////////////////////////////////////////////////////
+// FillReaderBuffer function - Compacts the unconsumed bytes to the front of
+// the buffer and issues a single read() into the free space behind them.
+// Returns the number of bytes read, zero at EOF, or ERROR.
+
+static ssize_t FillReaderBuffer(LPFILEREADER lpReader) {
+  if (lpReader->nStart > 0) {
+    size_t nPending = lpReader->nEnd - lpReader->nStart;
+    if (nPending > 0) {
+      memmove(lpReader->pBuffer, lpReader->pBuffer + lpReader->nStart,
+          nPending);
+    }
+    lpReader->nStart = 0;
+    lpReader->nEnd = nPending;
+  }
+
+  if (lpReader->bEndOfFile || lpReader->nEnd == lpReader->nBufferSize) {
+    return 0;
+  }
+
+  ssize_t nBytesRead = 0;
+  do {
+    nBytesRead = read(lpReader->nFileDescriptor,
+        lpReader->pBuffer + lpReader->nEnd,
+        lpReader->nBufferSize - lpReader->nEnd);
+  } while (nBytesRead < 0 && errno == EINTR);
+
+  if (nBytesRead < 0) {
+    return ERROR;
+  }
+
+  if (nBytesRead == 0) {
+    lpReader->bEndOfFile = TRUE;
+  }
+
+  lpReader->nEnd += (size_t) nBytesRead;
+  return nBytesRead;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// CreateFileReader function - Does the work of OpenFileReader and
+// OpenFileReaderAt.
+
+static LPFILEREADER CreateFileReader(LPFILECORECONTEXT lpContext,
+    const char* pszPath, size_t nBufferSize) {
+  if (IsNullOrWhiteSpace(pszPath)) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  if (nBufferSize == 0) {
+    nBufferSize = FILE_READER_DEFAULT_BUFFER_SIZE;
+  }
+
+  /* Expand the file name string a la Bash */
+  char szExpandedFileName[MAX_PATH + 1];
+  if (OK != ExpandContextPath(lpContext, pszPath, szExpandedFileName,
+      MAX_PATH + 1)) {
+    return NULL;
+  }
+
+  LPFILEREADER lpReader = (LPFILEREADER) calloc(1, sizeof(FILEREADER));
+  if (lpReader == NULL) {
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  lpReader->pBuffer = (char*) malloc(nBufferSize);
+  if (lpReader->pBuffer == NULL) {
+    free(lpReader);
+    errno = ENOMEM;
+    return NULL;
+  }
+  lpReader->nBufferSize = nBufferSize;
+
+  lpReader->nFileDescriptor = openat(GetContextDescriptor(lpContext),
+      szExpandedFileName, O_RDONLY | O_CLOEXEC);
+  if (lpReader->nFileDescriptor < 0) {
+    int nError = errno;
+    free(lpReader->pBuffer);
+    free(lpReader);
+    errno = nError;
+    return NULL;
+  }
+
+#ifdef POSIX_FADV_SEQUENTIAL
+  /* Harmless on pipes, where it simply fails with ESPIPE. */
+  posix_fadvise(lpReader->nFileDescriptor, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif //POSIX_FADV_SEQUENTIAL
+
+  return lpReader;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Publicly-exposed functions
+
+///////////////////////////////////////////////////////////////////////////////
+// CloseFileReader function
+
+void CloseFileReader(LPFILEREADER* lppReader) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_CLOSE_FILE_READER);
+
+  if (lppReader == NULL) {
+    return; // Required parameter
+  }
+
+  if (*lppReader == NULL) {
+    return; // Required parameter - or reader is already closed
+  }
+
+  close((*lppReader)->nFileDescriptor);
+  free((*lppReader)->pBuffer);
+  free(*lppReader);
+  *lppReader = NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// OpenFileReader function
+
+LPFILEREADER OpenFileReader(const char* pszPath, size_t nBufferSize) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_OPEN_FILE_READER);
+
+  return CreateFileReader(NULL, pszPath, nBufferSize);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// OpenFileReaderAt function
+
+LPFILEREADER OpenFileReaderAt(LPFILECORECONTEXT lpContext,
+    const char* pszPath, size_t nBufferSize) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_OPEN_FILE_READER_AT);
+
+  return CreateFileReader(lpContext, pszPath, nBufferSize);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ReadNextChunk function
+
+int ReadNextChunk(LPFILEREADER lpReader, const char** ppData,
+    size_t* pnLength) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_READ_NEXT_CHUNK);
+
+  if (lpReader == NULL || ppData == NULL || pnLength == NULL) {
+    errno = EINVAL;
+    return ERROR;
+  }
+
+  *ppData = NULL;
+  *pnLength = 0;
+
+  /* Hand back whatever ReadNextLine left over before reading more. */
+  if (lpReader->nStart == lpReader->nEnd) {
+    lpReader->nStart = lpReader->nEnd = 0;
+
+    ssize_t nBytesRead = FillReaderBuffer(lpReader);
+    if (nBytesRead < 0) {
+      return ERROR;
+    }
+
+    if (nBytesRead == 0) {
+      return FILE_READER_EOF;
+    }
+  }
+
+  *ppData = lpReader->pBuffer + lpReader->nStart;
+  *pnLength = lpReader->nEnd - lpReader->nStart;
+  lpReader->nStart = lpReader->nEnd;
+
+  FILE_CORE_TRACE_BYTES(*pnLength);
+  return OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ReadNextLine function
+
+int ReadNextLine(LPFILEREADER lpReader, const char** ppszLine,
+    size_t* pnLength) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_READ_NEXT_LINE);
+
+  if (lpReader == NULL || ppszLine == NULL || pnLength == NULL) {
+    errno = EINVAL;
+    return ERROR;
+  }
+
+  *ppszLine = NULL;
+  *pnLength = 0;
+
+  /* Only the bytes appended by the most recent fill need to be searched;
+   * everything before them is already known to contain no newline. */
+  size_t nSearchFrom = lpReader->nStart;
+
+  while (TRUE) {
+    char* pszNewline = (char*) memchr(lpReader->pBuffer + nSearchFrom, '\n',
+        lpReader->nEnd - nSearchFrom);
+
+    if (pszNewline != NULL) {
+      *ppszLine = lpReader->pBuffer + lpReader->nStart;
+      *pnLength = (size_t) (pszNewline - *ppszLine);
+      lpReader->nStart = (size_t) (pszNewline - lpReader->pBuffer) + 1;
+      FILE_CORE_TRACE_BYTES(*pnLength + 1);
+      return OK;
+    }
+
+    size_t nPending = lpReader->nEnd - lpReader->nStart;
+
+    /* The buffer is full and holds no newline, or the input is exhausted:
+     * either way, the pending bytes are handed out as a line. */
+    if (nPending == lpReader->nBufferSize || lpReader->bEndOfFile) {
+      if (nPending == 0) {
+        return FILE_READER_EOF;
+      }
+
+      *ppszLine = lpReader->pBuffer + lpReader->nStart;
+      *pnLength = nPending;
+      lpReader->nStart = lpReader->nEnd;
+      FILE_CORE_TRACE_BYTES(nPending);
+      return OK;
+    }
+
+    ssize_t nBytesRead = FillReaderBuffer(lpReader);
+    if (nBytesRead < 0) {
+      return ERROR;
+    }
+
+    /* FillReaderBuffer moved the pending bytes to the front. */
+    nSearchFrom = nPending;
+  }
+}
@@ -0,0 +1,496 @@
+/*
+ * group_commit.c
+ *
+ *  Multi-producer group-commit writer.  Producers push records onto a
+ *  lock-free MPSC queue; a dedicated flusher thread drains it, coalesces the
+ *  records for each file into writev() batches and synchronizes each file
+ *  once per batch.
+ */
+
+#include "stdafx.h"
+#include "file_core.h"
+
+#include "file_core_internal.h"
+#include "file_core_symbols.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// COMMIT_COMPLETION structure - Lives on the stack of a producer that is
+// waiting for its record to become durable.
+
+typedef struct _tagCOMMIT_COMPLETION {
+  BOOL bDone;
+  int nResult;
+  int nError;
+} COMMIT_COMPLETION, *LPCOMMIT_COMPLETION;
+
+///////////////////////////////////////////////////////////////////////////////
+// COMMIT_RECORD structure - A node in the MPSC queue.
+
+typedef struct _tagCOMMIT_RECORD {
+  struct _tagCOMMIT_RECORD* pNext;
+  int nFile;                          /* Index of the file, or -1 */
+  LPCOMMIT_COMPLETION lpCompletion;   /* NULL if nobody is waiting */
+  size_t nLength;
+  char data[];
+} COMMIT_RECORD, *LPCOMMIT_RECORD;
+
+///////////////////////////////////////////////////////////////////////////////
+// GROUPCOMMITWRITER structure
+
+struct _tagGROUPCOMMITWRITER {
+  /* Queue.  pHead is shared by producers; pTail belongs to the flusher. */
+  LPCOMMIT_RECORD pHead;
+  LPCOMMIT_RECORD pTail;
+  COMMIT_RECORD stub;
+
+  int* pFileDescriptors;
+  int* pResults;                      /* Per-file results of a batch, */
+  int* pErrors;                       /* owned by the flusher */
+  int nMaxFiles;
+  int nFileCount;
+  int nFlags;                         /* WRITE_FLAG_DATASYNC and friends */
+  int nStickyError;                   /* errno of the first failed commit */
+
+  pthread_t flusher;
+  pthread_mutex_t mutex;
+  pthread_cond_t workAvailable;       /* Signalled by producers */
+  pthread_cond_t batchCommitted;      /* Signalled by the flusher */
+  BOOL bFlusherSleeping;
+  BOOL bStopping;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Internal functions
+
+///////////////////////////////////////////////////////////////////////////////
+// PushRecord function - Vyukov's intrusive MPSC push.  Wait-free for
+// producers.
+
+static void PushRecord(LPGROUPCOMMITWRITER lpWriter,
+    LPCOMMIT_RECORD lpRecord) {
+  __atomic_store_n(&lpRecord->pNext, NULL, __ATOMIC_RELAXED);
+  LPCOMMIT_RECORD lpPrevious = __atomic_exchange_n(&lpWriter->pHead,
+      lpRecord, __ATOMIC_SEQ_CST);
+  __atomic_store_n(&lpPrevious->pNext, lpRecord, __ATOMIC_RELEASE);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// PopRecord function - Only ever called from the flusher thread.  Returns
+// NULL if the queue is empty or if a producer is part way through a push.
+
+static LPCOMMIT_RECORD PopRecord(LPGROUPCOMMITWRITER lpWriter) {
+  LPCOMMIT_RECORD lpTail = lpWriter->pTail;
+  LPCOMMIT_RECORD lpNext = __atomic_load_n(&lpTail->pNext, __ATOMIC_ACQUIRE);
+
+  if (lpTail == &lpWriter->stub) {
+    if (lpNext == NULL) {
+      return NULL;
+    }
+    lpWriter->pTail = lpNext;
+    lpTail = lpNext;
+    lpNext = __atomic_load_n(&lpNext->pNext, __ATOMIC_ACQUIRE);
+  }
+
+  if (lpNext != NULL) {
+    lpWriter->pTail = lpNext;
+    return lpTail;
+  }
+
+  if (lpTail != __atomic_load_n(&lpWriter->pHead, __ATOMIC_ACQUIRE)) {
+    return NULL;
+  }
+
+  /* lpTail is the last record; put the stub behind it so it can be
+   * detached. */
+  PushRecord(lpWriter, &lpWriter->stub);
+
+  lpNext = __atomic_load_n(&lpTail->pNext, __ATOMIC_ACQUIRE);
+  if (lpNext != NULL) {
+    lpWriter->pTail = lpNext;
+    return lpTail;
+  }
+
+  return NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// IsQueueEmpty function - Only ever called from the flusher thread.
+
+static BOOL IsQueueEmpty(LPGROUPCOMMITWRITER lpWriter) {
+  return lpWriter->pTail == &lpWriter->stub
+      && __atomic_load_n(&lpWriter->pHead, __ATOMIC_SEQ_CST)
+          == &lpWriter->stub;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// CommitBatch function - Writes and synchronizes a batch of records, then
+// wakes up any producer waiting on one of them.  The first failure is kept
+// as the writer's sticky error, since records that nobody waited on may
+// have been lost with it.
+
+static void CommitBatch(LPGROUPCOMMITWRITER lpWriter,
+    LPCOMMIT_RECORD* ppBatch, int nBatchSize, struct iovec* pIovecs,
+    int* pResults, int* pErrors) {
+  int nFileCount = __atomic_load_n(&lpWriter->nFileCount, __ATOMIC_ACQUIRE);
+
+  for (int nFile = 0; nFile < nFileCount; nFile++) {
+    int nIovecs = 0;
+    for (int i = 0; i < nBatchSize; i++) {
+      if (ppBatch[i]->nFile == nFile && ppBatch[i]->nLength > 0) {
+        pIovecs[nIovecs].iov_base = ppBatch[i]->data;
+        pIovecs[nIovecs].iov_len = ppBatch[i]->nLength;
+        nIovecs++;
+      }
+    }
+
+    pResults[nFile] = OK;
+    pErrors[nFile] = 0;
+
+    if (nIovecs == 0) {
+      continue;
+    }
+
+    int nFileDescriptor = lpWriter->pFileDescriptors[nFile];
+    if (OK != WritevFully(nFileDescriptor, pIovecs, nIovecs)
+        || OK != SyncFile(nFileDescriptor, lpWriter->nFlags)) {
+      pResults[nFile] = ERROR;
+      pErrors[nFile] = errno;
+
+      int nNoError = 0;
+      __atomic_compare_exchange_n(&lpWriter->nStickyError, &nNoError,
+          pErrors[nFile] != 0 ? pErrors[nFile] : EIO, FALSE,
+          __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+    }
+  }
+
+  /* A flush marker reports any failure up to and including this batch. */
+  int nStickyError = __atomic_load_n(&lpWriter->nStickyError,
+      __ATOMIC_ACQUIRE);
+
+  pthread_mutex_lock(&lpWriter->mutex);
+
+  BOOL bAnyWaiting = FALSE;
+  for (int i = 0; i < nBatchSize; i++) {
+    LPCOMMIT_COMPLETION lpCompletion = ppBatch[i]->lpCompletion;
+    if (lpCompletion == NULL) {
+      continue;
+    }
+
+    int nFile = ppBatch[i]->nFile;
+    if (nFile < 0) {
+      lpCompletion->nResult = nStickyError != 0 ? ERROR : OK;
+      lpCompletion->nError = nStickyError;
+    } else {
+      lpCompletion->nResult = pResults[nFile];
+      lpCompletion->nError = pErrors[nFile];
+    }
+    lpCompletion->bDone = TRUE;
+    bAnyWaiting = TRUE;
+  }
+
+  if (bAnyWaiting) {
+    pthread_cond_broadcast(&lpWriter->batchCommitted);
+  }
+
+  pthread_mutex_unlock(&lpWriter->mutex);
+
+  for (int i = 0; i < nBatchSize; i++) {
+    free(ppBatch[i]);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// FlusherThreadProc function
+
+static void* FlusherThreadProc(void* pArg) {
+  LPGROUPCOMMITWRITER lpWriter = (LPGROUPCOMMITWRITER) pArg;
+
+  LPCOMMIT_RECORD ppBatch[GROUP_COMMIT_MAX_BATCH_SIZE];
+  struct iovec iovecs[GROUP_COMMIT_MAX_BATCH_SIZE];
+
+  while (TRUE) {
+    int nBatchSize = 0;
+
+    /* Take everything that is queued, up to the batch limit. */
+    while (nBatchSize < GROUP_COMMIT_MAX_BATCH_SIZE) {
+      LPCOMMIT_RECORD lpRecord = PopRecord(lpWriter);
+      if (lpRecord != NULL) {
+        ppBatch[nBatchSize++] = lpRecord;
+        continue;
+      }
+
+      if (IsQueueEmpty(lpWriter)) {
+        break;
+      }
+
+      /* A producer is between its exchange and its link; it will finish
+       * in a moment. */
+      sched_yield();
+    }
+
+    if (nBatchSize > 0) {
+      CommitBatch(lpWriter, ppBatch, nBatchSize, iovecs, lpWriter->pResults,
+          lpWriter->pErrors);
+      continue;
+    }
+
+    pthread_mutex_lock(&lpWriter->mutex);
+
+    if (__atomic_load_n(&lpWriter->bStopping, __ATOMIC_ACQUIRE)
+        && IsQueueEmpty(lpWriter)) {
+      pthread_mutex_unlock(&lpWriter->mutex);
+      break;
+    }
+
+    __atomic_store_n(&lpWriter->bFlusherSleeping, TRUE, __ATOMIC_SEQ_CST);
+    if (IsQueueEmpty(lpWriter)
+        && !__atomic_load_n(&lpWriter->bStopping, __ATOMIC_ACQUIRE)) {
+      /* The timeout is only a safety net; producers signal us. */
+      struct timespec ts = { 0 };
+      clock_gettime(CLOCK_REALTIME, &ts);
+      ts.tv_sec += 1;
+      pthread_cond_timedwait(&lpWriter->workAvailable, &lpWriter->mutex, &ts);
+    }
+    __atomic_store_n(&lpWriter->bFlusherSleeping, FALSE, __ATOMIC_SEQ_CST);
+
+    pthread_mutex_unlock(&lpWriter->mutex);
+  }
+
+  return NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// SubmitRecord function - Queues a record, wakes the flusher if need be,
+// and, if requested, waits until the record has been committed.
+
+static int SubmitRecord(LPGROUPCOMMITWRITER lpWriter, int nFile,
+    const char* pData, size_t nLength, BOOL bWait) {
+  if (__atomic_load_n(&lpWriter->bStopping, __ATOMIC_ACQUIRE)) {
+    errno = ESHUTDOWN;
+    return ERROR;
+  }
+
+  /* Once a commit has failed, the files may be missing records, so no
+   * more are accepted. */
+  int nStickyError = __atomic_load_n(&lpWriter->nStickyError,
+      __ATOMIC_ACQUIRE);
+  if (nStickyError != 0) {
+    errno = nStickyError;
+    return ERROR;
+  }
+
+  LPCOMMIT_RECORD lpRecord = (LPCOMMIT_RECORD) malloc(
+      sizeof(COMMIT_RECORD) + nLength);
+  if (lpRecord == NULL) {
+    errno = ENOMEM;
+    return ERROR;
+  }
+
+  COMMIT_COMPLETION completion = { FALSE, OK, 0 };
+
+  lpRecord->nFile = nFile;
+  lpRecord->nLength = nLength;
+  lpRecord->lpCompletion = bWait ? &completion : NULL;
+  if (nLength > 0) {
+    memcpy(lpRecord->data, pData, nLength);
+  }
+
+  PushRecord(lpWriter, lpRecord);
+
+  if (__atomic_load_n(&lpWriter->bFlusherSleeping, __ATOMIC_SEQ_CST)) {
+    pthread_mutex_lock(&lpWriter->mutex);
+    pthread_cond_signal(&lpWriter->workAvailable);
+    pthread_mutex_unlock(&lpWriter->mutex);
+  }
+
+  if (!bWait) {
+    return OK;
+  }
+
+  pthread_mutex_lock(&lpWriter->mutex);
+  while (!completion.bDone) {
+    pthread_cond_wait(&lpWriter->batchCommitted, &lpWriter->mutex);
+  }
+  pthread_mutex_unlock(&lpWriter->mutex);
+
+  errno = completion.nError;
+  return completion.nResult;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Publicly-exposed functions
+
+///////////////////////////////////////////////////////////////////////////////
+// AddGroupCommitFile function
+
+int AddGroupCommitFile(LPGROUPCOMMITWRITER lpWriter, const char* pszPath) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_ADD_GROUP_COMMIT_FILE);
+
+  if (lpWriter == NULL || IsNullOrWhiteSpace(pszPath)) {
+    errno = EINVAL;
+    return ERROR;
+  }
+
+  /* Expand the path name a la Bash */
+  char szExpandedPathName[MAX_PATH + 1];
+  memset(szExpandedPathName, 0, MAX_PATH + 1);
+  ShellExpand(pszPath, szExpandedPathName, MAX_PATH + 1);
+
+  int nFileDescriptor = open(szExpandedPathName,
+      O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+  if (nFileDescriptor < 0) {
+    return ERROR;
+  }
+
+  pthread_mutex_lock(&lpWriter->mutex);
+
+  int nFile = lpWriter->nFileCount;
+  if (nFile == lpWriter->nMaxFiles) {
+    pthread_mutex_unlock(&lpWriter->mutex);
+    close(nFileDescriptor);
+    errno = EMFILE;
+    return ERROR;
+  }
+
+  /* Publish the descriptor before the count, since the flusher reads the
+   * count without taking the mutex. */
+  lpWriter->pFileDescriptors[nFile] = nFileDescriptor;
+  __atomic_store_n(&lpWriter->nFileCount, nFile + 1, __ATOMIC_RELEASE);
+
+  pthread_mutex_unlock(&lpWriter->mutex);
+
+  return nFile;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// CreateGroupCommitWriter function
+
+LPGROUPCOMMITWRITER CreateGroupCommitWriter(int nMaxFiles, int nFlags) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_CREATE_GROUP_COMMIT_WRITER);
+
+  if (nMaxFiles <= 0
+      || (nFlags & ~(WRITE_FLAG_DATASYNC | WRITE_FLAG_FULLSYNC)) != 0) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  LPGROUPCOMMITWRITER lpWriter = (LPGROUPCOMMITWRITER) calloc(1,
+      sizeof(GROUPCOMMITWRITER));
+  if (lpWriter == NULL) {
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  lpWriter->pFileDescriptors = (int*) calloc(nMaxFiles, sizeof(int));
+  lpWriter->pResults = (int*) calloc(nMaxFiles, sizeof(int));
+  lpWriter->pErrors = (int*) calloc(nMaxFiles, sizeof(int));
+  if (lpWriter->pFileDescriptors == NULL || lpWriter->pResults == NULL
+      || lpWriter->pErrors == NULL) {
+    free(lpWriter->pFileDescriptors);
+    free(lpWriter->pResults);
+    free(lpWriter->pErrors);
+    free(lpWriter);
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  lpWriter->nMaxFiles = nMaxFiles;
+  lpWriter->nFlags = nFlags;
+  lpWriter->pHead = lpWriter->pTail = &lpWriter->stub;
+
+  pthread_mutex_init(&lpWriter->mutex, NULL);
+  pthread_cond_init(&lpWriter->workAvailable, NULL);
+  pthread_cond_init(&lpWriter->batchCommitted, NULL);
+
+  int nResult = pthread_create(&lpWriter->flusher, NULL, FlusherThreadProc,
+      lpWriter);
+  if (nResult != OK) {
+    pthread_cond_destroy(&lpWriter->batchCommitted);
+    pthread_cond_destroy(&lpWriter->workAvailable);
+    pthread_mutex_destroy(&lpWriter->mutex);
+    free(lpWriter->pFileDescriptors);
+    free(lpWriter->pResults);
+    free(lpWriter->pErrors);
+    free(lpWriter);
+    errno = nResult;
+    return NULL;
+  }
+
+  return lpWriter;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// DestroyGroupCommitWriter function
+
+int DestroyGroupCommitWriter(LPGROUPCOMMITWRITER* lppWriter) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_DESTROY_GROUP_COMMIT_WRITER);
+
+  if (lppWriter == NULL || *lppWriter == NULL) {
+    errno = EINVAL;
+    return ERROR;
+  }
+
+  LPGROUPCOMMITWRITER lpWriter = *lppWriter;
+  *lppWriter = NULL;
+
+  /* The flusher drains whatever is still queued before it exits. */
+  pthread_mutex_lock(&lpWriter->mutex);
+  __atomic_store_n(&lpWriter->bStopping, TRUE, __ATOMIC_RELEASE);
+  pthread_cond_signal(&lpWriter->workAvailable);
+  pthread_mutex_unlock(&lpWriter->mutex);
+
+  pthread_join(lpWriter->flusher, NULL);
+
+  int nResult = OK;
+  int nError = 0;
+  for (int i = 0; i < lpWriter->nFileCount; i++) {
+    if (OK != close(lpWriter->pFileDescriptors[i]) && errno != EINTR) {
+      nResult = ERROR;
+      nError = errno;
+    }
+  }
+
+  pthread_cond_destroy(&lpWriter->batchCommitted);
+  pthread_cond_destroy(&lpWriter->workAvailable);
+  pthread_mutex_destroy(&lpWriter->mutex);
+  free(lpWriter->pFileDescriptors);
+  free(lpWriter->pResults);
+  free(lpWriter->pErrors);
+  free(lpWriter);
+
+  errno = nError;
+  return nResult;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// FlushGroupCommitWriter function
+
+int FlushGroupCommitWriter(LPGROUPCOMMITWRITER lpWriter) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_FLUSH_GROUP_COMMIT_WRITER);
+
+  if (lpWriter == NULL) {
+    errno = EINVAL;
+    return ERROR;
+  }
+
+  /* A marker record completes only after every record queued ahead of it
+   * has been committed. */
+  return SubmitRecord(lpWriter, -1, NULL, 0, TRUE);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// GroupCommitAppend function
+
+int GroupCommitAppend(LPGROUPCOMMITWRITER lpWriter, int nFile,
+    const char* pData, size_t nLength, BOOL bWait) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_GROUP_COMMIT_APPEND);
+
+  if (lpWriter == NULL || (pData == NULL && nLength > 0) || nFile < 0
+      || nFile >= __atomic_load_n(&lpWriter->nFileCount, __ATOMIC_ACQUIRE)) {
+    errno = EINVAL;
+    return ERROR;
+  }
+
+  FILE_CORE_TRACE_BYTES(nLength);
+  return SubmitRecord(lpWriter, nFile, pData, nLength, bWait);
+}
@@ -0,0 +1,864 @@
+/*
+ * line_index.c
+ *
+ *  Random access to the lines of large text files.  BuildLineIndex maps a
+ *  file, finds its newlines 64 bytes at a time with SIMD compares, and
+ *  records where each line starts in small bit-packed blocks; GetLine then
+ *  finds any line without scanning.  The index can be saved beside the file
+ *  and reused for as long as the file is unchanged.
+ */
+
+#include "stdafx.h"
+#include "file_core.h"
+
+#include "file_core_internal.h"
+#include "file_core_symbols.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define LINE_INDEX_HAVE_X86 1
+#endif
+
+/**
+ * @brief Lines per block.  The first line's offset is kept whole; the
+ * others are kept as distances from it, in as few bits as the largest
+ * distance needs.
+ */
+#define LINE_INDEX_BLOCK_LINES    64
+
+/**
+ * @brief Bytes covered by one newline mask.
+ */
+#define LINE_INDEX_WINDOW_SIZE    64
+
+/**
+ * @brief Masks produced by one call to a scanning kernel.
+ */
+#define LINE_INDEX_MASK_BATCH     64
+
+/**
+ * @brief Identification of a saved index.  The version also tells apart
+ * indexes saved on machines of the other byte order.
+ */
+#define LINE_INDEX_MAGIC          "FCLINEIX"
+#define LINE_INDEX_VERSION        1u
+#define LINE_INDEX_SUFFIX         ".lineindex"
+
+/**
+ * @brief Signature of a newline-scanning kernel.  Sets bit i of pMasks[n]
+ * if byte (64 * n + i) of pData is a newline.
+ */
+typedef void (*NEWLINE_SCAN_PROC)(const char* pData, size_t nWindows,
+    uint64_t* pMasks);
+
+///////////////////////////////////////////////////////////////////////////////
+// LINE_INDEX_HEADER structure - Start of an index, in memory and on disk.
+// The blocks and then the packed words follow it directly.
+
+typedef struct _tagLINE_INDEX_HEADER {
+  char szMagic[8];
+  uint32_t nVersion;
+  uint32_t nReserved;
+  uint64_t nSourceSize;             /* Identity of the indexed file */
+  uint64_t nSourceInode;
+  int64_t nSourceSeconds;
+  int64_t nSourceNanoseconds;
+  uint64_t nLines;
+  uint64_t nBlocks;
+  uint64_t nWords;
+} LINE_INDEX_HEADER, *LPLINE_INDEX_HEADER;
+
+///////////////////////////////////////////////////////////////////////////////
+// LINE_BLOCK structure - Offsets of up to LINE_INDEX_BLOCK_LINES lines.
+
+typedef struct _tagLINE_BLOCK {
+  uint64_t nBase;         /* Offset of the block's first line */
+  uint64_t nPacked;       /* First word << 8 | bits per distance */
+} LINE_BLOCK, *LPLINE_BLOCK;
+
+///////////////////////////////////////////////////////////////////////////////
+// LINEINDEX structure
+
+struct _tagLINEINDEX {
+  const char* pData;                /* Mapping of the file; NULL if empty */
+  uint64_t nLength;                 /* Size of the file */
+  LPLINE_INDEX_HEADER lpHeader;     /* Header, blocks and words */
+  size_t nStorageSize;
+  const LINE_BLOCK* pBlocks;
+  const uint64_t* pWords;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// LINE_INDEX_RANGE structure - The part of a file scanned by one worker.
+
+typedef struct _tagLINE_INDEX_RANGE {
+  uint64_t nStart;                  /* Bytes [nStart, nEnd) of the file */
+  uint64_t nEnd;
+  uint64_t nNewlines;               /* Line starts found in the range */
+  uint64_t nFirstLine;              /* Number of the first of them */
+  uint64_t nFirstBlock;             /* Blocks that begin in the range */
+  uint64_t nBlockCount;
+  uint64_t* pWords;                 /* Words packed by this worker */
+  size_t nWords;
+  size_t nCapacity;
+} LINE_INDEX_RANGE, *LPLINE_INDEX_RANGE;
+
+///////////////////////////////////////////////////////////////////////////////
+// LINE_INDEX_JOB structure - Shared by the workers building one index.
+
+typedef struct _tagLINE_INDEX_JOB {
+  const char* pData;
+  uint64_t nLength;
+  uint64_t nLines;
+  LPLINE_INDEX_RANGE pRanges;
+  LPLINE_BLOCK pBlocks;
+  int nFirstError;
+} LINE_INDEX_JOB, *LPLINE_INDEX_JOB;
+
+static pthread_once_t g_lineIndexOnce = PTHREAD_ONCE_INIT;
+static NEWLINE_SCAN_PROC g_lpfnScanNewlines = NULL;
+
+///////////////////////////////////////////////////////////////////////////////
+// Internal functions
+
+///////////////////////////////////////////////////////////////////////////////
+// ScanNewlinesScalar function - Portable kernel.
+
+static void ScanNewlinesScalar(const char* pData, size_t nWindows,
+    uint64_t* pMasks) {
+  for (size_t n = 0; n < nWindows; n++) {
+    const char* pWindow = pData + n * LINE_INDEX_WINDOW_SIZE;
+    uint64_t nMask = 0;
+    for (int i = 0; i < LINE_INDEX_WINDOW_SIZE; i++) {
+      nMask |= (uint64_t) (pWindow[i] == '\n') << i;
+    }
+    pMasks[n] = nMask;
+  }
+}
+
+#ifdef LINE_INDEX_HAVE_X86
+
+///////////////////////////////////////////////////////////////////////////////
+// ScanNewlinesSse2 function - Compares 16 bytes at a time.
+
+__attribute__((target("sse2")))
+static void ScanNewlinesSse2(const char* pData, size_t nWindows,
+    uint64_t* pMasks) {
+  const __m128i newlines = _mm_set1_epi8('\n');
+
+  for (size_t n = 0; n < nWindows; n++) {
+    const char* pWindow = pData + n * LINE_INDEX_WINDOW_SIZE;
+    uint64_t nMask = 0;
+    for (int i = 0; i < 4; i++) {
+      __m128i bytes = _mm_loadu_si128((const __m128i*) (pWindow + 16 * i));
+      nMask |= (uint64_t) (uint32_t) _mm_movemask_epi8(
+          _mm_cmpeq_epi8(bytes, newlines)) << (16 * i);
+    }
+    pMasks[n] = nMask;
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ScanNewlinesAvx2 function - Compares 32 bytes at a time.
+
+__attribute__((target("avx2")))
+static void ScanNewlinesAvx2(const char* pData, size_t nWindows,
+    uint64_t* pMasks) {
+  const __m256i newlines = _mm256_set1_epi8('\n');
+
+  for (size_t n = 0; n < nWindows; n++) {
+    const char* pWindow = pData + n * LINE_INDEX_WINDOW_SIZE;
+    __m256i low = _mm256_loadu_si256((const __m256i*) pWindow);
+    __m256i high = _mm256_loadu_si256((const __m256i*) (pWindow + 32));
+    uint32_t nLowMask = (uint32_t) _mm256_movemask_epi8(
+        _mm256_cmpeq_epi8(low, newlines));
+    uint32_t nHighMask = (uint32_t) _mm256_movemask_epi8(
+        _mm256_cmpeq_epi8(high, newlines));
+    pMasks[n] = (uint64_t) nHighMask << 32 | nLowMask;
+  }
+}
+
+#endif //LINE_INDEX_HAVE_X86
+
+///////////////////////////////////////////////////////////////////////////////
+// InitializeLineIndex function - Picks the fastest kernel the CPU supports.
+
+static void InitializeLineIndex(void) {
+  g_lpfnScanNewlines = ScanNewlinesScalar;
+
+#ifdef LINE_INDEX_HAVE_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    g_lpfnScanNewlines = ScanNewlinesAvx2;
+  } else if (__builtin_cpu_supports("sse2")) {
+    g_lpfnScanNewlines = ScanNewlinesSse2;
+  }
+#endif //LINE_INDEX_HAVE_X86
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// GetNewlineMasks function - Gets the masks for up to LINE_INDEX_MASK_BATCH
+// windows starting at nOffset, but not past nEnd.  A final window of fewer
+// than 64 bytes is scanned from a zero-padded copy, so that nothing beyond
+// nEnd is read or reported.  Returns the number of masks.
+
+static size_t GetNewlineMasks(const char* pData, uint64_t nOffset,
+    uint64_t nEnd, uint64_t* pMasks) {
+  uint64_t nWholeWindows = (nEnd - nOffset) / LINE_INDEX_WINDOW_SIZE;
+
+  if (nWholeWindows > 0) {
+    size_t nWindows = nWholeWindows > LINE_INDEX_MASK_BATCH
+        ? LINE_INDEX_MASK_BATCH : (size_t) nWholeWindows;
+    g_lpfnScanNewlines(pData + nOffset, nWindows, pMasks);
+    return nWindows;
+  }
+
+  char window[LINE_INDEX_WINDOW_SIZE] = { 0 };
+  memcpy(window, pData + nOffset, (size_t) (nEnd - nOffset));
+  g_lpfnScanNewlines(window, 1, pMasks);
+  return 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ReadPackedValue function - Extracts a value of nWidth bits that starts
+// nBitOffset bits into an array of words.
+
+static inline uint64_t ReadPackedValue(const uint64_t* pWords,
+    uint64_t nBitOffset, unsigned int nWidth) {
+  if (nWidth == 0) {
+    return 0;
+  }
+
+  const uint64_t* pWord = pWords + (nBitOffset >> 6);
+  unsigned int nShift = (unsigned int) (nBitOffset & 63);
+
+  uint64_t nValue = pWord[0] >> nShift;
+  if (nShift + nWidth > 64) {
+    nValue |= pWord[1] << (64 - nShift);
+  }
+
+  return nWidth == 64 ? nValue : nValue & ((1ULL << nWidth) - 1);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// GetWordsPerBlock function - Number of words taken by the packed distances
+// of a block of nLines lines, nWidth bits apiece.
+
+static inline uint64_t GetWordsPerBlock(uint64_t nLines,
+    unsigned int nWidth) {
+  return nLines <= 1 ? 0 : ((nLines - 1) * nWidth + 63) / 64;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// GetLineStart function - Gets the offset at which a line begins.
+
+static uint64_t GetLineStart(const LINEINDEX* lpIndex, uint64_t nLine) {
+  const LINE_BLOCK* lpBlock = &lpIndex->pBlocks[nLine
+      / LINE_INDEX_BLOCK_LINES];
+  unsigned int nSlot = (unsigned int) (nLine % LINE_INDEX_BLOCK_LINES);
+
+  if (nSlot == 0) {
+    return lpBlock->nBase;
+  }
+
+  unsigned int nWidth = (unsigned int) (lpBlock->nPacked & 0xFF);
+  return lpBlock->nBase + ReadPackedValue(lpIndex->pWords
+      + (lpBlock->nPacked >> 8), (uint64_t) (nSlot - 1) * nWidth, nWidth);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// GetLineEnd function - Gets the offset just past the end of a line, not
+// counting its newline.
+
+static uint64_t GetLineEnd(const LINEINDEX* lpIndex, uint64_t nLine) {
+  if (nLine + 1 < lpIndex->lpHeader->nLines) {
+    return GetLineStart(lpIndex, nLine + 1) - 1;
+  }
+
+  return lpIndex->pData[lpIndex->nLength - 1] == '\n'
+      ? lpIndex->nLength - 1 : lpIndex->nLength;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// AttachStorage function - Points the index at its header, blocks and
+// words, which live in one allocation laid out as they are on disk.
+
+static void AttachStorage(LPLINEINDEX lpIndex, LPLINE_INDEX_HEADER lpHeader,
+    size_t nStorageSize) {
+  lpIndex->lpHeader = lpHeader;
+  lpIndex->nStorageSize = nStorageSize;
+  lpIndex->pBlocks = (const LINE_BLOCK*) (lpHeader + 1);
+  lpIndex->pWords = (const uint64_t*) (lpIndex->pBlocks + lpHeader->nBlocks);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// SetSourceIdentity function - Records which version of the file an index
+// describes.
+
+static void SetSourceIdentity(LPLINE_INDEX_HEADER lpHeader,
+    const struct stat* pStat) {
+  memcpy(lpHeader->szMagic, LINE_INDEX_MAGIC, sizeof(lpHeader->szMagic));
+  lpHeader->nVersion = LINE_INDEX_VERSION;
+  lpHeader->nSourceSize = (uint64_t) pStat->st_size;
+  lpHeader->nSourceInode = (uint64_t) pStat->st_ino;
+  lpHeader->nSourceSeconds = (int64_t) pStat->st_mtim.tv_sec;
+  lpHeader->nSourceNanoseconds = (int64_t) pStat->st_mtim.tv_nsec;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// IsSameSource function - Determines whether an index describes the file
+// as it is now.
+
+static BOOL IsSameSource(const LINE_INDEX_HEADER* lpHeader,
+    const struct stat* pStat) {
+  return lpHeader->nSourceSize == (uint64_t) pStat->st_size
+      && lpHeader->nSourceInode == (uint64_t) pStat->st_ino
+      && lpHeader->nSourceSeconds == (int64_t) pStat->st_mtim.tv_sec
+      && lpHeader->nSourceNanoseconds == (int64_t) pStat->st_mtim.tv_nsec;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// EncodeBlock function - Packs the offsets of the next block of a range.
+
+static int EncodeBlock(LPLINE_INDEX_JOB lpJob, LPLINE_INDEX_RANGE lpRange,
+    uint64_t nBlock, const uint64_t* pStarts, int nCount) {
+  uint64_t nBase = pStarts[0];
+  uint64_t nSpan = pStarts[nCount - 1] - nBase;
+  unsigned int nWidth = nSpan == 0 ? 0
+      : 64 - (unsigned int) __builtin_clzll(nSpan);
+  size_t nWords = (size_t) GetWordsPerBlock((uint64_t) nCount, nWidth);
+
+  if (lpRange->nWords + nWords > lpRange->nCapacity) {
+    size_t nCapacity = lpRange->nCapacity == 0 ? 256 : lpRange->nCapacity * 2;
+    while (nCapacity < lpRange->nWords + nWords) {
+      nCapacity *= 2;
+    }
+
+    uint64_t* pGrown = (uint64_t*) realloc(lpRange->pWords,
+        nCapacity * sizeof(uint64_t));
+    if (pGrown == NULL) {
+      errno = ENOMEM;
+      return ERROR;
+    }
+    lpRange->pWords = pGrown;
+    lpRange->nCapacity = nCapacity;
+  }
+
+  uint64_t* pWords = lpRange->pWords + lpRange->nWords;
+  memset(pWords, 0, nWords * sizeof(uint64_t));
+
+  uint64_t nBitOffset = 0;
+  for (int i = 1; i < nCount; i++) {
+    uint64_t nDistance = pStarts[i] - nBase;
+    uint64_t* pWord = pWords + (nBitOffset >> 6);
+    unsigned int nShift = (unsigned int) (nBitOffset & 63);
+
+    pWord[0] |= nDistance << nShift;
+    if (nShift + nWidth > 64) {
+      pWord[1] |= nDistance >> (64 - nShift);
+    }
+    nBitOffset += nWidth;
+  }
+
+  /* The word offset is relative to this range's words for now; it is fixed
+   * up once the ranges' words have been put together. */
+  lpJob->pBlocks[nBlock].nBase = nBase;
+  lpJob->pBlocks[nBlock].nPacked = (uint64_t) lpRange->nWords << 8 | nWidth;
+  lpRange->nWords += nWords;
+
+  return OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// CountLinesProc function - First pass of BuildLineIndex: counts the lines
+// that begin within a range, which are those after each of its newlines,
+// unless the newline is the last byte of the file.
+
+static void CountLinesProc(void* pContext, int nIndex) {
+  LPLINE_INDEX_JOB lpJob = (LPLINE_INDEX_JOB) pContext;
+  LPLINE_INDEX_RANGE lpRange = &lpJob->pRanges[nIndex];
+
+  uint64_t nEnd = lpRange->nEnd < lpJob->nLength - 1 ? lpRange->nEnd
+      : lpJob->nLength - 1;
+  uint64_t masks[LINE_INDEX_MASK_BATCH];
+  uint64_t nNewlines = 0;
+
+  uint64_t nOffset = lpRange->nStart;
+  while (nOffset < nEnd) {
+    size_t nWindows = GetNewlineMasks(lpJob->pData, nOffset, nEnd, masks);
+    for (size_t i = 0; i < nWindows; i++) {
+      nNewlines += (uint64_t) __builtin_popcountll(masks[i]);
+    }
+    nOffset += nWindows * LINE_INDEX_WINDOW_SIZE;
+  }
+
+  lpRange->nNewlines = nNewlines;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// EncodeLinesProc function - Second pass of BuildLineIndex: encodes the
+// blocks whose first line begins within a range.  The last of them may run
+// on into the following ranges.
+
+static void EncodeLinesProc(void* pContext, int nIndex) {
+  LPLINE_INDEX_JOB lpJob = (LPLINE_INDEX_JOB) pContext;
+  LPLINE_INDEX_RANGE lpRange = &lpJob->pRanges[nIndex];
+
+  if (lpRange->nBlockCount == 0) {
+    return;
+  }
+
+  uint64_t nFirstLine = lpRange->nFirstBlock * LINE_INDEX_BLOCK_LINES;
+  uint64_t nStopLine = (lpRange->nFirstBlock + lpRange->nBlockCount)
+      * LINE_INDEX_BLOCK_LINES;
+  if (nStopLine > lpJob->nLines) {
+    nStopLine = lpJob->nLines;
+  }
+
+  uint64_t starts[LINE_INDEX_BLOCK_LINES];
+  uint64_t masks[LINE_INDEX_MASK_BATCH];
+  uint64_t nBlock = lpRange->nFirstBlock;
+  uint64_t nLine = lpRange->nFirstLine;
+  int nCount = 0;
+  int nResult = OK;
+
+  /* The first line has no newline in front of it. */
+  if (nIndex == 0) {
+    starts[nCount++] = 0;
+    nLine++;
+    if (nLine == nStopLine) {
+      nResult = EncodeBlock(lpJob, lpRange, nBlock++, starts, nCount);
+    }
+  }
+
+  uint64_t nEnd = lpJob->nLength - 1;
+  uint64_t nOffset = lpRange->nStart;
+  while (nResult == OK && nLine < nStopLine && nOffset < nEnd) {
+    size_t nWindows = GetNewlineMasks(lpJob->pData, nOffset, nEnd, masks);
+
+    for (size_t i = 0; i < nWindows && nResult == OK && nLine < nStopLine;
+        i++) {
+      uint64_t nMask = masks[i];
+      while (nMask != 0 && nLine < nStopLine) {
+        uint64_t nStart = nOffset + i * LINE_INDEX_WINDOW_SIZE
+            + (uint64_t) __builtin_ctzll(nMask) + 1;
+        nMask &= nMask - 1;
+
+        if (nLine++ < nFirstLine) {
+          continue;
+        }
+
+        starts[nCount++] = nStart;
+        if (nCount == LINE_INDEX_BLOCK_LINES || nLine == nStopLine) {
+          nResult = EncodeBlock(lpJob, lpRange, nBlock++, starts, nCount);
+          nCount = 0;
+          if (nResult != OK) {
+            break;
+          }
+        }
+      }
+    }
+
+    nOffset += nWindows * LINE_INDEX_WINDOW_SIZE;
+  }
+
+  /* Fewer newlines than the first pass counted means the file was changed
+   * while it was being indexed. */
+  int nError = nResult != OK ? errno : nLine < nStopLine ? ESTALE : 0;
+  if (nError != 0) {
+    int nExpected = 0;
+    __atomic_compare_exchange_n(&lpJob->nFirstError, &nExpected, nError,
+        FALSE, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// FreeRanges function
+
+static void FreeRanges(LPLINE_INDEX_RANGE pRanges, int nRanges) {
+  for (int i = 0; i < nRanges; i++) {
+    free(pRanges[i].pWords);
+  }
+  free(pRanges);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ScanLines function - Builds the index of a mapped file.  Files larger
+// than LINE_INDEX_RANGE_SIZE are cut into ranges that are scanned by a pool
+// of threads, once to count their lines and once to encode them; counting
+// first lets each worker know the number of its first line, and lets the
+// blocks be stored straight into their final places.
+
+static int ScanLines(LPLINEINDEX lpIndex, const struct stat* pStat) {
+  uint64_t nLength = lpIndex->nLength;
+  int nRanges = (int) ((nLength + LINE_INDEX_RANGE_SIZE - 1)
+      / LINE_INDEX_RANGE_SIZE);
+
+  LPLINE_INDEX_RANGE pRanges = (LPLINE_INDEX_RANGE) calloc(
+      (size_t) nRanges, sizeof(LINE_INDEX_RANGE));
+  if (pRanges == NULL) {
+    errno = ENOMEM;
+    return ERROR;
+  }
+
+  for (int i = 0; i < nRanges; i++) {
+    pRanges[i].nStart = (uint64_t) i * LINE_INDEX_RANGE_SIZE;
+    pRanges[i].nEnd = i < nRanges - 1 ? pRanges[i].nStart
+        + LINE_INDEX_RANGE_SIZE : nLength;
+  }
+
+  LINE_INDEX_JOB job;
+  memset(&job, 0, sizeof(LINE_INDEX_JOB));
+  job.pData = lpIndex->pData;
+  job.nLength = nLength;
+  job.pRanges = pRanges;
+
+  /* The work is all computation, so one thread per processor. */
+  long nProcessors = sysconf(_SC_NPROCESSORS_ONLN);
+  int nThreads = nProcessors > 0 ? (int) nProcessors : 1;
+
+  RunInParallel(nRanges, nThreads, CountLinesProc, &job);
+
+  /* Give each range its first line number, and the blocks that begin
+   * among its lines. */
+  uint64_t nLines = 1;
+  uint64_t nBlocks = 0;
+  for (int i = 0; i < nRanges; i++) {
+    pRanges[i].nFirstLine = i == 0 ? 0 : nLines;
+    nLines += pRanges[i].nNewlines;
+
+    uint64_t nEndBlock = (nLines + LINE_INDEX_BLOCK_LINES - 1)
+        / LINE_INDEX_BLOCK_LINES;
+    pRanges[i].nFirstBlock = nBlocks;
+    pRanges[i].nBlockCount = nEndBlock - nBlocks;
+    nBlocks = nEndBlock;
+  }
+
+  size_t nBlockBytes = sizeof(LINE_INDEX_HEADER)
+      + (size_t) nBlocks * sizeof(LINE_BLOCK);
+  LPLINE_INDEX_HEADER lpHeader = (LPLINE_INDEX_HEADER) calloc(1,
+      nBlockBytes);
+  if (lpHeader == NULL) {
+    FreeRanges(pRanges, nRanges);
+    errno = ENOMEM;
+    return ERROR;
+  }
+
+  job.nLines = nLines;
+  job.pBlocks = (LPLINE_BLOCK) (lpHeader + 1);
+
+  RunInParallel(nRanges, nThreads, EncodeLinesProc, &job);
+
+  if (job.nFirstError != 0) {
+    free(lpHeader);
+    FreeRanges(pRanges, nRanges);
+    errno = job.nFirstError;
+    return ERROR;
+  }
+
+  /* Put the ranges' words after the blocks, and make each block's word
+   * offset absolute. */
+  size_t nWords = 0;
+  for (int i = 0; i < nRanges; i++) {
+    nWords += pRanges[i].nWords;
+  }
+
+  size_t nStorageSize = nBlockBytes + nWords * sizeof(uint64_t);
+  LPLINE_INDEX_HEADER lpGrown = (LPLINE_INDEX_HEADER) realloc(lpHeader,
+      nStorageSize);
+  if (lpGrown == NULL) {
+    free(lpHeader);
+    FreeRanges(pRanges, nRanges);
+    errno = ENOMEM;
+    return ERROR;
+  }
+  lpHeader = lpGrown;
+
+  LPLINE_BLOCK pBlocks = (LPLINE_BLOCK) (lpHeader + 1);
+  uint64_t* pWords = (uint64_t*) (pBlocks + nBlocks);
+  size_t nWordOffset = 0;
+  for (int i = 0; i < nRanges; i++) {
+    for (uint64_t j = 0; j < pRanges[i].nBlockCount; j++) {
+      pBlocks[pRanges[i].nFirstBlock + j].nPacked += (uint64_t) nWordOffset
+          << 8;
+    }
+    if (pRanges[i].nWords > 0) {
+      memcpy(pWords + nWordOffset, pRanges[i].pWords,
+          pRanges[i].nWords * sizeof(uint64_t));
+    }
+    nWordOffset += pRanges[i].nWords;
+  }
+
+  FreeRanges(pRanges, nRanges);
+
+  SetSourceIdentity(lpHeader, pStat);
+  lpHeader->nLines = nLines;
+  lpHeader->nBlocks = nBlocks;
+  lpHeader->nWords = nWords;
+  AttachStorage(lpIndex, lpHeader, nStorageSize);
+
+  return OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ValidateLineIndex function - Checks that a loaded index is whole, and
+// that every line it describes lies within the file, in order.  This costs
+// one decode per line, far less than finding the newlines again.
+
+static BOOL ValidateLineIndex(const LINEINDEX* lpIndex) {
+  const LINE_INDEX_HEADER* lpHeader = lpIndex->lpHeader;
+
+  if (lpHeader->nLines == 0 || lpHeader->nBlocks != (lpHeader->nLines
+      + LINE_INDEX_BLOCK_LINES - 1) / LINE_INDEX_BLOCK_LINES) {
+    return FALSE;
+  }
+
+  for (uint64_t i = 0; i < lpHeader->nBlocks; i++) {
+    uint64_t nLines = i < lpHeader->nBlocks - 1 ? LINE_INDEX_BLOCK_LINES
+        : lpHeader->nLines - i * LINE_INDEX_BLOCK_LINES;
+    unsigned int nWidth = (unsigned int) (lpIndex->pBlocks[i].nPacked & 0xFF);
+    uint64_t nFirstWord = lpIndex->pBlocks[i].nPacked >> 8;
+
+    if (nWidth > 64 || nFirstWord > lpHeader->nWords
+        || GetWordsPerBlock(nLines, nWidth) > lpHeader->nWords - nFirstWord) {
+      return FALSE;
+    }
+  }
+
+  if (GetLineStart(lpIndex, 0) != 0) {
+    return FALSE;
+  }
+
+  uint64_t nPrevious = 0;
+  for (uint64_t i = 1; i < lpHeader->nLines; i++) {
+    uint64_t nStart = GetLineStart(lpIndex, i);
+    if (nStart <= nPrevious || nStart >= lpIndex->nLength) {
+      return FALSE;
+    }
+    nPrevious = nStart;
+  }
+
+  return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// LoadLineIndex function - Reads a saved index, if there is one that
+// matches the file as it is now.
+
+static int LoadLineIndex(LPLINEINDEX lpIndex, const char* pszIndexPath,
+    const struct stat* pStat) {
+  int nFileDescriptor = open(pszIndexPath, O_RDONLY | O_CLOEXEC);
+  if (nFileDescriptor < 0) {
+    return ERROR;
+  }
+
+  char* pStorage = NULL;
+  size_t nStorageSize = 0;
+  int nResult = ReadAllFromDescriptor(nFileDescriptor, &pStorage,
+      &nStorageSize);
+  close(nFileDescriptor);
+  if (nResult != OK) {
+    return ERROR;
+  }
+
+  LPLINE_INDEX_HEADER lpHeader = (LPLINE_INDEX_HEADER) pStorage;
+  BOOL bValid = nStorageSize >= sizeof(LINE_INDEX_HEADER)
+      && 0 == memcmp(lpHeader->szMagic, LINE_INDEX_MAGIC,
+          sizeof(lpHeader->szMagic))
+      && lpHeader->nVersion == LINE_INDEX_VERSION
+      && IsSameSource(lpHeader, pStat)
+      && lpHeader->nBlocks <= nStorageSize / sizeof(LINE_BLOCK)
+      && lpHeader->nWords <= nStorageSize / sizeof(uint64_t)
+      && nStorageSize == sizeof(LINE_INDEX_HEADER)
+          + lpHeader->nBlocks * sizeof(LINE_BLOCK)
+          + lpHeader->nWords * sizeof(uint64_t);
+
+  if (bValid) {
+    AttachStorage(lpIndex, lpHeader, nStorageSize);
+    bValid = ValidateLineIndex(lpIndex);
+  }
+
+  if (!bValid) {
+    lpIndex->lpHeader = NULL;
+    free(pStorage);
+    errno = EINVAL;
+    return ERROR;
+  }
+
+  return OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Publicly-exposed functions
+
+///////////////////////////////////////////////////////////////////////////////
+// BuildLineIndex function
+
+int BuildLineIndex(const char* pszPath, LPLINEINDEX* lppIndex, int nFlags) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_BUILD_LINE_INDEX);
+
+  if (lppIndex != NULL) {
+    *lppIndex = NULL;
+  }
+
+  if (IsNullOrWhiteSpace(pszPath) || lppIndex == NULL) {
+    errno = EINVAL;
+    return ERROR;
+  }
+
+  pthread_once(&g_lineIndexOnce, InitializeLineIndex);
+
+  /* Expand the path name a la Bash */
+  char szExpandedPathName[MAX_PATH + 1];
+  memset(szExpandedPathName, 0, MAX_PATH + 1);
+  ShellExpand(pszPath, szExpandedPathName, MAX_PATH + 1);
+
+  int nFileDescriptor = open(szExpandedPathName, O_RDONLY | O_CLOEXEC);
+  if (nFileDescriptor < 0) {
+    return ERROR;
+  }
+
+  struct stat st = { 0 };
+  if (OK != fstat(nFileDescriptor, &st)) {
+    int nError = errno;
+    close(nFileDescriptor);
+    errno = nError;
+    return ERROR;
+  }
+
+  if (!S_ISREG(st.st_mode)) {
+    close(nFileDescriptor);
+    errno = S_ISDIR(st.st_mode) ? EISDIR : ENODEV;
+    return ERROR;
+  }
+
+  if ((uint64_t) st.st_size > (uint64_t) SIZE_MAX) {
+    close(nFileDescriptor);
+    errno = EFBIG;
+    return ERROR;
+  }
+
+  LPLINEINDEX lpIndex = (LPLINEINDEX) calloc(1, sizeof(LINEINDEX));
+  if (lpIndex == NULL) {
+    close(nFileDescriptor);
+    errno = ENOMEM;
+    return ERROR;
+  }
+
+  /* An empty file has no lines, and nothing to map. */
+  if (st.st_size == 0) {
+    close(nFileDescriptor);
+    *lppIndex = lpIndex;
+    return OK;
+  }
+
+  void* pMapping = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED,
+      nFileDescriptor, 0);
+  if (pMapping == MAP_FAILED) {
+    int nError = errno;
+    close(nFileDescriptor);
+    free(lpIndex);
+    errno = nError;
+    return ERROR;
+  }
+
+  lpIndex->pData = (const char*) pMapping;
+  lpIndex->nLength = (uint64_t) st.st_size;
+
+  char szIndexPath[MAX_PATH + 1];
+  BOOL bPersist = (nFlags & LINE_INDEX_FLAG_PERSIST)
+      && snprintf(szIndexPath, sizeof(szIndexPath), "%s%s",
+          szExpandedPathName, LINE_INDEX_SUFFIX) < (int) sizeof(szIndexPath);
+
+  if (bPersist && OK == LoadLineIndex(lpIndex, szIndexPath, &st)) {
+    close(nFileDescriptor);
+    *lppIndex = lpIndex;
+    return OK;
+  }
+
+  if (OK != ScanLines(lpIndex, &st)) {
+    int nError = errno;
+    close(nFileDescriptor);
+    FreeLineIndex(&lpIndex);
+    errno = nError;
+    return ERROR;
+  }
+
+  FILE_CORE_TRACE_BYTES(lpIndex->nLength);
+
+  /* Saving is a convenience: the file's directory may well be read-only.
+   * Nor is an index saved if the file changed while it was being built. */
+  struct stat stAfter = { 0 };
+  if (bPersist && OK == fstat(nFileDescriptor, &stAfter)
+      && IsSameSource(lpIndex->lpHeader, &stAfter)) {
+    int nError = errno;
+    struct iovec part = { lpIndex->lpHeader, lpIndex->nStorageSize };
+    WriteAtomically(AT_FDCWD, szIndexPath, &part, 1, WRITE_FLAG_NONE);
+    errno = nError;
+  }
+
+  close(nFileDescriptor);
+  *lppIndex = lpIndex;
+
+  return OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// FreeLineIndex function
+
+void FreeLineIndex(LPLINEINDEX* lppIndex) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_FREE_LINE_INDEX);
+
+  if (lppIndex == NULL || *lppIndex == NULL) {
+    return;
+  }
+
+  LPLINEINDEX lpIndex = *lppIndex;
+  if (lpIndex->pData != NULL) {
+    munmap((void*) lpIndex->pData, (size_t) lpIndex->nLength);
+  }
+  free(lpIndex->lpHeader);
+  free(lpIndex);
+
+  *lppIndex = NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// GetLine function
+
+int GetLine(LPLINEINDEX lpIndex, uint64_t nLine, const char** ppLine,
+    size_t* pnLength) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_GET_LINE);
+
+  if (lpIndex == NULL || ppLine == NULL || pnLength == NULL) {
+    errno = EINVAL;
+    return ERROR;
+  }
+
+  if (lpIndex->lpHeader == NULL || nLine >= lpIndex->lpHeader->nLines) {
+    errno = ERANGE;
+    return ERROR;
+  }
+
+  uint64_t nStart = GetLineStart(lpIndex, nLine);
+  uint64_t nEnd = GetLineEnd(lpIndex, nLine);
+
+  *ppLine = lpIndex->pData + nStart;
+  *pnLength = (size_t) (nEnd - nStart);
+  FILE_CORE_TRACE_BYTES(*pnLength);
+
+  return OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// GetLineCount function
+
+uint64_t GetLineCount(LPLINEINDEX lpIndex) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_GET_LINE_COUNT);
+
+  if (lpIndex == NULL || lpIndex->lpHeader == NULL) {
+    return 0;
+  }
+
+  return lpIndex->lpHeader->nLines;
+}
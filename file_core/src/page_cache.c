@@ -0,0 +1,314 @@
+/*
+ * page_cache.c
+ *
+ *  Control over the kernel's page cache: warming it ahead of need, evicting
+ *  files from it, and bypassing it altogether with O_DIRECT.
+ */
+
+#include "stdafx.h"
+#include "file_core.h"
+
+#include "file_core_internal.h"
+#include "file_core_symbols.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// PREFETCH_JOB structure - Shared by the workers of PrefetchFiles.
+
+typedef struct _tagPREFETCH_JOB {
+  const char** ppszPaths;
+  int nFirstError;
+} PREFETCH_JOB, *LPPREFETCH_JOB;
+
+///////////////////////////////////////////////////////////////////////////////
+// Internal functions
+
+///////////////////////////////////////////////////////////////////////////////
+// ClearDirectFlag function - Turns O_DIRECT off on an open descriptor, for
+// the parts of a transfer that cannot meet its alignment rules.
+
+static int ClearDirectFlag(int nFileDescriptor) {
+  int nStatusFlags = fcntl(nFileDescriptor, F_GETFL);
+  if (nStatusFlags < 0) {
+    return ERROR;
+  }
+
+  if (!(nStatusFlags & O_DIRECT)) {
+    return OK;
+  }
+
+  return fcntl(nFileDescriptor, F_SETFL, nStatusFlags & ~O_DIRECT) == OK
+      ? OK : ERROR;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// PrefetchOneFileProc function - Work routine for PrefetchFiles.
+
+static void PrefetchOneFileProc(void* pContext, int nIndex) {
+  LPPREFETCH_JOB lpJob = (LPPREFETCH_JOB) pContext;
+  int nError = 0;
+
+  const char* pszPath = lpJob->ppszPaths[nIndex];
+  if (IsNullOrWhiteSpace(pszPath)) {
+    nError = EINVAL;
+  } else {
+    /* Expand the path name a la Bash */
+    char szExpandedPathName[MAX_PATH + 1];
+    memset(szExpandedPathName, 0, MAX_PATH + 1);
+    ShellExpand(pszPath, szExpandedPathName, MAX_PATH + 1);
+
+    int nFileDescriptor = open(szExpandedPathName, O_RDONLY | O_CLOEXEC);
+    if (nFileDescriptor < 0) {
+      nError = errno;
+    } else {
+      /* readahead() queues the reads itself rather than leaving the
+       * decision to the kernel, but only some file systems implement it;
+       * the advice works everywhere else. */
+      struct stat st = { 0 };
+      if (OK != fstat(nFileDescriptor, &st)) {
+        nError = errno;
+      } else if (S_ISREG(st.st_mode) && st.st_size > 0
+          && OK != readahead(nFileDescriptor, 0, (size_t) st.st_size)) {
+        nError = posix_fadvise(nFileDescriptor, 0, 0, POSIX_FADV_WILLNEED);
+      }
+
+      close(nFileDescriptor);
+    }
+  }
+
+  if (nError != 0) {
+    int nExpected = 0;
+    __atomic_compare_exchange_n(&lpJob->nFirstError, &nExpected, nError,
+        FALSE, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ReadAllDirect function
+
+int ReadAllDirect(int nFileDescriptor, char** ppOutput, size_t* pnLength) {
+  struct stat st = { 0 };
+  if (OK != fstat(nFileDescriptor, &st)) {
+    return ERROR;
+  }
+
+  /* Without a size to go on there is no aligned buffer to read into. */
+  if (!S_ISREG(st.st_mode) || st.st_size <= 0) {
+    if (OK != ClearDirectFlag(nFileDescriptor)) {
+      return ERROR;
+    }
+    return ReadAllFromDescriptor(nFileDescriptor, ppOutput, pnLength);
+  }
+
+  /* The buffer's address and size are both multiples of the alignment, and
+   * there is always room past the data for the NUL terminator. */
+  size_t nCapacity = ((size_t) st.st_size + DIRECT_IO_ALIGNMENT)
+      & ~((size_t) DIRECT_IO_ALIGNMENT - 1);
+  char* pBuffer = NULL;
+  if (OK != posix_memalign((void**) &pBuffer, DIRECT_IO_ALIGNMENT,
+      nCapacity)) {
+    errno = ENOMEM;
+    return ERROR;
+  }
+
+  size_t nTotalBytesRead = 0;
+  BOOL bDirect = TRUE;
+  int nResult = OK;
+
+  while (TRUE) {
+    if (nTotalBytesRead == nCapacity) {
+      /* The file grew while we were reading it.  realloc() does not keep
+       * the alignment, so the rest goes through the page cache. */
+      if (bDirect && OK != ClearDirectFlag(nFileDescriptor)) {
+        nResult = ERROR;
+        break;
+      }
+      bDirect = FALSE;
+
+      char* pGrown = (char*) realloc(pBuffer, nCapacity * 2);
+      if (pGrown == NULL) {
+        errno = ENOMEM;
+        nResult = ERROR;
+        break;
+      }
+      pBuffer = pGrown;
+      nCapacity *= 2;
+    }
+
+    size_t nToRead = nCapacity - nTotalBytesRead;
+    if (nToRead > MAX_READ_CHUNK_SIZE) {
+      nToRead = MAX_READ_CHUNK_SIZE;
+    }
+
+    ssize_t nBytesRead = pread(nFileDescriptor, pBuffer + nTotalBytesRead,
+        nToRead, (off_t) nTotalBytesRead);
+    if (nBytesRead < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EINVAL && bDirect) {
+        /* The device wants a coarser alignment than we use. */
+        if (OK != ClearDirectFlag(nFileDescriptor)) {
+          nResult = ERROR;
+          break;
+        }
+        bDirect = FALSE;
+        continue;
+      }
+      nResult = ERROR;
+      break;
+    }
+    if (nBytesRead == 0) {
+      break;
+    }
+
+    nTotalBytesRead += (size_t) nBytesRead;
+
+    /* A short read leaves the next offset unaligned; that read should find
+     * end-of-file, but in case it does not it must not be a direct one. */
+    if (bDirect && (nTotalBytesRead & (DIRECT_IO_ALIGNMENT - 1)) != 0) {
+      if (OK != ClearDirectFlag(nFileDescriptor)) {
+        nResult = ERROR;
+        break;
+      }
+      bDirect = FALSE;
+    }
+  }
+
+  if (nResult == OK && nTotalBytesRead == nCapacity) {
+    char* pGrown = (char*) realloc(pBuffer, nCapacity + 1);
+    if (pGrown == NULL) {
+      errno = ENOMEM;
+      nResult = ERROR;
+    } else {
+      pBuffer = pGrown;
+    }
+  }
+
+  if (nResult != OK) {
+    int nError = errno;
+    free(pBuffer);
+    errno = nError;
+    return ERROR;
+  }
+
+  pBuffer[nTotalBytesRead] = '\0';
+  *ppOutput = pBuffer;
+  *pnLength = nTotalBytesRead;
+
+  return OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// WriteAllDirect function
+
+int WriteAllDirect(int nFileDescriptor, const char* pData, size_t nLength) {
+  size_t nAlignedLength = nLength & ~((size_t) DIRECT_IO_ALIGNMENT - 1);
+
+  if (nAlignedLength > 0) {
+    if (((uintptr_t) pData & (DIRECT_IO_ALIGNMENT - 1)) == 0) {
+      /* The caller's buffer already meets the rules. */
+      if (OK != WriteFully(nFileDescriptor, pData, nAlignedLength, 0)) {
+        return ERROR;
+      }
+    } else {
+      char* pBounce = NULL;
+      if (OK != posix_memalign((void**) &pBounce, DIRECT_IO_ALIGNMENT,
+          DIRECT_IO_BUFFER_SIZE)) {
+        errno = ENOMEM;
+        return ERROR;
+      }
+
+      for (size_t nOffset = 0; nOffset < nAlignedLength;
+          nOffset += DIRECT_IO_BUFFER_SIZE) {
+        size_t nChunk = nAlignedLength - nOffset;
+        if (nChunk > DIRECT_IO_BUFFER_SIZE) {
+          nChunk = DIRECT_IO_BUFFER_SIZE;
+        }
+
+        memcpy(pBounce, pData + nOffset, nChunk);
+        if (OK != WriteFully(nFileDescriptor, pBounce, nChunk,
+            (off_t) nOffset)) {
+          int nError = errno;
+          free(pBounce);
+          errno = nError;
+          return ERROR;
+        }
+      }
+
+      free(pBounce);
+    }
+  }
+
+  /* The last partial block cannot be written directly. */
+  if (nAlignedLength < nLength) {
+    if (OK != ClearDirectFlag(nFileDescriptor)) {
+      return ERROR;
+    }
+    return WriteFully(nFileDescriptor, pData + nAlignedLength,
+        nLength - nAlignedLength, (off_t) nAlignedLength);
+  }
+
+  return OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Publicly-exposed functions
+
+///////////////////////////////////////////////////////////////////////////////
+// DropFromCache function
+
+int DropFromCache(const char* pszPath) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_DROP_FROM_CACHE);
+
+  if (IsNullOrWhiteSpace(pszPath)) {
+    errno = EINVAL;
+    return ERROR;
+  }
+
+  /* Expand the path name a la Bash */
+  char szExpandedPathName[MAX_PATH + 1];
+  memset(szExpandedPathName, 0, MAX_PATH + 1);
+  ShellExpand(pszPath, szExpandedPathName, MAX_PATH + 1);
+
+  int nFileDescriptor = open(szExpandedPathName, O_RDONLY | O_CLOEXEC);
+  if (nFileDescriptor < 0) {
+    return ERROR;
+  }
+
+  /* Dirty pages are not dropped, so write them back first.  Unlike
+   * fdatasync(), this does not wait on the journal. */
+  sync_file_range(nFileDescriptor, 0, 0, SYNC_FILE_RANGE_WAIT_BEFORE
+      | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+
+  int nError = posix_fadvise(nFileDescriptor, 0, 0, POSIX_FADV_DONTNEED);
+  close(nFileDescriptor);
+
+  if (nError != 0) {
+    errno = nError;
+    return ERROR;
+  }
+
+  return OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// PrefetchFiles function
+
+int PrefetchFiles(const char** ppszPaths, int nCount) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_PREFETCH_FILES);
+
+  if (ppszPaths == NULL || nCount < 0) {
+    errno = EINVAL;
+    return ERROR;
+  }
+
+  PREFETCH_JOB job = { ppszPaths, 0 };
+  RunInParallel(nCount, 0, PrefetchOneFileProc, &job);
+
+  if (job.nFirstError != 0) {
+    errno = job.nFirstError;
+    return ERROR;
+  }
+
+  return OK;
+}
@@ -0,0 +1,94 @@
+/*
+ * parallel.c
+ *
+ *  Minimal fork/join helper used by the batch routines of the library.
+ */
+
+#include "stdafx.h"
+#include "file_core.h"
+
+#include "file_core_internal.h"
+#include "file_core_symbols.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// PARALLEL_JOB structure
+
+typedef struct _tagPARALLEL_JOB {
+  int nCount;
+  int nNextIndex;
+  PARALLEL_WORK_PROC lpfnWork;
+  void* pContext;
+} PARALLEL_JOB, *LPPARALLEL_JOB;
+
+///////////////////////////////////////////////////////////////////////////////
+// Internal functions
+
+///////////////////////////////////////////////////////////////////////////////
+// WorkerThreadProc function
+
+static void* WorkerThreadProc(void* pArg) {
+  LPPARALLEL_JOB lpJob = (LPPARALLEL_JOB) pArg;
+
+  while (TRUE) {
+    int nIndex = __atomic_fetch_add(&lpJob->nNextIndex, 1, __ATOMIC_RELAXED);
+    if (nIndex >= lpJob->nCount) {
+      break;
+    }
+    lpJob->lpfnWork(lpJob->pContext, nIndex);
+  }
+
+  return NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// GetDefaultWorkerCount function
+
+int GetDefaultWorkerCount(void) {
+  long nProcessors = sysconf(_SC_NPROCESSORS_ONLN);
+  if (nProcessors <= 0) {
+    nProcessors = 1;
+  }
+
+  long nWorkers = nProcessors * 2;
+  return nWorkers > MAX_DEFAULT_WORKER_COUNT ? MAX_DEFAULT_WORKER_COUNT
+      : (int) nWorkers;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// RunInParallel function
+
+void RunInParallel(int nCount, int nThreads, PARALLEL_WORK_PROC lpfnWork,
+    void* pContext) {
+  if (nCount <= 0 || lpfnWork == NULL) {
+    return;
+  }
+
+  if (nThreads <= 0) {
+    nThreads = GetDefaultWorkerCount();
+  }
+  if (nThreads > MAX_WORKER_COUNT) {
+    nThreads = MAX_WORKER_COUNT;
+  }
+  if (nThreads > nCount) {
+    nThreads = nCount;
+  }
+
+  PARALLEL_JOB job = { nCount, 0, lpfnWork, pContext };
+
+  /* The calling thread is one of the workers. */
+  pthread_t threads[nThreads > 1 ? nThreads - 1 : 1];
+  int nStarted = 0;
+  for (int i = 0; i < nThreads - 1; i++) {
+    if (OK != pthread_create(&threads[nStarted], NULL, WorkerThreadProc,
+        &job)) {
+      break;
+    }
+    nStarted++;
+  }
+
+  WorkerThreadProc(&job);
+
+  for (int i = 0; i < nStarted; i++) {
+    pthread_join(threads[i], NULL);
+  }
+}
@@ -0,0 +1,604 @@
+/*
+ * read_many.c
+ *
+ *  Batch reading of many whole files at once, through io_uring where the
+ *  kernel provides it and through a pool of worker threads otherwise.
+ */
+
+#include "stdafx.h"
+#include "file_core.h"
+
+#include "file_core_internal.h"
+#include "file_core_symbols.h"
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+
+/**
+ * @brief Operations tracked by the io_uring engine, one per slot at a time.
+ */
+#define URING_OP_OPEN     1
+#define URING_OP_STATX    2
+#define URING_OP_READ     3
+
+///////////////////////////////////////////////////////////////////////////////
+// URING structure - The pieces of an io_uring instance that we touch.
+
+typedef struct _tagURING {
+  int nRingDescriptor;
+  unsigned int nEntries;
+
+  void* pSubmissionRing;
+  size_t nSubmissionRingSize;
+  unsigned int* pSqTail;
+  unsigned int* pSqMask;
+  unsigned int* pSqArray;
+  struct io_uring_sqe* pSqes;
+  size_t nSqesSize;
+
+  void* pCompletionRing;
+  size_t nCompletionRingSize;
+  unsigned int* pCqHead;
+  unsigned int* pCqTail;
+  unsigned int* pCqMask;
+  struct io_uring_cqe* pCqes;
+
+  unsigned int nPendingSubmissions;
+} URING, *LPURING;
+
+///////////////////////////////////////////////////////////////////////////////
+// URING_SLOT structure - One file in flight.
+
+typedef struct _tagURING_SLOT {
+  int nFile;                  /* Index into the caller's arrays, or -1 */
+  int nFileDescriptor;
+  int nOperation;             /* One of the URING_OP_* values */
+  struct statx stx;
+  char* pBuffer;
+  size_t nSize;               /* Size reported by statx */
+  size_t nRead;               /* Bytes read so far */
+} URING_SLOT, *LPURING_SLOT;
+
+///////////////////////////////////////////////////////////////////////////////
+// READ_MANY_JOB structure - Shared by the workers of the fallback engine.
+
+typedef struct _tagREAD_MANY_JOB {
+  const char** ppszPaths;
+  LPREADMANYRESULT pResults;
+  const int* pFiles;          /* Indices of the files to read, or NULL */
+} READ_MANY_JOB, *LPREAD_MANY_JOB;
+
+///////////////////////////////////////////////////////////////////////////////
+// Internal functions
+
+///////////////////////////////////////////////////////////////////////////////
+// CloseUring function
+
+static void CloseUring(LPURING lpUring) {
+  if (lpUring->pSqes != NULL && lpUring->pSqes != MAP_FAILED) {
+    munmap(lpUring->pSqes, lpUring->nSqesSize);
+  }
+  if (lpUring->pCompletionRing != NULL
+      && lpUring->pCompletionRing != MAP_FAILED
+      && lpUring->pCompletionRing != lpUring->pSubmissionRing) {
+    munmap(lpUring->pCompletionRing, lpUring->nCompletionRingSize);
+  }
+  if (lpUring->pSubmissionRing != NULL
+      && lpUring->pSubmissionRing != MAP_FAILED) {
+    munmap(lpUring->pSubmissionRing, lpUring->nSubmissionRingSize);
+  }
+  if (lpUring->nRingDescriptor >= 0) {
+    close(lpUring->nRingDescriptor);
+  }
+  memset(lpUring, 0, sizeof(URING));
+  lpUring->nRingDescriptor = -1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// OpenUring function - Sets up a ring and maps its queues.  Fails if the
+// kernel lacks io_uring, forbids it, or predates the opcodes we need.
+
+static int OpenUring(LPURING lpUring, unsigned int nEntries) {
+  memset(lpUring, 0, sizeof(URING));
+
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+
+  lpUring->nRingDescriptor = (int) syscall(__NR_io_uring_setup, nEntries,
+      &params);
+  if (lpUring->nRingDescriptor < 0) {
+    return ERROR;
+  }
+
+  /* IORING_OP_OPENAT, IORING_OP_STATX and IORING_OP_READ arrived in the
+   * same kernel release as this feature bit. */
+  if (!(params.features & IORING_FEAT_RW_CUR_POS)) {
+    CloseUring(lpUring);
+    errno = ENOSYS;
+    return ERROR;
+  }
+
+  lpUring->nEntries = params.sq_entries;
+  lpUring->nSubmissionRingSize = params.sq_off.array
+      + params.sq_entries * sizeof(unsigned int);
+  lpUring->nCompletionRingSize = params.cq_off.cqes
+      + params.cq_entries * sizeof(struct io_uring_cqe);
+
+  BOOL bSingleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (bSingleMap
+      && lpUring->nCompletionRingSize > lpUring->nSubmissionRingSize) {
+    lpUring->nSubmissionRingSize = lpUring->nCompletionRingSize;
+  }
+
+  lpUring->pSubmissionRing = mmap(NULL, lpUring->nSubmissionRingSize,
+      PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+      lpUring->nRingDescriptor, IORING_OFF_SQ_RING);
+  if (lpUring->pSubmissionRing == MAP_FAILED) {
+    CloseUring(lpUring);
+    return ERROR;
+  }
+
+  lpUring->pCompletionRing = bSingleMap ? lpUring->pSubmissionRing
+      : mmap(NULL, lpUring->nCompletionRingSize, PROT_READ | PROT_WRITE,
+          MAP_SHARED | MAP_POPULATE, lpUring->nRingDescriptor,
+          IORING_OFF_CQ_RING);
+  if (lpUring->pCompletionRing == MAP_FAILED) {
+    CloseUring(lpUring);
+    return ERROR;
+  }
+
+  lpUring->nSqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+  lpUring->pSqes = (struct io_uring_sqe*) mmap(NULL, lpUring->nSqesSize,
+      PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+      lpUring->nRingDescriptor, IORING_OFF_SQES);
+  if (lpUring->pSqes == MAP_FAILED) {
+    CloseUring(lpUring);
+    return ERROR;
+  }
+
+  char* pSq = (char*) lpUring->pSubmissionRing;
+  lpUring->pSqTail = (unsigned int*) (pSq + params.sq_off.tail);
+  lpUring->pSqMask = (unsigned int*) (pSq + params.sq_off.ring_mask);
+  lpUring->pSqArray = (unsigned int*) (pSq + params.sq_off.array);
+
+  char* pCq = (char*) lpUring->pCompletionRing;
+  lpUring->pCqHead = (unsigned int*) (pCq + params.cq_off.head);
+  lpUring->pCqTail = (unsigned int*) (pCq + params.cq_off.tail);
+  lpUring->pCqMask = (unsigned int*) (pCq + params.cq_off.ring_mask);
+  lpUring->pCqes = (struct io_uring_cqe*) (pCq + params.cq_off.cqes);
+
+  return OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// GetSubmissionEntry function - Claims the next SQE.  Each slot has at most
+// one operation in flight and there are no more slots than entries, so the
+// queue can never be full.
+
+static struct io_uring_sqe* GetSubmissionEntry(LPURING lpUring) {
+  unsigned int nTail = *lpUring->pSqTail + lpUring->nPendingSubmissions;
+  unsigned int nIndex = nTail & *lpUring->pSqMask;
+
+  struct io_uring_sqe* lpSqe = &lpUring->pSqes[nIndex];
+  memset(lpSqe, 0, sizeof(struct io_uring_sqe));
+  lpUring->pSqArray[nIndex] = nIndex;
+  lpUring->nPendingSubmissions++;
+
+  return lpSqe;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// SubmitAndWait function - Publishes the queued SQEs and waits for at least
+// one completion.
+
+static int SubmitAndWait(LPURING lpUring) {
+  unsigned int nToSubmit = lpUring->nPendingSubmissions;
+  __atomic_store_n(lpUring->pSqTail, *lpUring->pSqTail + nToSubmit,
+      __ATOMIC_RELEASE);
+  lpUring->nPendingSubmissions = 0;
+
+  while (TRUE) {
+    int nResult = (int) syscall(__NR_io_uring_enter, lpUring->nRingDescriptor,
+        nToSubmit, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+    if (nResult >= 0) {
+      return OK;
+    }
+    if (errno != EINTR) {
+      return ERROR;
+    }
+    /* Interrupted after the submissions were consumed; just wait. */
+    nToSubmit = 0;
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// QueueRead function - Queues the next read for a slot, up to the limit of
+// what a single read may return.
+
+static void QueueRead(LPURING lpUring, LPURING_SLOT lpSlot, int nSlot) {
+  size_t nToRead = lpSlot->nSize - lpSlot->nRead;
+  if (nToRead > MAX_READ_CHUNK_SIZE) {
+    nToRead = MAX_READ_CHUNK_SIZE;
+  }
+
+  struct io_uring_sqe* lpSqe = GetSubmissionEntry(lpUring);
+  lpSqe->opcode = IORING_OP_READ;
+  lpSqe->fd = lpSlot->nFileDescriptor;
+  lpSqe->addr = (uint64_t) (uintptr_t) (lpSlot->pBuffer + lpSlot->nRead);
+  lpSqe->len = (uint32_t) nToRead;
+  lpSqe->off = (uint64_t) lpSlot->nRead;
+  lpSqe->user_data = (uint64_t) nSlot;
+
+  lpSlot->nOperation = URING_OP_READ;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// FinishSlot function - Records the outcome for the slot's file and frees
+// the slot for the next one.
+
+static void FinishSlot(LPURING_SLOT lpSlot, LPREADMANYRESULT pResults,
+    int nError) {
+  LPREADMANYRESULT lpResult = &pResults[lpSlot->nFile];
+
+  if (lpSlot->nFileDescriptor >= 0) {
+    close(lpSlot->nFileDescriptor);
+  }
+
+  if (nError == 0) {
+    lpSlot->pBuffer[lpSlot->nRead] = '\0';
+    lpResult->nStatus = OK;
+    lpResult->nError = 0;
+    lpResult->pData = lpSlot->pBuffer;
+    lpResult->nLength = lpSlot->nRead;
+  } else {
+    free(lpSlot->pBuffer);
+    lpResult->nStatus = ERROR;
+    lpResult->nError = nError;
+  }
+
+  lpSlot->nFile = -1;
+  lpSlot->nFileDescriptor = -1;
+  lpSlot->pBuffer = NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// DeferSlot function - Hands the slot's file over to the worker pool, to be
+// read once the ring is done, and frees the slot for the next one.
+
+static void DeferSlot(LPURING_SLOT lpSlot, int* pDeferredFiles,
+    int* pnDeferred) {
+  if (lpSlot->nFileDescriptor >= 0) {
+    close(lpSlot->nFileDescriptor);
+  }
+
+  pDeferredFiles[(*pnDeferred)++] = lpSlot->nFile;
+
+  lpSlot->nFile = -1;
+  lpSlot->nFileDescriptor = -1;
+  lpSlot->pBuffer = NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// HandleCompletion function - Advances a slot's state machine by one step:
+// open, then statx, then one or more reads.
+
+static void HandleCompletion(LPURING lpUring, LPURING_SLOT lpSlot, int nSlot,
+    int nResult, LPREADMANYRESULT pResults, int* pDeferredFiles,
+    int* pnDeferred) {
+  if (nResult == -EINTR || nResult == -EAGAIN) {
+    /* Reissue the operation that was interrupted. */
+    if (lpSlot->nOperation == URING_OP_READ) {
+      QueueRead(lpUring, lpSlot, nSlot);
+      return;
+    }
+  }
+
+  if (nResult < 0) {
+    FinishSlot(lpSlot, pResults, -nResult);
+    return;
+  }
+
+  switch (lpSlot->nOperation) {
+    case URING_OP_OPEN: {
+      lpSlot->nFileDescriptor = nResult;
+
+      static const char szEmptyPath[] = "";
+      struct io_uring_sqe* lpSqe = GetSubmissionEntry(lpUring);
+      lpSqe->opcode = IORING_OP_STATX;
+      lpSqe->fd = lpSlot->nFileDescriptor;
+      lpSqe->addr = (uint64_t) (uintptr_t) szEmptyPath;
+      lpSqe->len = STATX_TYPE | STATX_SIZE;
+      lpSqe->off = (uint64_t) (uintptr_t) &lpSlot->stx;
+      lpSqe->statx_flags = AT_EMPTY_PATH;
+      lpSqe->user_data = (uint64_t) nSlot;
+      lpSlot->nOperation = URING_OP_STATX;
+      return;
+    }
+
+    case URING_OP_STATX: {
+      /* Files whose size is not known up front (pipes, procfs) may block
+       * or must be read until end-of-file; reading them here would stall
+       * every other file on the ring, so the worker pool reads them. */
+      if (!S_ISREG(lpSlot->stx.stx_mode) || lpSlot->stx.stx_size == 0) {
+        DeferSlot(lpSlot, pDeferredFiles, pnDeferred);
+        return;
+      }
+
+      if (lpSlot->stx.stx_size >= (uint64_t) SIZE_MAX) {
+        FinishSlot(lpSlot, pResults, EFBIG);
+        return;
+      }
+
+      lpSlot->nSize = (size_t) lpSlot->stx.stx_size;
+      lpSlot->nRead = 0;
+      lpSlot->pBuffer = (char*) malloc(lpSlot->nSize + 1);
+      if (lpSlot->pBuffer == NULL) {
+        FinishSlot(lpSlot, pResults, ENOMEM);
+        return;
+      }
+
+      QueueRead(lpUring, lpSlot, nSlot);
+      return;
+    }
+
+    case URING_OP_READ: {
+      lpSlot->nRead += (size_t) nResult;
+
+      /* Stop at the size statx reported, or earlier if the file shrank. */
+      if (nResult == 0 || lpSlot->nRead == lpSlot->nSize) {
+        FinishSlot(lpSlot, pResults, 0);
+        return;
+      }
+
+      QueueRead(lpUring, lpSlot, nSlot);
+      return;
+    }
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ReadDeferredFileProc function - Work routine for the files the io_uring
+// engine hands over to the worker pool.  Their paths are already expanded.
+
+static void ReadDeferredFileProc(void* pContext, int nIndex) {
+  LPREAD_MANY_JOB lpJob = (LPREAD_MANY_JOB) pContext;
+  int nFile = lpJob->pFiles[nIndex];
+  LPREADMANYRESULT lpResult = &lpJob->pResults[nFile];
+
+  int nFileDescriptor = open(lpJob->ppszPaths[nFile], O_RDONLY | O_CLOEXEC);
+  if (nFileDescriptor >= 0 && OK == ReadAllFromDescriptor(nFileDescriptor,
+      &lpResult->pData, &lpResult->nLength)) {
+    lpResult->nStatus = OK;
+    lpResult->nError = 0;
+  } else {
+    lpResult->nStatus = ERROR;
+    lpResult->nError = errno;
+  }
+
+  if (nFileDescriptor >= 0) {
+    close(nFileDescriptor);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ReadManyWithUring function - Keeps up to nQueueDepth files in flight on a
+// single ring, then reads any file whose size was not known up front on the
+// worker pool.  Files whose path is NULL are skipped; their results must
+// already be filled in.  Returns ERROR, without having touched any result,
+// if the ring cannot be set up.
+
+static int ReadManyWithUring(char** ppszExpandedPaths, int nCount,
+    LPREADMANYRESULT pResults, int nQueueDepth, int nThreads) {
+  URING uring;
+  if (OK != OpenUring(&uring, (unsigned int) nQueueDepth)) {
+    return ERROR;
+  }
+
+  int nSlots = (int) uring.nEntries < nQueueDepth ? (int) uring.nEntries
+      : nQueueDepth;
+  LPURING_SLOT pSlots = (LPURING_SLOT) calloc(nSlots, sizeof(URING_SLOT));
+  int* pDeferredFiles = (int*) malloc(nCount * sizeof(int));
+  if (pSlots == NULL || pDeferredFiles == NULL) {
+    free(pSlots);
+    free(pDeferredFiles);
+    CloseUring(&uring);
+    errno = ENOMEM;
+    return ERROR;
+  }
+
+  for (int i = 0; i < nSlots; i++) {
+    pSlots[i].nFile = -1;
+    pSlots[i].nFileDescriptor = -1;
+  }
+
+  int nNextFile = 0;
+  int nInFlight = 0;
+  int nDeferred = 0;
+
+  while (nNextFile < nCount || nInFlight > 0) {
+    /* Start opening files in any free slots. */
+    for (int i = 0; i < nSlots && nNextFile < nCount; i++) {
+      if (pSlots[i].nFile >= 0) {
+        continue;
+      }
+
+      int nFile = nNextFile++;
+      if (ppszExpandedPaths[nFile] == NULL) {
+        continue;
+      }
+
+      pSlots[i].nFile = nFile;
+      struct io_uring_sqe* lpSqe = GetSubmissionEntry(&uring);
+      lpSqe->opcode = IORING_OP_OPENAT;
+      lpSqe->fd = AT_FDCWD;
+      lpSqe->addr = (uint64_t) (uintptr_t) ppszExpandedPaths[nFile];
+      lpSqe->open_flags = O_RDONLY | O_CLOEXEC;
+      lpSqe->user_data = (uint64_t) i;
+      pSlots[i].nOperation = URING_OP_OPEN;
+      nInFlight++;
+    }
+
+    if (nInFlight == 0) {
+      break;
+    }
+
+    if (OK != SubmitAndWait(&uring)) {
+      /* The ring is unusable; fail whatever is still in flight. */
+      int nError = errno;
+      for (int i = 0; i < nSlots; i++) {
+        if (pSlots[i].nFile >= 0) {
+          FinishSlot(&pSlots[i], pResults, nError);
+        }
+      }
+      for (; nNextFile < nCount; nNextFile++) {
+        if (ppszExpandedPaths[nNextFile] != NULL) {
+          pResults[nNextFile].nStatus = ERROR;
+          pResults[nNextFile].nError = nError;
+        }
+      }
+      break;
+    }
+
+    /* Reap every completion that is ready. */
+    unsigned int nHead = *uring.pCqHead;
+    unsigned int nTail = __atomic_load_n(uring.pCqTail, __ATOMIC_ACQUIRE);
+    for (; nHead != nTail; nHead++) {
+      struct io_uring_cqe* lpCqe = &uring.pCqes[nHead & *uring.pCqMask];
+      int nSlot = (int) lpCqe->user_data;
+
+      HandleCompletion(&uring, &pSlots[nSlot], nSlot, lpCqe->res, pResults,
+          pDeferredFiles, &nDeferred);
+      if (pSlots[nSlot].nFile < 0) {
+        nInFlight--;
+      }
+    }
+    __atomic_store_n(uring.pCqHead, nHead, __ATOMIC_RELEASE);
+  }
+
+  free(pSlots);
+  CloseUring(&uring);
+
+  if (nDeferred > 0) {
+    READ_MANY_JOB job = { (const char**) ppszExpandedPaths, pResults,
+        pDeferredFiles };
+    RunInParallel(nDeferred, nThreads, ReadDeferredFileProc, &job);
+  }
+  free(pDeferredFiles);
+
+  return OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ReadOneFileProc function - Work routine for the fallback engine.
+
+static void ReadOneFileProc(void* pContext, int nIndex) {
+  LPREAD_MANY_JOB lpJob = (LPREAD_MANY_JOB) pContext;
+  LPREADMANYRESULT lpResult = &lpJob->pResults[nIndex];
+
+  if (OK == ReadAllBytes(lpJob->ppszPaths[nIndex], &lpResult->pData,
+      &lpResult->nLength)) {
+    lpResult->nStatus = OK;
+    lpResult->nError = 0;
+  } else {
+    lpResult->nStatus = ERROR;
+    lpResult->nError = errno;
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Publicly-exposed functions
+
+///////////////////////////////////////////////////////////////////////////////
+// FreeReadManyResults function
+
+void FreeReadManyResults(LPREADMANYRESULT pResults, int nCount) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_FREE_READ_MANY_RESULTS);
+
+  if (pResults == NULL) {
+    return;
+  }
+
+  for (int i = 0; i < nCount; i++) {
+    free(pResults[i].pData);
+    pResults[i].pData = NULL;
+    pResults[i].nLength = 0;
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ReadManyFiles function
+
+int ReadManyFiles(const char** ppszPaths, int nCount,
+    LPREADMANYRESULT pResults, LPREADMANYOPTIONS lpOptions) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_READ_MANY_FILES);
+
+  if (ppszPaths == NULL || pResults == NULL || nCount < 0) {
+    errno = EINVAL;
+    return ERROR;
+  }
+
+  memset(pResults, 0, nCount * sizeof(READMANYRESULT));
+
+  int nQueueDepth = READ_MANY_DEFAULT_QUEUE_DEPTH;
+  int nThreads = 0;
+  int nFlags = 0;
+  if (lpOptions != NULL) {
+    if (lpOptions->nQueueDepth > 0) {
+      nQueueDepth = lpOptions->nQueueDepth;
+    }
+    nThreads = lpOptions->nThreads;
+    nFlags = lpOptions->nFlags;
+  }
+
+  BOOL bDone = FALSE;
+
+  if (!(nFlags & READ_MANY_FLAG_NO_IO_URING) && nCount > 0) {
+    /* The ring needs every expanded path to stay put until its open has
+     * completed, so expand them all up front. */
+    char** ppszExpandedPaths = (char**) calloc(nCount, sizeof(char*));
+    if (ppszExpandedPaths != NULL) {
+      char szExpandedPathName[MAX_PATH + 1];
+      for (int i = 0; i < nCount; i++) {
+        if (IsNullOrWhiteSpace(ppszPaths[i])) {
+          pResults[i].nStatus = ERROR;
+          pResults[i].nError = EINVAL;
+          continue;
+        }
+        memset(szExpandedPathName, 0, MAX_PATH + 1);
+        ShellExpand(ppszPaths[i], szExpandedPathName, MAX_PATH + 1);
+        ppszExpandedPaths[i] = strdup(szExpandedPathName);
+        if (ppszExpandedPaths[i] == NULL) {
+          pResults[i].nStatus = ERROR;
+          pResults[i].nError = ENOMEM;
+        }
+      }
+
+      bDone = OK == ReadManyWithUring(ppszExpandedPaths, nCount, pResults,
+          nQueueDepth, nThreads);
+
+      for (int i = 0; i < nCount; i++) {
+        free(ppszExpandedPaths[i]);
+      }
+      free(ppszExpandedPaths);
+    }
+  }
+
+  if (!bDone) {
+    /* Anything recorded while expanding the paths is read again here. */
+    memset(pResults, 0, nCount * sizeof(READMANYRESULT));
+
+    READ_MANY_JOB job = { ppszPaths, pResults, NULL };
+    RunInParallel(nCount, nThreads, ReadOneFileProc, &job);
+  }
+
+  int nResult = OK;
+  for (int i = 0; i < nCount; i++) {
+    FILE_CORE_TRACE_BYTES(pResults[i].nLength);
+    if (pResults[i].nStatus != OK && nResult == OK) {
+      errno = pResults[i].nError;
+      nResult = ERROR;
+    }
+  }
+
+  return nResult;
+}
@@ -0,0 +1,370 @@
+/*
+ * scratch_file.c
+ *
+ *  Anonymous, preallocated files for spilling intermediate results.  A
+ *  scratch file is created with O_TMPFILE, so it has no name, and the
+ *  kernel reclaims it if the process dies, until LinkScratchFile gives it
+ *  one.  Its space is reserved up front with fallocate(), in as few extents
+ *  as the file system can manage, and it may be mapped as a buffer that
+ *  grows as it fills.
+ */
+
+#include "stdafx.h"
+#include "file_core.h"
+
+#include "file_core_internal.h"
+#include "file_core_symbols.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// SCRATCHFILE structure
+
+struct _tagSCRATCHFILE {
+  int nFileDescriptor;
+  int nFlags;                         /* SCRATCH_FLAG_* values */
+  uint64_t nLength;                   /* Bytes appended so far */
+  uint64_t nCapacity;                 /* Bytes allocated (and mapped) */
+  char* pMapping;                     /* With SCRATCH_FLAG_MAP only */
+  BOOL bLinked;                       /* TRUE once LinkScratchFile succeeds */
+  char szTemporaryPath[MAX_PATH + 1]; /* Name, if O_TMPFILE was refused */
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Internal functions
+
+///////////////////////////////////////////////////////////////////////////////
+// OpenScratchDescriptor function - Creates the file, anonymously where the
+// file system allows, and otherwise under a hidden name that is removed
+// when the scratch file is closed.
+
+static int OpenScratchDescriptor(const char* pszDirectoryPath,
+    char* pszTemporaryPath, size_t nBufferSize) {
+  pszTemporaryPath[0] = '\0';
+
+#ifdef O_TMPFILE
+  int nFileDescriptor = open(pszDirectoryPath, O_TMPFILE | O_RDWR | O_CLOEXEC,
+      0666);
+  if (nFileDescriptor >= 0 || (errno != EOPNOTSUPP && errno != EISDIR)) {
+    return nFileDescriptor;
+  }
+#endif //O_TMPFILE
+
+  char szPattern[MAX_PATH + 1];
+  if (snprintf(szPattern, sizeof(szPattern), "%s/scratch", pszDirectoryPath)
+      >= (int) sizeof(szPattern)) {
+    errno = ENAMETOOLONG;
+    return ERROR;
+  }
+
+  for (int nAttempt = 0; nAttempt < 16; nAttempt++) {
+    FormatTemporaryFileName(szPattern, pszTemporaryPath, nBufferSize);
+    int nFileDescriptor = open(pszTemporaryPath,
+        O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+    if (nFileDescriptor >= 0 || errno != EEXIST) {
+      return nFileDescriptor;
+    }
+  }
+
+  return ERROR;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ExtendScratchFile function - Allocates the space from nCapacity to
+// nNewCapacity.  An unmapped file keeps its size, so that appends need not
+// fill every byte reserved; a mapped one must cover its mapping.
+
+static int ExtendScratchFile(LPSCRATCHFILE lpScratch, uint64_t nNewCapacity) {
+  BOOL bMapped = (lpScratch->nFlags & SCRATCH_FLAG_MAP) != 0;
+  off_t nOffset = (off_t) lpScratch->nCapacity;
+  off_t nLength = (off_t) (nNewCapacity - lpScratch->nCapacity);
+
+  if (OK == fallocate(lpScratch->nFileDescriptor,
+      bMapped ? 0 : FALLOC_FL_KEEP_SIZE, nOffset, nLength)) {
+    return OK;
+  }
+
+  /* Running out of space is worth reporting now rather than at some later
+   * write, but a file system without fallocate() is no reason to fail. */
+  if (errno != EOPNOTSUPP) {
+    return ERROR;
+  }
+
+  return bMapped ? (ftruncate(lpScratch->nFileDescriptor,
+      (off_t) nNewCapacity) == OK ? OK : ERROR) : OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// GrowScratchFile function - Makes room for at least nNeeded bytes,
+// doubling the allocation to keep extents large and remaps few.
+
+static int GrowScratchFile(LPSCRATCHFILE lpScratch, uint64_t nNeeded) {
+  uint64_t nPageSize = (uint64_t) sysconf(_SC_PAGESIZE);
+  uint64_t nNewCapacity = lpScratch->nCapacity * 2;
+  if (nNewCapacity < nNeeded) {
+    nNewCapacity = nNeeded;
+  }
+  nNewCapacity = (nNewCapacity + nPageSize - 1) & ~(nPageSize - 1);
+
+  if ((lpScratch->nFlags & SCRATCH_FLAG_MAP)
+      && nNewCapacity > (uint64_t) SIZE_MAX) {
+    errno = EFBIG;
+    return ERROR;
+  }
+
+  if (OK != ExtendScratchFile(lpScratch, nNewCapacity)) {
+    return ERROR;
+  }
+
+  if (lpScratch->nFlags & SCRATCH_FLAG_MAP) {
+    void* pMapping = lpScratch->pMapping == NULL
+        ? mmap(NULL, (size_t) nNewCapacity, PROT_READ | PROT_WRITE,
+            MAP_SHARED, lpScratch->nFileDescriptor, 0)
+        : mremap(lpScratch->pMapping, (size_t) lpScratch->nCapacity,
+            (size_t) nNewCapacity, MREMAP_MAYMOVE);
+    if (pMapping == MAP_FAILED) {
+      return ERROR;
+    }
+    lpScratch->pMapping = (char*) pMapping;
+  }
+
+  lpScratch->nCapacity = nNewCapacity;
+  return OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// RestoreScratchFile function - Undoes the trimming done by LinkScratchFile
+// when the link fails, so the scratch file may still be appended to.  A
+// mapped file must again cover its whole mapping, or the next append would
+// touch pages past the end of the file; preserves errno.
+
+static void RestoreScratchFile(LPSCRATCHFILE lpScratch) {
+  int nError = errno;
+
+  if (lpScratch->nCapacity > lpScratch->nLength) {
+    BOOL bMapped = (lpScratch->nFlags & SCRATCH_FLAG_MAP) != 0;
+    off_t nOffset = (off_t) lpScratch->nLength;
+    off_t nLength = (off_t) (lpScratch->nCapacity - lpScratch->nLength);
+
+    if (OK != fallocate(lpScratch->nFileDescriptor,
+        bMapped ? 0 : FALLOC_FL_KEEP_SIZE, nOffset, nLength) && bMapped) {
+      ftruncate(lpScratch->nFileDescriptor, (off_t) lpScratch->nCapacity);
+    }
+  }
+
+  errno = nError;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Publicly-exposed functions
+
+///////////////////////////////////////////////////////////////////////////////
+// AppendScratchFile function
+
+int AppendScratchFile(LPSCRATCHFILE lpScratch, const char* pData,
+    size_t nLength) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_APPEND_SCRATCH_FILE);
+
+  if (lpScratch == NULL || (pData == NULL && nLength > 0)) {
+    errno = EINVAL;
+    return ERROR;
+  }
+
+  if (lpScratch->bLinked) {
+    errno = EALREADY;
+    return ERROR;
+  }
+
+  uint64_t nNeeded = lpScratch->nLength + nLength;
+  if (nNeeded > lpScratch->nCapacity
+      && OK != GrowScratchFile(lpScratch, nNeeded)) {
+    return ERROR;
+  }
+
+  if (lpScratch->pMapping != NULL) {
+    memcpy(lpScratch->pMapping + lpScratch->nLength, pData, nLength);
+  } else if (OK != WriteFully(lpScratch->nFileDescriptor, pData, nLength,
+      (off_t) lpScratch->nLength)) {
+    return ERROR;
+  }
+
+  lpScratch->nLength = nNeeded;
+  FILE_CORE_TRACE_BYTES(nLength);
+
+  return OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// CloseScratchFile function
+
+void CloseScratchFile(LPSCRATCHFILE* lppScratch) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_CLOSE_SCRATCH_FILE);
+
+  if (lppScratch == NULL || *lppScratch == NULL) {
+    return;
+  }
+
+  LPSCRATCHFILE lpScratch = *lppScratch;
+  if (lpScratch->pMapping != NULL) {
+    munmap(lpScratch->pMapping, (size_t) lpScratch->nCapacity);
+  }
+  close(lpScratch->nFileDescriptor);
+
+  /* An anonymous file goes away with its last descriptor; a named one has
+   * to be removed. */
+  if (!lpScratch->bLinked && lpScratch->szTemporaryPath[0] != '\0') {
+    unlink(lpScratch->szTemporaryPath);
+  }
+
+  free(lpScratch);
+  *lppScratch = NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// CreateScratchFile function
+
+LPSCRATCHFILE CreateScratchFile(const char* pszDirectoryPath,
+    uint64_t nExpectedSize, int nFlags) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_CREATE_SCRATCH_FILE);
+
+  if (IsNullOrWhiteSpace(pszDirectoryPath)) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  LPSCRATCHFILE lpScratch = (LPSCRATCHFILE) calloc(1, sizeof(SCRATCHFILE));
+  if (lpScratch == NULL) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  lpScratch->nFlags = nFlags;
+
+  /* Expand the path name a la Bash */
+  char szExpandedPathName[MAX_PATH + 1];
+  memset(szExpandedPathName, 0, MAX_PATH + 1);
+  ShellExpand(pszDirectoryPath, szExpandedPathName, MAX_PATH + 1);
+
+  lpScratch->nFileDescriptor = OpenScratchDescriptor(szExpandedPathName,
+      lpScratch->szTemporaryPath, sizeof(lpScratch->szTemporaryPath));
+  if (lpScratch->nFileDescriptor < 0) {
+    int nError = errno;
+    free(lpScratch);
+    errno = nError;
+    return NULL;
+  }
+
+  if (nExpectedSize > 0 && OK != GrowScratchFile(lpScratch, nExpectedSize)) {
+    int nError = errno;
+    CloseScratchFile(&lpScratch);
+    errno = nError;
+    return NULL;
+  }
+
+  return lpScratch;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// GetScratchBuffer function
+
+int GetScratchBuffer(LPSCRATCHFILE lpScratch, char** ppBuffer,
+    uint64_t* pnLength) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_GET_SCRATCH_BUFFER);
+
+  if (lpScratch == NULL || ppBuffer == NULL || pnLength == NULL
+      || !(lpScratch->nFlags & SCRATCH_FLAG_MAP)) {
+    errno = EINVAL;
+    return ERROR;
+  }
+
+  /* Nothing is mapped until the first byte arrives. */
+  *ppBuffer = lpScratch->pMapping;
+  *pnLength = lpScratch->nLength;
+
+  return OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// GetScratchFileDescriptor function
+
+int GetScratchFileDescriptor(LPSCRATCHFILE lpScratch) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_GET_SCRATCH_FILE_DESCRIPTOR);
+
+  if (lpScratch == NULL) {
+    errno = EINVAL;
+    return ERROR;
+  }
+
+  return lpScratch->nFileDescriptor;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// LinkScratchFile function
+
+int LinkScratchFile(LPSCRATCHFILE lpScratch, const char* pszPath,
+    int nFlags) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_LINK_SCRATCH_FILE);
+
+  if (lpScratch == NULL || IsNullOrWhiteSpace(pszPath)) {
+    errno = EINVAL;
+    return ERROR;
+  }
+
+  if (lpScratch->bLinked) {
+    errno = EALREADY;
+    return ERROR;
+  }
+
+  /* Expand the path name a la Bash */
+  char szExpandedPathName[MAX_PATH + 1];
+  memset(szExpandedPathName, 0, MAX_PATH + 1);
+  ShellExpand(pszPath, szExpandedPathName, MAX_PATH + 1);
+
+  /* Write back the mapping, if it is to be synchronized, then give back
+   * whatever was reserved but not used. */
+  if (lpScratch->pMapping != NULL && lpScratch->nLength > 0
+      && (nFlags & (WRITE_FLAG_DATASYNC | WRITE_FLAG_FULLSYNC))
+      && OK != msync(lpScratch->pMapping, (size_t) lpScratch->nLength,
+          MS_SYNC)) {
+    return ERROR;
+  }
+  if (OK != ftruncate(lpScratch->nFileDescriptor, (off_t) lpScratch->nLength)) {
+    return ERROR;
+  }
+  if (OK != SyncFile(lpScratch->nFileDescriptor, nFlags)) {
+    RestoreScratchFile(lpScratch);
+    return ERROR;
+  }
+
+  /* Either way the file appears under its final name in a single step,
+   * replacing anything already there.  Should that fail, the file is given
+   * back its reserved space, since it remains open for appending. */
+  if (lpScratch->szTemporaryPath[0] != '\0') {
+    if (OK != rename(lpScratch->szTemporaryPath, szExpandedPathName)) {
+      RestoreScratchFile(lpScratch);
+      return ERROR;
+    }
+  } else {
+    char szTemporaryPath[MAX_PATH + 1];
+    memset(szTemporaryPath, 0, MAX_PATH + 1);
+
+    if (OK != LinkAnonymousFile(lpScratch->nFileDescriptor, AT_FDCWD,
+        szExpandedPathName, szTemporaryPath, MAX_PATH + 1)) {
+      RestoreScratchFile(lpScratch);
+      return ERROR;
+    }
+
+    if (OK != rename(szTemporaryPath, szExpandedPathName)) {
+      int nError = errno;
+      unlink(szTemporaryPath);
+      RestoreScratchFile(lpScratch);
+      errno = nError;
+      return ERROR;
+    }
+  }
+
+  lpScratch->bLinked = TRUE;
+
+  if (nFlags & WRITE_FLAG_FULLSYNC) {
+    return SyncParentDirectory(AT_FDCWD, szExpandedPathName);
+  }
+
+  return OK;
+}
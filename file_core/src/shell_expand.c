@@ -0,0 +1,617 @@
+/*
+ * shell_expand.c
+ *
+ *  Expansion of path name strings a la Bash, with a fast path for plain
+ *  paths, a native expander for '~' and '$VAR', and an optional LRU cache.
+ */
+
+#include "stdafx.h"
+#include "file_core.h"
+
+#include "file_core_internal.h"
+#include "file_core_symbols.h"
+
+/**
+ * @brief Characters that wordexp treats specially anywhere in a word.  A
+ * string containing none of these (and not starting with '~' or '#') comes
+ * out of wordexp unchanged.
+ */
+#define SHELL_SPECIAL_CHARS       "$`\\\"' \t\n|&;<>(){}*?[]"
+
+/**
+ * @brief Characters that, when they appear in the value of an environment
+ * variable, would cause wordexp to split or glob the result.
+ */
+#define SHELL_UNSAFE_VALUE_CHARS  " \t\n*?["
+
+///////////////////////////////////////////////////////////////////////////////
+// EXPANSION_CACHE_ENTRY structure
+
+typedef struct _tagEXPANSION_CACHE_ENTRY {
+  char* pszKey;                                   /* Unexpanded string */
+  char* pszValue;                                 /* Expanded string */
+  uint64_t nHash;                                 /* Hash of pszKey */
+  struct _tagEXPANSION_CACHE_ENTRY* pNextInBucket;
+  struct _tagEXPANSION_CACHE_ENTRY* pPrev;        /* More recently used */
+  struct _tagEXPANSION_CACHE_ENTRY* pNext;        /* Less recently used */
+} EXPANSION_CACHE_ENTRY, *LPEXPANSION_CACHE_ENTRY;
+
+///////////////////////////////////////////////////////////////////////////////
+// USER_HOME_ENTRY structure
+
+typedef struct _tagUSER_HOME_ENTRY {
+  char szUserName[MAX_USER_NAME_LENGTH + 1];
+  char szHomeDirectory[MAX_PATH + 1];
+} USER_HOME_ENTRY, *LPUSER_HOME_ENTRY;
+
+///////////////////////////////////////////////////////////////////////////////
+// Global variables
+
+static pthread_mutex_t g_cacheMutex = PTHREAD_MUTEX_INITIALIZER;
+static BOOL g_bCacheEnabled = FALSE;
+static LPEXPANSION_CACHE_ENTRY* g_ppBuckets = NULL;
+static size_t g_nBucketCount = 0;
+static int g_nCacheCapacity = 0;
+static int g_nCacheCount = 0;
+static LPEXPANSION_CACHE_ENTRY g_pMostRecent = NULL;
+static LPEXPANSION_CACHE_ENTRY g_pLeastRecent = NULL;
+
+static pthread_mutex_t g_homeMutex = PTHREAD_MUTEX_INITIALIZER;
+static BOOL g_bHomeDirectoryCached = FALSE;
+static char g_szHomeDirectory[MAX_PATH + 1];
+static USER_HOME_ENTRY g_userHomes[MAX_CACHED_USER_HOMES];
+static int g_nUserHomeCount = 0;
+static int g_nNextUserHomeSlot = 0;
+
+///////////////////////////////////////////////////////////////////////////////
+// Internal functions
+
+///////////////////////////////////////////////////////////////////////////////
+// CopyTruncated function - Copies a string into a buffer, truncating it if
+// need be, and always leaving the result NUL-terminated.
+
+static void CopyTruncated(char* pszBuffer, int nBufferSize,
+    const char* pszSource) {
+  strncpy(pszBuffer, pszSource, nBufferSize - 1);
+  pszBuffer[nBufferSize - 1] = '\0';
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// HashString function - FNV-1a
+
+static uint64_t HashString(const char* pszValue) {
+  uint64_t nHash = 14695981039346656037ULL;
+  for (const unsigned char* p = (const unsigned char*) pszValue; *p; p++) {
+    nHash ^= *p;
+    nHash *= 1099511628211ULL;
+  }
+  return nHash;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// IsPlainPath function - Determines whether the string passes through the
+// shell's expansions untouched.
+
+static BOOL IsPlainPath(const char* pszPathName) {
+  if (pszPathName[0] == '~' || pszPathName[0] == '#') {
+    return FALSE;
+  }
+
+  return pszPathName[strcspn(pszPathName, SHELL_SPECIAL_CHARS)] == '\0';
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// IsVariableNameChar function
+
+static BOOL IsVariableNameChar(char ch, BOOL bFirst) {
+  if (ch == '_' || (ch >= 'A' && ch <= 'Z') || (ch >= 'a' && ch <= 'z')) {
+    return TRUE;
+  }
+
+  return !bFirst && ch >= '0' && ch <= '9';
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// LookupHomeDirectory function - Gets the home directory of the current
+// user, consulting GetHomeDirectoryPath only the first time.
+
+static BOOL LookupHomeDirectory(char* pszBuffer, size_t nBufferSize) {
+  pthread_mutex_lock(&g_homeMutex);
+
+  if (!g_bHomeDirectoryCached) {
+    char szHomeDirectory[MAX_PATH + 1];
+    memset(szHomeDirectory, 0, MAX_PATH + 1);
+    GetHomeDirectoryPath(szHomeDirectory);
+
+    strcpy(g_szHomeDirectory, szHomeDirectory);
+    g_bHomeDirectoryCached = TRUE;
+  }
+
+  BOOL bResult = strlen(g_szHomeDirectory) < nBufferSize;
+  if (bResult) {
+    strcpy(pszBuffer, g_szHomeDirectory);
+  }
+
+  pthread_mutex_unlock(&g_homeMutex);
+  return bResult;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// LookupUserHomeDirectory function - Gets the home directory of the named
+// user, remembering the answers for the most recently seen users.
+
+static BOOL LookupUserHomeDirectory(const char* pszUserName,
+    char* pszBuffer, size_t nBufferSize) {
+  BOOL bResult = FALSE;
+
+  pthread_mutex_lock(&g_homeMutex);
+
+  for (int i = 0; i < g_nUserHomeCount; i++) {
+    if (strcmp(g_userHomes[i].szUserName, pszUserName) == 0) {
+      bResult = strlen(g_userHomes[i].szHomeDirectory) < nBufferSize;
+      if (bResult) {
+        strcpy(pszBuffer, g_userHomes[i].szHomeDirectory);
+      }
+      pthread_mutex_unlock(&g_homeMutex);
+      return bResult;
+    }
+  }
+
+  pthread_mutex_unlock(&g_homeMutex);
+
+  struct passwd pwent = { 0 };
+  struct passwd *pwentp = NULL;
+  char buf[16384];
+
+  if (OK != getpwnam_r(pszUserName, &pwent, buf, sizeof(buf), &pwentp)
+      || pwentp == NULL || pwentp->pw_dir == NULL
+      || strlen(pwentp->pw_dir) > MAX_PATH) {
+    return FALSE;
+  }
+
+  pthread_mutex_lock(&g_homeMutex);
+
+  LPUSER_HOME_ENTRY lpEntry = &g_userHomes[g_nNextUserHomeSlot];
+  g_nNextUserHomeSlot = (g_nNextUserHomeSlot + 1) % MAX_CACHED_USER_HOMES;
+  if (g_nUserHomeCount < MAX_CACHED_USER_HOMES) {
+    g_nUserHomeCount++;
+  }
+
+  strcpy(lpEntry->szUserName, pszUserName);
+  strcpy(lpEntry->szHomeDirectory, pwentp->pw_dir);
+
+  pthread_mutex_unlock(&g_homeMutex);
+
+  bResult = strlen(pwentp->pw_dir) < nBufferSize;
+  if (bResult) {
+    strcpy(pszBuffer, pwentp->pw_dir);
+  }
+
+  return bResult;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ExpandNatively function - Expands a leading '~' or '~user' and any $VAR
+// or ${VAR} references without calling wordexp.  Returns FALSE, leaving the
+// output undefined, if the string needs anything the shell would do beyond
+// that (or if the result does not fit), so that the caller can fall back.
+
+static BOOL ExpandNatively(const char* pszPathName, char* pszBuffer,
+    int nBufferSize) {
+  const char* pszInput = pszPathName;
+  size_t nOutput = 0;
+  size_t nAvailable = (size_t) nBufferSize - 1;
+
+  if (*pszInput == '#') {
+    return FALSE;
+  }
+
+  if (*pszInput == '~') {
+    size_t nNameLength = strcspn(pszInput + 1, "/");
+    if (nNameLength > MAX_USER_NAME_LENGTH) {
+      return FALSE;
+    }
+
+    char szUserName[MAX_USER_NAME_LENGTH + 1];
+    memcpy(szUserName, pszInput + 1, nNameLength);
+    szUserName[nNameLength] = '\0';
+
+    if (szUserName[strcspn(szUserName, SHELL_SPECIAL_CHARS)] != '\0') {
+      return FALSE;
+    }
+
+    BOOL bFound = nNameLength == 0
+        ? LookupHomeDirectory(pszBuffer, nAvailable + 1)
+        : LookupUserHomeDirectory(szUserName, pszBuffer, nAvailable + 1);
+    if (!bFound) {
+      return FALSE;
+    }
+
+    nOutput = strlen(pszBuffer);
+    pszInput += 1 + nNameLength;
+  }
+
+  while (*pszInput != '\0') {
+    if (*pszInput != '$') {
+      if (strchr(SHELL_SPECIAL_CHARS, *pszInput) != NULL) {
+        return FALSE;
+      }
+      if (nOutput == nAvailable) {
+        return FALSE;
+      }
+      pszBuffer[nOutput++] = *pszInput++;
+      continue;
+    }
+
+    /* Parse $NAME or ${NAME} */
+    BOOL bBraced = pszInput[1] == '{';
+    const char* pszName = pszInput + (bBraced ? 2 : 1);
+    size_t nNameLength = 0;
+    while (IsVariableNameChar(pszName[nNameLength], nNameLength == 0)) {
+      nNameLength++;
+    }
+
+    if (nNameLength == 0 || nNameLength > MAX_USER_NAME_LENGTH
+        || (bBraced && pszName[nNameLength] != '}')) {
+      return FALSE;
+    }
+
+    char szName[MAX_USER_NAME_LENGTH + 1];
+    memcpy(szName, pszName, nNameLength);
+    szName[nNameLength] = '\0';
+
+    const char* pszValue = getenv(szName);
+    if (pszValue != NULL) {
+      /* wordexp would field-split or glob such a value. */
+      if (pszValue[strcspn(pszValue, SHELL_UNSAFE_VALUE_CHARS)] != '\0') {
+        return FALSE;
+      }
+
+      size_t nValueLength = strlen(pszValue);
+      if (nValueLength > nAvailable - nOutput) {
+        return FALSE;
+      }
+
+      memcpy(pszBuffer + nOutput, pszValue, nValueLength);
+      nOutput += nValueLength;
+    }
+
+    pszInput = pszName + nNameLength + (bBraced ? 1 : 0);
+  }
+
+  pszBuffer[nOutput] = '\0';
+  return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ExpandWithWordexp function - Hands the string to wordexp, keeping only the
+// first word of the result.  Command substitution is refused, so expanding a
+// path never runs a command; such strings expand to nothing.
+
+static void ExpandWithWordexp(const char* pszPathName, char* pszBuffer,
+    int nBufferSize) {
+  memset(pszBuffer, 0, nBufferSize);
+
+  wordexp_t p;
+  memset(&p, 0, sizeof(wordexp_t));
+
+  FILE_CORE_COUNT_EVENT(FILE_CORE_COUNTER_WORDEXP_CALLS);
+  int nResult = wordexp(pszPathName, &p, WRDE_NOCMD);
+  if (nResult != 0) {
+    /* WRDE_CMDSUB, for $(...) or backquotes, fails like any other error.
+     * Only WRDE_NOSPACE leaves behind memory that must be released. */
+    if (nResult == WRDE_NOSPACE) {
+      wordfree(&p);
+    }
+    return;
+  }
+
+  char **w = p.we_wordv;
+  if (w != NULL && p.we_wordc > 0 && !IsNullOrWhiteSpace(w[0])) {
+    CopyTruncated(pszBuffer, nBufferSize, w[0]);
+  }
+
+  wordfree(&p);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// UnlinkCacheEntry function - Removes an entry from the LRU list.  The cache
+// mutex must be held.
+
+static void UnlinkCacheEntry(LPEXPANSION_CACHE_ENTRY lpEntry) {
+  if (lpEntry->pPrev != NULL) {
+    lpEntry->pPrev->pNext = lpEntry->pNext;
+  } else {
+    g_pMostRecent = lpEntry->pNext;
+  }
+
+  if (lpEntry->pNext != NULL) {
+    lpEntry->pNext->pPrev = lpEntry->pPrev;
+  } else {
+    g_pLeastRecent = lpEntry->pPrev;
+  }
+
+  lpEntry->pPrev = lpEntry->pNext = NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// PushCacheEntry function - Makes an entry the most recently used one.  The
+// cache mutex must be held.
+
+static void PushCacheEntry(LPEXPANSION_CACHE_ENTRY lpEntry) {
+  lpEntry->pPrev = NULL;
+  lpEntry->pNext = g_pMostRecent;
+
+  if (g_pMostRecent != NULL) {
+    g_pMostRecent->pPrev = lpEntry;
+  }
+  g_pMostRecent = lpEntry;
+
+  if (g_pLeastRecent == NULL) {
+    g_pLeastRecent = lpEntry;
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// FreeCacheEntries function - Releases every entry in the cache.  The cache
+// mutex must be held.
+
+static void FreeCacheEntries(void) {
+  LPEXPANSION_CACHE_ENTRY lpEntry = g_pMostRecent;
+  while (lpEntry != NULL) {
+    LPEXPANSION_CACHE_ENTRY lpNext = lpEntry->pNext;
+    free(lpEntry->pszKey);
+    free(lpEntry->pszValue);
+    free(lpEntry);
+    lpEntry = lpNext;
+  }
+
+  g_pMostRecent = g_pLeastRecent = NULL;
+  g_nCacheCount = 0;
+
+  if (g_ppBuckets != NULL) {
+    memset(g_ppBuckets, 0, g_nBucketCount * sizeof(LPEXPANSION_CACHE_ENTRY));
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// RemoveFromBucket function - The cache mutex must be held.
+
+static void RemoveFromBucket(LPEXPANSION_CACHE_ENTRY lpEntry) {
+  LPEXPANSION_CACHE_ENTRY* lppLink =
+      &g_ppBuckets[lpEntry->nHash & (g_nBucketCount - 1)];
+
+  while (*lppLink != NULL) {
+    if (*lppLink == lpEntry) {
+      *lppLink = lpEntry->pNextInBucket;
+      return;
+    }
+    lppLink = &(*lppLink)->pNextInBucket;
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// LookupCachedExpansion function
+
+static BOOL LookupCachedExpansion(const char* pszPathName,
+    char* pszBuffer, int nBufferSize) {
+  BOOL bFound = FALSE;
+  uint64_t nHash = HashString(pszPathName);
+
+  pthread_mutex_lock(&g_cacheMutex);
+
+  if (g_bCacheEnabled) {
+    LPEXPANSION_CACHE_ENTRY lpEntry =
+        g_ppBuckets[nHash & (g_nBucketCount - 1)];
+    while (lpEntry != NULL) {
+      if (lpEntry->nHash == nHash && strcmp(lpEntry->pszKey,
+          pszPathName) == 0) {
+        UnlinkCacheEntry(lpEntry);
+        PushCacheEntry(lpEntry);
+        CopyTruncated(pszBuffer, nBufferSize, lpEntry->pszValue);
+        bFound = TRUE;
+        break;
+      }
+      lpEntry = lpEntry->pNextInBucket;
+    }
+  }
+
+  pthread_mutex_unlock(&g_cacheMutex);
+  return bFound;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// StoreCachedExpansion function
+
+static void StoreCachedExpansion(const char* pszPathName,
+    const char* pszExpanded) {
+  uint64_t nHash = HashString(pszPathName);
+
+  LPEXPANSION_CACHE_ENTRY lpEntry = (LPEXPANSION_CACHE_ENTRY) calloc(1,
+      sizeof(EXPANSION_CACHE_ENTRY));
+  if (lpEntry == NULL) {
+    return;
+  }
+
+  lpEntry->pszKey = strdup(pszPathName);
+  lpEntry->pszValue = strdup(pszExpanded);
+  lpEntry->nHash = nHash;
+  if (lpEntry->pszKey == NULL || lpEntry->pszValue == NULL) {
+    free(lpEntry->pszKey);
+    free(lpEntry->pszValue);
+    free(lpEntry);
+    return;
+  }
+
+  pthread_mutex_lock(&g_cacheMutex);
+
+  if (!g_bCacheEnabled) {
+    pthread_mutex_unlock(&g_cacheMutex);
+    free(lpEntry->pszKey);
+    free(lpEntry->pszValue);
+    free(lpEntry);
+    return;
+  }
+
+  /* Another thread may have stored the same key in the meantime. */
+  LPEXPANSION_CACHE_ENTRY* lppBucket =
+      &g_ppBuckets[nHash & (g_nBucketCount - 1)];
+  for (LPEXPANSION_CACHE_ENTRY lpExisting = *lppBucket; lpExisting != NULL;
+      lpExisting = lpExisting->pNextInBucket) {
+    if (lpExisting->nHash == nHash
+        && strcmp(lpExisting->pszKey, pszPathName) == 0) {
+      pthread_mutex_unlock(&g_cacheMutex);
+      free(lpEntry->pszKey);
+      free(lpEntry->pszValue);
+      free(lpEntry);
+      return;
+    }
+  }
+
+  if (g_nCacheCount == g_nCacheCapacity && g_pLeastRecent != NULL) {
+    LPEXPANSION_CACHE_ENTRY lpVictim = g_pLeastRecent;
+    UnlinkCacheEntry(lpVictim);
+    RemoveFromBucket(lpVictim);
+    free(lpVictim->pszKey);
+    free(lpVictim->pszValue);
+    free(lpVictim);
+    g_nCacheCount--;
+  }
+
+  lpEntry->pNextInBucket = *lppBucket;
+  *lppBucket = lpEntry;
+  PushCacheEntry(lpEntry);
+  g_nCacheCount++;
+
+  pthread_mutex_unlock(&g_cacheMutex);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Publicly-exposed functions
+
+///////////////////////////////////////////////////////////////////////////////
+// ClearShellExpandCache function
+
+void ClearShellExpandCache(void) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_CLEAR_SHELL_EXPAND_CACHE);
+
+  pthread_mutex_lock(&g_cacheMutex);
+  FreeCacheEntries();
+  pthread_mutex_unlock(&g_cacheMutex);
+
+  pthread_mutex_lock(&g_homeMutex);
+  g_bHomeDirectoryCached = FALSE;
+  memset(g_szHomeDirectory, 0, MAX_PATH + 1);
+  g_nUserHomeCount = 0;
+  g_nNextUserHomeSlot = 0;
+  pthread_mutex_unlock(&g_homeMutex);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// DisableShellExpandCache function
+
+void DisableShellExpandCache(void) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_DISABLE_SHELL_EXPAND_CACHE);
+
+  pthread_mutex_lock(&g_cacheMutex);
+
+  FreeCacheEntries();
+  free(g_ppBuckets);
+  g_ppBuckets = NULL;
+  g_nBucketCount = 0;
+  g_nCacheCapacity = 0;
+  __atomic_store_n(&g_bCacheEnabled, FALSE, __ATOMIC_RELEASE);
+
+  pthread_mutex_unlock(&g_cacheMutex);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// EnableShellExpandCache function
+
+int EnableShellExpandCache(int nCapacity) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_ENABLE_SHELL_EXPAND_CACHE);
+
+  if (nCapacity <= 0) {
+    return ERROR;
+  }
+
+  /* Keep the load factor at or below one half. */
+  size_t nBucketCount = 16;
+  while (nBucketCount < (size_t) nCapacity * 2) {
+    nBucketCount *= 2;
+  }
+
+  LPEXPANSION_CACHE_ENTRY* ppBuckets = (LPEXPANSION_CACHE_ENTRY*) calloc(
+      nBucketCount, sizeof(LPEXPANSION_CACHE_ENTRY));
+  if (ppBuckets == NULL) {
+    return ERROR;
+  }
+
+  pthread_mutex_lock(&g_cacheMutex);
+
+  FreeCacheEntries();
+  free(g_ppBuckets);
+  g_ppBuckets = ppBuckets;
+  g_nBucketCount = nBucketCount;
+  g_nCacheCapacity = nCapacity;
+  __atomic_store_n(&g_bCacheEnabled, TRUE, __ATOMIC_RELEASE);
+
+  pthread_mutex_unlock(&g_cacheMutex);
+
+  return OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ShellExpand function
+
+void ShellExpand(const char* pszPathName,
+    char* pszBuffer, int nBufferSize) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_SHELL_EXPAND);
+
+  if (IsNullOrWhiteSpace(pszPathName)) {
+    return;
+  }
+
+  if (pszBuffer == NULL) {
+    return;
+  }
+
+  if (nBufferSize <= 0) {
+    return;
+  }
+
+  /* Most paths contain nothing for the shell to do; hand them straight
+   * back.  The source and destination may be the same buffer. */
+  if (IsPlainPath(pszPathName)) {
+    if (pszBuffer != pszPathName) {
+      memset(pszBuffer, 0, nBufferSize);
+      CopyTruncated(pszBuffer, nBufferSize, pszPathName);
+    }
+    return;
+  }
+
+  BOOL bCacheEnabled = __atomic_load_n(&g_bCacheEnabled, __ATOMIC_ACQUIRE);
+
+  /* Work on a copy, in case the caller passed the same buffer twice. */
+  char szPathName[strlen(pszPathName) + 1];
+  strcpy(szPathName, pszPathName);
+
+  memset(pszBuffer, 0, nBufferSize);
+
+  if (bCacheEnabled
+      && LookupCachedExpansion(szPathName, pszBuffer, nBufferSize)) {
+    FILE_CORE_COUNT_EVENT(FILE_CORE_COUNTER_SHELL_EXPAND_CACHE_HITS);
+    return;
+  }
+
+  if (!ExpandNatively(szPathName, pszBuffer, nBufferSize)) {
+    ExpandWithWordexp(szPathName, pszBuffer, nBufferSize);
+  }
+
+  /* Results that were truncated to fit this caller's buffer are not
+   * remembered, since the next caller's buffer may be bigger. */
+  if (bCacheEnabled && pszBuffer[0] != '\0'
+      && strlen(pszBuffer) < (size_t) nBufferSize - 1) {
+    StoreCachedExpansion(szPathName, pszBuffer);
+  }
+}
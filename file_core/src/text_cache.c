@@ -0,0 +1,698 @@
+/*
+ * text_cache.c
+ *
+ *  An opt-in cache of whole-file contents for files that are read over and
+ *  over.  Entries are keyed by device and inode, validated against the
+ *  file's modification time and size on every lookup, and optionally
+ *  invalidated by an inotify thread the moment their file changes.
+ */
+
+#include "stdafx.h"
+#include "file_core.h"
+
+#include "file_core_internal.h"
+#include "file_core_symbols.h"
+
+#include <poll.h>
+#include <stddef.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+
+/**
+ * @brief Changes to a cached file that make its entry stale.
+ */
+#define TEXT_CACHE_WATCH_MASK \
+  (IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_MOVE_SELF | IN_DELETE_SELF)
+
+///////////////////////////////////////////////////////////////////////////////
+// CACHED_TEXT structure - An immutable, reference-counted copy of a file's
+// content.  Callers are handed szText and give it back to
+// ReleaseCachedText, which finds the header from it.
+
+typedef struct _tagCACHED_TEXT {
+  int nRefCount;
+  size_t nLength;
+  char szText[];
+} CACHED_TEXT, *LPCACHED_TEXT;
+
+///////////////////////////////////////////////////////////////////////////////
+// TEXT_CACHE_ENTRY structure
+
+typedef struct _tagTEXT_CACHE_ENTRY {
+  dev_t nDevice;
+  ino_t nInode;
+  struct timespec modified;
+  off_t nSize;
+  int nWatch;                 /* inotify watch descriptor, or -1 */
+  size_t nCharge;             /* Bytes counted against the budget */
+  LPCACHED_TEXT lpText;       /* The cache holds one reference */
+  struct _tagTEXT_CACHE_ENTRY* pNextInBucket;
+  struct _tagTEXT_CACHE_ENTRY* pPrev;           /* More recently used */
+  struct _tagTEXT_CACHE_ENTRY* pNext;           /* Less recently used */
+} TEXT_CACHE_ENTRY, *LPTEXT_CACHE_ENTRY;
+
+///////////////////////////////////////////////////////////////////////////////
+// TEXT_CACHE_SHARD structure - One independently-locked slice of the cache,
+// with its own buckets, LRU list and share of the memory budget.  Padded to
+// a cache line so that shards do not contend through false sharing.
+
+typedef struct _tagTEXT_CACHE_SHARD {
+  pthread_mutex_t mutex;
+  LPTEXT_CACHE_ENTRY* ppBuckets;
+  LPTEXT_CACHE_ENTRY pMostRecent;
+  LPTEXT_CACHE_ENTRY pLeastRecent;
+  size_t nBytes;
+} __attribute__((aligned(64))) TEXT_CACHE_SHARD, *LPTEXT_CACHE_SHARD;
+
+/* g_configLock is held for reading by every lookup and for writing while
+ * the cache is enabled or disabled; the shards' own mutexes protect their
+ * contents. */
+static pthread_rwlock_t g_configLock = PTHREAD_RWLOCK_INITIALIZER;
+static BOOL g_bTextCacheEnabled = FALSE;
+static size_t g_nShardBudget = 0;
+static TEXT_CACHE_SHARD g_shards[TEXT_CACHE_SHARD_COUNT];
+static pthread_once_t g_shardsOnce = PTHREAD_ONCE_INIT;
+
+static int g_nInotifyDescriptor = -1;
+static int g_nWakeDescriptor = -1;
+static pthread_t g_watchThread;
+
+///////////////////////////////////////////////////////////////////////////////
+// Internal functions
+
+///////////////////////////////////////////////////////////////////////////////
+// InitializeShards function - Sets up the shards' mutexes, once.
+
+static void InitializeShards(void) {
+  for (int i = 0; i < TEXT_CACHE_SHARD_COUNT; i++) {
+    pthread_mutex_init(&g_shards[i].mutex, NULL);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// HashFileKey function
+
+static uint64_t HashFileKey(dev_t nDevice, ino_t nInode) {
+  uint64_t nHash = (uint64_t) nInode ^ ((uint64_t) nDevice
+      * 0x9E3779B97F4A7C15ULL);
+  nHash ^= nHash >> 33;
+  nHash *= 0xFF51AFD7ED558CCDULL;
+  nHash ^= nHash >> 33;
+  return nHash;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ReleaseText function - Drops one reference to a CACHED_TEXT.
+
+static void ReleaseText(LPCACHED_TEXT lpText) {
+  if (__atomic_sub_fetch(&lpText->nRefCount, 1, __ATOMIC_ACQ_REL) == 0) {
+    free(lpText);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ReadCachedText function - Reads an open file into a new CACHED_TEXT with
+// a single reference.  Returns NULL, with errno set, on failure.
+
+static LPCACHED_TEXT ReadCachedText(int nFileDescriptor, off_t nSize) {
+  size_t nCapacity = nSize > 0 ? (size_t) nSize
+      : READ_ALL_BYTES_INITIAL_SIZE;
+  LPCACHED_TEXT lpText = (LPCACHED_TEXT) malloc(sizeof(CACHED_TEXT)
+      + nCapacity + 1);
+  if (lpText == NULL) {
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  size_t nTotalBytesRead = 0;
+  while (TRUE) {
+    if (nTotalBytesRead == nCapacity) {
+      /* The file is larger than it was, or its size was not known. */
+      LPCACHED_TEXT lpGrown = (LPCACHED_TEXT) realloc(lpText,
+          sizeof(CACHED_TEXT) + nCapacity * 2 + 1);
+      if (lpGrown == NULL) {
+        free(lpText);
+        errno = ENOMEM;
+        return NULL;
+      }
+      lpText = lpGrown;
+      nCapacity *= 2;
+    }
+
+    size_t nToRead = nCapacity - nTotalBytesRead;
+    if (nToRead > MAX_READ_CHUNK_SIZE) {
+      nToRead = MAX_READ_CHUNK_SIZE;
+    }
+
+    ssize_t nBytesRead = read(nFileDescriptor,
+        lpText->szText + nTotalBytesRead, nToRead);
+    if (nBytesRead < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      int nError = errno;
+      free(lpText);
+      errno = nError;
+      return NULL;
+    }
+    if (nBytesRead == 0) {
+      break;
+    }
+
+    nTotalBytesRead += (size_t) nBytesRead;
+
+    /* A regular file read to its known size is done; this saves the
+     * read() that would only confirm end-of-file. */
+    if (nSize > 0 && nTotalBytesRead == (size_t) nSize) {
+      break;
+    }
+  }
+
+  lpText->nRefCount = 1;
+  lpText->nLength = nTotalBytesRead;
+  lpText->szText[nTotalBytesRead] = '\0';
+
+  return lpText;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// UnlinkTextCacheEntry function - Removes an entry from its shard's LRU
+// list.  The shard's mutex must be held.
+
+static void UnlinkTextCacheEntry(LPTEXT_CACHE_SHARD lpShard,
+    LPTEXT_CACHE_ENTRY lpEntry) {
+  if (lpEntry->pPrev != NULL) {
+    lpEntry->pPrev->pNext = lpEntry->pNext;
+  } else {
+    lpShard->pMostRecent = lpEntry->pNext;
+  }
+
+  if (lpEntry->pNext != NULL) {
+    lpEntry->pNext->pPrev = lpEntry->pPrev;
+  } else {
+    lpShard->pLeastRecent = lpEntry->pPrev;
+  }
+
+  lpEntry->pPrev = lpEntry->pNext = NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// PushTextCacheEntry function - Makes an entry the most recently used one
+// in its shard.  The shard's mutex must be held.
+
+static void PushTextCacheEntry(LPTEXT_CACHE_SHARD lpShard,
+    LPTEXT_CACHE_ENTRY lpEntry) {
+  lpEntry->pPrev = NULL;
+  lpEntry->pNext = lpShard->pMostRecent;
+
+  if (lpShard->pMostRecent != NULL) {
+    lpShard->pMostRecent->pPrev = lpEntry;
+  }
+  lpShard->pMostRecent = lpEntry;
+
+  if (lpShard->pLeastRecent == NULL) {
+    lpShard->pLeastRecent = lpEntry;
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// RemoveTextCacheEntry function - Takes an entry out of its shard entirely
+// and frees it; readers holding its text keep it alive.  The shard's mutex
+// must be held.  If bRemoveWatch is set, the entry's inotify watch goes too.
+
+static void RemoveTextCacheEntry(LPTEXT_CACHE_SHARD lpShard,
+    LPTEXT_CACHE_ENTRY lpEntry, BOOL bRemoveWatch) {
+  uint64_t nHash = HashFileKey(lpEntry->nDevice, lpEntry->nInode);
+  LPTEXT_CACHE_ENTRY* lppLink = &lpShard->ppBuckets[nHash
+      & (TEXT_CACHE_BUCKETS_PER_SHARD - 1)];
+  while (*lppLink != NULL) {
+    if (*lppLink == lpEntry) {
+      *lppLink = lpEntry->pNextInBucket;
+      break;
+    }
+    lppLink = &(*lppLink)->pNextInBucket;
+  }
+
+  UnlinkTextCacheEntry(lpShard, lpEntry);
+  lpShard->nBytes -= lpEntry->nCharge;
+
+  if (bRemoveWatch && lpEntry->nWatch >= 0 && g_nInotifyDescriptor >= 0) {
+    inotify_rm_watch(g_nInotifyDescriptor, lpEntry->nWatch);
+  }
+
+  ReleaseText(lpEntry->lpText);
+  free(lpEntry);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// FindTextCacheEntry function - The shard's mutex must be held.
+
+static LPTEXT_CACHE_ENTRY FindTextCacheEntry(LPTEXT_CACHE_SHARD lpShard,
+    uint64_t nHash, dev_t nDevice, ino_t nInode) {
+  LPTEXT_CACHE_ENTRY lpEntry = lpShard->ppBuckets[nHash
+      & (TEXT_CACHE_BUCKETS_PER_SHARD - 1)];
+  while (lpEntry != NULL) {
+    if (lpEntry->nInode == nInode && lpEntry->nDevice == nDevice) {
+      return lpEntry;
+    }
+    lpEntry = lpEntry->pNextInBucket;
+  }
+
+  return NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ClearShards function - Removes every entry from every shard.  The
+// configuration lock must be held.
+
+static void ClearShards(BOOL bRemoveWatches) {
+  for (int i = 0; i < TEXT_CACHE_SHARD_COUNT; i++) {
+    LPTEXT_CACHE_SHARD lpShard = &g_shards[i];
+    pthread_mutex_lock(&lpShard->mutex);
+    while (lpShard->pMostRecent != NULL) {
+      RemoveTextCacheEntry(lpShard, lpShard->pMostRecent, bRemoveWatches);
+    }
+    pthread_mutex_unlock(&lpShard->mutex);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// InvalidateWatch function - Drops the entries of the file behind an
+// inotify watch descriptor.  Watch descriptors are not indexed, so every
+// shard is scanned; this only happens when a cached file changes.
+
+static void InvalidateWatch(int nWatch, BOOL bWatchRemoved) {
+  BOOL bFound = FALSE;
+
+  for (int i = 0; i < TEXT_CACHE_SHARD_COUNT; i++) {
+    LPTEXT_CACHE_SHARD lpShard = &g_shards[i];
+    pthread_mutex_lock(&lpShard->mutex);
+
+    LPTEXT_CACHE_ENTRY lpEntry = lpShard->pMostRecent;
+    while (lpEntry != NULL) {
+      LPTEXT_CACHE_ENTRY lpNext = lpEntry->pNext;
+      if (lpEntry->nWatch == nWatch) {
+        RemoveTextCacheEntry(lpShard, lpEntry, FALSE);
+        bFound = TRUE;
+      }
+      lpEntry = lpNext;
+    }
+
+    pthread_mutex_unlock(&lpShard->mutex);
+  }
+
+  /* The watch is added again if the file is read back into the cache. */
+  if (bFound && !bWatchRemoved) {
+    inotify_rm_watch(g_nInotifyDescriptor, nWatch);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// WatchThreadProc function - Waits for changes to cached files until woken
+// through g_nWakeDescriptor.
+
+static void* WatchThreadProc(void* pContext) {
+  (void) pContext;
+
+  char buffer[4096] __attribute__((aligned(__alignof__(
+      struct inotify_event))));
+
+  struct pollfd fds[2];
+  fds[0].fd = g_nInotifyDescriptor;
+  fds[0].events = POLLIN;
+  fds[1].fd = g_nWakeDescriptor;
+  fds[1].events = POLLIN;
+
+  while (TRUE) {
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+
+    if (fds[1].revents != 0) {
+      break;
+    }
+
+    ssize_t nBytesRead = read(g_nInotifyDescriptor, buffer, sizeof(buffer));
+    if (nBytesRead <= 0) {
+      continue;
+    }
+
+    for (char* pEvent = buffer; pEvent < buffer + nBytesRead;) {
+      const struct inotify_event* lpEvent =
+          (const struct inotify_event*) pEvent;
+      if (lpEvent->mask & IN_Q_OVERFLOW) {
+        /* Events were lost, so nothing can be trusted. */
+        ClearShards(TRUE);
+      } else if (lpEvent->wd >= 0) {
+        InvalidateWatch(lpEvent->wd, (lpEvent->mask & IN_IGNORED) != 0);
+      }
+      pEvent += sizeof(struct inotify_event) + lpEvent->len;
+    }
+  }
+
+  return NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ReleaseTextCacheResources function - Frees the buckets and closes the
+// inotify descriptors.  The configuration lock must be held for writing,
+// the shards must be empty and the watch thread must not be running.
+
+static void ReleaseTextCacheResources(void) {
+  if (g_nInotifyDescriptor >= 0) {
+    close(g_nInotifyDescriptor);
+  }
+  if (g_nWakeDescriptor >= 0) {
+    close(g_nWakeDescriptor);
+  }
+  g_nInotifyDescriptor = g_nWakeDescriptor = -1;
+
+  for (int i = 0; i < TEXT_CACHE_SHARD_COUNT; i++) {
+    free(g_shards[i].ppBuckets);
+    g_shards[i].ppBuckets = NULL;
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// StartTextCacheLocked function - Allocates the buckets and, if asked,
+// starts the watch thread.  The configuration lock must be held for writing
+// and the cache must be stopped.  On failure, the caller cleans up with
+// ReleaseTextCacheResources.
+
+static int StartTextCacheLocked(int nFlags) {
+  for (int i = 0; i < TEXT_CACHE_SHARD_COUNT; i++) {
+    g_shards[i].ppBuckets = (LPTEXT_CACHE_ENTRY*) calloc(
+        TEXT_CACHE_BUCKETS_PER_SHARD, sizeof(LPTEXT_CACHE_ENTRY));
+    if (g_shards[i].ppBuckets == NULL) {
+      errno = ENOMEM;
+      return ERROR;
+    }
+  }
+
+  if (!(nFlags & TEXT_CACHE_FLAG_WATCH)) {
+    return OK;
+  }
+
+  g_nInotifyDescriptor = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+  if (g_nInotifyDescriptor < 0) {
+    return ERROR;
+  }
+
+  g_nWakeDescriptor = eventfd(0, EFD_CLOEXEC);
+  if (g_nWakeDescriptor < 0) {
+    return ERROR;
+  }
+
+  int nError = pthread_create(&g_watchThread, NULL, WatchThreadProc, NULL);
+  if (nError != OK) {
+    errno = nError;
+    return ERROR;
+  }
+
+  return OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// StopTextCacheLocked function - Stops the watch thread, if any, and empties
+// and frees the cache.  The configuration lock must be held for writing.
+
+static void StopTextCacheLocked(void) {
+  if (!g_bTextCacheEnabled) {
+    return;
+  }
+
+  /* Stop the watcher first; it takes the shard mutexes itself. */
+  if (g_nInotifyDescriptor >= 0) {
+    uint64_t nWake = 1;
+    if (write(g_nWakeDescriptor, &nWake, sizeof(nWake)) == sizeof(nWake)) {
+      pthread_join(g_watchThread, NULL);
+    } else {
+      pthread_cancel(g_watchThread);
+      pthread_join(g_watchThread, NULL);
+    }
+  }
+
+  ClearShards(FALSE);
+  ReleaseTextCacheResources();
+
+  g_nShardBudget = 0;
+  g_bTextCacheEnabled = FALSE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// LookupCachedText function - Returns a new reference to the cached text of
+// a file if it is still current.  The configuration lock must be held.
+
+static LPCACHED_TEXT LookupCachedText(const struct stat* lpStat) {
+  uint64_t nHash = HashFileKey(lpStat->st_dev, lpStat->st_ino);
+  LPTEXT_CACHE_SHARD lpShard = &g_shards[(nHash >> 32)
+      % TEXT_CACHE_SHARD_COUNT];
+  LPCACHED_TEXT lpText = NULL;
+
+  pthread_mutex_lock(&lpShard->mutex);
+
+  LPTEXT_CACHE_ENTRY lpEntry = FindTextCacheEntry(lpShard, nHash,
+      lpStat->st_dev, lpStat->st_ino);
+  if (lpEntry != NULL && lpEntry->nSize == lpStat->st_size
+      && lpEntry->modified.tv_sec == lpStat->st_mtim.tv_sec
+      && lpEntry->modified.tv_nsec == lpStat->st_mtim.tv_nsec) {
+    UnlinkTextCacheEntry(lpShard, lpEntry);
+    PushTextCacheEntry(lpShard, lpEntry);
+    lpText = lpEntry->lpText;
+    __atomic_add_fetch(&lpText->nRefCount, 1, __ATOMIC_RELAXED);
+  }
+
+  pthread_mutex_unlock(&lpShard->mutex);
+  return lpText;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// StoreCachedText function - Puts freshly-read text in the cache, replacing
+// any stale entry for the same file and evicting the least-recently-used
+// entries of the shard until it is back within its budget.  The
+// configuration lock must be held.
+
+static void StoreCachedText(const struct stat* lpStat, int nWatch,
+    LPCACHED_TEXT lpText) {
+  uint64_t nHash = HashFileKey(lpStat->st_dev, lpStat->st_ino);
+  LPTEXT_CACHE_SHARD lpShard = &g_shards[(nHash >> 32)
+      % TEXT_CACHE_SHARD_COUNT];
+  size_t nCharge = sizeof(TEXT_CACHE_ENTRY) + sizeof(CACHED_TEXT)
+      + lpText->nLength + 1;
+
+  LPTEXT_CACHE_ENTRY lpEntry = NULL;
+  if (nCharge <= g_nShardBudget) {
+    lpEntry = (LPTEXT_CACHE_ENTRY) calloc(1, sizeof(TEXT_CACHE_ENTRY));
+  }
+
+  pthread_mutex_lock(&lpShard->mutex);
+
+  /* The stale entry has the same inode, and so the same watch. */
+  LPTEXT_CACHE_ENTRY lpStale = FindTextCacheEntry(lpShard, nHash,
+      lpStat->st_dev, lpStat->st_ino);
+  if (lpStale != NULL) {
+    RemoveTextCacheEntry(lpShard, lpStale, FALSE);
+  }
+
+  if (lpEntry == NULL) {
+    /* Too large to cache, or out of memory. */
+    pthread_mutex_unlock(&lpShard->mutex);
+    if (nWatch >= 0) {
+      inotify_rm_watch(g_nInotifyDescriptor, nWatch);
+    }
+    return;
+  }
+
+  lpEntry->nDevice = lpStat->st_dev;
+  lpEntry->nInode = lpStat->st_ino;
+  lpEntry->modified = lpStat->st_mtim;
+  lpEntry->nSize = lpStat->st_size;
+  lpEntry->nWatch = nWatch;
+  lpEntry->nCharge = nCharge;
+  lpEntry->lpText = lpText;
+  __atomic_add_fetch(&lpText->nRefCount, 1, __ATOMIC_RELAXED);
+
+  while (lpShard->nBytes + nCharge > g_nShardBudget
+      && lpShard->pLeastRecent != NULL) {
+    RemoveTextCacheEntry(lpShard, lpShard->pLeastRecent, TRUE);
+  }
+
+  LPTEXT_CACHE_ENTRY* lppBucket = &lpShard->ppBuckets[nHash
+      & (TEXT_CACHE_BUCKETS_PER_SHARD - 1)];
+  lpEntry->pNextInBucket = *lppBucket;
+  *lppBucket = lpEntry;
+  PushTextCacheEntry(lpShard, lpEntry);
+  lpShard->nBytes += nCharge;
+
+  pthread_mutex_unlock(&lpShard->mutex);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Publicly-exposed functions
+
+///////////////////////////////////////////////////////////////////////////////
+// CachedReadAllText function
+
+int CachedReadAllText(const char* pszPath, const char** ppszText,
+    size_t* pnLength) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_CACHED_READ_ALL_TEXT);
+
+  if (IsNullOrWhiteSpace(pszPath) || ppszText == NULL) {
+    errno = EINVAL;
+    return ERROR;
+  }
+
+  *ppszText = NULL;
+  if (pnLength != NULL) {
+    *pnLength = 0;
+  }
+
+  /* Expand the path name a la Bash */
+  char szExpandedPathName[MAX_PATH + 1];
+  memset(szExpandedPathName, 0, MAX_PATH + 1);
+  ShellExpand(pszPath, szExpandedPathName, MAX_PATH + 1);
+
+  pthread_rwlock_rdlock(&g_configLock);
+
+  LPCACHED_TEXT lpText = NULL;
+  struct stat st = { 0 };
+
+  if (g_bTextCacheEnabled) {
+    if (OK != stat(szExpandedPathName, &st)) {
+      int nError = errno;
+      pthread_rwlock_unlock(&g_configLock);
+      errno = nError;
+      return ERROR;
+    }
+
+    lpText = LookupCachedText(&st);
+  }
+
+  if (lpText != NULL) {
+    pthread_rwlock_unlock(&g_configLock);
+    FILE_CORE_COUNT_EVENT(FILE_CORE_COUNTER_TEXT_CACHE_HITS);
+  } else {
+    FILE_CORE_COUNT_EVENT(FILE_CORE_COUNTER_TEXT_CACHE_MISSES);
+
+    /* Watch before reading, so a change made during the read is seen. */
+    int nWatch = -1;
+    if (g_bTextCacheEnabled && g_nInotifyDescriptor >= 0) {
+      nWatch = inotify_add_watch(g_nInotifyDescriptor, szExpandedPathName,
+          TEXT_CACHE_WATCH_MASK);
+    }
+
+    int nFileDescriptor = open(szExpandedPathName, O_RDONLY | O_CLOEXEC);
+    if (nFileDescriptor >= 0) {
+      /* The entry is stamped with what fstat() reports before the read,
+       * so a change made during the read makes it stale at once. */
+      if (OK == fstat(nFileDescriptor, &st)) {
+        lpText = ReadCachedText(nFileDescriptor,
+            S_ISREG(st.st_mode) ? st.st_size : 0);
+      }
+
+      int nError = errno;
+      close(nFileDescriptor);
+      errno = nError;
+    }
+
+    /* Files whose size does not describe their content, such as those
+     * under /proc and /sys, which report a size of zero and a modification
+     * time that never changes, could never be seen to go stale, so they are
+     * read afresh every time. */
+    if (g_bTextCacheEnabled && lpText != NULL && S_ISREG(st.st_mode)
+        && st.st_size > 0 && lpText->nLength == (size_t) st.st_size) {
+      StoreCachedText(&st, nWatch, lpText);
+    } else if (nWatch >= 0) {
+      inotify_rm_watch(g_nInotifyDescriptor, nWatch);
+    }
+
+    int nError = errno;
+    pthread_rwlock_unlock(&g_configLock);
+    errno = nError;
+
+    if (lpText == NULL) {
+      return ERROR;
+    }
+  }
+
+  *ppszText = lpText->szText;
+  if (pnLength != NULL) {
+    *pnLength = lpText->nLength;
+  }
+
+  FILE_CORE_TRACE_BYTES(lpText->nLength);
+  return OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ClearTextCache function
+
+void ClearTextCache(void) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_CLEAR_TEXT_CACHE);
+
+  pthread_rwlock_rdlock(&g_configLock);
+  if (g_bTextCacheEnabled) {
+    ClearShards(TRUE);
+  }
+  pthread_rwlock_unlock(&g_configLock);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// DisableTextCache function
+
+void DisableTextCache(void) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_DISABLE_TEXT_CACHE);
+
+  pthread_rwlock_wrlock(&g_configLock);
+  StopTextCacheLocked();
+  pthread_rwlock_unlock(&g_configLock);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// EnableTextCache function
+
+int EnableTextCache(size_t nMemoryBudget, int nFlags) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_ENABLE_TEXT_CACHE);
+
+  if (nMemoryBudget == 0) {
+    errno = EINVAL;
+    return ERROR;
+  }
+
+  pthread_once(&g_shardsOnce, InitializeShards);
+
+  /* Stop and restart under one hold of the lock, so that two callers
+   * cannot both find the cache stopped and both start it. */
+  pthread_rwlock_wrlock(&g_configLock);
+
+  StopTextCacheLocked();
+
+  int nResult = StartTextCacheLocked(nFlags);
+  if (nResult == OK) {
+    g_nShardBudget = nMemoryBudget / TEXT_CACHE_SHARD_COUNT;
+    g_bTextCacheEnabled = TRUE;
+  } else {
+    int nError = errno;
+    ReleaseTextCacheResources();
+    errno = nError;
+  }
+
+  pthread_rwlock_unlock(&g_configLock);
+  return nResult;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ReleaseCachedText function
+
+void ReleaseCachedText(const char* pszText) {
+  FILE_CORE_TRACE_CALL(FILE_CORE_API_RELEASE_CACHED_TEXT);
+
+  if (pszText == NULL) {
+    return;
+  }
+
+  ReleaseText((LPCACHED_TEXT) (pszText - offsetof(CACHED_TEXT, szText)));
+}